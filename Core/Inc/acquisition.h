@@ -0,0 +1,86 @@
+/** ***************************************************************************
+ * @file
+ * @brief See acquisition.c
+ *
+ * Prefix ACQ
+ *
+ *****************************************************************************/
+
+#ifndef ACQUISITION_H_
+#define ACQUISITION_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "measuring.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define ACQ_CHANNELS        4       ///< Max channels of a frame
+#define ACQ_DSP_BACKENDS    2       ///< Backends 0 ... ACQ_DSP_BACKENDS-1 have all channels of the DSP
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Acquisition backends, the numbers are those of CFG_BACKEND */
+typedef enum {
+    ACQ_GROUPS = 0,         ///< ADC3 regular and injected group, Hall sensors at MEAS_HALL_FS
+    ACQ_TIMER,              ///< ADC3 scan of the 4 channels, end of conversion interrupt
+    ACQ_DMA,                ///< ADC3_IN4 by DMA
+    ACQ_DUAL,               ///< ADC1_IN13 and ADC2_IN5 simultaneously, packed by DMA
+    ACQ_SCAN2,              ///< ADC2 scan of IN13 and IN5 by DMA
+    ACQ_SCAN3,              ///< ADC3 scan of IN13 and IN4 by DMA
+    ACQ_SINGLE,             ///< ADC3_IN4 single conversion, polled
+    ACQ_BACKENDS            ///< Number of backends
+} ACQ_backend_t;
+
+/** Inputs which a column of a frame may hold */
+typedef enum {
+    ACQ_NONE = 0,           ///< Column not used
+    ACQ_PAD_LEFT,           ///< ADC3_IN4 = PF6
+    ACQ_PAD_RIGHT,          ///< ADC123_IN13 = PC3
+    ACQ_HALL_LEFT,          ///< ADC3_IN6 = PF8
+    ACQ_HALL_RIGHT,         ///< ADC3_IN11 = PC1
+    ACQ_AUX                 ///< ADC12_IN5 = PA5, also DAC_OUT2
+} ACQ_channel_t;
+
+/** Frame of any backend, see ACQ_get_frame() */
+typedef struct {
+    const uint32_t *samples;    ///< Sample n of column c at samples[n*channels + c]
+    uint8_t channels;           ///< Interleaved columns, 1 ... ACQ_CHANNELS
+    uint8_t map[ACQ_CHANNELS];  ///< ACQ_channel_t of each column
+    uint8_t backend;            ///< ACQ_backend_t which sampled the frame
+    uint16_t length;            ///< Samples per channel
+    uint16_t number;            ///< Frames completed since the reset, all backends
+    uint32_t fs;                ///< Sampling frequency [Hz], 0 = software triggered
+    uint32_t start_us;          ///< Time of the first sample
+    uint32_t end_us;            ///< Time the frame was complete
+    bool overrun;               ///< An ADC lost a conversion, the frame is not valid
+    MEAS_frame_t halls;         ///< Hall sensors at their own rate, samples NULL if none
+} ACQ_frame_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+bool ACQ_select(ACQ_backend_t backend);
+bool ACQ_set_rate(uint32_t fs);
+ACQ_backend_t ACQ_get_backend(void);
+uint32_t ACQ_get_rate(void);
+const char *ACQ_get_name(ACQ_backend_t backend);
+void ACQ_start(void);
+ACQ_frame_t ACQ_get_frame(void);
+int ACQ_find(const ACQ_frame_t *frame, ACQ_channel_t channel);
+bool ACQ_is_complete(const ACQ_frame_t *frame, uint32_t fs);
+
+#endif
@@ -0,0 +1,69 @@
+/** ***************************************************************************
+ * @file
+ * @brief See arena.c
+ *
+ * Prefix ARENA
+ *
+ *****************************************************************************/
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define ARENA_ALIGN         32          ///< Alignment of arenas and allocations (DMA bursts)
+#define ARENA_FB_SIZE       0x50000     ///< Size of one LCD layer incl. padding
+#define ARENA_SDRAM_BASE    (0xD0000000 + 2*ARENA_FB_SIZE)  ///< Behind both LCD layers
+#define ARENA_SDRAM_SIZE    (0x800000 - 2*ARENA_FB_SIZE)    ///< Rest of the 8 MB SDRAM
+#define ARENA_CHUNK_SIZE    1088        ///< Block of ARENA_CHUNKS, a capture chunk with its prefix
+#define ARENA_CHUNK_BLOCKS  8           ///< Blocks of ARENA_CHUNKS
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Enumeration of the arenas, in the order they are placed */
+typedef enum {
+    ARENA_CAPTURE = 0,  ///< Bump: index and header pieces of the capture
+    ARENA_CHUNKS,       ///< Pool: chunk buffers of the capture waiting for the UART
+    ARENA_HISTORY,      ///< Bump: reading history of the command interface
+    ARENA_COUNT         ///< Number of arenas
+} ARENA_id_t;
+
+/** Usage of an arena */
+typedef struct {
+    const char *name;       ///< Name for the display
+    uint32_t size;          ///< Size of the arena [bytes]
+    uint32_t used;          ///< Allocated [bytes]
+    uint32_t peak;          ///< Max allocated since ARENA_init() [bytes]
+    uint32_t allocs;        ///< Successful allocations
+    uint32_t failures;      ///< Failed allocations
+    uint32_t block_size;    ///< Block size of a pool, 0 for bump arenas
+} ARENA_stats_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+bool ARENA_init(void *base, uint32_t size);
+void *ARENA_alloc(ARENA_id_t id, uint32_t size);
+void ARENA_reset(ARENA_id_t id);
+void *ARENA_pool_get(ARENA_id_t id);
+void ARENA_pool_put(ARENA_id_t id, void *block);
+ARENA_stats_t ARENA_get_stats(ARENA_id_t id);
+
+#endif
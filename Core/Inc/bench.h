@@ -0,0 +1,50 @@
+/** ***************************************************************************
+ * @file
+ * @brief See bench.c
+ *
+ * Prefix BENCH
+ *
+ *****************************************************************************/
+
+#ifndef BENCH_H_
+#define BENCH_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "stm32f4xx.h"
+#include "main.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define BENCH_RUNS          100     ///< Runs of each kernel
+#define BENCH_ACQ_FRAMES    8       ///< Frames of each acquisition backend
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Result of one kernel */
+typedef struct {
+    const char *name;       ///< Name of the kernel, key for Tools/bench_diff.py
+    uint32_t min;           ///< Fastest run [cycles]
+    uint32_t mean;          ///< Average of all runs [cycles]
+    uint32_t max;           ///< Slowest run [cycles]
+} BENCH_result_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+#ifdef BENCH_FIRMWARE
+void BENCH_main(void);
+#endif
+
+#endif
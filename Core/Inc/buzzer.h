@@ -36,5 +36,9 @@ bool BUZZER_get_status(void);
 
 void BUZZER_play_note(uint16_t note,uint16_t length);
 void BUZZER_play_melody(void);
+void BUZZER_play_alert(bool rising);
+void BUZZER_stop_melody(void);
+bool BUZZER_melody_playing(void);
+void BUZZER_update(void);
 
 #endif /* INC_BUZZER_H_ */
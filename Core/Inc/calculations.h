@@ -20,23 +20,144 @@
  * Defines
  *****************************************************************************/
 
+#define CALC_LPAD           0       ///< Channel index of the left pad.
+#define CALC_RPAD           1       ///< Channel index of the right pad.
+#define CALC_LHALL          2       ///< Channel index of the left Hall sensor.
+#define CALC_RHALL          3       ///< Channel index of the right Hall sensor.
+#define CALC_CHANNELS       4       ///< Number of channels in one ADC scan.
+#define CALC_MAINS_BIN      5       ///< DFT bin of 50 Hz: 50 Hz * ADC_NUMS / 640 Hz, see config.bin.
+#define CALC_CAL_VERSION    1       ///< Version of LPAD_lut.csv and RPAD_lut.csv, increment when they change.
+#define CALC_LUT_BASE       200     ///< Amplitude of the first entry of the LUTs in ADC steps.
+#define CALC_LUT_ENTRIES    1301    ///< Entries of LPAD_lut.csv and RPAD_lut.csv.
+#define CALC_NULL_FRAMES    20      ///< Frames averaged by the capture of the background.
+#define CALC_XTALK_FRAMES   20      ///< Frames averaged by the capture of a column of the coupling matrix.
 
+#define CALC_CLIP_PADS      ((1u << CALC_LPAD)  | (1u << CALC_RPAD))   ///< Clip flags of the pads.
+#define CALC_CLIP_HALLS     ((1u << CALC_LHALL) | (1u << CALC_RHALL))  ///< Clip flags of the Hall sensors.
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Statistics of the raw ADC samples of one channel over one frame */
+typedef struct {
+    uint16_t min;           ///< Smallest sample of the frame.
+    uint16_t max;           ///< Largest sample of the frame.
+    uint16_t mean;          ///< Mean value (DC level) of the frame.
+    uint16_t clip_count;    ///< Number of samples at the ADC limits.
+} CALC_stats_t;
+
+/** Phasor of one channel at the mains bin (config.bin) */
+typedef struct {
+    float32_t re;           ///< Real part.
+    float32_t im;           ///< Imaginary part.
+} CALC_phasor_t;
+
+/** Stages of the pipeline, see calculate_frame() */
+typedef enum {
+    CALC_STAGE_DFT = 0,     ///< split_Array(): single bin DFT and statistics.
+    CALC_STAGE_LUT,         ///< calculate_FFT(): amplitudes, averaging and distance LUT.
+    CALC_STAGE_TRIANG,      ///< calculate_triangulation(): position, angle and current.
+    CALC_STAGES             ///< Number of stages.
+} CALC_stage_t;
+
+/** Tunable parameters of the pipeline, see CALC_config_default */
+typedef struct {
+    int32_t lpad_min;       ///< LPAD amplitudes above are looked up in the LUT (>= CALC_LUT_BASE).
+    int32_t lpad_max;       ///< LPAD amplitudes above are at distance 0 (<= CALC_LUT_BASE + CALC_LUT_ENTRIES).
+    int32_t rpad_min;       ///< Same for RPAD.
+    int32_t rpad_max;       ///< Same for RPAD.
+    int32_t max_x;          ///< Largest |X_Pos| in mm, further is CALC_OUTOF_X_RANGE.
+    int32_t max_y;          ///< Largest Y_Pos in mm, further is CALC_OUTOF_Y_RANGE.
+    float32_t smoothing;    ///< Weight of a new window in the exponential smoothing of the amplitudes, 1 = off.
+    uint32_t fs;            ///< Sampling frequency of the pads [Hz], calculate_pos() skips frames of other rates.
+    uint8_t bin;            ///< DFT bin of the mains frequency in ADC_NUMS samples at fs.
+    float32_t pad_gain;     ///< Factor of the pad amplitudes before the LUT (LUTs measured at 50 Hz).
+} CALC_config_t;
+
+/** State of one pipeline */
+typedef struct {
+    const uint32_t *samples;                    ///< Interleaved frame which is processed.
+    const uint32_t *hall_samples;               ///< Hall sensors at their own rate, NULL = in samples.
+    uint16_t hall_length;                       ///< Samples per Hall sensor in hall_samples.
+    int num_of_samples;                         ///< Number of frames to be averaged.
+    int avg_counter;                            ///< Frames in the current averaging window - 1.
+    CALC_phasor_t phasor[CALC_CHANNELS];        ///< Mains phasor of each channel of the last frame.
+    uint32_t amplitude_sum[CALC_CHANNELS];      ///< Sum of the mains amplitudes in the current averaging window.
+    float32_t amplitude_smooth[CALC_CHANNELS];  ///< Smoothed window amplitudes, 0 = no window yet.
+    int32_t LPAD_FFT_distance;                  ///< Distance of the cable to the left pad.
+    int32_t RPAD_FFT_distance;                  ///< Distance of the cable to the right pad.
+    int32_t LHALL_FFT_voltage;                  ///< Voltage on the left Hall.
+    int32_t RHALL_FFT_voltage;                  ///< Voltage on the right Hall.
+    int X_Pos;                                  ///< X position to the cable (offset to the right and left).
+    int Y_Pos;                                  ///< Y position to the cable (the distance).
+    double Gamma;                               ///< Angle of the device to the cable.
+    float current;                              ///< Current of the cable.
+    CALC_stats_t channel_stats[CALC_CHANNELS];  ///< Statistics of the raw samples of the last frame.
+    uint8_t clip_flags_window;                  ///< Clipped channels of the frames in the current averaging window.
+    uint8_t clip_flags;                         ///< Clipped channels of the last completed averaging window.
+    CALC_config_t config;                       ///< Parameters, CALC_config_default after calculate_init().
+    CALC_phasor_t background[CALC_CHANNELS];    ///< Background pattern subtracted from the phasors, 0 = none.
+    CALC_phasor_t null_sum[CALC_CHANNELS];      ///< Sum of the rotated phasors of the running capture.
+    int null_frames;                            ///< Frames until the capture is complete, 0 = no capture.
+    int null_ref;                               ///< Phase reference channel of the running capture.
+    CALC_phasor_t coupling[CALC_CHANNELS*CALC_CHANNELS];   ///< Coupling C row by row, C[r][c] = response of r to c.
+    CALC_phasor_t decoupling[CALC_CHANNELS*CALC_CHANNELS]; ///< Inverse of the coupling applied to the phasors.
+    bool decoupling_set;                        ///< decoupling[] is applied, false = no crosstalk.
+    CALC_phasor_t xtalk_sum[CALC_CHANNELS];     ///< Sum of the rotated phasors of the running column capture.
+    int xtalk_frames;                           ///< Frames until the column is complete, 0 = no capture.
+    int xtalk_channel;                          ///< Channel with the stimulus of the running capture.
+    uint8_t xtalk_columns;                      ///< Bit c set: column c of coupling[] has been captured.
+    uint32_t (*clock)(void);                    ///< Time source of stage_time[], NULL = not measured.
+    uint32_t stage_time[CALC_STAGES];           ///< Summed time of each stage in units of clock().
+} CALC_context_t;
+
+
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+extern const CALC_config_t CALC_config_default;
 
 /******************************************************************************
  * Functions
  *****************************************************************************/
-void calculate_pos(int num_of_samples);
-void split_Array(void);
+bool calculate_pos(int num_of_samples);
+void calculate_init(CALC_context_t *ctx);
+bool calculate_decoupling(CALC_context_t *ctx);
+void calculate_frame(CALC_context_t *ctx, const uint32_t *samples, int num_of_samples);
+void calculate_frame_groups(CALC_context_t *ctx, const uint32_t *samples,
+                            const uint32_t *hall_samples, uint16_t hall_length, int num_of_samples);
+void calculate_from_phasors(CALC_context_t *ctx, int num_of_samples);
+void calculate_triangulation(CALC_context_t *ctx, int32_t lpad_distance, int32_t rpad_distance);
+void split_Array(CALC_context_t *ctx);
 void calculate_RMS(void);
-void calculate_FFT (void);
+void calculate_FFT (CALC_context_t *ctx);
+uint32_t calculate_amplitude(CALC_phasor_t phasor);
 void FFT_Init(void);
-void clear_Buffer (void);
-void distance_LUT(void);
-void calculate_current(void);
-void check_display_bounderies(void);
-void averaging_FFT_semples(void);
+void distance_LUT(CALC_context_t *ctx);
+void calculate_current(CALC_context_t *ctx);
+void check_display_bounderies(CALC_context_t *ctx);
+void averaging_FFT_semples(CALC_context_t *ctx);
 int  get_X_Pos(void);
 int  get_Y_Pos(void);
 int  get_angle(void);
 float  get_current(void);
+uint8_t get_clip_flags(void);
+CALC_stats_t get_channel_stats(int channel);
+CALC_phasor_t get_channel_phasor(int channel);
+uint32_t get_dsp_state_bytes(uint32_t *fft_state);
+void null_background_start(void);
+void null_background_clear(void);
+int  get_null_frames(void);
+bool get_background(CALC_phasor_t *background);
+void set_background(const CALC_phasor_t *background);
+bool crosstalk_start(int channel);
+bool crosstalk_apply(void);
+void crosstalk_clear(void);
+int  get_crosstalk_frames(uint8_t *columns);
+bool get_decoupling(CALC_phasor_t *decoupling);
+void set_decoupling(const CALC_phasor_t *decoupling);
+void set_calibration(const CALC_config_t *config);
 #endif
@@ -0,0 +1,91 @@
+/** ***************************************************************************
+ * @file
+ * @brief See capture.c
+ *
+ * Prefix CAP
+ *
+ *****************************************************************************/
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define CAP_VERSION         1       ///< Version of the file format
+#define CAP_HEADER_SIZE     64      ///< Size of CAP_header_t, offset of the first chunk
+#define CAP_CHUNK_SIZE      1024    ///< Size of a chunk in the file incl. CAP_chunk_t
+#define CAP_MAX_CHUNKS      16384   ///< Max chunks of a session (16 MB, about 45 min)
+#define CAP_PIECE           1024    ///< Max data bytes of a SER_FRAME_CAPTURE
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Channel ids of the channel map */
+typedef enum {
+    CAP_CH_NONE = 0,        ///< Unused slot
+    CAP_CH_LPAD,            ///< Left pad
+    CAP_CH_RPAD,            ///< Right pad
+    CAP_CH_LHALL,           ///< Left Hall sensor
+    CAP_CH_RHALL,           ///< Right Hall sensor
+} CAP_channel_t;
+
+/** File header at offset 0 */
+typedef struct {
+    char magic[4];          ///< "CMCP"
+    uint16_t version;       ///< CAP_VERSION
+    uint16_t header_size;   ///< CAP_HEADER_SIZE
+    uint32_t sample_rate;   ///< Scans per second [Hz]
+    uint16_t frame_length;  ///< Scans per frame
+    uint8_t channels;       ///< Channels per scan
+    uint8_t sample_bits;    ///< Resolution of the samples
+    uint8_t channel_map[8]; ///< CAP_channel_t of each channel in the scan
+    uint32_t calibration;   ///< Version of the calibration (CALC_CAL_VERSION)
+    uint32_t chunk_size;    ///< CAP_CHUNK_SIZE
+    uint32_t session;       ///< Number of the session since reset
+    uint32_t start_ms;      ///< HAL tick at the start of the session
+    uint32_t mains_mhz;     ///< Mains frequency of the analysis [mHz], 0 = 50 Hz (older files)
+    uint8_t reserved[20];   ///< Zero
+} CAP_header_t;
+
+/** Header of a chunk and entry of the index */
+typedef struct {
+    uint32_t first_frame;   ///< Number of the first frame in the chunk
+    uint16_t frames;        ///< Frames in the chunk
+    uint16_t bytes;         ///< Bytes of the frames behind this header
+} CAP_chunk_t;
+
+/** Trailer at the end of the file */
+typedef struct {
+    char magic[4];          ///< "CIDX"
+    uint32_t chunks;        ///< Entries in the index
+    uint32_t frames;        ///< Number of the last frame + 1
+    uint32_t index_offset;  ///< File offset of the index
+} CAP_trailer_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void CAP_init(void);
+void CAP_start(void);
+void CAP_stop(void);
+void CAP_add_frame(void);
+void CAP_update(void);
+bool CAP_active(void);
+uint32_t CAP_get_dropped(void);
+
+#endif
@@ -0,0 +1,55 @@
+/** ***************************************************************************
+ * @file
+ * @brief See clock.c
+ *
+ * Prefix CLOCK
+ *
+ *****************************************************************************/
+
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define CLOCK_FULL_HZ   168000000   ///< Core clock during DSP bursts
+#define CLOCK_LOW_HZ    84000000    ///< Core clock otherwise
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Enumeration of the clock states, used for the residency report */
+typedef enum {
+    CLOCK_SLEEP = 0,    ///< Core sleeping (WFI) at CLOCK_LOW_HZ
+    CLOCK_LOW,          ///< Core running at CLOCK_LOW_HZ
+    CLOCK_FULL,         ///< Core running at CLOCK_FULL_HZ
+    CLOCK_STATES        ///< Number of clock states
+} CLOCK_state_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void CLOCK_init(void);
+void CLOCK_set(CLOCK_state_t state);
+CLOCK_state_t CLOCK_get(void);
+void CLOCK_sleep(void);
+uint32_t CLOCK_get_us(void);
+uint32_t CLOCK_get_residency_ms(CLOCK_state_t state);
+uint32_t CLOCK_get_residency_permille(CLOCK_state_t state);
+void CLOCK_reset_residency(void);
+
+#endif
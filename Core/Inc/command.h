@@ -0,0 +1,101 @@
+/** ***************************************************************************
+ * @file
+ * @brief See command.c
+ *
+ * Prefix CMD
+ *
+ *****************************************************************************/
+
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "calculations.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define CMD_PROTOCOL        1       ///< Version of the command protocol
+#define CMD_MAX_PAYLOAD     64      ///< Max payload of a SER_FRAME_COMMAND
+#define CMD_BATCH_SIZE      1024    ///< Max payload of a SER_FRAME_RESPONSE
+#define CMD_RX_BUDGET       128     ///< Max bytes parsed by one CMD_update()
+#define CMD_HISTORY_SIZE    256     ///< Readings kept for CMD_HISTORY, must be a power of 2
+#define CMD_HISTORY_MAX     15      ///< Max readings in one CMD_HISTORY response
+
+#define CMD_VALID_POSITION  0x1     ///< Reading: x, y and angle are valid
+#define CMD_VALID_CURRENT   0x2     ///< Reading: current is valid
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Commands, first byte after the sequence number */
+typedef enum {
+    CMD_PING = 0x00,        ///< Protocol version, uptime
+    CMD_GET = 0x01,         ///< Value of one or all settings (CFG_id_t)
+    CMD_SET = 0x02,         ///< Change a setting
+    CMD_CAPTURE = 0x03,     ///< Start or stop a capture session
+    CMD_STATS = 0x04,       ///< CMD_stats_t
+    CMD_HISTORY = 0x05,     ///< Recent readings, CMD_reading_t
+    CMD_SNAPSHOT = 0x06,    ///< Start a screen snapshot, see snapshot.c
+    CMD_SESSION = 0x07,     ///< Session statistics, SES_summary_t
+    CMD_EVENTS = 0x08,      ///< Load changes, DET_event_t
+    CMD_NULL = 0x09,        ///< Capture or clear the background field
+    CMD_CROSSTALK = 0x0A,   ///< Capture, apply or clear the crosstalk decoupling
+} CMD_id_t;
+
+/** Status of a response */
+typedef enum {
+    CMD_OK = 0,             ///< Executed
+    CMD_ERR_UNKNOWN,        ///< Unknown command
+    CMD_ERR_LENGTH,         ///< Wrong number of argument bytes
+    CMD_ERR_ARGUMENT,       ///< Argument out of range
+    CMD_ERR_BUSY,           ///< Not possible now, e.g. snapshot running
+} CMD_status_t;
+
+/** One processed frame in the history, 16 bytes */
+typedef struct {
+    uint32_t time_ms;       ///< HAL_GetTick() when processed
+    int16_t x;              ///< X position [mm] or error code
+    int16_t y;              ///< Y position [mm] or error code
+    int16_t angle;          ///< Angle [degree] or error code
+    uint8_t clip_flags;     ///< Clipped channels, see get_clip_flags()
+    uint8_t valid;          ///< CMD_VALID_POSITION | CMD_VALID_CURRENT
+    float current;          ///< Current [A] or error code
+} CMD_reading_t;
+
+/** Response of CMD_STATS, 64 bytes */
+typedef struct {
+    uint32_t uptime_ms;                     ///< HAL_GetTick()
+    uint32_t readings;                      ///< Readings added to the history
+    uint32_t valid_readings;                ///< Readings with a valid position
+    uint32_t rx_lost;                       ///< SER_get_rx_lost()
+    uint32_t tx_dropped;                    ///< SER_get_dropped()
+    uint32_t capture_dropped;               ///< CAP_get_dropped()
+    uint16_t commands;                      ///< Commands executed
+    uint16_t errors;                        ///< Frames with bad length or checksum
+    uint8_t clip_flags;                     ///< get_clip_flags()
+    uint8_t capture_active;                 ///< CAP_active()
+    uint8_t reserved[2];                    ///< 0
+    CALC_stats_t channel[CALC_CHANNELS];    ///< get_channel_stats() of the last frame
+} CMD_stats_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void CMD_init(void);
+void CMD_update(void);
+void CMD_add_reading(int x, int y, int angle, float current, uint8_t clip_flags);
+
+#endif
@@ -0,0 +1,69 @@
+/** ***************************************************************************
+ * @file
+ * @brief See detector.c
+ *
+ * Prefix DET
+ *
+ *****************************************************************************/
+
+#ifndef DETECTOR_H_
+#define DETECTOR_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define DET_EVENTS          32      ///< Events kept, must be a power of 2
+#define DET_EVENTS_MAX      12      ///< Max events in one CMD_EVENTS response
+#define DET_SENSITIVITIES   5       ///< Sensitivity 1 (coarse) ... 5 (fine), 0 = off
+#define DET_WARMUP          16      ///< Frames to learn the level and the noise
+#define DET_ALERT_HOLDOFF_MS 2000   ///< Min time between two alerts on the buzzer
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Signals watched for steps */
+typedef enum {
+    DET_CURRENT = 0,        ///< Current [A], only while the position is valid
+    DET_LHALL,              ///< 50 Hz amplitude of the left Hall sensor [ADC steps]
+    DET_RHALL,              ///< 50 Hz amplitude of the right Hall sensor [ADC steps]
+    DET_SIGNALS             ///< Number of signals
+} DET_signal_t;
+
+/** Detected step, 20 bytes */
+typedef struct {
+    uint32_t time_ms;       ///< Time of the detection
+    uint32_t onset_ms;      ///< Estimated start of the step
+    uint8_t signal;         ///< DET_signal_t
+    int8_t direction;       ///< +1 = rise (load on), -1 = fall (load off)
+    uint16_t frames;        ///< Frames from the onset to the detection
+    float before;           ///< Level before the step
+    float after;            ///< Level after the step
+} DET_event_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void DET_reset(void);
+void DET_set_sensitivity(uint8_t value);
+void DET_add_frame(uint32_t time_ms, float current, float lhall, float rhall, uint8_t clip_flags);
+uint32_t DET_get_count(void);
+bool DET_get_event(uint32_t number, DET_event_t *event);
+int DET_format_event(const DET_event_t *event, char *text, size_t size);
+void DET_update(void);
+
+#endif
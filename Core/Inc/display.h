@@ -0,0 +1,44 @@
+/** ***************************************************************************
+ * @file
+ * @brief See display.c
+ *
+ * Prefix DISP
+ *
+ *****************************************************************************/
+
+#ifndef DISPLAY_H_
+#define DISPLAY_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "stm32f429i_discovery_lcd.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define DISP_ITEMS          48      ///< Max primitives of a page
+#define DISP_TEXT_SIZE      33      ///< Max characters of a text + 1
+#define DISP_BACKGROUND     LCD_COLOR_WHITE ///< Color of the data area after MENU_clear()
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void DISP_invalidate(void);
+void DISP_begin(void);
+void DISP_text(uint16_t x, uint16_t y, const sFONT *font, uint32_t color, uint32_t back,
+               const char *text);
+void DISP_line(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint32_t color);
+void DISP_circle(uint16_t x, uint16_t y, uint16_t radius, uint32_t color);
+void DISP_rect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint32_t color);
+void DISP_commit(void);
+
+#endif
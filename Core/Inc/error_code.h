@@ -16,5 +16,6 @@
 
 #define CURR_OUTOF_Y_RANGE  	4444
 #define CURR_OUTOF_Angle_RANGE  4555
+#define CURR_ADC_CLIPPED        4666
 
 #endif /* INC_ERROR_CODE_H_ */
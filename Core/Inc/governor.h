@@ -0,0 +1,91 @@
+/** ***************************************************************************
+ * @file
+ * @brief See governor.c
+ *
+ * Prefix GOV
+ *
+ *****************************************************************************/
+
+#ifndef GOVERNOR_H_
+#define GOVERNOR_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "measuring.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define GOV_FRAME_US        (1000000UL*ADC_NUMS/ADC_FS) ///< Frame period at ADC_FS [us], until GOV_set_rate()
+#define GOV_LOAD_HIGH       800     ///< Pressure above this load [permille of the frame period]
+#define GOV_LOAD_LOW        600     ///< Relief below this predicted load [permille of the frame period]
+#define GOV_LATE_US         20000   ///< Pressure if a frame waited longer to be processed
+#define GOV_RAISE_FRAMES    2       ///< Frames under pressure before the next feature is shed
+#define GOV_RELAX_FRAMES    30      ///< Frames of relief before a feature is restored
+#define GOV_RELAX_MAX       600     ///< Max frames of relief after repeated shedding
+#define GOV_FACTOR_MAX      16000   ///< Max saving of a feature [permille of the cost]
+#define GOV_UI_DIVIDER      2       ///< GOV_SHED_UI: the display is drawn every n-th frame
+#define GOV_PAGE_FRAMES     10      ///< GOV_SHED_PAGES: text pages are drawn every n-th frame
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Stages of the main loop with their own budget */
+typedef enum {
+    GOV_DSP = 0,            ///< calculate_pos() and the consumers of the reading
+    GOV_LCD,                ///< Drawing of the page
+    GOV_TELEMETRY,          ///< Reports, capture, snapshot and logs on USART1
+    GOV_INPUT,              ///< Touchscreen and commands
+    GOV_STAGES              ///< Number of stages
+} GOV_stage_t;
+
+/** Features shed under pressure, in this order. The level is the number of shed features */
+typedef enum {
+    GOV_SHED_UI = 0,        ///< Refresh of the display: every pass -> every GOV_UI_DIVIDER-th frame
+    GOV_SHED_PAGES,         ///< Text pages (diagnostics, memory, session): every GOV_PAGE_FRAMES-th frame
+    GOV_SHED_TELEMETRY,     ///< Telemetry detail: memory reports, trace dumps, snapshots wait
+    GOV_LEVELS              ///< Highest level
+} GOV_feature_t;
+
+/** State of the governor */
+typedef struct {
+    uint8_t level;                      ///< Shed features, 0 = everything runs
+    uint8_t pressure;                   ///< Consecutive frames under pressure
+    uint16_t relief;                    ///< Consecutive frames of relief
+    uint16_t relax_frames;              ///< Frames of relief needed to restore a feature
+    uint32_t frames;                    ///< Frames since GOV_init()
+    uint32_t changes;                   ///< Level changes since GOV_init()
+    uint32_t late;                      ///< Frames older than GOV_LATE_US
+    uint32_t over[GOV_STAGES];          ///< Frames with the stage over its budget
+    uint32_t cost_us[GOV_STAGES];       ///< Costs of the last frame period
+    uint32_t age_us;                    ///< Age of the last frame when it was processed
+} GOV_status_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void GOV_init(void);
+void GOV_set_rate(uint32_t fs);
+uint32_t GOV_get_frame_us(void);
+uint32_t GOV_begin(void);
+void GOV_end(GOV_stage_t stage, uint32_t start);
+void GOV_add_cost(GOV_stage_t stage, uint32_t us);
+void GOV_frame(uint32_t age_us);
+uint8_t GOV_get_level(void);
+bool GOV_shed(GOV_feature_t feature);
+bool GOV_draw_due(bool new_frame, bool text_page);
+uint32_t GOV_get_budget_us(GOV_stage_t stage);
+GOV_status_t GOV_get_status(void);
+
+#endif
@@ -0,0 +1,80 @@
+/** ***************************************************************************
+ * @file
+ * @brief See interrupts.c
+ *
+ * Prefix IRQ
+ *
+ *****************************************************************************/
+
+#ifndef INTERRUPTS_H_
+#define INTERRUPTS_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+/* Preemption priorities, 0 = highest, 15 = lowest (no subpriorities) */
+#define IRQ_PRIO_ACQ        0   ///< ADC, acquisition DMA streams, TIM2
+#define IRQ_PRIO_TICK       2   ///< SysTick, HAL time base
+#define IRQ_PRIO_SERIAL     4   ///< USART1 and its DMA
+#define IRQ_PRIO_BUZZER     6   ///< TIM5 tone generation
+#define IRQ_PRIO_BUTTON     8   ///< EXTI0, USER pushbutton
+#define IRQ_PRIO_TOUCH      12  ///< EXTI15_10, touch controller
+#define IRQ_PRIO_DEFERRED   15  ///< PendSV, deferred work
+
+#define IRQ_MAX_JOBS        4   ///< Max pending deferred jobs
+#define IRQ_TRACE_MASK      (~(1UL << IRQ_SRC_SYSTICK)) ///< Traced sources, SysTick would flood the trace
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Enumeration of the measured interrupt sources */
+typedef enum {
+    IRQ_SRC_ADC = 0,    ///< ADC end of conversion, the pads of the injected group
+    IRQ_SRC_ACQ_DMA,    ///< DMA2 streams 1, 3 and 4 of the acquisition
+    IRQ_SRC_TIM2,       ///< TIM2 update = ADC trigger at MEAS_HALL_FS
+    IRQ_SRC_SYSTICK,    ///< SysTick
+    IRQ_SRC_SERIAL,     ///< USART1 idle line, DMA2 streams 5 and 7
+    IRQ_SRC_BUZZER,     ///< TIM5
+    IRQ_SRC_BUTTON,     ///< EXTI0
+    IRQ_SRC_TOUCH,      ///< EXTI15_10
+    IRQ_SRC_DEFERRED,   ///< PendSV
+    IRQ_SOURCES         ///< Number of sources
+} IRQ_source_t;
+
+/** Worst case timing of an interrupt source */
+typedef struct {
+    uint32_t count;             ///< Number of calls
+    uint32_t max_run_ns;        ///< Longest handler, including preemption
+    uint32_t max_latency_ns;    ///< Longest entry latency, 0 = not measured
+} IRQ_stats_t;
+
+typedef void (*IRQ_job_t)(void);    ///< Deferred job
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void IRQ_init(void);
+uint32_t IRQ_mask(uint32_t priority);
+void IRQ_unmask(uint32_t basepri);
+void IRQ_defer(IRQ_job_t job);
+uint32_t IRQ_enter(IRQ_source_t source);
+void IRQ_exit(IRQ_source_t source, uint32_t start);
+void IRQ_latency(IRQ_source_t source, uint32_t cycles);
+IRQ_stats_t IRQ_get_stats(IRQ_source_t source);
+const char *IRQ_get_name(IRQ_source_t source);
+void IRQ_reset_stats(void);
+
+#endif
@@ -31,6 +31,23 @@
  *****************************************************************************/
 #define FLIPPED_LCD
 
+/** ***************************************************************************
+ * Event trace, see trace.c
+ * @attention
+ * Comment this \#define to remove the trace and its memory from the build.
+ *****************************************************************************/
+#define TRACE_ENABLED
+
+/** ***************************************************************************
+ * Microbenchmark firmware, see bench.c
+ * @note
+ * BENCH_FIRMWARE is defined by the build configuration "Bench",
+ * it replaces the application by the benchmark suite.
+ *****************************************************************************/
+#ifdef BENCH_FIRMWARE
+#undef TRACE_ENABLED                    // Events would disturb the measurement
+#endif
+
 
 /******************************************************************************
  * Functions
@@ -0,0 +1,75 @@
+/** ***************************************************************************
+ * @file
+ * @brief See mains.c
+ *
+ * Prefix MAINS
+ *
+ *****************************************************************************/
+
+#ifndef MAINS_H_
+#define MAINS_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "calculations.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define MAINS_AUTO          0       ///< CFG_MAINS: detect the frequency, 1 + MAINS_t = fixed
+#define MAINS_PERIOD_MS     10000   ///< Time between two detections while measuring
+#define MAINS_MARGIN        2.0f    ///< Min amplitude of the dominant frequency relative to the others
+#define MAINS_MIN_RMS       8.0f    ///< Min amplitude of the dominant frequency [ADC steps RMS]
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Mains frequencies, the numbers are those of CFG_MAINS - 1 */
+typedef enum {
+    MAINS_50HZ = 0,         ///< Public grid, the LUTs are calibrated at 50 Hz
+    MAINS_60HZ,             ///< Public grid
+    MAINS_16HZ7,            ///< Railway traction
+    MAINS_PROFILES          ///< Number of profiles
+} MAINS_t;
+
+/** Acquisition and calibration of a mains frequency */
+typedef struct {
+    const char *name;       ///< e.g. "16.7 Hz"
+    uint32_t mains_mhz;     ///< Mains frequency [mHz]
+    uint32_t fs;            ///< Sampling frequency of the pads [Hz], nominal
+    uint8_t bin;            ///< DFT bin of the mains frequency, bin * fs / ADC_NUMS = mains
+    float pad_gain;         ///< Pad amplitude at 50 Hz / pad amplitude at this frequency
+} MAINS_profile_t;
+
+/** Result of MAINS_detect() */
+typedef struct {
+    float rms[MAINS_PROFILES];  ///< Amplitude at each frequency, root sum square of the channels [ADC steps]
+    MAINS_t dominant;           ///< Strongest frequency
+} MAINS_result_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+const MAINS_profile_t *MAINS_get_profile(MAINS_t mains);
+MAINS_t MAINS_find(uint32_t mains_mhz);
+void MAINS_get_config(MAINS_t mains, CALC_config_t *config);
+bool MAINS_detect(const uint32_t *samples, uint8_t channels, uint16_t length, uint32_t fs,
+                  MAINS_result_t *result);
+void MAINS_set_mode(uint8_t mode);
+void MAINS_apply(void);
+bool MAINS_add_frame(uint32_t now_ms);
+MAINS_t MAINS_get(void);
+bool MAINS_is_auto(void);
+
+#endif
@@ -10,23 +10,59 @@
 #define MEAS_H_
 
 #define ADC_NUMS        64      ///< Number of samples
+#define ADC_FS          640     ///< Sampling freq. => 12.8 samples for a 50Hz period
+#define MEAS_HALL_RATIO 5       ///< The Hall sensors are sampled MEAS_HALL_RATIO times faster than the pads
+#define MEAS_HALL_FS    (ADC_FS*MEAS_HALL_RATIO)    ///< Sampling freq. of the Hall sensors
+#define MEAS_HALL_NUMS  (ADC_NUMS*MEAS_HALL_RATIO)  ///< Samples of a Hall sensor per frame
 /******************************************************************************
  * Includes
  *****************************************************************************/
 #include <stdbool.h>
+#include <stdint.h>
 
 /******************************************************************************
  * Defines
  *****************************************************************************/
-extern bool MEAS_data_ready;
+extern volatile bool MEAS_data_ready;
 extern  bool MEAS_copy;
 extern uint32_t MEAS_input_count;
 extern bool DAC_active;
 
 /******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Channel groups sampled at their own rate, see ADC3_groups_init() */
+typedef enum {
+    MEAS_GROUP_PADS = 0,    ///< Left and right pad at ADC_FS
+    MEAS_GROUP_HALLS,       ///< Left and right Hall sensor at MEAS_HALL_FS
+    MEAS_GROUPS             ///< Number of groups
+} MEAS_group_t;
+
+/** Frame of a channel group */
+typedef struct {
+    const uint32_t *samples;    ///< Left channel at samples[0], right channel at samples[1]
+    uint16_t stride;            ///< Distance between two samples of a channel
+    uint16_t length;            ///< Samples per channel
+    uint32_t fs;                ///< Sampling frequency [Hz]
+    uint32_t start_us;          ///< Time of the first sample, the same for all groups
+} MEAS_frame_t;
+
+/** Timing of the last frame of any configuration, see MEAS_get_timing() */
+typedef struct {
+    uint32_t start_us;          ///< Time of the first trigger
+    uint32_t end_us;            ///< Time the buffer was full
+    uint16_t number;            ///< Frames completed since the reset
+    bool overrun;               ///< An ADC lost a conversion (ADC_SR_OVR)
+} MEAS_timing_t;
+
+/******************************************************************************
+ * Functions
  *****************************************************************************/
 void MEAS_GPIO_analog_init(void);
 void MEAS_timer_init(void);
+uint32_t MEAS_set_rate(uint32_t fs);
+void MEAS_stop(void);
 void DAC_reset(void);
 void DAC_init(void);
 void DAC_increment(void);
@@ -43,7 +79,13 @@ void ADC2_IN13_IN5_scan_init(void);
 void ADC2_IN13_IN5_scan_start(void);
 void ADC3_IN13_IN4_scan_init(void);
 void ADC3_IN13_IN4_scan_start(void);
+void ADC3_groups_init(void);
+void ADC3_groups_start(void);
+MEAS_frame_t MEAS_get_group(MEAS_group_t group);
 uint32_t MEAS_return_data(int i);
+const uint32_t *MEAS_get_samples(void);
+uint32_t MEAS_get_frame_age_us(void);
+MEAS_timing_t MEAS_get_timing(void);
 void MEAS_show_data(void);
 void reset_sample_counter(void);
 
@@ -0,0 +1,74 @@
+/** ***************************************************************************
+ * @file
+ * @brief See memory.c
+ *
+ * Prefix MEM
+ *
+ *****************************************************************************/
+
+#ifndef MEMORY_H_
+#define MEMORY_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define MEM_REPORT_MS       5000    ///< Period of the telemetry frame
+#define MEM_PAINT           0xC5C5C5C5  ///< Pattern of unused stack
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Enumeration of the stacks */
+typedef enum {
+    MEM_STACK_MAIN = 0, ///< Process stack of main() in CCMRAM
+    MEM_STACK_IRQ,      ///< Main stack of the interrupts in RAM
+    MEM_STACKS          ///< Number of stacks
+} MEM_stack_id_t;
+
+/** Enumeration of the sections of the linker script */
+typedef enum {
+    MEM_SECTION_DATA = 0,   ///< Initialized variables in RAM
+    MEM_SECTION_BSS,        ///< Zero initialized variables in RAM
+    MEM_SECTION_IRQ_STACK,  ///< Rest of RAM, stack of the interrupts
+    MEM_SECTION_CCMRAM,     ///< Variables in CCMRAM
+    MEM_SECTION_MAIN_STACK, ///< Rest of CCMRAM, stack of main()
+    MEM_SECTIONS            ///< Number of sections
+} MEM_section_id_t;
+
+/** Section of the linker script */
+typedef struct {
+    const char *name;       ///< Name for the display
+    uint32_t start;         ///< First address
+    uint32_t size;          ///< Size [bytes]
+} MEM_section_t;
+
+/** Memory usage, sent as SER_FRAME_MEMORY */
+typedef struct {
+    uint32_t section_size[MEM_SECTIONS];    ///< Size of each section [bytes]
+    uint32_t stack_used[MEM_STACKS];        ///< High watermark of each stack [bytes]
+} MEM_report_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void MEM_init(void);
+MEM_section_t MEM_get_section(MEM_section_id_t section);
+uint32_t MEM_get_stack_size(MEM_stack_id_t stack);
+uint32_t MEM_get_stack_used(MEM_stack_id_t stack);
+MEM_report_t MEM_get_report(void);
+void MEM_update(void);
+
+#endif
@@ -59,13 +59,23 @@ typedef struct {
  * Functions
  *****************************************************************************/
 void MENU_hint(void);
+bool MENU_hint_step(void);
+void MENU_boot_timeline(void);
 
 void MENU_values_init(uint8_t *title);
 void MENU_values_act(int16_t x_distance, uint16_t y_distance, int16_t angle, float current);
 
+void MENU_clip_act(uint8_t clip_flags);
 void MENU_visual_init(uint8_t *title);
 void MENU_visual_act(int16_t x_distance, uint16_t y_distance, float current);
 
+void MENU_load_act(uint8_t level);
+void MENU_diag_init(uint8_t *title);
+void MENU_diag_act(void);
+void MENU_memory_init(uint8_t *title);
+void MENU_memory_act(void);
+void MENU_session_init(uint8_t *title);
+void MENU_session_act(void);
 void MENU_no_cable(void);
 
 void MENU_draw(void);
@@ -0,0 +1,80 @@
+/** ***************************************************************************
+ * @file
+ * @brief See power.c
+ *
+ * Prefix PWR
+ *
+ *****************************************************************************/
+
+#ifndef POWER_H_
+#define POWER_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define PWR_REPORT_MS       1000    ///< Length of a report window
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Enumeration of the accounted subsystems */
+typedef enum {
+    PWR_MAIN = 0,       ///< Main loop, everything not accounted otherwise
+    PWR_ACQ,            ///< Acquisition: ADC and its interrupts
+    PWR_DSP,            ///< Signal processing in calculate_pos()
+    PWR_LCD,            ///< Drawing on the LCD
+    PWR_TOUCH,          ///< I2C transactions with the touch controller
+    PWR_BUZZER,         ///< Buzzer and its interrupts
+    PWR_SUBSYSTEMS      ///< Number of subsystems
+} PWR_subsystem_t;
+
+/** Power model, currents at VDD */
+typedef struct {
+    uint16_t vdd_mv;                        ///< Supply voltage [mV]
+    uint16_t run_full_ua;                   ///< Core running at 168 MHz [uA]
+    uint16_t run_low_ua;                    ///< Core running at 84 MHz [uA]
+    uint16_t sleep_ua;                      ///< Core sleeping at 84 MHz [uA]
+    uint16_t busy_ua[PWR_SUBSYSTEMS];       ///< Additional current of the busy peripheral [uA]
+} PWR_model_t;
+
+/** Report of one window, sent as SER_FRAME_POWER */
+typedef struct {
+    uint32_t window_ms;                     ///< Length of the window
+    uint32_t measurements;                  ///< Processed frames in the window
+    uint32_t sleep_us;                      ///< Core sleeping
+    uint32_t active_us[PWR_SUBSYSTEMS];     ///< CPU time of each subsystem
+    uint32_t busy_us[PWR_SUBSYSTEMS];       ///< Peripheral or DMA busy time of each subsystem
+    uint32_t energy_uj;                     ///< Estimated energy of the window
+    uint32_t energy_per_meas_uj;            ///< Estimated energy per measurement
+} PWR_report_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void PWR_init(void);
+void PWR_set_model(const PWR_model_t *model);
+PWR_model_t PWR_get_model(void);
+void PWR_begin(PWR_subsystem_t subsystem);
+void PWR_end(void);
+void PWR_clock_change(void);
+void PWR_busy_start(PWR_subsystem_t subsystem);
+void PWR_busy_stop(PWR_subsystem_t subsystem);
+void PWR_count_measurement(void);
+void PWR_update(void);
+PWR_report_t PWR_get_report(void);
+
+#endif
@@ -0,0 +1,50 @@
+/** ***************************************************************************
+ * @file
+ * @brief See profiling.c
+ *
+ * Prefix PROF
+ *
+ *****************************************************************************/
+
+#ifndef PROFILING_H_
+#define PROFILING_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Enumeration of the recorded boot stages, in the order they are reached */
+typedef enum {
+    PROF_BOOT_CLOCK = 0,        ///< System clock configured, time base of the timeline
+    PROF_BOOT_ACQ_START,        ///< First acquisition started
+    PROF_BOOT_LCD,              ///< LCD and SDRAM initialized
+    PROF_BOOT_MENU,             ///< Menu bar drawn
+    PROF_BOOT_FIRST_FRAME,      ///< First frame processed by calculate_pos(), in range or not
+    PROF_BOOT_TOUCH,            ///< Touch controller initialized
+    PROF_BOOT_STAGES            ///< Number of boot stages
+} PROF_boot_stage_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void PROF_init(void);
+uint32_t PROF_get_cycles(void);
+uint32_t PROF_cycles_to_us(uint32_t cycles);
+uint32_t PROF_cycles_to_ns(uint32_t cycles);
+void PROF_boot_mark(PROF_boot_stage_t stage);
+bool PROF_boot_reached(PROF_boot_stage_t stage);
+bool PROF_boot_complete(void);
+uint32_t PROF_boot_get_us(PROF_boot_stage_t stage);
+
+#endif
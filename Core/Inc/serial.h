@@ -0,0 +1,62 @@
+/** ***************************************************************************
+ * @file
+ * @brief See serial.c
+ *
+ * Prefix SER
+ *
+ *****************************************************************************/
+
+#ifndef SERIAL_H_
+#define SERIAL_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define SER_BAUDRATE        115200  ///< Baudrate of USART1 (ST-LINK virtual COM port)
+#define SER_TX_SIZE         2048    ///< Size of the transmit queue, must be a power of 2
+#define SER_RX_SIZE         1024    ///< Size of the receive ring, must be a power of 2
+#define SER_FRAME_START     0xA5    ///< First byte of each frame
+#define SER_FRAME_OVERHEAD  5       ///< Start, type, 2 length bytes and checksum
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Frame types, the payload of each type is described with its sender */
+typedef enum {
+    SER_FRAME_TEXT = 0x00,          ///< ASCII text
+    SER_FRAME_POWER = 0x01,         ///< PWR_report_t, see power.c
+    SER_FRAME_MEMORY = 0x02,        ///< MEM_report_t, see memory.c
+    SER_FRAME_TRACE = 0x03,         ///< Chunk of the event trace, see trace.c
+    SER_FRAME_CAPTURE = 0x04,       ///< Piece of a capture file, see capture.c
+    SER_FRAME_COMMAND = 0x05,       ///< Command of the host (received), see command.c
+    SER_FRAME_RESPONSE = 0x06,      ///< Batch of command responses, see command.c
+    SER_FRAME_SNAPSHOT = 0x07,      ///< Chunk of a screen snapshot, see snapshot.c
+} SER_frame_type_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void SER_init(void);
+bool SER_write(const void *data, uint32_t length);
+bool SER_send_frame(SER_frame_type_t type, const void *payload, uint16_t length);
+uint32_t SER_get_free(void);
+uint32_t SER_get_dropped(void);
+uint32_t SER_read(void *data, uint32_t length);
+uint32_t SER_get_rx_lost(void);
+bool SER_tx_busy(void);
+
+#endif
@@ -0,0 +1,82 @@
+/** ***************************************************************************
+ * @file
+ * @brief See session.c
+ *
+ * Prefix SES
+ *
+ *****************************************************************************/
+
+#ifndef SESSION_H_
+#define SESSION_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define SES_WINDOWS         2       ///< Decaying windows per quantity
+#define SES_WINDOW_SHORT_S  10      ///< Time constant of window 0 [s]
+#define SES_WINDOW_LONG_S   60      ///< Time constant of window 1 [s]
+#define SES_MAX_HOLD_MS     1000    ///< Max time a reading is weighted in the time-weighted mean
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Quantities of the session statistics */
+typedef enum {
+    SES_CURRENT = 0,        ///< Current [A]
+    SES_X,                  ///< X position [mm]
+    SES_Y,                  ///< Y position [mm]
+    SES_ANGLE,              ///< Angle [degree]
+    SES_QUANTITIES          ///< Number of quantities
+} SES_quantity_t;
+
+/** Decaying window, exponentially weighted */
+typedef struct {
+    float mean;             ///< Mean
+    float std;              ///< Standard deviation
+} SES_window_t;
+
+/** Statistics of one quantity since the start of the session, 52 bytes */
+typedef struct {
+    uint32_t count;                     ///< Valid readings
+    float mean;                         ///< Mean of the valid readings
+    float std;                          ///< Standard deviation of the valid readings
+    float time_mean;                    ///< Time-weighted mean
+    uint32_t covered_ms;                ///< Time covered by time_mean
+    float min;                          ///< Smallest valid reading
+    float max;                          ///< Largest valid reading
+    uint32_t min_ms;                    ///< HAL_GetTick() of the first min
+    uint32_t max_ms;                    ///< HAL_GetTick() of the first max
+    SES_window_t window[SES_WINDOWS];   ///< Decaying windows, see SES_WINDOW_SHORT_S
+} SES_stats_t;
+
+/** Summary of the session, response of CMD_SESSION, 224 bytes */
+typedef struct {
+    uint32_t start_ms;                      ///< HAL_GetTick() at the start
+    uint32_t duration_ms;                   ///< Time since the start
+    uint32_t readings;                      ///< Readings added, valid or not
+    uint16_t window_s[SES_WINDOWS];         ///< Time constants of the windows [s]
+    SES_stats_t quantity[SES_QUANTITIES];   ///< Statistics of each quantity
+} SES_summary_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void SES_reset(void);
+void SES_add_reading(int x, int y, int angle, float current);
+void SES_get_summary(SES_summary_t *summary);
+
+#endif
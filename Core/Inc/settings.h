@@ -0,0 +1,70 @@
+/** ***************************************************************************
+ * @file
+ * @brief See settings.c
+ *
+ * Prefix CFG
+ *
+ *****************************************************************************/
+
+#ifndef SETTINGS_H_
+#define SETTINGS_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define CFG_MODE_NOTHING        1   ///< Mode: no measurement
+#define CFG_MODE_SINGLE         2   ///< Mode: single measurement
+#define CFG_MODE_AVERAGE        3   ///< Mode: average measurement
+
+#define CFG_PAGE_VALUES         1   ///< Page: measurement in numbers
+#define CFG_PAGE_GRAPHIC        2   ///< Page: measurement visualized
+#define CFG_PAGE_DIAG           3   ///< Page: diagnostics
+#define CFG_PAGE_MEMORY         4   ///< Page: memory usage
+#define CFG_PAGE_SESSION        5   ///< Page: session statistics
+#define CFG_PAGES               5   ///< Number of pages
+
+#define CFG_TABLE_ONE_PHASE     1   ///< Table: one phase
+#define CFG_TABLE_TWO_PHASE     2   ///< Table: two phase
+#define CFG_TABLES              1   ///< Tables available: 1 = one phase, 2 = both
+
+#define CFG_MAX_AVERAGING       16  ///< Max frames averaged in CFG_MODE_AVERAGE
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Measurement settings, the numbers are part of the command protocol */
+typedef enum {
+    CFG_MODE = 0,           ///< CFG_MODE_NOTHING, _SINGLE or _AVERAGE
+    CFG_PAGE,               ///< Page shown, CFG_PAGE_VALUES ... CFG_PAGE_SESSION
+    CFG_TABLE,              ///< Calibration table, CFG_TABLE_ONE_PHASE ... CFG_TABLES
+    CFG_AVERAGING,          ///< Frames averaged in CFG_MODE_AVERAGE
+    CFG_BUZZER,             ///< Distance feedback on the buzzer, 0 = off, 1 = on
+    CFG_DETECT,             ///< Sensitivity of the load change detection, 0 = off
+    CFG_BACKEND,            ///< Acquisition backend (ACQ_backend_t), 0 ... ACQ_DSP_BACKENDS-1
+    CFG_MAINS,              ///< Mains frequency, MAINS_AUTO or 1 + MAINS_t
+    CFG_SETTINGS            ///< Number of settings
+} CFG_id_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+int32_t CFG_get(CFG_id_t id);
+bool CFG_set(CFG_id_t id, int32_t value);
+bool CFG_get_range(CFG_id_t id, int32_t *min, int32_t *max);
+bool CFG_is_stored(CFG_id_t id);
+
+#endif
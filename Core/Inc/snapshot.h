@@ -0,0 +1,70 @@
+/** ***************************************************************************
+ * @file
+ * @brief See snapshot.c
+ *
+ * Prefix SNAP
+ *
+ *****************************************************************************/
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define SNAP_MAX_WIDTH      320     ///< Max pixels of a line of the layer
+#define SNAP_DATA_SIZE      768     ///< Max compressed bytes of a chunk
+#define SNAP_PALETTE_SIZE   256     ///< Max palette entries of a snapshot
+#define SNAP_LINES_PER_PASS 16      ///< Max lines compressed by one SNAP_update()
+
+#define SNAP_FIRST          0x01    ///< Chunk flag: first chunk of the snapshot
+#define SNAP_LAST           0x02    ///< Chunk flag: last chunk of the snapshot
+#define SNAP_LOSSY          0x04    ///< Chunk flag: palette full, colors approximated
+
+#define SNAP_OP_LITERAL     0x00    ///< Token: n palette indices follow
+#define SNAP_OP_RUN         0x40    ///< Token: one palette index, repeated n times
+#define SNAP_OP_COPY        0x80    ///< Token: n pixels of the line above
+#define SNAP_OP_MASK        0xC0    ///< Operation bits of a token
+#define SNAP_LENGTH_EXT     0x3F    ///< Length bits: n = 64 + next byte, else n = bits + 1
+#define SNAP_MAX_LENGTH     319     ///< Max n of a token
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Header of each SER_FRAME_SNAPSHOT, 20 bytes */
+typedef struct {
+    uint8_t snapshot;       ///< Number of the snapshot
+    uint8_t flags;          ///< SNAP_FIRST | SNAP_LAST | SNAP_LOSSY
+    uint16_t width;         ///< Pixels of a line
+    uint16_t height;        ///< Lines of the layer
+    uint16_t first_line;    ///< First line in this chunk
+    uint16_t lines;         ///< Lines in this chunk
+    uint16_t palette_first; ///< Index of the first new palette entry
+    uint16_t palette_new;   ///< New palette entries (ARGB8888) after the header
+    uint16_t reserved;      ///< 0
+    uint32_t elapsed_ms;    ///< Since the snapshot was started
+} SNAP_chunk_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+bool SNAP_start(void);
+void SNAP_update(void);
+bool SNAP_busy(void);
+uint8_t SNAP_get_number(void);
+
+#endif
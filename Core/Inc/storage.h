@@ -0,0 +1,67 @@
+/** ***************************************************************************
+ * @file
+ * @brief See storage.c
+ *
+ * Prefix STO
+ *
+ *****************************************************************************/
+
+#ifndef STORAGE_H_
+#define STORAGE_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "settings.h"
+#include "calculations.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define STO_ADDRESS     0x081E0000UL    ///< Sector 23, region STORAGE of the linker script
+#define STO_SIZE        0x20000UL       ///< Size of the sector [bytes]
+#define STO_SECTOR      27              ///< FLASH_CR_SNB of sector 23 (bank 2: 16 + 11)
+#define STO_MAGIC       0x344F5453UL    ///< "STO4", first word of a record
+#define STO_DELAY_MS    2000            ///< A change must be stable this long before it is written
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Record in the flash, appended after the last one */
+typedef struct {
+    uint32_t magic;                             ///< STO_MAGIC, 0xFFFFFFFF = free
+    uint32_t sequence;                          ///< Number of the record since the first erase
+    int32_t setting[CFG_SETTINGS];              ///< Values of the stored settings, 0 if not stored
+    CALC_phasor_t background[CALC_CHANNELS];    ///< Background field, see get_background()
+    CALC_phasor_t decoupling[CALC_CHANNELS*CALC_CHANNELS];  ///< Crosstalk, see get_decoupling()
+    uint32_t check;                             ///< FNV-1a of the words before, written last
+} STO_record_t;
+
+/** State of the storage */
+typedef struct {
+    uint32_t records;       ///< Records in the sector
+    uint32_t sequence;      ///< Number of the last record, 0 = none
+    uint32_t writes;        ///< Records written since STO_init()
+    uint32_t erases;        ///< Sector erases since STO_init()
+    uint32_t errors;        ///< Failed programming or erase
+    bool erasing;           ///< Erase of the sector running
+} STO_status_t;
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+void STO_init(void);
+void STO_update(uint32_t now_ms);
+STO_status_t STO_get_status(void);
+
+#endif
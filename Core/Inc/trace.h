@@ -0,0 +1,114 @@
+/** ***************************************************************************
+ * @file
+ * @brief See trace.c
+ *
+ * Prefix TRACE
+ *
+ *****************************************************************************/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include "stm32f4xx.h"
+#include "main.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define TRACE_EVENTS        2048    ///< Events in the ring, power of 2 (about 0.3 s)
+#define TRACE_CHUNK         40      ///< Events per SER_FRAME_TRACE
+#define TRACE_LATE_US       30000   ///< Frames older than this trigger a dump
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Enumeration of the event types */
+typedef enum {
+    TRACE_ISR_ENTER = 1,    ///< Handler entered, arg = IRQ_source_t
+    TRACE_ISR_EXIT,         ///< Handler left, arg = IRQ_source_t
+    TRACE_FRAME,            ///< Frame captured, arg = frame number
+    TRACE_BEGIN,            ///< Work started, arg = PWR_subsystem_t
+    TRACE_END,              ///< Work finished, arg = PWR_subsystem_t
+    TRACE_CLOCK,            ///< Core clock changed, arg = MHz
+    TRACE_TRIGGERED,        ///< Dump triggered, arg = age of the frame [ms]
+} TRACE_id_t;
+
+/** Recorded event */
+typedef struct {
+    uint32_t ms;            ///< HAL tick
+    uint32_t val;           ///< SysTick VAL (bits 0..23) and core clock in MHz (bits 24..31)
+    uint16_t id;            ///< TRACE_id_t
+    uint16_t arg;           ///< Argument of the event
+} TRACE_event_t;
+
+
+/******************************************************************************
+ * Macros
+ *****************************************************************************/
+
+#ifdef TRACE_ENABLED
+#define TRACE(id, arg)      TRACE_record((id), (arg))   ///< Record an event
+#define TRACE_TRIGGER(arg)  TRACE_trigger(arg)          ///< Freeze and dump the ring
+#define TRACE_UPDATE()      TRACE_update()              ///< Send the next chunk
+#define TRACE_CLOCK_SET(mhz) TRACE_clock(mhz)           ///< Core clock changed
+#else
+#define TRACE(id, arg)      ((void)0)
+#define TRACE_TRIGGER(arg)  ((void)0)
+#define TRACE_UPDATE()      ((void)0)
+#define TRACE_CLOCK_SET(mhz) ((void)0)
+#endif
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+#ifdef TRACE_ENABLED
+
+extern TRACE_event_t TRACE_ring[TRACE_EVENTS];
+extern volatile uint32_t TRACE_head;
+extern volatile bool TRACE_frozen;
+extern uint32_t TRACE_mhz;
+
+void TRACE_trigger(uint16_t arg);
+void TRACE_update(void);
+void TRACE_clock(uint32_t mhz);
+
+/** ***************************************************************************
+ * @brief Record an event
+ * @param [in] id TRACE_id_t
+ * @param [in] arg
+ *
+ * Inline, about 20 cycles. Use the macro TRACE(), which compiles out.
+ *****************************************************************************/
+static inline void TRACE_record(uint16_t id, uint16_t arg)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!TRACE_frozen) {
+        TRACE_event_t *e = &TRACE_ring[TRACE_head++ & (TRACE_EVENTS-1)];
+        uint32_t val = SysTick->VAL;
+        e->ms = uwTick;
+        if ((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) && val > SysTick->LOAD/2) {
+            e->ms++;                    // Reloaded, but tick not yet incremented
+        }
+        e->val = val | (TRACE_mhz << 24);
+        e->id = id;
+        e->arg = arg;
+    }
+    __set_PRIMASK(primask);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,272 @@
+/** ***************************************************************************
+ * @file
+ * @brief Acquisition backends selectable at runtime behind one frame format
+ *
+ * Backends
+ * ========
+ * Each ADC configuration of measuring.c is a backend: its init and start
+ * function, the rate of the TIM2 trigger and the layout it leaves in the ADC buffer.
+ * | Backend     | Columns                          | Trigger          | Transfer             |
+ * | :---------- | :------------------------------- | :--------------- | :------------------- |
+ * | ACQ_GROUPS  | PAD_LEFT PAD_RIGHT HALL_LEFT HALL_RIGHT | TIM2 at MEAS_HALL_FS, pads every MEAS_HALL_RATIO-th | DMA + JEOC interrupt |
+ * | ACQ_TIMER   | PAD_LEFT PAD_RIGHT HALL_LEFT HALL_RIGHT | TIM2 at ADC_FS  | EOC interrupt        |
+ * | ACQ_DMA     | PAD_LEFT                         | TIM2 at ADC_FS   | DMA2_Stream1         |
+ * | ACQ_DUAL    | PAD_RIGHT AUX                    | TIM2 at ADC_FS   | DMA2_Stream4, packed |
+ * | ACQ_SCAN2   | PAD_RIGHT AUX                    | TIM2 at ADC_FS   | DMA2_Stream3         |
+ * | ACQ_SCAN3   | PAD_RIGHT PAD_LEFT               | TIM2 at ADC_FS   | DMA2_Stream1         |
+ * | ACQ_SINGLE  | PAD_LEFT, 1 sample               | software         | polled               |
+ * All but ACQ_SINGLE sample ADC_NUMS per channel.
+ * Only the first ACQ_DSP_BACKENDS have the four channels of the DSP,
+ * they are selectable with CFG_BACKEND. The others are kept for
+ * the demonstration and the benchmark (see bench.c).
+ *
+ * Frame
+ * =====
+ * ACQ_get_frame() describes the buffer of the last frame in the same way for all
+ * backends: interleaved columns, the input of each column (ACQ_channel_t),
+ * the rate and the time of the first and last sample, the frame number
+ * and the ADC overrun of measuring.c. ACQ_find() gives the column of an input.
+ * The layout is that of the backend which sampled the frame,
+ * a backend selected while the frame is processed does not change it.
+ * ACQ_is_complete() checks if a frame fits calculate_frame_groups().
+ *
+ * Sequence
+ * ========
+ * ACQ_start() inits and starts the selected backend. It does nothing
+ * while a frame is sampled (the frame number of measuring.c has not changed)
+ * or processed (MEAS_data_ready), so calculate_pos() calls it in every pass.
+ * ACQ_select() aborts a running frame with MEAS_stop(), the next ACQ_start()
+ * begins with the new backend. ACQ_set_rate() changes the rate
+ * of the selected backend until the next ACQ_select(), the pipeline needs
+ * the rate of the mains frequency (see mains.c).
+ * @n No register is accessed here, Tools/host/backends.c runs this file
+ * unchanged on a mock of measuring.c.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+#include "acquisition.h"
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Backend of the table */
+typedef struct {
+    const char *name;               ///< Short name, e.g. for the benchmark
+    void (*init)(void);             ///< Configure ADC(s) and DMA
+    void (*start)(void);            ///< Start the frame
+    uint32_t fs;                    ///< Sampling frequency [Hz] after ACQ_select()
+    uint8_t ratio;                  ///< TIM2 updates per sample, 0 = software triggered
+    uint8_t channels;               ///< Interleaved columns
+    uint8_t map[ACQ_CHANNELS];      ///< ACQ_channel_t of each column
+    uint16_t length;                ///< Samples per channel
+} backend_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const backend_t backends[ACQ_BACKENDS] = {
+        [ACQ_GROUPS] = {"groups", ADC3_groups_init, ADC3_groups_start, ADC_FS, MEAS_HALL_RATIO, 4,
+                        {ACQ_PAD_LEFT, ACQ_PAD_RIGHT, ACQ_HALL_LEFT, ACQ_HALL_RIGHT}, ADC_NUMS},
+        [ACQ_TIMER]  = {"timer", ADC3_IN4_timer_init, ADC3_IN4_timer_start, ADC_FS, 1, 4,
+                        {ACQ_PAD_LEFT, ACQ_PAD_RIGHT, ACQ_HALL_LEFT, ACQ_HALL_RIGHT}, ADC_NUMS},
+        [ACQ_DMA]    = {"dma", ADC3_IN4_DMA_init, ADC3_IN4_DMA_start, ADC_FS, 1, 1,
+                        {ACQ_PAD_LEFT}, ADC_NUMS},
+        [ACQ_DUAL]   = {"dual", ADC1_IN13_ADC2_IN5_dual_init, ADC1_IN13_ADC2_IN5_dual_start,
+                        ADC_FS, 1, 2, {ACQ_PAD_RIGHT, ACQ_AUX}, ADC_NUMS},
+        [ACQ_SCAN2]  = {"scan2", ADC2_IN13_IN5_scan_init, ADC2_IN13_IN5_scan_start, ADC_FS, 1, 2,
+                        {ACQ_PAD_RIGHT, ACQ_AUX}, ADC_NUMS},
+        [ACQ_SCAN3]  = {"scan3", ADC3_IN13_IN4_scan_init, ADC3_IN13_IN4_scan_start, ADC_FS, 1, 2,
+                        {ACQ_PAD_RIGHT, ACQ_PAD_LEFT}, ADC_NUMS},
+        [ACQ_SINGLE] = {"single", ADC3_IN4_single_init, ADC3_IN4_single_read, 0, 0, 1,
+                        {ACQ_PAD_LEFT}, 1},
+};
+
+static ACQ_backend_t selected = ACQ_GROUPS; ///< Backend of the next frame
+static uint32_t selected_fs = ADC_FS;   ///< Sampling frequency of the next frame
+static ACQ_backend_t sampled = ACQ_GROUPS;  ///< Backend of the frame in the buffer
+static uint32_t sampled_fs = ADC_FS;    ///< Sampling frequency of the frame in the buffer
+static bool started = false;            ///< A frame was started since ACQ_select()
+static uint16_t started_number = 0;     ///< Frame number of measuring.c at the start
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Abort a running frame and set the trigger rate of the selected backend
+ *
+ * selected_fs becomes the rate the timer can make.
+ *****************************************************************************/
+static void prepare(void)
+{
+    MEAS_stop();
+    started = false;
+    uint8_t ratio = backends[selected].ratio;
+    if (ratio > 0) {
+        selected_fs = MEAS_set_rate(selected_fs * ratio) / ratio;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Select the backend of the next frame
+ * @param [in] backend
+ * @return false if backend is invalid, the selection is not changed
+ *
+ * A running frame is aborted, the rate is that of the table.
+ *****************************************************************************/
+bool ACQ_select(ACQ_backend_t backend)
+{
+    if ((uint32_t)backend >= ACQ_BACKENDS) {
+        return false;
+    }
+    selected = backend;
+    selected_fs = backends[backend].fs;
+    prepare();
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Change the sampling frequency of the selected backend
+ * @param [in] fs [Hz], rounded to a rate of TIM2 (see ACQ_get_frame())
+ * @return false for a software triggered backend
+ *
+ * A running frame is aborted. The Hall sensors of ACQ_GROUPS
+ * stay at MEAS_HALL_RATIO times fs.
+ *****************************************************************************/
+bool ACQ_set_rate(uint32_t fs)
+{
+    if (backends[selected].ratio == 0 || fs == 0) {
+        return false;
+    }
+    selected_fs = fs;
+    prepare();
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Selected backend
+ *****************************************************************************/
+ACQ_backend_t ACQ_get_backend(void)
+{
+    return selected;
+}
+
+
+/** ***************************************************************************
+ * @brief Sampling frequency of the next frame [Hz], 0 = software triggered
+ *****************************************************************************/
+uint32_t ACQ_get_rate(void)
+{
+    return (backends[selected].ratio > 0) ? selected_fs : 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Short name of a backend
+ * @return "?" if backend is invalid
+ *****************************************************************************/
+const char *ACQ_get_name(ACQ_backend_t backend)
+{
+    if ((uint32_t)backend >= ACQ_BACKENDS) {
+        return "?";
+    }
+    return backends[backend].name;
+}
+
+
+/** ***************************************************************************
+ * @brief Start a frame with the selected backend
+ *
+ * Does nothing while a frame is sampled or processed (until reset_sample_counter()).
+ * ACQ_SINGLE samples synchronously, MEAS_data_ready is set on return.
+ *****************************************************************************/
+void ACQ_start(void)
+{
+    if (MEAS_data_ready) {
+        return;                         // DMA would overwrite the frame
+    }
+    uint16_t number = MEAS_get_timing().number;
+    if (started && number == started_number) {
+        return;                         // Frame running
+    }
+    started = true;
+    started_number = number;
+    sampled = selected;
+    sampled_fs = selected_fs;
+    backends[selected].init();
+    backends[selected].start();
+}
+
+
+/** ***************************************************************************
+ * @brief Last frame in the common format
+ *
+ * Valid while MEAS_data_ready is set.
+ *****************************************************************************/
+ACQ_frame_t ACQ_get_frame(void)
+{
+    const backend_t *b = &backends[sampled];
+    MEAS_timing_t timing = MEAS_get_timing();
+    ACQ_frame_t frame = {
+            .samples = MEAS_get_samples(),
+            .channels = b->channels,
+            .backend = sampled,
+            .length = b->length,
+            .number = timing.number,
+            .fs = sampled_fs,
+            .start_us = timing.start_us,
+            .end_us = timing.end_us,
+            .overrun = timing.overrun,
+    };
+    memcpy(frame.map, b->map, sizeof(frame.map));
+    if (sampled == ACQ_GROUPS) {
+        frame.halls = MEAS_get_group(MEAS_GROUP_HALLS);
+    }
+    return frame;
+}
+
+
+/** ***************************************************************************
+ * @brief Column of an input in a frame
+ * @return 0 ... channels-1, -1 if the frame does not have the input
+ *****************************************************************************/
+int ACQ_find(const ACQ_frame_t *frame, ACQ_channel_t channel)
+{
+    for (int c = 0; c < frame->channels; c++) {
+        if (frame->map[c] == channel) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if a frame fits the pipeline
+ * @param [in] frame of ACQ_get_frame()
+ * @param [in] fs rate of the pipeline [Hz], config.fs of calculations.c
+ *
+ * The four channels at CALC_LPAD ... CALC_RHALL, ADC_NUMS samples at fs
+ * and no overrun (a lost conversion shifts the columns of ACQ_TIMER).
+ *****************************************************************************/
+bool ACQ_is_complete(const ACQ_frame_t *frame, uint32_t fs)
+{
+    static const uint8_t dsp[ACQ_CHANNELS] = {
+            ACQ_PAD_LEFT, ACQ_PAD_RIGHT, ACQ_HALL_LEFT, ACQ_HALL_RIGHT};
+    return frame->channels == ACQ_CHANNELS && memcmp(frame->map, dsp, sizeof(dsp)) == 0
+            && frame->length == ADC_NUMS && frame->fs == fs && !frame->overrun;
+}
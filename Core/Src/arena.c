@@ -0,0 +1,223 @@
+/** ***************************************************************************
+ * @file
+ * @brief Allocation of large buffers in the external SDRAM
+ *
+ * Arenas
+ * ======
+ * The 8 MB SDRAM holds the two LCD layers at LCD_FRAME_BUFFER.
+ * ARENA_init() divides the rest into the fixed arenas of the table arenas[].
+ * Each arena starts at a multiple of ARENA_ALIGN.
+ * An arena with size 0 gets the remaining memory, only the last one may have it.
+ * The memory behind the arenas is free for new ones.
+ *
+ * There are two kinds of arenas, both allocate in O(1) and never fragment:
+ * - Bump: ARENA_alloc() returns the next free address and advances it.
+ *   All allocations of the arena are released at once by ARENA_reset().
+ * - Pool: The arena is divided into blocks of equal size.
+ *   ARENA_pool_get() takes a block from a free list, ARENA_pool_put() returns it.
+ *
+ * Allocations are aligned to ARENA_ALIGN, so they can be used by DMA and DMA2D.
+ * @note SDRAM is not initialized, allocated memory has random contents.
+ * @note Allocate from the main loop only, the functions are not reentrant.
+ *
+ * Host build
+ * ==========
+ * The module only uses standard C. On a host, ARENA_init() is called
+ * with a region from malloc() instead of ARENA_SDRAM_BASE,
+ * the arenas are then placed in this region.
+ * Tools/host/arena_check tests the allocation this way.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "arena.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define ALIGN_UP(x)     (((x) + ARENA_ALIGN - 1) & ~(uintptr_t)(ARENA_ALIGN - 1))
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Configuration and state of an arena */
+typedef struct {
+    const char *name;       ///< Name for the display
+    uint32_t size;          ///< Requested size, 0 = rest of the region
+    uint32_t block_size;    ///< Block size of a pool, 0 = bump arena
+    uint8_t *base;          ///< First address
+    uint32_t capacity;      ///< Size after ARENA_init()
+    uint32_t used;          ///< Allocated bytes
+    uint32_t peak;          ///< Max allocated bytes
+    uint32_t allocs;        ///< Successful allocations
+    uint32_t failures;      ///< Failed allocations
+    void *free_list;        ///< Pool: first free block
+} arena_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static arena_t arenas[ARENA_COUNT] = {      ///< Arenas in the order of the region
+        [ARENA_CAPTURE] = {"capture", 256*1024, 0},
+        [ARENA_CHUNKS]  = {"chunks",  ARENA_CHUNK_BLOCKS*ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE},
+        [ARENA_HISTORY] = {"history", 64*1024, 0},
+};
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Link all blocks of a pool into the free list
+ * @param [in] a arena
+ *****************************************************************************/
+static void pool_build(arena_t *a)
+{
+    a->free_list = NULL;
+    uint32_t blocks = a->capacity / a->block_size;
+    for (uint32_t i = blocks; i > 0; i--) {     // Lowest address first
+        void **block = (void **)(a->base + (i-1) * a->block_size);
+        *block = a->free_list;
+        a->free_list = block;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Divide a memory region into the arenas
+ * @param [in] base of the region, ARENA_SDRAM_BASE on the target
+ * @param [in] size of the region [bytes]
+ * @return false if the region is too small, no arena can be used then
+ *
+ * @note Call after BSP_LCD_Init(), which initializes the SDRAM.
+ *****************************************************************************/
+bool ARENA_init(void *base, uint32_t size)
+{
+    uint8_t *p = (uint8_t *)ALIGN_UP((uintptr_t)base);
+    uint8_t *end = (uint8_t *)base + size;
+
+    for (int i = 0; i < ARENA_COUNT; i++) {
+        arena_t *a = &arenas[i];
+        uint32_t capacity = ALIGN_UP(a->size);
+        if (a->size == 0) {                     // Rest of the region
+            capacity = (p < end) ? (uint32_t)(end - p) & ~(uint32_t)(ARENA_ALIGN - 1) : 0;
+        }
+        if (p + capacity > end) {
+            for (int j = 0; j < ARENA_COUNT; j++) {
+                arenas[j].capacity = 0;         // Nothing can be allocated
+            }
+            return false;
+        }
+        a->base = p;
+        a->capacity = capacity;
+        a->used = a->peak = a->allocs = a->failures = 0;
+        if (a->block_size > 0) {
+            pool_build(a);
+        }
+        p += capacity;
+    }
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Allocate from a bump arena
+ * @param [in] id of the arena
+ * @param [in] size [bytes]
+ * @return aligned memory or NULL if the arena is full
+ *****************************************************************************/
+void *ARENA_alloc(ARENA_id_t id, uint32_t size)
+{
+    arena_t *a = &arenas[id];
+    uint32_t aligned = ALIGN_UP(size);
+    if (a->block_size > 0 || aligned < size || aligned > a->capacity - a->used) {
+        a->failures++;
+        return NULL;
+    }
+    void *p = a->base + a->used;
+    a->used += aligned;
+    a->allocs++;
+    if (a->used > a->peak) {
+        a->peak = a->used;
+    }
+    return p;
+}
+
+
+/** ***************************************************************************
+ * @brief Release all allocations of an arena
+ * @param [in] id of the arena
+ *
+ * A pool gets all its blocks back.
+ *****************************************************************************/
+void ARENA_reset(ARENA_id_t id)
+{
+    arena_t *a = &arenas[id];
+    a->used = 0;
+    if (a->block_size > 0 && a->capacity > 0) {
+        pool_build(a);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Take a block from a pool
+ * @param [in] id of the arena
+ * @return block of block_size bytes or NULL if all blocks are in use
+ *****************************************************************************/
+void *ARENA_pool_get(ARENA_id_t id)
+{
+    arena_t *a = &arenas[id];
+    void **block = a->free_list;
+    if (a->block_size == 0 || block == NULL) {
+        a->failures++;
+        return NULL;
+    }
+    a->free_list = *block;
+    a->used += a->block_size;
+    a->allocs++;
+    if (a->used > a->peak) {
+        a->peak = a->used;
+    }
+    return block;
+}
+
+
+/** ***************************************************************************
+ * @brief Return a block to its pool
+ * @param [in] id of the arena
+ * @param [in] block from ARENA_pool_get(), NULL is ignored
+ *****************************************************************************/
+void ARENA_pool_put(ARENA_id_t id, void *block)
+{
+    arena_t *a = &arenas[id];
+    if (block != NULL && a->block_size > 0) {
+        *(void **)block = a->free_list;
+        a->free_list = block;
+        a->used -= a->block_size;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Usage of an arena
+ * @param [in] id of the arena
+ * @return stats
+ *****************************************************************************/
+ARENA_stats_t ARENA_get_stats(ARENA_id_t id)
+{
+    arena_t *a = &arenas[id];
+    ARENA_stats_t s = {a->name, a->capacity, a->used, a->peak,
+            a->allocs, a->failures, a->block_size};
+    return s;
+}
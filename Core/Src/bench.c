@@ -0,0 +1,530 @@
+/** ***************************************************************************
+ * @file
+ * @brief Microbenchmark firmware for the DSP and graphics kernels and the acquisition
+ *
+ * Build
+ * =====
+ * The build configuration "Bench" defines BENCH_FIRMWARE.
+ * main() then calls BENCH_main() instead of the application.
+ * The same measurement and graphics modules are linked as in the application,
+ * so the numbers belong to the code that is shipped.
+ *
+ * Suite
+ * =====
+ * Each kernel runs BENCH_RUNS times with all interrupts masked.
+ * The cycles of each run are counted with the DWT counter,
+ * the overhead of the measurement itself is subtracted.
+ * | Name    | Kernel                                                          |
+ * | :------ | :-------------------------------------------------------------- |
+ * | deint   | Deinterleave the frame into 4 float arrays (former stage)       |
+ * | rfft    | arm_rfft_fast_f32() of 4 channels (former stage)                |
+ * | dft1    | split_Array(): single bin DFT, statistics and clipping          |
+ * | lut     | calculate_FFT(): amplitudes, averaging and distance LUT         |
+ * | triang  | calculate_triangulation(): law of cosines and current           |
+ * | text    | 20 characters with Font16                                       |
+ * | fill    | 100 x 100 pixel rectangle (DMA2D)                               |
+ * | line    | Diagonal line over 200 x 100 pixels                             |
+ * The kernels process a synthetic 50 Hz frame with their own pipeline context,
+ * the acquisition is not started.
+ * The core runs at 168 MHz.
+ *
+ * Acquisition
+ * ===========
+ * Then each backend of acquisition.c samples BENCH_ACQ_FRAMES frames at its rate
+ * with the interrupts enabled. While waiting for MEAS_data_ready the loop counts
+ * its passes, the cycles of a pass are calibrated without acquisition.
+ * The cycles of a frame which the loop did not get are taken by the backend:
+ * start, interrupts (TIM2 included) and the DMA on the bus matrix.
+ * They are the row acq_<name> of the result table, the load is their share of the frame.
+ * @n The max sample rate doubles the rate of the backend until a frame fails
+ * (ADC overrun, not complete within twice its duration, frame number not
+ * advanced or a load above ACQ_MAX_LOAD), then it is bisected ACQ_STEPS times between the last good
+ * and the failed rate. The search ends at ACQ_MAX_TRIGGER TIM2 updates per second,
+ * at higher rates the TIM2 interrupt alone would starve the loop.
+ * ACQ_SINGLE is polled (1 ms ADC settling in each conversion),
+ * its max rate is one sample per frame time and its load 100 %.
+ *
+ * Result table
+ * ============
+ * The results are shown on the LCD and sent as SER_FRAME_TEXT lines on USART1:
+ * @code
+ * BENCH,begin,<build date and time>,<core clock MHz>,<runs>
+ * BENCH,<name>,<min>,<mean>,<max>      (cycles)
+ * BENCH,acq_<backend>,<min>,<mean>,<max>   (busy cycles per frame)
+ * BENCH,rate,<backend>,<load permille>,<fs>,<max fs>   (Hz)
+ * BENCH,end
+ * @endcode
+ * Tools/bench_diff.py records the table and compares two of them,
+ * the rate lines are not compared.
+ * @n The suite is repeated when the blue pushbutton is pressed.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "bench.h"
+
+#ifdef BENCH_FIRMWARE
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "stm32f429i_discovery.h"
+#include "stm32f429i_discovery_lcd.h"
+#include "arm_math.h"
+
+#include "measuring.h"
+#include "acquisition.h"
+#include "calculations.h"
+#include "clock.h"
+#include "pushbutton.h"
+#include "profiling.h"
+#include "interrupts.h"
+#include "serial.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define LINE_LENGTH     64              ///< Max length of a line of the result table
+#define KERNEL_Y        200             ///< Y position of the graphics kernels
+#define TABLE_Y         40              ///< Y position of the result table on the LCD
+#define CALIBRATION_US  20000           ///< Calibration of the waiting loop [us]
+#define ACQ_MAX_LOAD    900             ///< Max load of the rate search [permille]
+#define ACQ_MAX_TRIGGER 1000000         ///< Max TIM2 update rate of the rate search [Hz]
+#define ACQ_STEPS       4               ///< Bisections of the rate search
+#define ACQ_MARGIN_US   10000           ///< Added to the timeout of a frame [us]
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Kernel of the suite */
+typedef struct {
+    const char *name;                   ///< Name in the result table
+    void (*run)(void);                  ///< One run of the kernel
+} kernel_t;
+
+/** Result of an acquisition backend */
+typedef struct {
+    char name[12];                      ///< acq_<backend>, key for Tools/bench_diff.py
+    BENCH_result_t busy;                ///< Cycles per frame taken by the backend
+    uint32_t load;                      ///< Share of the frames [permille]
+    uint32_t fs;                        ///< Sampling frequency of the backend [Hz]
+    uint32_t max_fs;                    ///< Max sampling frequency found [Hz]
+} acq_result_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static uint32_t frame[CALC_CHANNELS*ADC_NUMS];      ///< Synthetic interleaved frame
+static CALC_context_t ctx;              ///< Pipeline context of the DSP kernels
+static float32_t samples[CALC_CHANNELS][ADC_NUMS];  ///< Deinterleaved channels
+static float32_t spectrum[ADC_NUMS];    ///< Output of the rfft kernel
+static float32_t rfft_input[ADC_NUMS];  ///< arm_rfft_fast_f32() overwrites its input
+static arm_rfft_fast_instance_f32 rfft; ///< Instance of the rfft kernel
+
+static void kernel_deint(void);
+static void kernel_rfft(void);
+static void kernel_dft1(void);
+static void kernel_lut(void);
+static void kernel_triang(void);
+static void kernel_text(void);
+static void kernel_fill(void);
+static void kernel_line(void);
+
+static const kernel_t kernels[] = {     ///< The suite
+        {"deint",  kernel_deint},
+        {"rfft",   kernel_rfft},
+        {"dft1",   kernel_dft1},
+        {"lut",    kernel_lut},
+        {"triang", kernel_triang},
+        {"text",   kernel_text},
+        {"fill",   kernel_fill},
+        {"line",   kernel_line},
+};
+
+#define KERNELS     (sizeof(kernels) / sizeof(kernels[0]))  ///< Number of kernels
+
+static BENCH_result_t results[KERNELS]; ///< Results of the last suite
+static acq_result_t acq_results[ACQ_BACKENDS];  ///< Results of the acquisition backends
+static uint32_t calibration_passes;     ///< Passes of the waiting loop in CALIBRATION_US
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Kernels of the suite
+ *****************************************************************************/
+static void kernel_deint(void)
+{
+    for (uint32_t j = 0; j < ADC_NUMS; j++) {
+        for (uint32_t i = 0; i < CALC_CHANNELS; i++) {
+            samples[i][j] = (float32_t)frame[CALC_CHANNELS*j + i];
+        }
+    }
+}
+
+static void kernel_rfft(void)
+{
+    for (uint32_t i = 0; i < CALC_CHANNELS; i++) {
+        memcpy(rfft_input, samples[i], sizeof(rfft_input));
+        arm_rfft_fast_f32(&rfft, rfft_input, spectrum, 0);
+    }
+}
+
+static void kernel_dft1(void)
+{
+    split_Array(&ctx);
+}
+
+static void kernel_lut(void)
+{
+    calculate_FFT(&ctx);
+}
+
+static void kernel_triang(void)
+{
+    calculate_triangulation(&ctx, 60, 70);
+}
+
+static void kernel_text(void)
+{
+    BSP_LCD_SetFont(&Font16);
+    BSP_LCD_DisplayStringAt(0, KERNEL_Y, (uint8_t *)"BENCH 0123456789 ABC", LEFT_MODE);
+}
+
+static void kernel_fill(void)
+{
+    BSP_LCD_FillRect(70, KERNEL_Y, 100, 100);
+}
+
+static void kernel_line(void)
+{
+    BSP_LCD_DrawLine(20, KERNEL_Y, 219, KERNEL_Y + 99);
+}
+
+
+/** ***************************************************************************
+ * @brief Fill the frame with synthetic samples
+ *
+ * 50 Hz sines on a DC level of half scale, the amplitudes are within
+ * the range of the distance LUTs.
+ *****************************************************************************/
+static void load_frame(void)
+{
+    const uint32_t amplitude[CALC_CHANNELS] = {900, 800, 300, 250};
+    for (uint32_t j = 0; j < ADC_NUMS; j++) {
+        float32_t s = sinf(2*PI*CALC_MAINS_BIN*j/ADC_NUMS);
+        for (uint32_t i = 0; i < CALC_CHANNELS; i++) {
+            frame[CALC_CHANNELS*j + i] = (uint32_t)(2048 + amplitude[i]*s);
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Cycles of one measured run
+ * @param [in] run kernel or NULL for the overhead
+ * @return cycles
+ *****************************************************************************/
+static uint32_t measure(void (*run)(void))
+{
+    uint32_t mask = IRQ_mask(IRQ_PRIO_ACQ);
+    uint32_t start = PROF_get_cycles();
+    if (run != NULL) {
+        run();
+    }
+    uint32_t cycles = PROF_get_cycles() - start;
+    IRQ_unmask(mask);
+    return cycles;
+}
+
+
+/** ***************************************************************************
+ * @brief Send a line of the result table
+ * @param [in] line
+ *
+ * Waits for space in the transmit queue, the table must be complete.
+ *****************************************************************************/
+static void send_line(const char *line)
+{
+    uint32_t length = strlen(line);
+    while (SER_get_free() < length + SER_FRAME_OVERHEAD) {
+        ;                               // DMA is draining the queue
+    }
+    SER_send_frame(SER_FRAME_TEXT, line, length);
+}
+
+
+/** ***************************************************************************
+ * @brief Run the suite and store the results
+ *****************************************************************************/
+static void run_suite(void)
+{
+    uint32_t overhead = UINT32_MAX;
+    for (uint32_t r = 0; r < BENCH_RUNS; r++) {
+        uint32_t cycles = measure(NULL);
+        if (cycles < overhead) { overhead = cycles; }
+    }
+
+    BSP_LCD_Clear(LCD_COLOR_WHITE);
+    BSP_LCD_SetTextColor(LCD_COLOR_BLUE);
+    for (uint32_t k = 0; k < KERNELS; k++) {
+        calculate_init(&ctx);
+        calculate_frame(&ctx, frame, 1);    // Averaging over one frame for the lut kernel
+        uint64_t sum = 0;
+        results[k].name = kernels[k].name;
+        results[k].min = UINT32_MAX;
+        results[k].max = 0;
+        for (uint32_t r = 0; r < BENCH_RUNS; r++) {
+            uint32_t cycles = measure(kernels[k].run);
+            cycles = (cycles > overhead) ? cycles - overhead : 0;
+            sum += cycles;
+            if (cycles < results[k].min) { results[k].min = cycles; }
+            if (cycles > results[k].max) { results[k].max = cycles; }
+        }
+        results[k].mean = sum / BENCH_RUNS;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Wait for a frame and count the passes
+ * @param [in] start_us time the wait began
+ * @param [in] timeout_us
+ * @return passes of the loop
+ *****************************************************************************/
+static uint32_t wait_frame(uint32_t start_us, uint32_t timeout_us)
+{
+    uint32_t passes = 0;
+    while (!MEAS_data_ready && CLOCK_get_us() - start_us < timeout_us) {
+        passes++;
+    }
+    return passes;
+}
+
+
+/** ***************************************************************************
+ * @brief Sample one frame with the selected backend
+ * @param [out] cycles of the frame, from the start
+ * @param [out] busy cycles of the frame taken by the backend
+ * @return false if the frame failed (timeout, overrun or frame number)
+ *
+ * The timeout is twice the duration of the frame plus ACQ_MARGIN_US.
+ * A frame which does not complete is aborted.
+ * @n The frame number has to advance by one, the bench runs with tracing
+ * compiled out and ACQ_start() waits for the number of the running frame.
+ *****************************************************************************/
+static bool sample_frame(uint32_t *cycles, uint32_t *busy)
+{
+    uint32_t fs = ACQ_get_rate();
+    uint32_t timeout_us = ACQ_MARGIN_US;
+    if (fs > 0) {
+        timeout_us += (uint32_t)(2ULL * (ADC_NUMS + 1) * 1000000 / fs);
+    }
+    reset_sample_counter();
+    uint16_t number = MEAS_get_timing().number;
+    uint32_t start_us = CLOCK_get_us();
+    ACQ_start();
+    uint32_t passes = wait_frame(start_us, timeout_us);
+    uint32_t elapsed_us = CLOCK_get_us() - start_us;
+    if (!MEAS_data_ready) {
+        ACQ_set_rate(fs);               // Abort
+        return false;
+    }
+    uint32_t mhz = SystemCoreClock / 1000000;
+    uint32_t idle = (uint32_t)((uint64_t)passes * CALIBRATION_US * mhz / calibration_passes);
+    *cycles = elapsed_us * mhz;
+    *busy = (*cycles > idle) ? *cycles - idle : 0;
+    ACQ_frame_t frame = ACQ_get_frame();
+    reset_sample_counter();
+    return !frame.overrun && frame.number == (uint16_t)(number + 1);
+}
+
+
+/** ***************************************************************************
+ * @brief Check if the selected backend works at a rate
+ * @param [in] fs [Hz]
+ *****************************************************************************/
+static bool rate_works(uint32_t fs)
+{
+    uint32_t cycles, busy;
+    return ACQ_set_rate(fs) && sample_frame(&cycles, &busy)
+            && (uint64_t)busy * 1000 <= (uint64_t)cycles * ACQ_MAX_LOAD;
+}
+
+
+/** ***************************************************************************
+ * @brief Search the max sample rate of the selected backend
+ * @param [in] fs rate which works [Hz]
+ * @param [in] ratio TIM2 updates per sample
+ * @return max rate [Hz]
+ *****************************************************************************/
+static uint32_t search_rate(uint32_t fs, uint32_t ratio)
+{
+    uint32_t limit = ACQ_MAX_TRIGGER / ratio;
+    uint32_t good = fs;
+    uint32_t bad = 0;
+    while (bad == 0 && good < limit) {
+        uint32_t next = (2*good < limit) ? 2*good : limit;
+        if (rate_works(next)) {
+            good = next;
+        } else {
+            bad = next;
+        }
+    }
+    for (uint32_t s = 0; s < ACQ_STEPS && bad != 0; s++) {
+        uint32_t mid = (good + bad) / 2;
+        if (rate_works(mid)) {
+            good = mid;
+        } else {
+            bad = mid;
+        }
+    }
+    ACQ_set_rate(good);
+    return ACQ_get_rate();
+}
+
+
+/** ***************************************************************************
+ * @brief Run the acquisition backends and store the results
+ *****************************************************************************/
+static void run_acquisition(void)
+{
+    MEAS_data_ready = false;
+    calibration_passes = wait_frame(CLOCK_get_us(), CALIBRATION_US);
+
+    for (uint32_t b = 0; b < ACQ_BACKENDS; b++) {
+        acq_result_t *r = &acq_results[b];
+        snprintf(r->name, sizeof(r->name), "acq_%s", ACQ_get_name(b));
+        r->busy.name = r->name;
+        r->busy.min = UINT32_MAX;
+        r->busy.max = 0;
+        r->load = 0;
+        r->max_fs = 0;
+        ACQ_select(b);
+        r->fs = ACQ_get_rate();
+
+        uint64_t busy_sum = 0, cycles_sum = 0;
+        uint32_t frames = 0, ratio = 1;
+        for (uint32_t f = 0; f < BENCH_ACQ_FRAMES; f++) {
+            uint32_t cycles, busy;
+            if (!sample_frame(&cycles, &busy)) {
+                continue;
+            }
+            ACQ_frame_t frame = ACQ_get_frame();
+            if (frame.halls.samples != NULL && frame.fs > 0) {
+                ratio = frame.halls.fs / frame.fs;
+            }
+            busy_sum += busy;
+            cycles_sum += cycles;
+            frames++;
+            if (busy < r->busy.min) { r->busy.min = busy; }
+            if (busy > r->busy.max) { r->busy.max = busy; }
+        }
+        if (frames == 0) {
+            r->busy.min = 0;
+            r->busy.mean = 0;
+            continue;                   // Does not work at all
+        }
+        r->busy.mean = busy_sum / frames;
+        r->load = (uint32_t)(busy_sum * 1000 / cycles_sum);
+        if (r->fs > 0) {
+            r->max_fs = search_rate(r->fs, ratio);
+        } else {
+            r->max_fs = (uint32_t)((uint64_t)frames * SystemCoreClock / cycles_sum);
+        }
+    }
+    ACQ_select(ACQ_GROUPS);
+}
+
+
+/** ***************************************************************************
+ * @brief Show the results on the LCD and send them on USART1
+ *****************************************************************************/
+static void report(void)
+{
+    char line[LINE_LENGTH];
+
+    BSP_LCD_Clear(LCD_COLOR_WHITE);
+    BSP_LCD_SetTextColor(LCD_COLOR_BLACK);
+    BSP_LCD_SetFont(&Font16);
+    BSP_LCD_DisplayStringAt(0, 10, (uint8_t *)"BENCHMARK [cycles]", CENTER_MODE);
+    BSP_LCD_SetFont(&Font12);
+    BSP_LCD_DisplayStringAt(5, TABLE_Y, (uint8_t *)"kernel      min    mean     max", LEFT_MODE);
+
+    snprintf(line, LINE_LENGTH, "BENCH,begin,%s %s,%d,%d\r\n", __DATE__, __TIME__,
+            (int)(SystemCoreClock / 1000000), (int)BENCH_RUNS);
+    send_line(line);
+    for (uint32_t k = 0; k < KERNELS; k++) {
+        snprintf(line, LINE_LENGTH, "%-7s %7d %7d %7d", results[k].name,
+                (int)results[k].min, (int)results[k].mean, (int)results[k].max);
+        BSP_LCD_DisplayStringAt(5, TABLE_Y + 15*(k+1), (uint8_t *)line, LEFT_MODE);
+        snprintf(line, LINE_LENGTH, "BENCH,%s,%d,%d,%d\r\n", results[k].name,
+                (int)results[k].min, (int)results[k].mean, (int)results[k].max);
+        send_line(line);
+    }
+    uint16_t y = TABLE_Y + 15*(KERNELS+1);
+    BSP_LCD_DisplayStringAt(5, y, (uint8_t *)"backend   load      fs  max fs", LEFT_MODE);
+    for (uint32_t b = 0; b < ACQ_BACKENDS; b++) {
+        const acq_result_t *r = &acq_results[b];
+        snprintf(line, LINE_LENGTH, "%-7s %3d.%d%% %7d %7d", ACQ_get_name(b),
+                (int)(r->load/10), (int)(r->load%10), (int)r->fs, (int)r->max_fs);
+        BSP_LCD_DisplayStringAt(5, y + 15*(b+1), (uint8_t *)line, LEFT_MODE);
+        snprintf(line, LINE_LENGTH, "BENCH,%s,%d,%d,%d\r\n", r->busy.name,
+                (int)r->busy.min, (int)r->busy.mean, (int)r->busy.max);
+        send_line(line);
+        snprintf(line, LINE_LENGTH, "BENCH,rate,%s,%d,%d,%d\r\n", ACQ_get_name(b),
+                (int)r->load, (int)r->fs, (int)r->max_fs);
+        send_line(line);
+    }
+    send_line("BENCH,end\r\n");
+    BSP_LCD_DisplayStringAt(0, y + 15*(ACQ_BACKENDS+1), (uint8_t *)"Blue button: run again", CENTER_MODE);
+}
+
+
+/** ***************************************************************************
+ * @brief Main function of the benchmark firmware
+ *
+ * @note Call after IRQ_init(), does not return.
+ *****************************************************************************/
+void BENCH_main(void)
+{
+#ifdef FLIPPED_LCD
+    BSP_LCD_Init_Flipped();             // Initialize the LCD for flipped orientation
+#else
+    BSP_LCD_Init();                     // Initialize the LCD display
+#endif
+    BSP_LCD_LayerDefaultInit(LCD_FOREGROUND_LAYER, LCD_FRAME_BUFFER);
+    BSP_LCD_SelectLayer(LCD_FOREGROUND_LAYER);
+    BSP_LCD_DisplayOn();
+
+    PB_init();
+    PB_enableIRQ();
+    SER_init();
+    FFT_Init();
+    arm_rfft_fast_init_f32(&rfft, ADC_NUMS);
+    load_frame();
+    MEAS_GPIO_analog_init();
+    MEAS_timer_init();
+
+    while (1) {
+        run_suite();
+        run_acquisition();
+        report();
+        while (!PB_pressed()) {
+            HAL_Delay(10);
+        }
+    }
+}
+
+#endif
@@ -12,6 +12,8 @@
  *****************************************************************************/
 
 #include "buzzer.h"
+#include "power.h"
+#include "interrupts.h"
 
 /******************************************************************************
  * Variables
@@ -33,6 +35,30 @@ static const int16_t note[]={           ///< notes from C5 to B6
     1047,1109,1175,1245,1319,1397,1480,1568,1661,1760,1866,1976
 };
 
+/** One note of a melody */
+typedef struct {
+    uint8_t  note;                      ///< index into note[]
+    uint16_t length;                    ///< duration [ms]
+} BUZZER_step_t;
+
+static const BUZZER_step_t melody[] = { ///< Nokia ringtone
+    {16,150}, {14,150}, {18,300}, {20,300},     // E6  D6  F#6 G#6
+    {13,150}, {11,150}, {14,300}, {16,300},     // C#6 B5  D6  E6
+    {11,150}, { 9,150}, {13,300}, {16,300},     // B5  A5  C#6 E6
+    {21,450}                                    // A6
+};
+
+static const BUZZER_step_t alert_on[] = {  ///< Load switched on
+    {12,100}, {19,200}                          // C6  G6
+};
+static const BUZZER_step_t alert_off[] = { ///< Load switched off
+    {19,100}, {12,200}                          // G6  C6
+};
+static const BUZZER_step_t *tune = melody;  ///< melody or alert being played
+static int16_t  tune_length = sizeof(melody)/sizeof(melody[0]);   ///< steps of tune
+static int16_t  melody_step = -1;       ///< current step of the melody, -1 = not playing
+static uint32_t melody_step_end = 0;    ///< HAL tick when the current step ends
+
 /******************************************************************************
  * Functions
  *****************************************************************************/
@@ -55,6 +81,7 @@ void BUZZER_init(void)
     TIM5->DIER |= TIM_DIER_UIE;         // Enable Interrupt
     TIM5->EGR  |= TIM_EGR_UG;           // Update settings
 
+    NVIC_SetPriority(TIM5_IRQn, IRQ_PRIO_BUZZER);
     NVIC_ClearPendingIRQ(TIM5_IRQn);    // Clear pending interrupt on line 0
     NVIC_EnableIRQ(TIM5_IRQn);          // Enable Interrupt
 }
@@ -90,6 +117,7 @@ void BUZZER_turn_on(void)
 {
     TIM5->CR1  |= TIM_CR1_CEN;    // Turn TIM5 on
     flag_buzzer = true;
+    PWR_busy_start(PWR_BUZZER);
 }
 
 /** ***************************************************************************
@@ -100,6 +128,7 @@ void BUZZER_turn_off(void)
     TIM5->CR1  &= ~TIM_CR1_CEN;     // Turn TIM5 off
     GPIOA->BSRR = GPIO_BSRR_BR5;    // Set PA5 to low
     flag_buzzer = false;
+    PWR_busy_stop(PWR_BUZZER);
 }
 
 /** ***************************************************************************
@@ -128,26 +157,87 @@ void BUZZER_play_note(uint16_t note,uint16_t length)
 }
 
 /** ***************************************************************************
- * @brief Play Nokia ringtone
+ * @brief Start a tune in the background
+ * @param [in] steps notes of the tune
+ * @param [in] length number of steps
+ *****************************************************************************/
+static void play(const BUZZER_step_t *steps, int16_t length)
+{
+    tune = steps;
+    tune_length = length;
+    melody_step = 0;
+    BUZZER_set_note(tune[0].note);
+    BUZZER_turn_on();
+    melody_step_end = HAL_GetTick() + tune[0].length;
+}
+
+
+/** ***************************************************************************
+ * @brief Start the Nokia ringtone
+ *
+ * The melody is played in the background.
+ * @note BUZZER_update() must be called periodically from the main loop.
  *****************************************************************************/
 void BUZZER_play_melody(void)
 {
-    BUZZER_play_note(note[16],150); // E6
-    BUZZER_play_note(note[14],150); // D6
-    BUZZER_play_note(note[18],300); // F#6
-    BUZZER_play_note(note[20],300); // G#6
-
-    BUZZER_play_note(note[13],150); // C#6
-    BUZZER_play_note(note[11],150); // B5
-    BUZZER_play_note(note[14],300); // D6
-    BUZZER_play_note(note[16],300); // E6
-
-    BUZZER_play_note(note[11],150); // B5
-    BUZZER_play_note(note[9],150);  // A5
-    BUZZER_play_note(note[13],300); // C#6
-    BUZZER_play_note(note[16],300); // E6
-
-    BUZZER_play_note(note[21],450); // A6
+    play(melody, sizeof(melody)/sizeof(melody[0]));
+}
+
+
+/** ***************************************************************************
+ * @brief Play a short alert for a load change
+ * @param [in] rising true = load on (rising notes), false = load off
+ *
+ * The alert is played in the background like the melody.
+ * @note BUZZER_update() must be called periodically from the main loop.
+ *****************************************************************************/
+void BUZZER_play_alert(bool rising)
+{
+    if (rising) {
+        play(alert_on, sizeof(alert_on)/sizeof(alert_on[0]));
+    } else {
+        play(alert_off, sizeof(alert_off)/sizeof(alert_off[0]));
+    }
+}
+
+/** ***************************************************************************
+ * @brief Stop the melody or the alert
+ *****************************************************************************/
+void BUZZER_stop_melody(void)
+{
+    if(melody_step >= 0){
+        melody_step = -1;
+        BUZZER_turn_off();
+    }
+}
+
+/** ***************************************************************************
+ * @brief Check if the melody or an alert is playing
+ * @return true while the melody or an alert is playing
+ *****************************************************************************/
+bool BUZZER_melody_playing(void)
+{
+    return melody_step >= 0;
+}
+
+/** ***************************************************************************
+ * @brief Advance the melody
+ *
+ * Switches to the next note when the current one is over
+ * and turns the buzzer off after the last note.
+ *****************************************************************************/
+void BUZZER_update(void)
+{
+    if(melody_step >= 0 && (int32_t)(HAL_GetTick() - melody_step_end) >= 0){
+        melody_step++;
+        if(melody_step < tune_length){
+            BUZZER_set_note(tune[melody_step].note);
+            melody_step_end += tune[melody_step].length;
+        }
+        else{
+            BUZZER_stop_melody();
+        }
+    }
 }
 
 /** ***************************************************************************
@@ -158,6 +248,8 @@ void BUZZER_play_melody(void)
  *****************************************************************************/
 void TIM5_IRQHandler(void)
 {
+    uint32_t start = IRQ_enter(IRQ_SRC_BUZZER);
+    PWR_begin(PWR_BUZZER);
     TIM5->SR &= ~TIM_SR_UIF;    // Clear pending interrupt flag
     if(flag_piezo){
         GPIOA->BSRR = GPIO_BSRR_BS5; // Set PA5 to high
@@ -167,4 +259,6 @@ void TIM5_IRQHandler(void)
     }
 
     flag_piezo = !flag_piezo;   // Toggle flag
+    PWR_end();
+    IRQ_exit(IRQ_SRC_BUZZER, start);
 }
@@ -21,8 +21,54 @@
  * which should be averaged before the the distance value get loaded in to the "LPAD_distance" and "RPAD_distance" variables.
  * With the parameter of this function it is possible to change this number of samples which should be averaged.
  *
- * @note The parameter of the calculate_pos function should not be less than 1 and greater than 3,
- * otherwise the macros FFT_AVG_NUMS must be changed to a higher number.
+ * @note The parameter of the calculate_pos function should not be less than 1.
+ * The amplitudes are summed up, so there is no upper limit by an array size.
+ *
+ * 50 Hz phasors
+ * =============
+ * Only the bin of the mains frequency (config.bin, CALC_MAINS_BIN at 50 Hz) of the spectrum is used.
+ * Instead of four full FFTs, split_Array() accumulates this bin with a single bin DFT
+ * while it reads the ADC buffer. No sample or spectrum arrays are needed,
+ * the ADC buffer in measuring.c is the only working set of a frame.
+ * Between frames only the phasors (get_channel_phasor()) and the amplitude sums of the context survive.
+ * @n The Hall sensors may come at a higher rate (see MEAS_get_group()), calculate_frame_groups()
+ * takes them from their own buffer. The frame has the same duration, so 50 Hz is the same bin
+ * for every frame length. The twiddle table is read with a step of DFT_SIZE / length
+ * and the phasors are scaled to ADC_NUMS samples, they do not depend on the rate.
+ * @n At 60 Hz and 16.7 Hz mains.c changes the rate and the bin (config.fs and config.bin)
+ * with set_calibration(), the pad amplitudes are scaled to the 50 Hz LUTs with config.pad_gain.
+ * @n get_dsp_state_bytes() reports the static state compared to the former FFT stage,
+ * it is shown on the memory page.
+ *
+ * Background null
+ * ===============
+ * Near distribution boards the 50 Hz field of other conductors adds to all four channels.
+ * null_background_start() averages the phasors of CALC_NULL_FRAMES frames
+ * with the probe away from the target cable. The acquisition restarts at any phase of the mains,
+ * so each frame is rotated to the phase of the strongest channel before it is added:
+ * the background is a pattern of the four channels with a fixed relative phase.
+ * @n calculate_FFT() subtracts it from each frame before the amplitudes, the LUT and the triangulation:
+ * the pattern is rotated to the phase that fits the frame best, arg(sum conj(B[c]) * X[c]),
+ * and subtracted channel by channel. A few complex multiplications per frame.
+ * @note The phase is fitted on the whole frame. If the target cable is much stronger
+ * and in a different phase than the background, the fit follows the target
+ * and the correction is not exact, but never larger than the background itself.
+ * @n The background is kept in the flash with the settings (see storage.c),
+ * the phasors of get_channel_phasor() are not corrected.
+ *
+ * Crosstalk
+ * =========
+ * The pads and the Hall sensors share ADC3, the traces and the analog ground,
+ * each channel picks up a little of the others. The coupling is a complex 4x4 matrix C,
+ * measured phasors = C * true phasors. crosstalk_start() captures one column of C:
+ * a 50 Hz stimulus is applied to one channel only (e.g. a signal generator or a
+ * reference cable on its input, the other inputs quiet) and CALC_XTALK_FRAMES frames
+ * are averaged like the background. The column is normalized to the stimulated channel,
+ * C has a unit diagonal and the LUTs stay valid.
+ * @n crosstalk_apply() inverts C (calculate_decoupling()), calculate_FFT() multiplies
+ * the phasors of each frame with the inverse (arm_mat_cmplx_mult_f32(), 16 complex MACs)
+ * before the background is subtracted. The decoupling is kept in the flash (see storage.c).
+ * Tools/host/crosstalk checks the identity and the recovery of a known coupling.
  *
  * Current
  * =======
@@ -31,6 +77,34 @@
  * For this, the current can only be calculated if the distance (Y_pos) is between 15 mm and 25 mm and the angle is in the range of -+15 degrees.
  * If these requirements are not fulfilled, an error code is stored in the "current" variable.
  *
+ * ADC clipping
+ * ============
+ * While the ADC samples are read, split_Array() also collects
+ * min, max, mean and the number of clipped samples of every channel (see get_channel_stats()).
+ * Two channels are packed into one 32 bit word, so the Cortex-M4 SIMD instructions compare
+ * two channels at once and no additional pass over the ADC buffers is needed.
+ * A channel is flagged as clipped (see get_clip_flags()) if one of its samples is within
+ * ADC_CLIP_MARGIN of 0 or 4095 in any frame of the averaging window.
+ * If one of the Hall sensors clips, the current can not be calculated and CURR_ADC_CLIPPED is stored.
+ *
+ * Pipeline context
+ * ================
+ * The state of the pipeline is kept in a CALC_context_t.
+ * calculate_frame() runs the pipeline of one context over a frame,
+ * so several pipelines can run side by side, e.g. in the host tool Tools/host/reprocess.c.
+ * The firmware uses one context with the ADC buffer: calculate_pos() and the getters.
+ * Only the twiddle table (FFT_Init()) and the LUTs are shared, they are constant after FFT_Init().
+ * calculate_from_phasors() runs the stages after split_Array() on the phasors in the context,
+ * Tools/host/sweep.c uses it to evaluate many parameter sets on the same phasors.
+ *
+ * Parameters
+ * ==========
+ * The LUT limits, the display boundaries and the smoothing are in ctx->config (CALC_config_t).
+ * The firmware uses CALC_config_default, the values are those of the former constants,
+ * at 60 Hz and 16.7 Hz the one of MAINS_get_config().
+ * With config.smoothing < 1 the averaged amplitudes of each window are smoothed exponentially
+ * before the LUT: a = a + smoothing * (window - a). The firmware does not smooth.
+ *
  * Error codes
  * ===========
  * The whole calculations.c file is using error codes from the header file error_code.h.
@@ -55,8 +129,10 @@
 #include "stm32f429i_discovery_lcd.h"
 #include "stm32f429i_discovery_ts.h"
 #include <math.h>
+#include <string.h>
 
 #include "measuring.h"
+#include "acquisition.h"
 #include "calculations.h"
 #include "error_code.h"
 
@@ -64,55 +140,46 @@
  * Defines
  *****************************************************************************/
 
-#define FFT_AVG_NUMS    3               ///< Max size of average array (LPAD_FFT_avg_array[]).
+#define FFT_AVG_NUMS    3               ///< Max number of averaged frames of the former FFT stage.
+/** Static state of the former FFT stage: 4 sample arrays, 4 FFT outputs, 4 average arrays and the FFT instance */
+#define FFT_STATE_BYTES (2*CALC_CHANNELS*ADC_NUMS*sizeof(float32_t) + CALC_CHANNELS*FFT_AVG_NUMS*sizeof(uint32_t) \
+                         + sizeof(arm_rfft_fast_instance_f32))
 #define PAD_SPACING     50              ///< Space between pads in mm.
 #define RAD_TO_DEGREE   57.295779513;   ///< Factor to calculate from rad to degree.
-#define MAX_Y_DISTANCE  200             ///< Max distance to cable.
-#define MAX_X_DISTANCE  100             ///< Max offset to cable.
 #define CURRENT_FACTOR  0.357              ///< Is used to transform the voltage from The Hall sensor to a current.
+#define ADC_MAX_VALUE   4095            ///< Highest value of the 12 bit ADC.
+#define ADC_CLIP_MARGIN 8               ///< Samples closer than this to 0 or ADC_MAX_VALUE count as clipped.
+#define DFT_SIZE        MEAS_HALL_NUMS  ///< Entries of the twiddle table, a multiple of 4 and of every frame length.
 
 /******************************************************************************
  * Variables
  *****************************************************************************/
 
 
-static float32_t LPAD_samples [ADC_NUMS];          ///< Copy of ADC values for the left pad.
-static float32_t RPAD_samples [ADC_NUMS];       ///< Copy of ADC values for the right pad.
-static float32_t LHALL_samples [ADC_NUMS];      ///< Copy of ADC values for the left Hall.
-static float32_t RHALL_samples [ADC_NUMS];      ///< Copy of ADC values for the right Hall.
+static float32_t twiddle[DFT_SIZE];     ///< cos(2*pi*m/DFT_SIZE), sin is read with an offset of 3/4 DFT_SIZE.
+static CALC_context_t calc;             ///< Context of the firmware pipeline, used by calculate_pos() and the getters.
 
-static float32_t LPAD_FFT [ADC_NUMS];           ///< Output Array of the FFT for the left pad.
-static float32_t RPAD_FFT [ADC_NUMS];           ///< Output Array of the FFT for the right pad.
-static float32_t LHALL_FFT [ADC_NUMS];          ///< Output Array of the FFT for the left Hall.
-static float32_t RHALL_FFT [ADC_NUMS];          ///< Output Array of the FFT for the right Hall.
+const CALC_config_t CALC_config_default = {
+     .lpad_min  = 200,
+     .lpad_max  = 1458,
+     .rpad_min  = 200,
+     .rpad_max  = 1466,
+     .max_x     = 100,                  // Max offset to cable.
+     .max_y     = 200,                  // Max distance to cable.
+     .smoothing = 1,
+     .fs        = ADC_FS,
+     .bin       = CALC_MAINS_BIN,       // 50 Hz
+     .pad_gain  = 1,
+};                                      ///< Parameters of the firmware pipeline.
 
-static uint32_t LPAD_FFT_avg_array[FFT_AVG_NUMS];   ///< Array which contains multiple values of the left pad after the FFT in the range of 50 Hz.
-static uint32_t RPAD_FFT_avg_array[FFT_AVG_NUMS];   ///< Array which contains multiple values of the right pad after the FFT in the range of 50 Hz.
-static uint32_t LHALL_FFT_avg_array[FFT_AVG_NUMS];  ///< Array which contains multiple values of the left Hall after the FFT in the range of 50 Hz.
-static uint32_t RHALL_FFT_avg_array[FFT_AVG_NUMS];  ///< Array which contains multiple values of the right Hall after the FFT in the range of 50 Hz.
-
-static int32_t LPAD_FFT_distance=0;     ///< Variable which contains the distance of the cable to the left pad.
-static int32_t RPAD_FFT_distance=0;     ///< Variable which contains the distance of the cable to the right pad.
-static int32_t LHALL_FFT_voltage=0;     ///< Variable which contains the voltage on the left Hall.
-static int32_t RHALL_FFT_voltage=0;     ///< Variable which contains the voltage on the right Hall.
-
-static int    X_Pos;                   ///< Contains the X position to the cable (the offset to the right and left to the cable).
-static int    Y_Pos;                   ///< Contains the Y position to the cable (the distance).
-static double Gamma;                   ///< Contains the angle of the device to the cable.
-static float  current;                 ///< Contains the current of the cable.
-
-static int avg_counter=0;              ///< Counts the amount of average values in the in the " "_FFT_avg_array.
-int        num_of_samples;             ///< Contains the number of ADC values should be averaged.
-
-const int32_t LPAD_LUT[] = {
+const int32_t LPAD_LUT[CALC_LUT_ENTRIES] = {
      #include "LPAD_lut.csv"
  };                                   ///< The array is initialised with the values stored in the LPAD_lut.csv file and is used as a luck up table.
 
-const int32_t RPAD_LUT[] = {
+const int32_t RPAD_LUT[CALC_LUT_ENTRIES] = {
      #include "RPAD_lut.csv"
  };                                  ///< The array is initialised with the values stored in the RPAD_lut.csv file and is used as a luck up table.
 
-arm_rfft_fast_instance_f32 fft_handler; ///< This struct is needed to initialise the arm_rfft_fast_f32() function.
 /******************************************************************************
  * Functions
  *****************************************************************************/
@@ -125,7 +192,7 @@ arm_rfft_fast_instance_f32 fft_handler; ///< This struct is needed to initialise
  *****************************************************************************/
 int get_X_Pos(void)
 {
-     return X_Pos;
+     return calc.X_Pos;
 }
 /** ***************************************************************************
  * @brief Returns the Y position.
@@ -135,7 +202,7 @@ int get_X_Pos(void)
  *****************************************************************************/
 int get_Y_Pos(void)
 {
-     return Y_Pos;
+     return calc.Y_Pos;
 }
 /** ***************************************************************************
  * @brief Returns the angle.
@@ -145,7 +212,7 @@ int get_Y_Pos(void)
  *****************************************************************************/
 int get_angle(void)
 {
-     return (int)Gamma;
+     return (int)calc.Gamma;
 }
 /** ***************************************************************************
  * @brief Returns the current.
@@ -155,87 +222,254 @@ int get_angle(void)
  *****************************************************************************/
 float get_current(void)
 {
-    return current;
+    return calc.current;
+}
+
+/** ***************************************************************************
+ * @brief Returns the clipped channels.
+ *
+ * Bit n is set if channel n (CALC_LPAD ... CALC_RHALL) clipped
+ * in one of the frames of the last averaging window.
+ * @return clip_flags
+ *****************************************************************************/
+uint8_t get_clip_flags(void)
+{
+    return calc.clip_flags;
+}
+/** ***************************************************************************
+ * @brief Returns the statistics of the raw samples of the last frame.
+ *
+ * @param channel CALC_LPAD, CALC_RPAD, CALC_LHALL or CALC_RHALL
+ * @return channel_stats[channel]
+ *****************************************************************************/
+CALC_stats_t get_channel_stats(int channel)
+{
+    CALC_stats_t stats = {0};
+    if(channel >= 0 && channel < CALC_CHANNELS){
+        stats = calc.channel_stats[channel];
+    }
+    return stats;
 }
 
 /** ***************************************************************************
  * @brief Calculate angle, X and Y Position of the cable, from the FFT value.
  *
  * @param Number of FFT output values to be averaged before calculating with it.
+ * @return true if a frame was processed, false if none was ready
+ *         or ACQ_is_complete() rejected it (overrun, other rate).
  *
+ * Processes the ADC buffer with the firmware context, see the getters.
+ * The getters keep the values of the last processed frame.
  * @note The zero point is at the leading edge of the device between the two pads.
  *****************************************************************************/
-void calculate_pos(int fft_avg_num)
+bool calculate_pos(int fft_avg_num)
+{
+     /* Restarts only after reset_sample_counter(), otherwise the
+      * DMA would overwrite the frame which is processed */
+     ACQ_start();
+
+     if (MEAS_data_ready){
+          ACQ_frame_t frame = ACQ_get_frame();
+          if (ACQ_is_complete(&frame, calc.config.fs)){
+               calculate_frame_groups(&calc, frame.samples, frame.halls.samples,
+                                      frame.halls.length, fft_avg_num);
+               return true;
+          }
+     }
+     return false;
+}
+/** ***************************************************************************
+ * @brief Resets a pipeline context.
+ *
+ * @param ctx Context, the time source ctx->clock is kept.
+ *
+ * The parameters are set to CALC_config_default.
+ *****************************************************************************/
+void calculate_init(CALC_context_t *ctx)
+{
+     uint32_t (*clock)(void) = ctx->clock;
+     memset(ctx, 0, sizeof(*ctx));
+     ctx->clock = clock;
+     ctx->config = CALC_config_default;
+     for(int i = 0; i < CALC_CHANNELS; i++){
+          ctx->coupling[i*CALC_CHANNELS + i].re = 1;     // No crosstalk
+     }
+}
+/** ***************************************************************************
+ * @brief Inverts the coupling matrix into the decoupling matrix.
+ *
+ * @param ctx Context with ctx->coupling[], e.g. captured with crosstalk_start().
+ * @return false if the matrix is singular, the decoupling is not changed.
+ *
+ * CMSIS-DSP has no complex inverse. C = A + jB is inverted as the real matrix
+ * [A -B; B A], its inverse is [P -Q; Q P] with inv(C) = P + jQ.
+ *****************************************************************************/
+bool calculate_decoupling(CALC_context_t *ctx)
+{
+     enum { N = CALC_CHANNELS, N2 = 2*CALC_CHANNELS };
+     float32_t real[N2*N2];
+     float32_t inverse[N2*N2];
+
+     for(int r = 0; r < N; r++){
+          for(int c = 0; c < N; c++){
+               CALC_phasor_t v = ctx->coupling[r*N + c];
+               real[r*N2 + c] = v.re;
+               real[r*N2 + c + N] = -v.im;
+               real[(r + N)*N2 + c] = v.im;
+               real[(r + N)*N2 + c + N] = v.re;
+          }
+     }
+     arm_matrix_instance_f32 src;
+     arm_matrix_instance_f32 dst;
+     arm_mat_init_f32(&src, N2, N2, real);
+     arm_mat_init_f32(&dst, N2, N2, inverse);
+     if(arm_mat_inverse_f32(&src, &dst) != ARM_MATH_SUCCESS){
+          return false;
+     }
+     for(int r = 0; r < N; r++){
+          for(int c = 0; c < N; c++){
+               ctx->decoupling[r*N + c].re = inverse[r*N2 + c];
+               ctx->decoupling[r*N + c].im = inverse[(r + N)*N2 + c];
+          }
+     }
+     ctx->decoupling_set = true;
+     return true;
+}
+/** ***************************************************************************
+ * @brief Adds the time since *mark to a stage and restarts *mark.
+ *****************************************************************************/
+static void stage_time(CALC_context_t *ctx, CALC_stage_t stage, uint32_t *mark)
+{
+     if(ctx->clock != NULL){
+          uint32_t now = ctx->clock();
+          ctx->stage_time[stage] += now - *mark;
+          *mark = now;
+     }
+}
+/** ***************************************************************************
+ * @brief Runs the whole pipeline over one frame.
+ *
+ * @param ctx Context of the pipeline.
+ * @param samples Interleaved frame, CALC_CHANNELS*ADC_NUMS samples.
+ * @param fft_avg_num Number of frames to be averaged.
+ *
+ * The results are in ctx->X_Pos, ctx->Y_Pos, ctx->Gamma and ctx->current.
+ * If ctx->clock is set, the time of each stage is added to ctx->stage_time[].
+ *****************************************************************************/
+void calculate_frame(CALC_context_t *ctx, const uint32_t *samples, int fft_avg_num)
+{
+     calculate_frame_groups(ctx, samples, NULL, 0, fft_avg_num);
+}
+/** ***************************************************************************
+ * @brief Runs the whole pipeline over one frame with the Hall sensors at their own rate.
+ *
+ * @param ctx Context of the pipeline.
+ * @param samples Interleaved frame, CALC_CHANNELS*ADC_NUMS samples, the pads are used.
+ * @param hall_samples Interleaved LHALL and RHALL, NULL = the Hall sensors of samples.
+ * @param hall_length Samples per Hall sensor, a divisor of DFT_SIZE.
+ * @param fft_avg_num Number of frames to be averaged.
+ *****************************************************************************/
+void calculate_frame_groups(CALC_context_t *ctx, const uint32_t *samples,
+                            const uint32_t *hall_samples, uint16_t hall_length, int fft_avg_num)
+{
+     uint32_t mark = (ctx->clock != NULL) ? ctx->clock() : 0;
+
+     ctx->samples = samples;
+     ctx->hall_samples = hall_samples;
+     ctx->hall_length = hall_length;
+     split_Array(ctx);
+     stage_time(ctx, CALC_STAGE_DFT, &mark);
+     calculate_from_phasors(ctx, fft_avg_num);
+}
+/** ***************************************************************************
+ * @brief Runs the stages after split_Array() over one frame.
+ *
+ * @param ctx Context of the pipeline, ctx->phasor[] and ctx->clip_flags_window
+ *            are set by split_Array() or by the caller.
+ * @param fft_avg_num Number of frames to be averaged.
+ *****************************************************************************/
+void calculate_from_phasors(CALC_context_t *ctx, int fft_avg_num)
+{
+     uint32_t mark = (ctx->clock != NULL) ? ctx->clock() : 0;
+
+     ctx->num_of_samples = fft_avg_num;
+
+     /* Sets the error code as a default value*/
+     ctx->X_Pos = CALC_OUTOF_X_RANGE; // ERROR code
+     ctx->Y_Pos = CALC_OUTOF_Y_RANGE; // ERROR code
+     ctx->Gamma = CALC_OUTOF_ANGLE_RANGE; // ERROR code
+
+     calculate_FFT(ctx);
+     stage_time(ctx, CALC_STAGE_LUT, &mark);
+     /*Checks if there is no error code from the FFT function*/
+     if(ctx->LPAD_FFT_distance != FFT_NO_SIGNAL || ctx->RPAD_FFT_distance != FFT_NO_SIGNAL){
+          calculate_triangulation(ctx, ctx->LPAD_FFT_distance, ctx->RPAD_FFT_distance);
+     }
+     stage_time(ctx, CALC_STAGE_TRIANG, &mark);
+}
+/** ***************************************************************************
+ * @brief Calculate angle, X and Y Position from the distances to the pads.
+ *
+ * @param ctx Context of the pipeline.
+ * @param lpad_distance Distance of the cable to the left pad in mm.
+ * @param rpad_distance Distance of the cable to the right pad in mm.
+ *
+ * The current is calculated as well. If the distances do not form a triangle,
+ * the error codes set by calculate_frame() are kept.
+ *****************************************************************************/
+void calculate_triangulation(CALC_context_t *ctx, int32_t lpad_distance, int32_t rpad_distance)
 {
-     num_of_samples = fft_avg_num;
      double cos_alpha;
      double alpha;
      double cos_beta;
      double beta;
 
-     ADC3_IN4_timer_init();
-     ADC3_IN4_timer_start();
+     cos_beta   = (double)( lpad_distance*lpad_distance
+                           + PAD_SPACING*PAD_SPACING
+                           - rpad_distance*rpad_distance)
+                           / (2*lpad_distance*PAD_SPACING);  // Law of cosines
 
-     if (MEAS_data_ready){
-          /* Sets the error code as a default value*/
-          X_Pos = CALC_OUTOF_X_RANGE; // ERROR code
-          Y_Pos = CALC_OUTOF_Y_RANGE; // ERROR code
-          Gamma = CALC_OUTOF_ANGLE_RANGE; // ERROR code
-
-          split_Array();
-          calculate_FFT();
-          clear_Buffer();
-          /*Checks if there is no error code from the FFT function*/
-          if(LPAD_FFT_distance != FFT_NO_SIGNAL || RPAD_FFT_distance != FFT_NO_SIGNAL){
-
-            cos_beta   = (double)( LPAD_FFT_distance*LPAD_FFT_distance
-                                  + PAD_SPACING*PAD_SPACING
-                                  - RPAD_FFT_distance*RPAD_FFT_distance)
-                                  / (2*LPAD_FFT_distance*PAD_SPACING);  // Law of cosines
-
-            cos_alpha = (double)( RPAD_FFT_distance*RPAD_FFT_distance
-                                  - LPAD_FFT_distance*LPAD_FFT_distance
-                                  + PAD_SPACING*PAD_SPACING)
-                                  / (2*RPAD_FFT_distance*PAD_SPACING); // Law of cosines
-            /* Checks if cos_alpha and cos_beta are in range of arccosine*/
-            if(cos_alpha <= 1 && cos_beta <= 1 && cos_alpha > -1 && cos_beta >-1){
-
-                alpha = acos(cos_alpha);   //Left angle
-                beta  = acos(cos_beta);    //Right angle
-
-                if (alpha < M_PI/2 && beta < M_PI/2){// First case : cable in between pads
-                    X_Pos = fabs((cos(alpha)*RPAD_FFT_distance - PAD_SPACING/2));
-                    Y_Pos = sin(alpha)*RPAD_FFT_distance;
-                }
-                else if (alpha >= M_PI/2 && beta < M_PI/2){ //Second case: cable on the left side of the device
-                    X_Pos = cos(M_PI-alpha)*RPAD_FFT_distance + PAD_SPACING/2;
-                    Y_Pos = sin(M_PI-alpha)*RPAD_FFT_distance;
-                }
-                else if (alpha < M_PI/2 && beta >= M_PI/2){ //Third case: cable on the right side of the device
-                    X_Pos = (cos(M_PI-beta)*LPAD_FFT_distance + PAD_SPACING/2);
-                    Y_Pos =  sin(M_PI-beta)*LPAD_FFT_distance;
-                }
-
-                Gamma= atan2(Y_Pos,X_Pos );
-                /*sets the correct signs for X_Pos and gamma*/
-                if(alpha < beta){//Check if cable is on the right side of the zero point.
-
-                    Gamma = M_PI/2-Gamma;/* Angle minus 90 degree, so that angel is zero degree
-                                                 if cable is in front of the device and a negative angle
-                                                 when we move the cable to the right.*/
-                    X_Pos = -X_Pos;
-                }
-                else {                     // If cable is on the left side of the zero point.
-                     Gamma -= M_PI/2;       /* 90 degree minus angle, so that angel is zero degree
-                                               if cable is in front of the device and a positive
-                                               angle when we move the cable to the left.*/
-                }
-                Gamma=Gamma*RAD_TO_DEGREE;
-
-                calculate_current();
-                check_display_bounderies();
-            }
-          }
+     cos_alpha = (double)( rpad_distance*rpad_distance
+                           - lpad_distance*lpad_distance
+                           + PAD_SPACING*PAD_SPACING)
+                           / (2*rpad_distance*PAD_SPACING); // Law of cosines
+     /* Checks if cos_alpha and cos_beta are in range of arccosine*/
+     if(cos_alpha <= 1 && cos_beta <= 1 && cos_alpha > -1 && cos_beta >-1){
+
+         alpha = acos(cos_alpha);   //Left angle
+         beta  = acos(cos_beta);    //Right angle
+
+         if (alpha < M_PI/2 && beta < M_PI/2){// First case : cable in between pads
+             ctx->X_Pos = fabs((cos(alpha)*rpad_distance - PAD_SPACING/2));
+             ctx->Y_Pos = sin(alpha)*rpad_distance;
+         }
+         else if (alpha >= M_PI/2 && beta < M_PI/2){ //Second case: cable on the left side of the device
+             ctx->X_Pos = cos(M_PI-alpha)*rpad_distance + PAD_SPACING/2;
+             ctx->Y_Pos = sin(M_PI-alpha)*rpad_distance;
+         }
+         else if (alpha < M_PI/2 && beta >= M_PI/2){ //Third case: cable on the right side of the device
+             ctx->X_Pos = (cos(M_PI-beta)*lpad_distance + PAD_SPACING/2);
+             ctx->Y_Pos =  sin(M_PI-beta)*lpad_distance;
+         }
+
+         ctx->Gamma= atan2(ctx->Y_Pos,ctx->X_Pos );
+         /*sets the correct signs for X_Pos and gamma*/
+         if(alpha < beta){//Check if cable is on the right side of the zero point.
+
+             ctx->Gamma = M_PI/2-ctx->Gamma;/* Angle minus 90 degree, so that angel is zero degree
+                                          if cable is in front of the device and a negative angle
+                                          when we move the cable to the right.*/
+             ctx->X_Pos = -ctx->X_Pos;
+         }
+         else {                     // If cable is on the left side of the zero point.
+              ctx->Gamma -= M_PI/2;       /* 90 degree minus angle, so that angel is zero degree
+                                        if cable is in front of the device and a positive
+                                        angle when we move the cable to the left.*/
+         }
+         ctx->Gamma=ctx->Gamma*RAD_TO_DEGREE;
+
+         calculate_current(ctx);
+         check_display_bounderies(ctx);
      }
 }
 /** ***************************************************************************
@@ -244,26 +478,30 @@ void calculate_pos(int fft_avg_num)
  * with the magnetic field detected by the Hall sensor.
  *
  *****************************************************************************/
-void calculate_current(void)
+void calculate_current(CALC_context_t *ctx)
 {
+     /* A clipped Hall signal is too small after the FFT, the current would be wrong*/
+     if(ctx->clip_flags & CALC_CLIP_HALLS){
+          ctx->current = CURR_ADC_CLIPPED; // ERROR code
+     }
      /* Checks that the distance between the cable and the Hall sensor is not too large*/
-     if(Y_Pos > 15 && Y_Pos < 25  ){
+     else if(ctx->Y_Pos > 15 && ctx->Y_Pos < 25  ){
 
         /*Checks that the angle between the cable and the Hall sensor is not too large.*/
-        if(Gamma < 15 && Gamma > -15){
+        if(ctx->Gamma < 15 && ctx->Gamma > -15){
 
            /* Detection of the higher Hall sensor voltage and storage of the higher voltage in the current variable */
-           if(RHALL_FFT_voltage > LHALL_FFT_voltage){
-               current = (RHALL_FFT_voltage*CURRENT_FACTOR*Y_Pos)/1000;
+           if(ctx->RHALL_FFT_voltage > ctx->LHALL_FFT_voltage){
+               ctx->current = (ctx->RHALL_FFT_voltage*CURRENT_FACTOR*ctx->Y_Pos)/1000;
             }else{
-               current = (LHALL_FFT_voltage*CURRENT_FACTOR*Y_Pos)/1000;
+               ctx->current = (ctx->LHALL_FFT_voltage*CURRENT_FACTOR*ctx->Y_Pos)/1000;
             }
 
         }else{
-             current = CURR_OUTOF_Angle_RANGE; // ERROR code
+             ctx->current = CURR_OUTOF_Angle_RANGE; // ERROR code
         }
      }else{
-          current = CURR_OUTOF_Y_RANGE;// ERROR code
+          ctx->current = CURR_OUTOF_Y_RANGE;// ERROR code
      }
 }
 /** ***************************************************************************
@@ -272,77 +510,216 @@ void calculate_current(void)
  * If they are too large an error code will be saved in the X_Pos or the Y_Pos.
  *
  *****************************************************************************/
-void check_display_bounderies(void)
+void check_display_bounderies(CALC_context_t *ctx)
+{
+      if(fabs(ctx->X_Pos) > ctx->config.max_x){
+         ctx->X_Pos = CALC_OUTOF_X_RANGE;// ERROR code
+     }
+
+     if(ctx->Y_Pos > ctx->config.max_y){
+          ctx->Y_Pos = CALC_OUTOF_Y_RANGE;// ERROR code
+     }
+}
+/** ***************************************************************************
+ * @brief Adds the phasors of a frame rotated to the phase of a reference channel.
+ *
+ * @param sum Sums of the capture, sum[c] += X[c] * conj(X[ref] / |X[ref]|).
+ * @param x Phasors of the frame.
+ * @param ref Reference channel, its sum is real.
+ *****************************************************************************/
+static void add_rotated(CALC_phasor_t sum[CALC_CHANNELS], const CALC_phasor_t x[CALC_CHANNELS], int ref)
 {
-      if(fabs(X_Pos) > MAX_X_DISTANCE){
-         X_Pos = CALC_OUTOF_X_RANGE;// ERROR code
+     float32_t norm = hypotf(x[ref].re, x[ref].im);
+     if(norm > 0){
+          float32_t cr = x[ref].re/norm;
+          float32_t ci = x[ref].im/norm;
+          for(int i = 0; i < CALC_CHANNELS; i++){
+               sum[i].re += x[i].re*cr + x[i].im*ci;
+               sum[i].im += x[i].im*cr - x[i].re*ci;
+          }
      }
+}
+/** ***************************************************************************
+ * @brief Adds the phasors of the frame to the capture of a column of the coupling matrix.
+ *
+ * The stimulus is on channel ctx->xtalk_channel, the column is normalized
+ * to this channel: coupling[r][c] = response of r / response of c.
+ *****************************************************************************/
+static void add_crosstalk(CALC_context_t *ctx)
+{
+     int c = ctx->xtalk_channel;
 
-     if(Y_Pos > MAX_Y_DISTANCE){
-          Y_Pos = CALC_OUTOF_Y_RANGE;// ERROR code
+     if(ctx->xtalk_frames == CALC_XTALK_FRAMES){
+          memset(ctx->xtalk_sum, 0, sizeof(ctx->xtalk_sum));
+     }
+     add_rotated(ctx->xtalk_sum, ctx->phasor, c);
+     if(--ctx->xtalk_frames == 0 && ctx->xtalk_sum[c].re > 0){
+          for(int r = 0; r < CALC_CHANNELS; r++){
+               ctx->coupling[r*CALC_CHANNELS + c].re = ctx->xtalk_sum[r].re / ctx->xtalk_sum[c].re;
+               ctx->coupling[r*CALC_CHANNELS + c].im = ctx->xtalk_sum[r].im / ctx->xtalk_sum[c].re;
+          }
+          ctx->xtalk_columns |= 1 << c;
+     }
+}
+/** ***************************************************************************
+ * @brief Applies the decoupling matrix to the phasors of the frame.
+ *
+ * @param ctx Context of the pipeline with ctx->phasor[] and ctx->decoupling[].
+ * @param out Decoupled phasors, a copy of ctx->phasor[] if no matrix is set.
+ *****************************************************************************/
+static void decouple(const CALC_context_t *ctx, CALC_phasor_t out[CALC_CHANNELS])
+{
+     if(!ctx->decoupling_set){
+          memcpy(out, ctx->phasor, CALC_CHANNELS*sizeof(CALC_phasor_t));
+          return;
+     }
+     arm_matrix_instance_f32 m;
+     arm_matrix_instance_f32 x;
+     arm_matrix_instance_f32 y;
+     arm_mat_init_f32(&m, CALC_CHANNELS, CALC_CHANNELS, (float32_t *)ctx->decoupling);
+     arm_mat_init_f32(&x, CALC_CHANNELS, 1, (float32_t *)ctx->phasor);
+     arm_mat_init_f32(&y, CALC_CHANNELS, 1, (float32_t *)out);
+     arm_mat_cmplx_mult_f32(&m, &x, &y);
+}
+/** ***************************************************************************
+ * @brief Adds the phasors of the frame to the background capture.
+ *
+ * @param ctx Context of the pipeline.
+ * @param x Decoupled phasors of the frame.
+ *
+ * The first frame chooses the strongest channel as phase reference,
+ * each frame is rotated so that this channel has phase 0.
+ *****************************************************************************/
+static void add_background(CALC_context_t *ctx, const CALC_phasor_t x[CALC_CHANNELS])
+{
+     if(ctx->null_frames == CALC_NULL_FRAMES){
+          ctx->null_ref = 0;
+          for(int i = 1; i < CALC_CHANNELS; i++){
+               if(hypotf(x[i].re, x[i].im) > hypotf(x[ctx->null_ref].re, x[ctx->null_ref].im)){
+                    ctx->null_ref = i;
+               }
+          }
+          memset(ctx->null_sum, 0, sizeof(ctx->null_sum));
+     }
+     add_rotated(ctx->null_sum, x, ctx->null_ref);
+     if(--ctx->null_frames == 0){
+          for(int i = 0; i < CALC_CHANNELS; i++){
+               ctx->background[i].re = ctx->null_sum[i].re / CALC_NULL_FRAMES;
+               ctx->background[i].im = ctx->null_sum[i].im / CALC_NULL_FRAMES;
+          }
      }
 }
 /** ***************************************************************************
- * @brief Transformers the ADC samples in to the frequency domain with a FFT.
+ * @brief Subtracts the background from the phasors of the frame.
  *
- * The ADC values at50 Hz from both pads and both Hall will be saved in the
- * {LPAD_FFT_avg_array[],RPAD_FFT_avg_array[],LHALL_FFT_avg_array[],RHALL_FFT_avg_array[]}
- * at the position of the avg_counter.
+ * @param ctx Context of the pipeline with ctx->background[].
+ * @param x Phasors of the frame, corrected in place.
  *
+ * The background is rotated by w = sum conj(B[c]) * X[c] / |...|,
+ * the phase which fits the frame best, then X[c] = X[c] - w * B[c].
  *****************************************************************************/
-void calculate_FFT (void)
+static void subtract_background(const CALC_context_t *ctx, CALC_phasor_t x[CALC_CHANNELS])
 {
+     const CALC_phasor_t *b = ctx->background;
+     float32_t wr = 0;
+     float32_t wi = 0;
 
-     uint8_t RFFT =0;  // Flag which declares that an real fast Fourier transformation is required.
-     /* Writes real and imaginary part of different frequencies (from 0 to 320 Hz with delta-frequency) in LPAD_FFT.*/
-     arm_rfft_fast_f32(&fft_handler,LPAD_samples, LPAD_FFT,RFFT);
-     LPAD_FFT_avg_array[avg_counter]=(uint32_t)(hypot(LPAD_FFT[10],LPAD_FFT[11])*sqrt(2)/ADC_NUMS);  /* 50 Hz real part is at position 10 and
-                                                                                                      imaginary part is at position 11 of the LPAD_FFT[] array.*/
-     arm_rfft_fast_f32(&fft_handler,RPAD_samples,RPAD_FFT,RFFT);
-     RPAD_FFT_avg_array[avg_counter]= (uint32_t)(hypot(RPAD_FFT[10],RPAD_FFT[11])*sqrt(2)/ADC_NUMS);
-     arm_rfft_fast_f32(&fft_handler,LHALL_samples, LHALL_FFT,RFFT);
-     LHALL_FFT_avg_array[avg_counter]=(uint32_t)(hypot(LHALL_FFT[10],LHALL_FFT[11])*sqrt(2)/ADC_NUMS);
+     for(int i = 0; i < CALC_CHANNELS; i++){
+          wr += b[i].re*x[i].re + b[i].im*x[i].im;
+          wi += b[i].re*x[i].im - b[i].im*x[i].re;
+     }
+     float32_t norm = hypotf(wr, wi);
+     if(norm == 0){
+          return;                       // No background
+     }
+     wr /= norm;
+     wi /= norm;
+     for(int i = 0; i < CALC_CHANNELS; i++){
+          x[i].re -= wr*b[i].re - wi*b[i].im;
+          x[i].im -= wr*b[i].im + wi*b[i].re;
+     }
+}
+/** ***************************************************************************
+ * @brief Converts the 50 Hz phasors of the frame into RMS amplitudes.
+ *
+ * The phasors have been accumulated by split_Array(). They are decoupled
+ * and the background is subtracted first, ctx->phasor[] keeps the raw phasors.
+ * The pads are multiplied with ctx->config.pad_gain.
+ * The amplitudes of both pads and both Hall sensors are added to ctx->amplitude_sum[].
+ *
+ *****************************************************************************/
+void calculate_FFT (CALC_context_t *ctx)
+{
+     CALC_phasor_t phasor[CALC_CHANNELS];
 
-     arm_rfft_fast_f32(&fft_handler,RHALL_samples, RHALL_FFT,RFFT);
-     RHALL_FFT_avg_array[avg_counter]=(uint32_t)(hypot(RHALL_FFT[10],RHALL_FFT[11])*sqrt(2)/ADC_NUMS);
+     if(ctx->xtalk_frames > 0){
+          add_crosstalk(ctx);           // Raw phasors
+     }
+     decouple(ctx, phasor);
+     if(ctx->null_frames > 0){
+          add_background(ctx, phasor);
+     }
+     subtract_background(ctx, phasor);
+     for(int i = 0; i < CALC_CHANNELS; i++){
+          if(i == CALC_LPAD || i == CALC_RPAD){
+               phasor[i].re *= ctx->config.pad_gain;  // To the frequency of the LUTs
+               phasor[i].im *= ctx->config.pad_gain;
+          }
+          ctx->amplitude_sum[i] += calculate_amplitude(phasor[i]);
+     }
 
-    averaging_FFT_semples();
+    averaging_FFT_semples(ctx);
+}
+/** ***************************************************************************
+ * @brief Converts a 50 Hz phasor into the RMS amplitude.
+ *
+ * @param phasor Phasor of one channel from split_Array().
+ * @return RMS value of the 50 Hz signal in ADC steps.
+ *****************************************************************************/
+uint32_t calculate_amplitude(CALC_phasor_t phasor)
+{
+     /* |X[k]| * sqrt(2) / N = RMS value of the 50 Hz signal in ADC steps */
+     return (uint32_t)(hypot(phasor.re, phasor.im)*sqrt(2)/ADC_NUMS);
 }
 
 /** ***************************************************************************
  * @brief Averaging several FFT output values for each pad and Hall sensor.
  *
- * The number of samples (num_of_samples) which will be averaged, is defined in the function calculate_pos.
+ * The number of samples (ctx->num_of_samples) which will be averaged, is defined in the function calculate_frame.
  *
- * The averages will be saved in the variables {LPAD_FFT_distance, RPAD_FFT_distance, LHALL_FFT_voltage, RHALL_FFT_voltage}.
+ * The averages will be saved in ctx->{LPAD_FFT_distance, RPAD_FFT_distance, LHALL_FFT_voltage, RHALL_FFT_voltage}.
+ * If the number is reduced during a window, the window is closed with the next frame.
  *
  *****************************************************************************/
-void averaging_FFT_semples(void)
+void averaging_FFT_semples(CALC_context_t *ctx)
 {
 
-      if(avg_counter == num_of_samples-1){
-
-          LPAD_FFT_distance=0;
-          RPAD_FFT_distance=0;
-          LHALL_FFT_voltage =0;
-          RHALL_FFT_voltage =0;
-
-          for(int i =0; i < num_of_samples; i++){                 //If the desired number of samples is achieved, they get summed up.
+      if(ctx->avg_counter >= ctx->num_of_samples-1){
 
-               LPAD_FFT_distance += LPAD_FFT_avg_array[i];
-               RPAD_FFT_distance += RPAD_FFT_avg_array[i];
-               LHALL_FFT_voltage += LHALL_FFT_avg_array[i];
-               RHALL_FFT_voltage += RHALL_FFT_avg_array[i];
+          //If the desired number of samples is achieved, the sums get divided by the number of samples to get the average.
+          int32_t average[CALC_CHANNELS];
+          for(int i = 0; i < CALC_CHANNELS; i++){
+               average[i] = ctx->amplitude_sum[i]/(ctx->avg_counter+1);
+               ctx->amplitude_sum[i] = 0;
+               if(ctx->config.smoothing < 1){
+                    //Exponential smoothing over the windows, starts with the first window.
+                    if(ctx->amplitude_smooth[i] == 0){
+                         ctx->amplitude_smooth[i] = average[i];
+                    }
+                    ctx->amplitude_smooth[i] += ctx->config.smoothing*(average[i] - ctx->amplitude_smooth[i]);
+                    average[i] = (int32_t)ctx->amplitude_smooth[i];
+               }
           }
-
-          LPAD_FFT_distance = LPAD_FFT_distance/(num_of_samples); //The summed up samples get divided by the number of samples to get the average.
-          RPAD_FFT_distance = RPAD_FFT_distance/(num_of_samples);
-          LHALL_FFT_voltage = LHALL_FFT_voltage/(num_of_samples);
-          RHALL_FFT_voltage = RHALL_FFT_voltage/(num_of_samples);
-          avg_counter = 0;
-          distance_LUT();
+          ctx->LPAD_FFT_distance = average[CALC_LPAD];
+          ctx->RPAD_FFT_distance = average[CALC_RPAD];
+          ctx->LHALL_FFT_voltage = average[CALC_LHALL];
+          ctx->RHALL_FFT_voltage = average[CALC_RHALL];
+          ctx->avg_counter = 0;
+          ctx->clip_flags = ctx->clip_flags_window;
+          ctx->clip_flags_window = 0;
+          distance_LUT(ctx);
      }else{
-          avg_counter++;
+          ctx->avg_counter++;
      }
 
 }
@@ -351,90 +728,320 @@ void averaging_FFT_semples(void)
  * @brief Determines the distance of the cable to the pads from a look-up table.
  *
  *****************************************************************************/
-void distance_LUT(void)
+void distance_LUT(CALC_context_t *ctx)
 {
-     const int LPAD_Max = 1458;
-     const int LPAD_Min = 200;
-     const int RPAD_Max = 1466;
-     const int RPAD_Min = 200;
+     const CALC_config_t *cfg = &ctx->config;
 
-     if(LPAD_FFT_distance > LPAD_Min && LPAD_FFT_distance < LPAD_Max){
+     if(ctx->LPAD_FFT_distance > cfg->lpad_min && ctx->LPAD_FFT_distance < cfg->lpad_max){
 
-          LPAD_FFT_distance = LPAD_LUT[LPAD_FFT_distance-LPAD_Min];
+          ctx->LPAD_FFT_distance = LPAD_LUT[ctx->LPAD_FFT_distance-CALC_LUT_BASE];
 
-     }else if(LPAD_FFT_distance > LPAD_Max){
+     }else if(ctx->LPAD_FFT_distance > cfg->lpad_max){
 
-          LPAD_FFT_distance = 0;
+          ctx->LPAD_FFT_distance = 0;
 
      }else{
-          LPAD_FFT_distance = FFT_NO_SIGNAL; // ERROR code
+          ctx->LPAD_FFT_distance = FFT_NO_SIGNAL; // ERROR code
      }
 
 
-     if(RPAD_FFT_distance > RPAD_Min && RPAD_FFT_distance < RPAD_Max){
+     if(ctx->RPAD_FFT_distance > cfg->rpad_min && ctx->RPAD_FFT_distance < cfg->rpad_max){
 
-               RPAD_FFT_distance = RPAD_LUT[RPAD_FFT_distance-RPAD_Min];
+               ctx->RPAD_FFT_distance = RPAD_LUT[ctx->RPAD_FFT_distance-CALC_LUT_BASE];
 
-          }else if(RPAD_FFT_distance > RPAD_Max){
+          }else if(ctx->RPAD_FFT_distance > cfg->rpad_max){
 
-               RPAD_FFT_distance = 0;
+               ctx->RPAD_FFT_distance = 0;
 
           }else{
-               RPAD_FFT_distance = FFT_NO_SIGNAL; // ERROR code
+               ctx->RPAD_FFT_distance = FFT_NO_SIGNAL; // ERROR code
           }
 
 }
 /** ***************************************************************************
- * @brief Splits the ADC_Samples array from measuring.c into four arrays.
+ * @brief Single bin DFT and statistics of a channel pair in a single pass.
  *
- * A copy of each Array will be saved in { LPAD_samples, RPAD_samples, LHALL_samples, RHALL_samples}.
+ * @param ctx Context of the pipeline.
+ * @param samples Left channel at samples[0], right channel at samples[1].
+ * @param stride Distance between two samples of a channel.
+ * @param length Samples per channel, a divisor of DFT_SIZE.
+ * @param left Channel index of the left channel (CALC_LPAD or CALC_LHALL).
  *
+ * Both channels are packed into one word (lower halfword = left channel),
+ * so min, max and the clip counters are updated for two channels with one SIMD instruction.
  *****************************************************************************/
-void split_Array(void)
+static void split_pair(CALC_context_t *ctx, const uint32_t *samples, uint32_t stride,
+                       uint32_t length, int left)
 {
-     int j=0;
-     for(int i =0; i<(4*ADC_NUMS);i+=4){
-          LPAD_samples[j++] =MEAS_return_data(i);
+     const uint32_t clip_low  = __PKHBT(ADC_CLIP_MARGIN, ADC_CLIP_MARGIN, 16);
+     const uint32_t clip_high = __PKHBT(ADC_MAX_VALUE-ADC_CLIP_MARGIN, ADC_MAX_VALUE-ADC_CLIP_MARGIN, 16);
+     const uint32_t one       = 0x00010001;
+     const uint32_t step      = ctx->config.bin*(DFT_SIZE/length);  // Bin in the twiddle table
+
+     uint32_t pair_min  = 0xFFFFFFFF;  // [right:left]
+     uint32_t pair_max  = 0;
+     uint32_t pair_clip = 0;
+     uint32_t sum[2] = {0};
+     float32_t re[2] = {0};
+     float32_t im[2] = {0};
+     uint32_t m = 0;
+
+     for(uint32_t j = 0; j < length; j++){
+          uint32_t l = samples[stride*j];
+          uint32_t r = samples[stride*j+1];
+
+          /* X[k] = sum x[n] * (cos(2*pi*k*n/N) - j*sin(2*pi*k*n/N)) */
+          uint32_t ms = m + 3*DFT_SIZE/4;
+          if(ms >= DFT_SIZE){
+               ms -= DFT_SIZE;
+          }
+          float32_t c = twiddle[m];
+          float32_t s = twiddle[ms];
+          re[0] += l*c;   im[0] -= l*s;
+          re[1] += r*c;   im[1] -= r*s;
+          m += step;
+          if(m >= DFT_SIZE){
+               m -= DFT_SIZE;
+          }
+
+          sum[0] += l;
+          sum[1] += r;
+
+          uint32_t pair = __PKHBT(l, r, 16);
+
+          /* USUB16 sets the GE flags of each halfword, SEL picks the halfwords accordingly */
+          __USUB16(pair, pair_min);   pair_min  = __SEL(pair_min, pair);
+          __USUB16(pair, pair_max);   pair_max  = __SEL(pair, pair_max);
+          __USUB16(pair, clip_high);  pair_clip = __UADD16(pair_clip, __SEL(one, 0));
+          __USUB16(clip_low, pair);   pair_clip = __UADD16(pair_clip, __SEL(one, 0));
      }
-     j=0;
-     for(int i =1; i<4*ADC_NUMS;i+=4){
-          RPAD_samples[j++] = MEAS_return_data(i);
+
+     for(int i = 0; i < 2; i++){
+          CALC_stats_t *stats = &ctx->channel_stats[left+i];
+          stats->min        = pair_min  >> (16*i);
+          stats->max        = pair_max  >> (16*i);
+          stats->clip_count = pair_clip >> (16*i);
+          stats->mean       = sum[i] / length;
+          /* Scaled to ADC_NUMS samples */
+          ctx->phasor[left+i].re = re[i] * ADC_NUMS / length;
+          ctx->phasor[left+i].im = im[i] * ADC_NUMS / length;
+          if(stats->clip_count > 0){
+               ctx->clip_flags_window |= (1u << (left+i));
+          }
      }
-     j=0;
-     for(int i =2; i<4*ADC_NUMS;i+=4){
-          LHALL_samples[j++] = MEAS_return_data(i);
+}
+/** ***************************************************************************
+ * @brief Deinterleaves the frame ctx->samples.
+ *
+ * The samples are not copied. The 50 Hz phasor of each channel is accumulated
+ * with a single bin DFT and stored in ctx->phasor[].
+ * In the same pass the statistics of each channel are collected in ctx->channel_stats[].
+ *
+ * The pads are read from ctx->samples, the Hall sensors from ctx->hall_samples
+ * if it is set, otherwise from ctx->samples as well.
+ *
+ *****************************************************************************/
+void split_Array(CALC_context_t *ctx)
+{
+     split_pair(ctx, &ctx->samples[CALC_LPAD], CALC_CHANNELS, ADC_NUMS, CALC_LPAD);
+     if(ctx->hall_samples != NULL){
+          split_pair(ctx, ctx->hall_samples, 2, ctx->hall_length, CALC_LHALL);
+     }else{
+          split_pair(ctx, &ctx->samples[CALC_LHALL], CALC_CHANNELS, ADC_NUMS, CALC_LHALL);
      }
-     j=0;
-     for(int i =3; i<4*ADC_NUMS;i+=4){
-          RHALL_samples[j++] =MEAS_return_data(i);
+}
+/** ***************************************************************************
+ * @brief Initialisation of the twiddle table of the single bin DFT
+ *
+ * The firmware context is reset as well.
+ * @note Needs to be initialised only ones before calling calculate_pos().
+ *****************************************************************************/
+void FFT_Init(void)
+{
+     for(int m = 0; m < DFT_SIZE; m++){
+          twiddle[m] = cosf(2*PI*m/DFT_SIZE);
      }
+     calculate_init(&calc);
+}
+/** ***************************************************************************
+ * @brief Returns the mains phasor of a channel of the last frame.
+ *
+ * @param channel CALC_LPAD, CALC_RPAD, CALC_LHALL or CALC_RHALL
+ * @return Unscaled DFT bin config.bin in ADC steps
+ *****************************************************************************/
+CALC_phasor_t get_channel_phasor(int channel)
+{
+    CALC_phasor_t p = {0};
+    if(channel >= 0 && channel < CALC_CHANNELS){
+        p = calc.phasor[channel];
+    }
+    return p;
+}
+/** ***************************************************************************
+ * @brief Starts the capture of the background.
+ *
+ * The next CALC_NULL_FRAMES frames are averaged, the probe must be away from the target cable.
+ * The old background is subtracted until the capture is complete.
+ *****************************************************************************/
+void null_background_start(void)
+{
+    calc.null_frames = CALC_NULL_FRAMES;
+}
+/** ***************************************************************************
+ * @brief Removes the background, the frames are no longer corrected.
+ *****************************************************************************/
+void null_background_clear(void)
+{
+    calc.null_frames = 0;
+    memset(calc.background, 0, sizeof(calc.background));
+}
+/** ***************************************************************************
+ * @brief Returns the frames until the capture of the background is complete.
+ *
+ * @return 0 if no capture is running.
+ *****************************************************************************/
+int get_null_frames(void)
+{
+    return calc.null_frames;
+}
+/** ***************************************************************************
+ * @brief Returns the background.
+ *
+ * @param background CALC_CHANNELS phasors, all 0 if there is none.
+ * @return true if a background is subtracted.
+ *****************************************************************************/
+bool get_background(CALC_phasor_t *background)
+{
+    bool set = false;
+    for(int i = 0; i < CALC_CHANNELS; i++){
+        background[i] = calc.background[i];
+        set |= (calc.background[i].re != 0 || calc.background[i].im != 0);
+    }
+    return set;
+}
+/** ***************************************************************************
+ * @brief Replaces the background, e.g. with the one kept in the flash.
+ *
+ * @param background CALC_CHANNELS phasors, all 0 = no background.
+ *****************************************************************************/
+void set_background(const CALC_phasor_t *background)
+{
+    memcpy(calc.background, background, sizeof(calc.background));
+}
+/** ***************************************************************************
+ * @brief Starts the capture of a column of the coupling matrix.
+ *
+ * @param channel Channel with the stimulus, CALC_LPAD ... CALC_RHALL.
+ * @return false if channel is invalid.
+ *
+ * The next CALC_XTALK_FRAMES frames are averaged.
+ *****************************************************************************/
+bool crosstalk_start(int channel)
+{
+    if(channel < 0 || channel >= CALC_CHANNELS){
+        return false;
+    }
+    calc.xtalk_channel = channel;
+    calc.xtalk_frames = CALC_XTALK_FRAMES;
+    return true;
+}
+/** ***************************************************************************
+ * @brief Applies the inverse of the captured coupling matrix.
+ *
+ * @return false if the matrix is singular, the decoupling is not changed.
+ * Columns which have not been captured are those of the identity.
+ *****************************************************************************/
+bool crosstalk_apply(void)
+{
+    return calculate_decoupling(&calc);
+}
+/** ***************************************************************************
+ * @brief Removes the decoupling and the captured columns.
+ *****************************************************************************/
+void crosstalk_clear(void)
+{
+    CALC_phasor_t none[CALC_CHANNELS*CALC_CHANNELS] = {0};
 
+    calc.xtalk_frames = 0;
+    calc.xtalk_columns = 0;
+    memset(calc.coupling, 0, sizeof(calc.coupling));
+    for(int i = 0; i < CALC_CHANNELS; i++){
+        calc.coupling[i*CALC_CHANNELS + i].re = 1;
+    }
+    set_decoupling(none);
 }
 /** ***************************************************************************
- * @brief Initialisation for the FFT function
+ * @brief Returns the frames until the capture of the column is complete.
  *
- * @note Needs to be initialised only ones before using the arm_rfft_fast_f32() function.
+ * @param columns Bit c is set if column c has been captured.
+ * @return 0 if no capture is running.
  *****************************************************************************/
-void FFT_Init(void)
+int get_crosstalk_frames(uint8_t *columns)
 {
-     arm_rfft_fast_init_f32(&fft_handler, ADC_NUMS);
+    *columns = calc.xtalk_columns;
+    return calc.xtalk_frames;
 }
 /** ***************************************************************************
- * @brief Clearing all four ADS samples arrays
+ * @brief Returns the decoupling matrix.
  *
+ * @param decoupling CALC_CHANNELS x CALC_CHANNELS phasors, row by row, all 0 if there is none.
+ * @return true if the phasors are decoupled.
  *****************************************************************************/
-void clear_Buffer (void)
+bool get_decoupling(CALC_phasor_t *decoupling)
 {
-     /* Clear buffer and flag */
-     for (uint32_t i = 0; i < ADC_NUMS/2; i++){
-          RPAD_samples[2*i] = 0;
-          RPAD_samples[2*i+1] = 0;
-          LPAD_samples[2*i] = 0;
-          LPAD_samples[2*i+1] = 0;
-          RHALL_samples[2*i] = 0;
-          RHALL_samples[2*i+1] = 0;
-          LHALL_samples[2*i] = 0;
-          LHALL_samples[2*i+1] = 0;
-     }
+    if(calc.decoupling_set){
+        memcpy(decoupling, calc.decoupling, sizeof(calc.decoupling));
+    }else{
+        memset(decoupling, 0, sizeof(calc.decoupling));
+    }
+    return calc.decoupling_set;
+}
+/** ***************************************************************************
+ * @brief Replaces the decoupling matrix, e.g. with the one kept in the flash.
+ *
+ * @param decoupling CALC_CHANNELS x CALC_CHANNELS phasors, row by row, all 0 = none.
+ *****************************************************************************/
+void set_decoupling(const CALC_phasor_t *decoupling)
+{
+    calc.decoupling_set = false;
+    for(int i = 0; i < CALC_CHANNELS*CALC_CHANNELS; i++){
+        calc.decoupling_set |= (decoupling[i].re != 0 || decoupling[i].im != 0);
+    }
+    memcpy(calc.decoupling, decoupling, sizeof(calc.decoupling));
+}
+/** ***************************************************************************
+ * @brief Replaces the parameters of the firmware pipeline, e.g. for another mains frequency.
+ *
+ * @param config Rate, bin and pad gain of the mains frequency, see MAINS_get_config().
+ *
+ * The averaging window and a running capture of the background
+ * or of the crosstalk restart, their frames would mix two frequencies.
+ *****************************************************************************/
+void set_calibration(const CALC_config_t *config)
+{
+    calc.config = *config;
+    calc.avg_counter = 0;
+    calc.clip_flags_window = 0;
+    memset(calc.amplitude_sum, 0, sizeof(calc.amplitude_sum));
+    memset(calc.amplitude_smooth, 0, sizeof(calc.amplitude_smooth));
+    if(calc.null_frames > 0){
+        calc.null_frames = CALC_NULL_FRAMES;
+    }
+    if(calc.xtalk_frames > 0){
+        calc.xtalk_frames = CALC_XTALK_FRAMES;
+    }
+}
+/** ***************************************************************************
+ * @brief Returns the size of the static DSP state.
+ *
+ * @param fft_state If not NULL, the size of the former FFT stage is stored here.
+ * @return Bytes of the twiddle table and of a pipeline context.
+ *****************************************************************************/
+uint32_t get_dsp_state_bytes(uint32_t *fft_state)
+{
+    if(fft_state != NULL){
+        *fft_state = FFT_STATE_BYTES;
+    }
+    return sizeof(twiddle) + sizeof(calc);
 }
 
@@ -0,0 +1,455 @@
+/** ***************************************************************************
+ * @file
+ * @brief Capture of the raw ADC frames into a seekable, chunk-indexed file
+ *
+ * File format
+ * ===========
+ * | Offset                         | Content                                |
+ * | :----------------------------- | :------------------------------------- |
+ * | 0                              | CAP_header_t (CAP_HEADER_SIZE bytes)   |
+ * | CAP_HEADER_SIZE + i*CAP_CHUNK_SIZE | chunk i: CAP_chunk_t and frames    |
+ * | index_offset                   | CAP_chunk_t of each chunk (the index)  |
+ * | end - sizeof(CAP_trailer_t)    | CAP_trailer_t                          |
+ * All values are little endian.
+ * The chunks have a fixed size, a reader finds chunk i without the index.
+ * The unused rest of a chunk is zero.
+ * The index at the end holds a copy of all chunk headers,
+ * so a reader can map a frame number to its chunk without reading the chunks.
+ * If the trailer is missing (capture interrupted), the chunk headers
+ * can be scanned instead.
+ *
+ * Frame compression
+ * -----------------
+ * Each frame holds the channels one after the other. Each channel is stored as:
+ * - the first sample (2 bytes)
+ * - the number of bits b of the deltas (1 byte)
+ * - the ADC_NUMS-1 differences to the previous sample, zigzag coded
+ *   (0, -1, 1, -2, ... = 0, 1, 2, 3, ...) and packed with b bits each, LSB first
+ *
+ * A frame is at most CAP_FRAME_MAX bytes, a quiet channel needs few bits.
+ *
+ * Streaming
+ * =========
+ * The file is not buffered on the device, it is sent in pieces on USART1
+ * as SER_FRAME_CAPTURE: session number (4 bytes), file offset (4 bytes), data.
+ * Tools/capture_recv.py writes each piece at its offset.
+ * @n The chunk buffers are blocks of the pool ARENA_CHUNKS (SDRAM).
+ * One is filled by CAP_add_frame(), the closed ones wait in a queue
+ * until CAP_update() has sent them and returned them to the pool.
+ * If all blocks are waiting for the UART, frames are dropped and counted
+ * (CAP_get_dropped()). The frame numbers of the chunks show the gap.
+ * Only the index grows with the session, it is kept in the capture arena (SDRAM).
+ * The chunk in its last entry (CAP_MAX_CHUNKS) stops the session,
+ * the frames after it are counted as dropped.
+ * @n CAP_stop() sends the last chunk, the index and the trailer.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <string.h>
+#include "capture.h"
+#include "measuring.h"
+#include "calculations.h"
+#include "acquisition.h"
+#include "mains.h"
+#include "serial.h"
+#include "arena.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define SAMPLE_BITS     12                  ///< Resolution of the ADC
+#define CAP_DELTA_BITS  (SAMPLE_BITS+1)     ///< Max bits of a zigzag coded delta
+#define CAP_FRAME_MAX   (CALC_CHANNELS * (3 + ((ADC_NUMS-1)*CAP_DELTA_BITS + 7) / 8)) ///< Max bytes of a frame
+#define CHUNK_DATA      (CAP_CHUNK_SIZE - sizeof(CAP_chunk_t))  ///< Frame bytes of a chunk
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** States of the capture */
+typedef enum {
+    CAP_IDLE = 0,           ///< No session
+    CAP_RUNNING,            ///< Frames are added
+    CAP_CLOSING,            ///< Last chunk and index are sent
+} state_t;
+
+/** Prefix of each SER_FRAME_CAPTURE */
+typedef struct {
+    uint32_t session;       ///< Number of the session
+    uint32_t offset;        ///< File offset of the data
+} stream_t;
+
+/** Chunk buffer as it is sent */
+typedef struct {
+    stream_t stream;        ///< Prefix of the frame
+    CAP_chunk_t chunk;      ///< Header of the chunk
+    uint8_t data[CHUNK_DATA];   ///< Compressed frames
+} slot_t;
+
+/** Piece of the header or the index as it is sent */
+typedef struct {
+    stream_t stream;        ///< Prefix of the frame
+    uint8_t data[CAP_PIECE];    ///< Part of the file
+} piece_t;
+
+_Static_assert(sizeof(slot_t) <= ARENA_CHUNK_SIZE, "a chunk buffer is a block of ARENA_CHUNKS");
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static state_t state = CAP_IDLE;        ///< State of the capture
+static bool start_requested = false;    ///< CAP_start() while closing
+static uint32_t session = 0;            ///< Number of the current session
+static uint32_t frame_number = 0;       ///< Number of the next frame
+static uint32_t dropped = 0;            ///< Frames dropped since CAP_init()
+
+static CAP_chunk_t *index_table = NULL; ///< Index in the capture arena
+static uint32_t chunks = 0;             ///< Closed chunks of the session
+static slot_t *filling = NULL;          ///< Chunk buffer which is filled, NULL = pool empty
+static slot_t *queue[ARENA_CHUNK_BLOCKS];   ///< Closed chunk buffers, oldest first
+static uint32_t queued = 0;             ///< Chunk buffers waiting for the UART
+static piece_t *piece = NULL;           ///< Buffer of header and index pieces
+static bool header_pending = false;     ///< Header not yet sent
+static uint32_t index_sent = 0;         ///< Bytes of the index already sent
+
+static uint8_t frame_buffer[CAP_FRAME_MAX]; ///< Compressed frame
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Compress the frame in the ADC buffer
+ * @param [out] out at least CAP_FRAME_MAX bytes
+ * @return bytes
+ *****************************************************************************/
+static uint32_t encode_frame(uint8_t *out)
+{
+    uint8_t *p = out;
+    for (uint32_t ch = 0; ch < CALC_CHANNELS; ch++) {
+        uint32_t zigzag[ADC_NUMS-1];
+        uint32_t all = 0;
+        int32_t previous = MEAS_return_data(ch);
+        for (uint32_t j = 1; j < ADC_NUMS; j++) {
+            int32_t sample = MEAS_return_data(CALC_CHANNELS*j + ch);
+            int32_t delta = sample - previous;
+            previous = sample;
+            zigzag[j-1] = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+            all |= zigzag[j-1];
+        }
+        uint32_t bits = 32 - __CLZ(all);
+        uint32_t first = MEAS_return_data(ch);
+        *p++ = first & 0xFF;
+        *p++ = first >> 8;
+        *p++ = bits;
+        uint32_t accu = 0;              // Not yet stored bits
+        uint32_t count = 0;
+        for (uint32_t j = 0; j < ADC_NUMS-1; j++) {
+            accu |= zigzag[j] << count;
+            count += bits;
+            while (count >= 8) {
+                *p++ = accu & 0xFF;
+                accu >>= 8;
+                count -= 8;
+            }
+        }
+        if (count > 0) {
+            *p++ = accu & 0xFF;
+        }
+    }
+    return p - out;
+}
+
+
+/** ***************************************************************************
+ * @brief Take an empty chunk buffer from the pool
+ * @return NULL if all buffers wait for the UART
+ *****************************************************************************/
+static slot_t *take_slot(void)
+{
+    slot_t *slot = ARENA_pool_get(ARENA_CHUNKS);
+    if (slot != NULL) {
+        slot->chunk.frames = 0;
+        slot->chunk.bytes = 0;
+    }
+    return slot;
+}
+
+
+/** ***************************************************************************
+ * @brief Queue the chunk buffer which is filled and take the next one
+ *
+ * The chunk in the last entry of the index stops the session.
+ *****************************************************************************/
+static void close_chunk(void)
+{
+    slot_t *slot = filling;
+    if (slot == NULL || slot->chunk.frames == 0) {
+        return;
+    }
+    index_table[chunks] = slot->chunk;
+    slot->stream.session = session;
+    slot->stream.offset = CAP_HEADER_SIZE + chunks * CAP_CHUNK_SIZE;
+    chunks++;
+    queue[queued++] = slot;             // At most ARENA_CHUNK_BLOCKS buffers exist
+    if (chunks >= CAP_MAX_CHUNKS) {
+        filling = NULL;                 // Taken again by send_slots()
+        CAP_stop();                     // Index full
+        return;
+    }
+    filling = take_slot();
+}
+
+
+/** ***************************************************************************
+ * @brief Send a piece of the file
+ * @param [in] data
+ * @param [in] length at most CAP_PIECE
+ * @param [in] offset in the file
+ * @return true if sent, false if the transmit queue is full
+ *****************************************************************************/
+static bool send_piece(const void *data, uint32_t length, uint32_t offset)
+{
+    if (SER_get_free() < sizeof(stream_t) + length + SER_FRAME_OVERHEAD) {
+        return false;
+    }
+    piece->stream.session = session;
+    piece->stream.offset = offset;
+    memcpy(piece->data, data, length);
+    SER_send_frame(SER_FRAME_CAPTURE, piece, sizeof(stream_t) + length);
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Send the header of the session
+ * @return true if sent
+ *****************************************************************************/
+static bool send_header(void)
+{
+    CAP_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "CMCP", 4);
+    header.version = CAP_VERSION;
+    header.header_size = CAP_HEADER_SIZE;
+    header.sample_rate = ACQ_get_rate();
+    header.frame_length = ADC_NUMS;
+    header.channels = CALC_CHANNELS;
+    header.sample_bits = SAMPLE_BITS;
+    header.channel_map[CALC_LPAD] = CAP_CH_LPAD;
+    header.channel_map[CALC_RPAD] = CAP_CH_RPAD;
+    header.channel_map[CALC_LHALL] = CAP_CH_LHALL;
+    header.channel_map[CALC_RHALL] = CAP_CH_RHALL;
+    header.calibration = CALC_CAL_VERSION;
+    header.mains_mhz = MAINS_get_profile(MAINS_get())->mains_mhz;
+    header.chunk_size = CAP_CHUNK_SIZE;
+    header.session = session;
+    header.start_ms = HAL_GetTick();
+    return send_piece(&header, sizeof(header), 0);
+}
+
+
+/** ***************************************************************************
+ * @brief Send the queued chunk buffers, oldest first, and return them to the pool
+ * @return true if the queue is empty
+ *****************************************************************************/
+static bool send_slots(void)
+{
+    while (queued > 0) {
+        slot_t *slot = queue[0];
+        uint32_t length = sizeof(stream_t) + sizeof(CAP_chunk_t) + slot->chunk.bytes;
+        if (SER_get_free() < length + SER_FRAME_OVERHEAD) {
+            return false;
+        }
+        SER_send_frame(SER_FRAME_CAPTURE, slot, length);
+        ARENA_pool_put(ARENA_CHUNKS, slot);
+        queued--;
+        memmove(&queue[0], &queue[1], queued * sizeof(queue[0]));
+    }
+    if (filling == NULL) {
+        filling = take_slot();
+    }
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Send the index and the trailer
+ * @return true if all is sent
+ *****************************************************************************/
+static bool send_index(void)
+{
+    uint32_t index_offset = CAP_HEADER_SIZE + chunks * CAP_CHUNK_SIZE;
+    uint32_t index_bytes = chunks * sizeof(CAP_chunk_t);
+    while (index_sent < index_bytes) {
+        uint32_t length = index_bytes - index_sent;
+        if (length > CAP_PIECE) {
+            length = CAP_PIECE;
+        }
+        if (!send_piece((uint8_t *)index_table + index_sent, length, index_offset + index_sent)) {
+            return false;
+        }
+        index_sent += length;
+    }
+    CAP_trailer_t trailer;
+    memcpy(trailer.magic, "CIDX", 4);
+    trailer.chunks = chunks;
+    trailer.frames = frame_number;
+    trailer.index_offset = index_offset;
+    return send_piece(&trailer, sizeof(trailer), index_offset + index_bytes);
+}
+
+
+/** ***************************************************************************
+ * @brief Allocate the buffers in the capture arenas
+ *
+ * @note Call after ARENA_init() and SER_init().
+ *****************************************************************************/
+void CAP_init(void)
+{
+    index_table = ARENA_alloc(ARENA_CAPTURE, CAP_MAX_CHUNKS * sizeof(CAP_chunk_t));
+    piece = ARENA_alloc(ARENA_CAPTURE, sizeof(piece_t));
+    filling = take_slot();
+    queued = 0;
+    state = CAP_IDLE;
+    dropped = 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Start a new session
+ *
+ * If the last session is still closing, the new one starts afterwards.
+ *****************************************************************************/
+void CAP_start(void)
+{
+    if (index_table == NULL || piece == NULL) {
+        return;                         // Arena too small
+    }
+    if (state == CAP_CLOSING) {
+        start_requested = true;
+        return;
+    }
+    if (state == CAP_RUNNING) {
+        return;
+    }
+    session++;
+    frame_number = 0;
+    chunks = 0;
+    index_sent = 0;
+    if (filling == NULL) {
+        filling = take_slot();
+    } else {
+        filling->chunk.frames = 0;
+        filling->chunk.bytes = 0;
+    }
+    header_pending = true;
+    state = CAP_RUNNING;
+}
+
+
+/** ***************************************************************************
+ * @brief Stop the session, the rest of the file is sent by CAP_update()
+ *****************************************************************************/
+void CAP_stop(void)
+{
+    start_requested = false;
+    if (state != CAP_RUNNING) {
+        return;
+    }
+    state = CAP_CLOSING;
+    close_chunk();
+}
+
+
+/** ***************************************************************************
+ * @brief Add the frame in the ADC buffer to the session
+ *
+ * @note Call when a frame is complete and before the next acquisition starts.
+ *****************************************************************************/
+void CAP_add_frame(void)
+{
+    if (state != CAP_RUNNING) {
+        return;
+    }
+    uint32_t length = encode_frame(frame_buffer);
+    if (filling != NULL && filling->chunk.bytes + length > CHUNK_DATA) {
+        close_chunk();
+    }
+    if (state != CAP_RUNNING) {
+        dropped++;                      // Index full, the session ended before this frame
+        return;
+    }
+    slot_t *slot = filling;
+    if (slot == NULL) {
+        dropped++;                      // All chunk buffers wait for the UART
+        frame_number++;
+        return;
+    }
+    if (slot->chunk.frames == 0) {
+        slot->chunk.first_frame = frame_number;
+    }
+    memcpy(&slot->data[slot->chunk.bytes], frame_buffer, length);
+    slot->chunk.bytes += length;
+    slot->chunk.frames++;
+    frame_number++;
+}
+
+
+/** ***************************************************************************
+ * @brief Send the header, the closed chunks and at the end the index
+ *
+ * @note Call periodically from the main loop.
+ *****************************************************************************/
+void CAP_update(void)
+{
+    if (state == CAP_IDLE) {
+        return;
+    }
+    if (header_pending) {
+        if (!send_header()) {
+            return;
+        }
+        header_pending = false;
+    }
+    if (!send_slots()) {
+        return;
+    }
+    if (state == CAP_CLOSING && send_index()) {
+        state = CAP_IDLE;
+        if (start_requested) {
+            start_requested = false;
+            CAP_start();
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Is a session running?
+ * @return true while frames are added
+ *****************************************************************************/
+bool CAP_active(void)
+{
+    return state == CAP_RUNNING;
+}
+
+
+/** ***************************************************************************
+ * @brief Dropped frames
+ * @return Frames dropped since CAP_init(), the UART was too slow
+ *****************************************************************************/
+uint32_t CAP_get_dropped(void)
+{
+    return dropped;
+}
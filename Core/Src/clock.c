@@ -0,0 +1,229 @@
+/** ***************************************************************************
+ * @file
+ * @brief Switches the core clock between idle and DSP bursts
+ *
+ * Clock states
+ * ============
+ * The PLL is configured once by SystemClock_Config() for SYSCLK = 168 MHz
+ * and is never touched again.
+ * Only the AHB and APB prescalers are switched:
+ *
+ * | State      | HCLK    | APB1 presc. | APB2 presc. | PCLK1  | PCLK2  | APB1 timers |
+ * |------------|---------|-------------|-------------|--------|--------|-------------|
+ * | CLOCK_FULL | 168 MHz | 4           | 2           | 42 MHz | 84 MHz | 84 MHz      |
+ * | CLOCK_LOW  | 84 MHz  | 2           | 1           | 42 MHz | 84 MHz | 84 MHz      |
+ *
+ * The peripheral clocks are the same in both states.
+ * TIM2 (sampling), TIM5 (buzzer), the I2C of the touchscreen,
+ * the SPI of the LCD and the ADCs are therefore not affected by a switch.
+ * The LTDC pixel clock comes from PLLSAI and keeps running as well.
+ * @n All prescalers are written with one single access to RCC->CFGR.
+ * @n The SDRAM clock is HCLK/2, its refresh counter is adapted with each switch.
+ * The SysTick reload value is adapted as well,
+ * the millisecond which is running during the switch is slightly off.
+ *
+ * @note 180 MHz overdrive is not used: SYSCLK = 180 MHz needs a different PLL
+ * setting, the APB1 timer clock would become 90 MHz and TIM2 can not produce
+ * MEAS_HALL_FS = 3200 Hz exactly any more. Relocking the PLL also stalls all peripherals.
+ *
+ * Sleep
+ * =====
+ * CLOCK_init() is called after the LCD and the SDRAM are initialized,
+ * the boot runs at full speed.
+ * @n CLOCK_sleep() is called from HAL_Delay().
+ * It switches to CLOCK_LOW and waits with WFI for the next interrupt
+ * (SysTick every ms, the ADC or the DMA).
+ *
+ * Residency
+ * =========
+ * The time spent in each state is accumulated in microseconds
+ * (from the HAL tick and the SysTick counter, which also run during sleep).
+ * CLOCK_get_residency_ms() and CLOCK_get_residency_permille()
+ * report it, e.g. for the estimation of the energy consumption.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "clock.h"
+#include "stm32f429i_discovery_sdram.h"
+#include "power.h"
+#include "trace.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+/** Prescalers for CLOCK_FULL: HCLK = SYSCLK, PCLK1 = HCLK/4, PCLK2 = HCLK/2 */
+#define CFGR_FULL       (RCC_CFGR_HPRE_DIV1 | RCC_CFGR_PPRE1_DIV4 | RCC_CFGR_PPRE2_DIV2)
+/** Prescalers for CLOCK_LOW: HCLK = SYSCLK/2, PCLK1 = HCLK/2, PCLK2 = HCLK */
+#define CFGR_LOW        (RCC_CFGR_HPRE_DIV2 | RCC_CFGR_PPRE1_DIV2 | RCC_CFGR_PPRE2_DIV1)
+#define CFGR_PRESCALERS (RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2)
+
+#define SDRAM_REFRESH_LOW   (REFRESH_COUNT/2)   ///< SDRAM refresh count at HCLK/2
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static bool clock_ready = false;                ///< CLOCK_init() was called
+static CLOCK_state_t clock_state = CLOCK_FULL;  ///< Current clock state
+static uint32_t state_start_us = 0;             ///< Time the current state was entered
+static uint32_t residency_us[CLOCK_STATES];     ///< Accumulated time in each state
+static uint32_t residency_ms[CLOCK_STATES];     ///< Full milliseconds of residency_us[]
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Account the time of the current state and enter a new one
+ * @param [in] state
+ *****************************************************************************/
+static void clock_account(CLOCK_state_t state)
+{
+    uint32_t now = CLOCK_get_us();
+    residency_us[clock_state] += now - state_start_us;
+    residency_ms[clock_state] += residency_us[clock_state] / 1000;
+    residency_us[clock_state] %= 1000;
+    state_start_us = now;
+    clock_state = state;
+}
+
+
+/** ***************************************************************************
+ * @brief Enable clock switching and start the residency accounting
+ *
+ * @note Call after BSP_LCD_Init(), the SDRAM must be initialized
+ * at full speed before its refresh counter is switched.
+ * Before, the system always runs in CLOCK_FULL.
+ *****************************************************************************/
+void CLOCK_init(void)
+{
+    clock_state = CLOCK_FULL;
+    CLOCK_reset_residency();
+    TRACE_CLOCK_SET(SystemCoreClock / 1000000U);
+    clock_ready = true;
+}
+
+
+/** ***************************************************************************
+ * @brief Switch the core clock
+ * @param [in] state CLOCK_LOW or CLOCK_FULL
+ *
+ * The peripheral clocks stay the same (see the table above).
+ *****************************************************************************/
+void CLOCK_set(CLOCK_state_t state)
+{
+    if (state == CLOCK_SLEEP) { state = CLOCK_LOW; }
+    if (!clock_ready || state == clock_state) { return; }
+
+    bool full = (state == CLOCK_FULL);
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();                    // SysTick must not run in between
+    clock_account(state);
+    PWR_clock_change();                 // Cycles so far at the old clock
+    RCC->CFGR = (RCC->CFGR & ~CFGR_PRESCALERS) | (full ? CFGR_FULL : CFGR_LOW);
+    SystemCoreClock = full ? CLOCK_FULL_HZ : CLOCK_LOW_HZ;
+    SysTick->LOAD = SystemCoreClock / (1000U / uwTickFreq) - 1;   // Keep 1 ms tick
+    FMC_Bank5_6->SDRTR = (FMC_Bank5_6->SDRTR & ~FMC_SDRTR_COUNT)
+            | ((full ? REFRESH_COUNT : SDRAM_REFRESH_LOW) << FMC_SDRTR_COUNT_Pos);
+    TRACE_CLOCK_SET(SystemCoreClock / 1000000U);    // Scale of the trace timestamps
+    __set_PRIMASK(primask);
+}
+
+
+/** ***************************************************************************
+ * @brief Get the current clock state
+ * @return CLOCK_LOW or CLOCK_FULL
+ *****************************************************************************/
+CLOCK_state_t CLOCK_get(void)
+{
+    return clock_state;
+}
+
+
+/** ***************************************************************************
+ * @brief Sleep until the next interrupt
+ *
+ * The core clock is reduced first and stays reduced after wakeup.
+ *****************************************************************************/
+void CLOCK_sleep(void)
+{
+    CLOCK_set(CLOCK_LOW);
+    if (clock_ready) { clock_account(CLOCK_SLEEP); }
+    __DSB();
+    __WFI();                            // Wait for interrupt
+    if (clock_ready) { clock_account(CLOCK_LOW); }
+}
+
+
+/** ***************************************************************************
+ * @brief Time since HAL_Init()
+ * @return Microseconds, overflows after about 71 minutes
+ *
+ * Combines the HAL tick with the SysTick counter.
+ * Unlike the DWT cycle counter this also works during sleep
+ * and independently of the clock state.
+ *****************************************************************************/
+uint32_t CLOCK_get_us(void)
+{
+    uint32_t ms;
+    uint32_t count;
+    do {
+        ms = HAL_GetTick();
+        count = SysTick->VAL;
+    } while (ms != HAL_GetTick());      // Retry if the tick was incremented
+    return ms * 1000 + ((SysTick->LOAD - count) * 1000) / (SysTick->LOAD + 1);
+}
+
+
+/** ***************************************************************************
+ * @brief Time spent in a clock state
+ * @param [in] state
+ * @return Milliseconds since CLOCK_init() or CLOCK_reset_residency()
+ *****************************************************************************/
+uint32_t CLOCK_get_residency_ms(CLOCK_state_t state)
+{
+    uint32_t ms = 0;
+    if (state < CLOCK_STATES) {
+        ms = residency_ms[state];
+        if (state == clock_state) {     // Add the running state
+            ms += (residency_us[state] + CLOCK_get_us() - state_start_us) / 1000;
+        }
+    }
+    return ms;
+}
+
+
+/** ***************************************************************************
+ * @brief Share of a clock state
+ * @param [in] state
+ * @return Share of the total time in 1/1000
+ *****************************************************************************/
+uint32_t CLOCK_get_residency_permille(CLOCK_state_t state)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < CLOCK_STATES; i++) {
+        total += CLOCK_get_residency_ms(i);
+    }
+    return (total > 0) ? (uint32_t)(((uint64_t)CLOCK_get_residency_ms(state) * 1000) / total) : 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Restart the residency accounting
+ *****************************************************************************/
+void CLOCK_reset_residency(void)
+{
+    for (int i = 0; i < CLOCK_STATES; i++) {
+        residency_us[i] = 0;
+        residency_ms[i] = 0;
+    }
+    state_start_us = CLOCK_get_us();
+}
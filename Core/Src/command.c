@@ -0,0 +1,618 @@
+/** ***************************************************************************
+ * @file
+ * @brief Command interface on USART1 for remote control and bulk queries
+ *
+ * Commands
+ * ========
+ * The host sends commands as SER_FRAME_COMMAND frames (see serial.c):
+ * sequence number (1 byte), command (CMD_id_t, 1 byte), arguments.
+ * All values are little endian.
+ * | Command     | Arguments                    | Response data                          |
+ * | :---------- | :--------------------------- | :------------------------------------- |
+ * | CMD_PING    | -                            | protocol (1), settings (1), history size (2), uptime ms (4) |
+ * | CMD_GET     | -                            | value (4) of each setting (CFG_id_t)   |
+ * | CMD_GET     | id (1)                       | id (1), value (4), min (4), max (4)    |
+ * | CMD_SET     | id (1), value (4)            | id (1), value (4)                      |
+ * | CMD_CAPTURE | 0 = stop, 1 = new session (1) | active (1), dropped frames (4)        |
+ * | CMD_STATS   | -                            | CMD_stats_t                            |
+ * | CMD_HISTORY | first (4), count (1)         | first (4), count (1), CMD_reading_t[count] |
+ * | CMD_SNAPSHOT | -                           | snapshot number (1), chunks follow as SER_FRAME_SNAPSHOT |
+ * | CMD_SESSION | - or 1 = new session (1)     | SES_summary_t (before the new session) |
+ * | CMD_EVENTS  | first (4), count (1)         | first (4), count (1), DET_event_t[count] |
+ * | CMD_NULL    | - or 0 = clear, 1 = capture (1) | frames to capture (1), background set (1) |
+ * | CMD_CROSSTALK | - or 0 = clear, 1 = apply (1) or 2 = capture (1), channel (1) | frames to capture (1), captured columns (1), decoupled (1) |
+ * The settings are changed with CFG_set() and applied by main()
+ * in the same pass of its loop, like a change on the touchscreen.
+ *
+ * History
+ * -------
+ * Each processed frame is added as CMD_reading_t with its number
+ * (CMD_add_reading()). The last CMD_HISTORY_SIZE readings are kept
+ * in the history arena (SDRAM), CMD_init() allocates them.
+ * CMD_HISTORY returns up to CMD_HISTORY_MAX readings from number first on,
+ * or from the oldest kept one if first is older.
+ * The host continues with first + count of the response.
+ * CMD_EVENTS works the same on the load changes of detector.c
+ * (last DET_EVENTS, at most DET_EVENTS_MAX per response).
+ *
+ * Background
+ * ----------
+ * CMD_NULL captures the background field with the probe away from
+ * the target cable (see calculations.c). The capture takes
+ * CALC_NULL_FRAMES frames, the host polls CMD_NULL without argument
+ * until no frames are left. The background is kept in the flash (see storage.c).
+ * CMD_CROSSTALK captures the columns of the coupling matrix the same way,
+ * one per channel with a stimulus on this channel only. Apply fails with
+ * CMD_ERR_ARGUMENT if the matrix is singular.
+ *
+ * Responses
+ * =========
+ * Each command is answered by a record:
+ * sequence number (1), command (1), status (CMD_status_t, 1),
+ * data length n (1), data (n).
+ * The records of all commands executed in one CMD_update() are batched
+ * into one SER_FRAME_RESPONSE, which saves frames and DMA transfers.
+ * Frames with a bad checksum or length are not answered, they are counted
+ * (CMD_stats_t.errors), the host repeats the command after a timeout.
+ *
+ * Incremental parsing
+ * ===================
+ * CMD_update() is called once per pass of the main loop and never waits.
+ * It takes the received bytes from the receive ring (SER_read()) and feeds
+ * them to a state machine, which keeps a partial frame for the next call.
+ * At most CMD_RX_BUDGET bytes are parsed per call, so a burst of commands
+ * can not delay the measurement.
+ * @n A command is only read if its largest response still fits into the batch.
+ * If the transmit queue has no space for the batch, it is kept
+ * and the commands wait in the receive ring: the host is slowed down,
+ * no response is lost.
+ *
+ * Tools/command.py sends the commands,
+ * Tools/host/cmd_device is a stand-in of the device on a pseudo-terminal.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <string.h>
+#include "command.h"
+#include "settings.h"
+#include "serial.h"
+#include "capture.h"
+#include "snapshot.h"
+#include "session.h"
+#include "detector.h"
+#include "arena.h"
+#include "error_code.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define RECORD_HEADER   4                       ///< Sequence, command, status, length
+#define RECORD_MAX      (RECORD_HEADER + 255)   ///< Largest record of a response
+#define HISTORY_MASK    (CMD_HISTORY_SIZE-1)    ///< Index mask of the history
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** States of the frame parser */
+typedef enum {
+    RX_START = 0,           ///< Waiting for SER_FRAME_START
+    RX_TYPE,                ///< Type byte
+    RX_LENGTH_LOW,          ///< Low byte of the payload length
+    RX_LENGTH_HIGH,         ///< High byte of the payload length
+    RX_PAYLOAD,             ///< Payload bytes
+    RX_CHECKSUM,            ///< Checksum byte
+} rx_state_t;
+
+/** Partial frame of the parser */
+typedef struct {
+    rx_state_t state;                   ///< Next expected byte
+    uint8_t type;                       ///< SER_frame_type_t
+    uint8_t sum;                        ///< Sum of the bytes after the start
+    uint16_t length;                    ///< Payload length
+    uint16_t received;                  ///< Payload bytes received
+    uint8_t payload[CMD_MAX_PAYLOAD];   ///< Payload
+} parser_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static parser_t parser;                         ///< Frame being received
+static uint8_t batch[CMD_BATCH_SIZE];           ///< Records not yet sent
+static uint32_t batch_length = 0;               ///< Bytes in batch[]
+static CMD_reading_t *history = NULL;           ///< Last readings, NULL = arena too small
+static uint32_t readings = 0;                   ///< Readings added
+static uint32_t valid_readings = 0;             ///< Readings with a valid position
+static uint16_t commands = 0;                   ///< Commands executed
+static uint16_t errors = 0;                     ///< Frames with bad length or checksum
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Feed one byte to the frame parser
+ * @param [in] byte received
+ * @return true if a SER_FRAME_COMMAND is complete in parser.payload
+ *****************************************************************************/
+static bool parse(uint8_t byte)
+{
+    if (parser.state != RX_START) {
+        parser.sum += byte;
+    }
+    switch (parser.state) {
+        case RX_START:
+            if (byte == SER_FRAME_START) {
+                parser.sum = 0;
+                parser.state = RX_TYPE;
+            }
+            break;
+        case RX_TYPE:
+            parser.type = byte;
+            parser.state = RX_LENGTH_LOW;
+            break;
+        case RX_LENGTH_LOW:
+            parser.length = byte;
+            parser.state = RX_LENGTH_HIGH;
+            break;
+        case RX_LENGTH_HIGH:
+            parser.length |= (uint16_t)byte << 8;
+            parser.received = 0;
+            if (parser.length > CMD_MAX_PAYLOAD) {
+                errors++;
+                parser.state = RX_START;    // Resynchronize on the next start byte
+            } else {
+                parser.state = (parser.length > 0) ? RX_PAYLOAD : RX_CHECKSUM;
+            }
+            break;
+        case RX_PAYLOAD:
+            parser.payload[parser.received++] = byte;
+            if (parser.received == parser.length) {
+                parser.state = RX_CHECKSUM;
+            }
+            break;
+        case RX_CHECKSUM:
+            parser.state = RX_START;
+            if (parser.sum != 0) {
+                errors++;
+                return false;
+            }
+            return parser.type == SER_FRAME_COMMAND;
+    }
+    return false;
+}
+
+
+/** ***************************************************************************
+ * @brief Store a 32 bit value little endian
+ *****************************************************************************/
+static void put_u32(uint8_t *dst, uint32_t value)
+{
+    memcpy(dst, &value, sizeof(value));
+}
+
+
+/** ***************************************************************************
+ * @brief Load a 32 bit value little endian
+ *****************************************************************************/
+static uint32_t get_u32(const uint8_t *src)
+{
+    uint32_t value;
+    memcpy(&value, src, sizeof(value));
+    return value;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_GET: one or all settings
+ *****************************************************************************/
+static CMD_status_t cmd_get(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n == 0) {
+        for (uint32_t id = 0; id < CFG_SETTINGS; id++) {
+            put_u32(&data[4*id], CFG_get(id));
+        }
+        *size = 4*CFG_SETTINGS;
+        return CMD_OK;
+    }
+    if (n != 1) {
+        return CMD_ERR_LENGTH;
+    }
+    int32_t min, max;
+    if (!CFG_get_range(args[0], &min, &max)) {
+        return CMD_ERR_ARGUMENT;
+    }
+    data[0] = args[0];
+    put_u32(&data[1], CFG_get(args[0]));
+    put_u32(&data[5], min);
+    put_u32(&data[9], max);
+    *size = 13;
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_SET: change a setting
+ *****************************************************************************/
+static CMD_status_t cmd_set(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n != 5) {
+        return CMD_ERR_LENGTH;
+    }
+    if (!CFG_set(args[0], get_u32(&args[1]))) {
+        return CMD_ERR_ARGUMENT;
+    }
+    data[0] = args[0];
+    put_u32(&data[1], CFG_get(args[0]));
+    *size = 5;
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_CAPTURE: stop the session or start a new one
+ *****************************************************************************/
+static CMD_status_t cmd_capture(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n != 1) {
+        return CMD_ERR_LENGTH;
+    }
+    if (args[0] > 1) {
+        return CMD_ERR_ARGUMENT;
+    }
+    CAP_stop();                         // Closes the running session
+    if (args[0] == 1) {
+        CAP_start();                    // Starts after the last one is sent
+    }
+    data[0] = CAP_active();
+    put_u32(&data[1], CAP_get_dropped());
+    *size = 5;
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_STATS: counters and the statistics of the last frame
+ *****************************************************************************/
+static CMD_status_t cmd_stats(uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n != 0) {
+        return CMD_ERR_LENGTH;
+    }
+    CMD_stats_t stats = {
+            .uptime_ms = HAL_GetTick(),
+            .readings = readings,
+            .valid_readings = valid_readings,
+            .rx_lost = SER_get_rx_lost(),
+            .tx_dropped = SER_get_dropped(),
+            .capture_dropped = CAP_get_dropped(),
+            .commands = commands,
+            .errors = errors,
+            .clip_flags = get_clip_flags(),
+            .capture_active = CAP_active(),
+    };
+    for (int i = 0; i < CALC_CHANNELS; i++) {
+        stats.channel[i] = get_channel_stats(i);
+    }
+    memcpy(data, &stats, sizeof(stats));
+    *size = sizeof(stats);
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_HISTORY: readings from number first on
+ *****************************************************************************/
+static CMD_status_t cmd_history(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n != 5) {
+        return CMD_ERR_LENGTH;
+    }
+    uint32_t first = get_u32(args);
+    uint32_t count = args[4];
+    uint32_t oldest = (readings > CMD_HISTORY_SIZE) ? readings - CMD_HISTORY_SIZE : 0;
+    if (first < oldest) {
+        first = oldest;                 // Overwritten, continue with the oldest
+    }
+    if (first > readings) {
+        first = readings;
+    }
+    if (count > readings - first) {
+        count = readings - first;
+    }
+    if (count > CMD_HISTORY_MAX) {
+        count = CMD_HISTORY_MAX;
+    }
+    if (history == NULL) {
+        count = 0;
+    }
+    put_u32(data, first);
+    data[4] = count;
+    for (uint32_t i = 0; i < count; i++) {
+        memcpy(&data[5 + i*sizeof(CMD_reading_t)], &history[(first + i) & HISTORY_MASK],
+               sizeof(CMD_reading_t));
+    }
+    *size = 5 + count*sizeof(CMD_reading_t);
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_EVENTS: load changes from number first on
+ *****************************************************************************/
+static CMD_status_t cmd_events(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n != 5) {
+        return CMD_ERR_LENGTH;
+    }
+    uint32_t first = get_u32(args);
+    uint32_t count = args[4];
+    uint32_t total = DET_get_count();
+    uint32_t oldest = (total > DET_EVENTS) ? total - DET_EVENTS : 0;
+    if (first < oldest) {
+        first = oldest;                 // Overwritten, continue with the oldest
+    }
+    if (first > total) {
+        first = total;
+    }
+    if (count > total - first) {
+        count = total - first;
+    }
+    if (count > DET_EVENTS_MAX) {
+        count = DET_EVENTS_MAX;
+    }
+    put_u32(data, first);
+    data[4] = count;
+    for (uint32_t i = 0; i < count; i++) {
+        DET_event_t event;
+        DET_get_event(first + i, &event);
+        memcpy(&data[5 + i*sizeof(DET_event_t)], &event, sizeof(event));
+    }
+    *size = 5 + count*sizeof(DET_event_t);
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_SESSION: summary of the session, optionally start a new one
+ *****************************************************************************/
+static CMD_status_t cmd_session(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n > 1) {
+        return CMD_ERR_LENGTH;
+    }
+    if (n == 1 && args[0] > 1) {
+        return CMD_ERR_ARGUMENT;
+    }
+    SES_summary_t summary;
+    SES_get_summary(&summary);
+    if (n == 1 && args[0] == 1) {
+        SES_reset();
+    }
+    memcpy(data, &summary, sizeof(summary));
+    *size = sizeof(summary);
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_NULL: capture or clear the background, or its state
+ *****************************************************************************/
+static CMD_status_t cmd_null(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n > 1) {
+        return CMD_ERR_LENGTH;
+    }
+    if (n == 1 && args[0] > 1) {
+        return CMD_ERR_ARGUMENT;
+    }
+    if (n == 1 && args[0] == 1) {
+        null_background_start();
+    } else if (n == 1) {
+        null_background_clear();
+    }
+    CALC_phasor_t background[CALC_CHANNELS];
+    data[0] = get_null_frames();
+    data[1] = get_background(background);
+    *size = 2;
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief CMD_CROSSTALK: capture, apply or clear the decoupling, or its state
+ *****************************************************************************/
+static CMD_status_t cmd_crosstalk(const uint8_t *args, uint32_t n, uint8_t *data, uint32_t *size)
+{
+    if (n > 2 || (n == 2) != (n > 0 && args[0] == 2)) {
+        return CMD_ERR_LENGTH;
+    }
+    if (n == 1 && args[0] == 0) {
+        crosstalk_clear();
+    } else if (n == 1 && args[0] == 1) {
+        if (!crosstalk_apply()) {
+            return CMD_ERR_ARGUMENT;    // Singular
+        }
+    } else if (n == 2) {
+        if (!crosstalk_start(args[1])) {
+            return CMD_ERR_ARGUMENT;
+        }
+    } else if (n == 1) {
+        return CMD_ERR_ARGUMENT;
+    }
+    CALC_phasor_t decoupling[CALC_CHANNELS*CALC_CHANNELS];
+    data[0] = get_crosstalk_frames(&data[1]);
+    data[2] = get_decoupling(decoupling);
+    *size = 3;
+    return CMD_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief Execute a command and add its response record to the batch
+ * @param [in] payload of the SER_FRAME_COMMAND
+ * @param [in] length of the payload
+ *
+ * @note The batch must have space for RECORD_MAX bytes.
+ *****************************************************************************/
+static void execute(const uint8_t *payload, uint32_t length)
+{
+    if (length < 2) {
+        errors++;                       // No sequence number or command
+        return;
+    }
+    const uint8_t *args = &payload[2];
+    uint32_t n = length - 2;
+    uint8_t *record = &batch[batch_length];
+    uint8_t *data = &record[RECORD_HEADER];
+    uint32_t size = 0;
+    CMD_status_t status;
+    switch (payload[1]) {
+        case CMD_PING:
+            data[0] = CMD_PROTOCOL;
+            data[1] = CFG_SETTINGS;
+            data[2] = CMD_HISTORY_SIZE & 0xFF;
+            data[3] = CMD_HISTORY_SIZE >> 8;
+            put_u32(&data[4], HAL_GetTick());
+            size = 8;
+            status = CMD_OK;
+            break;
+        case CMD_GET:
+            status = cmd_get(args, n, data, &size);
+            break;
+        case CMD_SET:
+            status = cmd_set(args, n, data, &size);
+            break;
+        case CMD_CAPTURE:
+            status = cmd_capture(args, n, data, &size);
+            break;
+        case CMD_STATS:
+            status = cmd_stats(n, data, &size);
+            break;
+        case CMD_HISTORY:
+            status = cmd_history(args, n, data, &size);
+            break;
+        case CMD_SNAPSHOT:
+            status = (n != 0) ? CMD_ERR_LENGTH : SNAP_start() ? CMD_OK : CMD_ERR_BUSY;
+            data[0] = SNAP_get_number();
+            size = 1;
+            break;
+        case CMD_SESSION:
+            status = cmd_session(args, n, data, &size);
+            break;
+        case CMD_EVENTS:
+            status = cmd_events(args, n, data, &size);
+            break;
+        case CMD_NULL:
+            status = cmd_null(args, n, data, &size);
+            break;
+        case CMD_CROSSTALK:
+            status = cmd_crosstalk(args, n, data, &size);
+            break;
+        default:
+            status = CMD_ERR_UNKNOWN;
+            break;
+    }
+    if (status != CMD_OK) {
+        size = 0;
+    }
+    record[0] = payload[0];
+    record[1] = payload[1];
+    record[2] = status;
+    record[3] = size;
+    batch_length += RECORD_HEADER + size;
+    commands++;
+}
+
+
+/** ***************************************************************************
+ * @brief Send the batch if the transmit queue has space for it
+ * @return true if the batch is empty now
+ *****************************************************************************/
+static bool flush(void)
+{
+    if (batch_length == 0) {
+        return true;
+    }
+    if (SER_get_free() < batch_length + SER_FRAME_OVERHEAD) {
+        return false;                   // Keep it, nothing is dropped
+    }
+    SER_send_frame(SER_FRAME_RESPONSE, batch, batch_length);
+    batch_length = 0;
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Parse the received bytes, execute the commands and send the responses
+ *
+ * Call once per pass of the main loop, returns without waiting.
+ *****************************************************************************/
+void CMD_update(void)
+{
+    for (uint32_t i = 0; i < CMD_RX_BUDGET; i++) {
+        if (batch_length + RECORD_MAX > CMD_BATCH_SIZE && !flush()) {
+            break;                      // Transmit queue full, commands wait
+        }
+        uint8_t byte;
+        if (SER_read(&byte, 1) == 0) {
+            break;
+        }
+        if (parse(byte)) {
+            execute(parser.payload, parser.length);
+        }
+    }
+    flush();
+}
+
+
+/** ***************************************************************************
+ * @brief Allocate the history in the history arena
+ *
+ * @note Call after ARENA_init().
+ *****************************************************************************/
+void CMD_init(void)
+{
+    history = ARENA_alloc(ARENA_HISTORY, CMD_HISTORY_SIZE * sizeof(CMD_reading_t));
+}
+
+
+/** ***************************************************************************
+ * @brief Add the reading of a processed frame to the history
+ * @param [in] x position [mm] or error code
+ * @param [in] y position [mm] or error code
+ * @param [in] angle [degree] or error code
+ * @param [in] current [A] or error code
+ * @param [in] clip_flags see get_clip_flags()
+ *****************************************************************************/
+void CMD_add_reading(int x, int y, int angle, float current, uint8_t clip_flags)
+{
+    CMD_reading_t unkept;               // Still counted without a history
+    CMD_reading_t *r = (history != NULL) ? &history[readings & HISTORY_MASK] : &unkept;
+    r->time_ms = HAL_GetTick();
+    r->x = x;
+    r->y = y;
+    r->angle = angle;
+    r->current = current;
+    r->clip_flags = clip_flags;
+    r->valid = 0;
+    if (x != CALC_OUTOF_X_RANGE && y != CALC_OUTOF_Y_RANGE) {
+        r->valid |= CMD_VALID_POSITION;
+        valid_readings++;
+        /* The error codes of the current are >= 1000 A */
+        if (current >= 0 && current < CURR_OUTOF_Y_RANGE) {
+            r->valid |= CMD_VALID_CURRENT;
+        }
+    }
+    readings++;
+}
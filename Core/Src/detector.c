@@ -0,0 +1,349 @@
+/** ***************************************************************************
+ * @file
+ * @brief Detection of load changes on the current and the Hall amplitudes
+ *
+ * Each processed frame is added with DET_add_frame().
+ * A two-sided CUSUM per signal (DET_signal_t) detects steps of the level:
+ * @code
+ * z    = (x - level) / noise
+ * up   = max(0, up   + z - DRIFT)     rise
+ * down = max(0, down - z - DRIFT)     fall
+ * @endcode
+ * A step is detected when up or down exceeds the threshold
+ * of the sensitivity (threshold[]). The onset is the frame where the sum
+ * left 0, the new level is the mean since the onset.
+ * The detector then learns the new level for DET_WARMUP frames.
+ * @n Level and noise (mean absolute deviation) follow slow drifts,
+ * the deviations are clipped to NOISE_CLIP in the noise. The noise has a floor (noise_floor[]
+ * and RELATIVE_FLOOR of the level), so steps below some percent are
+ * ignored even if the signal is very clean.
+ * @n The cost per frame is constant, the state is a few floats per signal.
+ *
+ * Events
+ * ------
+ * The last DET_EVENTS steps are kept with their number (DET_get_event())
+ * and exported with CMD_EVENTS (see command.c).
+ * DET_update() in the main loop logs each new event as SER_FRAME_TEXT
+ * and plays an alert on the buzzer, rising for load on, falling for load off.
+ * A switch usually shows on all signals at once, so there is at most
+ * one alert in DET_ALERT_HOLDOFF_MS.
+ *
+ * The sensitivity is the setting CFG_DETECT, 0 turns the detector off.
+ * Tools/host/detect replays capture files with labelled steps
+ * and reports detection rate, false alarms and delay.
+ *
+ * @note The Hall amplitudes also change when the device is moved,
+ * the device must stay clamped to the cable.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "detector.h"
+#include "calculations.h"
+#include "serial.h"
+#include "buzzer.h"
+#include "error_code.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define DRIFT           0.5f            ///< Allowance of the CUSUM [noise]
+#define LEVEL_WEIGHT    (1.0f/64)       ///< Weight of a frame in the level
+#define NOISE_WEIGHT    (1.0f/32)       ///< Weight of a frame in the noise
+#define NOISE_CLIP      3.0f            ///< Max deviation in the noise [noise]
+#define MAD_TO_STD      1.25f           ///< Standard deviation / mean absolute deviation
+#define RELATIVE_FLOOR  0.01f           ///< Min noise relative to the level
+#define EVENTS_MASK     (DET_EVENTS-1)  ///< Index mask of the events
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** One side of the CUSUM */
+typedef struct {
+    float sum;              ///< up or down, 0 = no step in progress
+    float values;           ///< Sum of the values since the onset
+    uint16_t frames;        ///< Frames since the onset
+    uint32_t onset_ms;      ///< Time of the first frame with sum > 0
+} side_t;
+
+/** State of one signal */
+typedef struct {
+    uint32_t frames;        ///< Valid frames since the reset or the last step
+    bool noise_known;       ///< noise has been learned
+    float level;            ///< Level of the signal
+    float noise;            ///< Mean absolute deviation from the level
+    side_t up;              ///< Rise
+    side_t down;            ///< Fall
+} cusum_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const float threshold[DET_SENSITIVITIES+1] = {   ///< Threshold per sensitivity
+        0, 16.0f, 11.0f, 8.0f, 6.0f, 5.0f
+};
+static const float noise_floor[DET_SIGNALS] = {         ///< Min noise of each signal
+        [DET_CURRENT] = 0.05f,
+        [DET_LHALL] = 1.0f,
+        [DET_RHALL] = 1.0f,
+};
+static const char *const signal_name[DET_SIGNALS] = {   ///< Names in the log
+        [DET_CURRENT] = "current",
+        [DET_LHALL] = "LHALL",
+        [DET_RHALL] = "RHALL",
+};
+
+static cusum_t cusum[DET_SIGNALS];      ///< State of each signal
+static uint8_t sensitivity = 0;         ///< 0 = off
+static DET_event_t events[DET_EVENTS];  ///< Last events
+static uint32_t event_count = 0;        ///< Events detected
+static uint32_t event_reported = 0;     ///< Events logged by DET_update()
+static uint32_t alert_ms = 0;           ///< Time of the last alert
+static bool alerted = false;            ///< An alert has been played
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Advance one side of the CUSUM
+ * @param [in] s side
+ * @param [in] increment z - DRIFT (rise) or -z - DRIFT (fall)
+ * @param [in] value of the frame
+ * @param [in] now time of the frame
+ *****************************************************************************/
+static void advance(side_t *s, float increment, float value, uint32_t now)
+{
+    if (s->sum + increment <= 0) {
+        s->sum = 0;
+        return;
+    }
+    if (s->sum == 0) {                  // Possible onset of a step
+        s->values = 0;
+        s->frames = 0;
+        s->onset_ms = now;
+    }
+    s->sum += increment;
+    s->values += value;
+    if (s->frames < UINT16_MAX) {
+        s->frames++;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Add an event to the ring
+ *****************************************************************************/
+static void add_event(DET_signal_t signal, int direction, const cusum_t *c,
+                      const side_t *s, uint32_t now)
+{
+    DET_event_t *e = &events[event_count & EVENTS_MASK];
+    e->time_ms = now;
+    e->onset_ms = s->onset_ms;
+    e->signal = signal;
+    e->direction = direction;
+    e->frames = s->frames;
+    e->before = c->level;
+    e->after = s->values / s->frames;
+    event_count++;
+}
+
+
+/** ***************************************************************************
+ * @brief Add a valid value of one signal
+ * @param [in] signal
+ * @param [in] value
+ * @param [in] now time of the frame
+ *****************************************************************************/
+static void update(DET_signal_t signal, float value, uint32_t now)
+{
+    cusum_t *c = &cusum[signal];
+
+    if (c->frames < DET_WARMUP) {       // Learn the level (and the noise)
+        c->frames++;
+        float deviation = value - c->level;
+        c->level += deviation / c->frames;
+        if (!c->noise_known && c->frames > 1) {
+            c->noise += (fabsf(value - c->level) - c->noise) / (c->frames - 1);
+        }
+        if (c->frames == DET_WARMUP) {
+            c->noise_known = true;
+        }
+        return;
+    }
+
+    float noise = c->noise * MAD_TO_STD;
+    if (noise < noise_floor[signal]) {
+        noise = noise_floor[signal];
+    }
+    if (noise < RELATIVE_FLOOR * fabsf(c->level)) {
+        noise = RELATIVE_FLOOR * fabsf(c->level);
+    }
+    float z = (value - c->level) / noise;
+    advance(&c->up, z - DRIFT, value, now);
+    advance(&c->down, -z - DRIFT, value, now);
+
+    const side_t *step = NULL;
+    int direction = 0;
+    if (c->up.sum > threshold[sensitivity]) {
+        step = &c->up;
+        direction = 1;
+    } else if (c->down.sum > threshold[sensitivity]) {
+        step = &c->down;
+        direction = -1;
+    }
+    if (step != NULL) {
+        add_event(signal, direction, c, step, now);
+        c->level = step->values / step->frames;
+        c->frames = 0;                  // Learn the new level, keep the noise
+        memset(&c->up, 0, sizeof(c->up));
+        memset(&c->down, 0, sizeof(c->down));
+        return;
+    }
+
+    /* Follow slow drifts, a deviation counts at most NOISE_CLIP
+     * in the noise, so a step in progress hardly raises it */
+    float deviation = fabsf(value - c->level);
+    if (deviation > NOISE_CLIP * noise / MAD_TO_STD) {
+        deviation = NOISE_CLIP * noise / MAD_TO_STD;
+    }
+    c->noise += NOISE_WEIGHT * (deviation - c->noise);
+    c->level += LEVEL_WEIGHT * (value - c->level);
+}
+
+
+/** ***************************************************************************
+ * @brief Forget the levels, e.g. when the measurement setting changes
+ *
+ * The events are kept.
+ *****************************************************************************/
+void DET_reset(void)
+{
+    memset(cusum, 0, sizeof(cusum));
+}
+
+
+/** ***************************************************************************
+ * @brief Set the sensitivity
+ * @param [in] value 1 (coarse) ... DET_SENSITIVITIES (fine), 0 = off
+ *
+ * Turning the detector on starts with learning the levels.
+ *****************************************************************************/
+void DET_set_sensitivity(uint8_t value)
+{
+    if (value > DET_SENSITIVITIES) {
+        value = DET_SENSITIVITIES;
+    }
+    if (sensitivity == 0 && value != 0) {
+        DET_reset();
+    }
+    sensitivity = value;
+}
+
+
+/** ***************************************************************************
+ * @brief Add the result of a processed frame
+ * @param [in] time_ms time of the frame
+ * @param [in] current [A] or error code
+ * @param [in] lhall 50 Hz amplitude of the left Hall sensor, see calculate_amplitude()
+ * @param [in] rhall same for the right Hall sensor
+ * @param [in] clip_flags see get_clip_flags(), a clipped amplitude is skipped
+ *****************************************************************************/
+void DET_add_frame(uint32_t time_ms, float current, float lhall, float rhall, uint8_t clip_flags)
+{
+    if (sensitivity == 0) {
+        return;
+    }
+    /* The error codes of the current are >= 1000 A */
+    if (current >= 0 && current < CURR_OUTOF_Y_RANGE) {
+        update(DET_CURRENT, current, time_ms);
+    }
+    if (!(clip_flags & (1u << CALC_LHALL))) {
+        update(DET_LHALL, lhall, time_ms);
+    }
+    if (!(clip_flags & (1u << CALC_RHALL))) {
+        update(DET_RHALL, rhall, time_ms);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Number of events detected
+ *****************************************************************************/
+uint32_t DET_get_count(void)
+{
+    return event_count;
+}
+
+
+/** ***************************************************************************
+ * @brief Event with a number
+ * @param [in] number 0 = first event
+ * @param [out] event
+ * @return false if the event is not detected yet or overwritten
+ *****************************************************************************/
+bool DET_get_event(uint32_t number, DET_event_t *event)
+{
+    if (number >= event_count || event_count - number > DET_EVENTS) {
+        return false;
+    }
+    *event = events[number & EVENTS_MASK];
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Text of an event for the log
+ * @param [in] event
+ * @param [out] text
+ * @param [in] size of text
+ * @return length as snprintf()
+ *****************************************************************************/
+int DET_format_event(const DET_event_t *event, char *text, size_t size)
+{
+    const char *name = (event->signal < DET_SIGNALS) ? signal_name[event->signal] : "?";
+    return snprintf(text, size, "%u.%01u s: load %s, %s %.2f -> %.2f (onset %u.%01u s)\r\n",
+            (unsigned)(event->time_ms / 1000), (unsigned)(event->time_ms / 100 % 10),
+            (event->direction > 0) ? "on" : "off", name, event->before, event->after,
+            (unsigned)(event->onset_ms / 1000), (unsigned)(event->onset_ms / 100 % 10));
+}
+
+
+/** ***************************************************************************
+ * @brief Log the new events and play the alert
+ *
+ * Call once per pass of the main loop.
+ *****************************************************************************/
+void DET_update(void)
+{
+    while (event_reported < event_count) {
+        DET_event_t event;
+        if (!DET_get_event(event_reported++, &event)) {
+            continue;                   // Overwritten before it was logged
+        }
+        char text[80];
+        int length = DET_format_event(&event, text, sizeof(text));
+        if (length > (int)sizeof(text) - 1) {
+            length = sizeof(text) - 1;
+        }
+        SER_send_frame(SER_FRAME_TEXT, text, length);
+        if (!alerted || event.time_ms - alert_ms >= DET_ALERT_HOLDOFF_MS) {
+            BUZZER_play_alert(event.direction > 0);
+            alert_ms = event.time_ms;
+            alerted = true;
+        }
+    }
+}
@@ -0,0 +1,352 @@
+/** ***************************************************************************
+ * @file
+ * @brief Retained display list: only the changes of a page are drawn
+ *
+ * The act functions of the pages (see menu.c) no longer draw directly.
+ * They describe the whole page in each pass as a list of primitives
+ * (text, line, circle, filled rectangle) between DISP_begin() and DISP_commit().
+ * DISP_commit() compares the list with the one shown before,
+ * primitive by primitive in the order they were added:
+ * - Unchanged primitives are not drawn.
+ * - A changed text at the same place with the same font and background
+ *   is drawn padded with blanks to the old length, its background covers the old text.
+ * - Other changed or removed primitives are erased: texts are filled
+ *   with their background, lines, circles and rectangles are drawn
+ *   in DISP_BACKGROUND. Then the new primitives are drawn.
+ * - An unchanged primitive is redrawn if its bounding box overlaps
+ *   an erased primitive or a primitive drawn before it in the list.
+ *   The list order is the drawing order, so the result is the same
+ *   as drawing the whole list on a cleared data area.
+ *
+ * The pages are drawn in every pass of the main loop,
+ * mostly without any change. The frame buffer in the SDRAM is now only
+ * written where the page changes, and the pages need no erase bookkeeping.
+ * @n The static parts of a page (labels) are drawn once by its init function.
+ * DISP_invalidate() is called when the data area is cleared (MENU_clear()),
+ * then the next DISP_commit() draws the whole list.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <string.h>
+#include "display.h"
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Kind of primitive */
+typedef enum {
+    TEXT = 0,               ///< x, y, font, colors, text
+    LINE,                   ///< From x, y to x2, y2
+    CIRCLE,                 ///< Center x, y, radius x2
+    RECT                    ///< Filled, x, y, width x2, height y2
+} kind_t;
+
+/** Primitive of the list, compared with memcmp() */
+typedef struct {
+    uint8_t kind;           ///< kind_t
+    uint8_t length;         ///< Characters of text
+    int16_t x;              ///< Left, start or center
+    int16_t y;              ///< Top, start or center
+    int16_t x2;             ///< End, radius or width
+    int16_t y2;             ///< End or height
+    uint32_t color;         ///< Text or drawing color
+    uint32_t back;          ///< Background of text
+    const sFONT *font;      ///< Font of text
+    char text[DISP_TEXT_SIZE];  ///< Text, 0-terminated
+} item_t;
+
+/** Bounding box, inclusive */
+typedef struct {
+    int16_t x0;             ///< Left
+    int16_t y0;             ///< Top
+    int16_t x1;             ///< Right
+    int16_t y1;             ///< Bottom
+} box_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static item_t list[2][DISP_ITEMS];      ///< Shown and building list
+static uint16_t count[2];               ///< Primitives of each list
+static uint8_t shown = 0;               ///< Index of the list on the screen
+static bool valid = false;              ///< The shown list is on the screen
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Next free primitive of the building list
+ * @return NULL if the list is full, the primitive is dropped
+ *****************************************************************************/
+static item_t *add(kind_t kind)
+{
+    uint8_t building = 1 - shown;
+    if (count[building] >= DISP_ITEMS) {
+        return NULL;
+    }
+    item_t *item = &list[building][count[building]++];
+    memset(item, 0, sizeof(*item));     // Padding and text are compared
+    item->kind = kind;
+    return item;
+}
+
+
+/** ***************************************************************************
+ * @brief Bounding box of a primitive
+ * @param [in] item
+ * @param [in] length characters of a text, may be longer than the text (padding)
+ *****************************************************************************/
+static box_t bounds(const item_t *item, uint16_t length)
+{
+    box_t b = {item->x, item->y, item->x, item->y};
+    switch (item->kind) {
+        case TEXT:
+            b.x1 = item->x + length * item->font->Width - 1;
+            b.y1 = item->y + item->font->Height - 1;
+            break;
+        case LINE:
+            b.x0 = (item->x < item->x2) ? item->x : item->x2;
+            b.x1 = (item->x < item->x2) ? item->x2 : item->x;
+            b.y0 = (item->y < item->y2) ? item->y : item->y2;
+            b.y1 = (item->y < item->y2) ? item->y2 : item->y;
+            break;
+        case CIRCLE:
+            b.x0 = item->x - item->x2;
+            b.x1 = item->x + item->x2;
+            b.y0 = item->y - item->x2;
+            b.y1 = item->y + item->x2;
+            break;
+        case RECT:
+            b.x1 = item->x + item->x2 - 1;
+            b.y1 = item->y + item->y2 - 1;
+            break;
+    }
+    return b;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if two bounding boxes overlap
+ *****************************************************************************/
+static bool overlap(const box_t *a, const box_t *b)
+{
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+
+/** ***************************************************************************
+ * @brief Draw a primitive
+ * @param [in] item
+ * @param [in] length characters of a text, padded with blanks
+ * @param [in] erase draw in the background instead
+ *****************************************************************************/
+static void draw(const item_t *item, uint16_t length, bool erase)
+{
+    uint32_t color = erase ? DISP_BACKGROUND : item->color;
+    switch (item->kind) {
+        case TEXT:
+            if (erase) {
+                BSP_LCD_SetTextColor(item->back);
+                BSP_LCD_FillRect(item->x, item->y, item->length * item->font->Width,
+                        item->font->Height);
+            } else {
+                char text[DISP_TEXT_SIZE];
+                memset(text, ' ', length);
+                memcpy(text, item->text, item->length);
+                text[length] = '\0';
+                BSP_LCD_SetFont((sFONT *)item->font);
+                BSP_LCD_SetBackColor(item->back);
+                BSP_LCD_SetTextColor(item->color);
+                BSP_LCD_DisplayStringAt(item->x, item->y, (uint8_t *)text, LEFT_MODE);
+            }
+            break;
+        case LINE:
+            BSP_LCD_SetTextColor(color);
+            BSP_LCD_DrawLine(item->x, item->y, item->x2, item->y2);
+            break;
+        case CIRCLE:
+            BSP_LCD_SetTextColor(color);
+            BSP_LCD_DrawCircle(item->x, item->y, item->x2);
+            break;
+        case RECT:
+            BSP_LCD_SetTextColor(color);
+            BSP_LCD_FillRect(item->x, item->y, item->x2, item->y2);
+            break;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Forget the shown list, the data area has been cleared
+ *****************************************************************************/
+void DISP_invalidate(void)
+{
+    valid = false;
+}
+
+
+/** ***************************************************************************
+ * @brief Start the list of a pass
+ *****************************************************************************/
+void DISP_begin(void)
+{
+    count[1 - shown] = 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Add a text
+ * @param [in] x left
+ * @param [in] y top
+ * @param [in] font
+ * @param [in] color of the characters
+ * @param [in] back background of the characters
+ * @param [in] text at most DISP_TEXT_SIZE-1 characters, longer text is cut
+ *****************************************************************************/
+void DISP_text(uint16_t x, uint16_t y, const sFONT *font, uint32_t color, uint32_t back,
+               const char *text)
+{
+    item_t *item = add(TEXT);
+    if (item == NULL) {
+        return;
+    }
+    item->x = x;
+    item->y = y;
+    item->font = font;
+    item->color = color;
+    item->back = back;
+    strncpy(item->text, text, DISP_TEXT_SIZE-1);
+    item->length = strlen(item->text);
+}
+
+
+/** ***************************************************************************
+ * @brief Add a line
+ *****************************************************************************/
+void DISP_line(uint16_t x1, uint16_t y1, uint16_t x2, uint16_t y2, uint32_t color)
+{
+    item_t *item = add(LINE);
+    if (item == NULL) {
+        return;
+    }
+    item->x = x1;
+    item->y = y1;
+    item->x2 = x2;
+    item->y2 = y2;
+    item->color = color;
+}
+
+
+/** ***************************************************************************
+ * @brief Add a circle
+ *****************************************************************************/
+void DISP_circle(uint16_t x, uint16_t y, uint16_t radius, uint32_t color)
+{
+    item_t *item = add(CIRCLE);
+    if (item == NULL) {
+        return;
+    }
+    item->x = x;
+    item->y = y;
+    item->x2 = radius;
+    item->color = color;
+}
+
+
+/** ***************************************************************************
+ * @brief Add a filled rectangle, e.g. a bar
+ *****************************************************************************/
+void DISP_rect(uint16_t x, uint16_t y, uint16_t width, uint16_t height, uint32_t color)
+{
+    if (width == 0 || height == 0) {
+        return;                         // Nothing to draw
+    }
+    item_t *item = add(RECT);
+    if (item == NULL) {
+        return;
+    }
+    item->x = x;
+    item->y = y;
+    item->x2 = width;
+    item->y2 = height;
+    item->color = color;
+}
+
+
+/** ***************************************************************************
+ * @brief Draw the differences to the shown list
+ *
+ * The list becomes the shown list.
+ *****************************************************************************/
+void DISP_commit(void)
+{
+    uint8_t building = 1 - shown;
+    const item_t *old = list[shown];
+    const item_t *new = list[building];
+    uint16_t n_old = valid ? count[shown] : 0;
+    uint16_t n_new = count[building];
+    uint16_t n = (n_old > n_new) ? n_old : n_new;
+
+    bool changed[DISP_ITEMS] = {false};
+    uint16_t length[DISP_ITEMS];        // Drawn characters of the texts
+    box_t erased[DISP_ITEMS];
+    uint16_t n_erased = 0;
+
+    /* Erase the old primitives which are not covered by the new ones */
+    for (uint16_t i = 0; i < n; i++) {
+        if (i < n_new) {
+            length[i] = new[i].length;
+        }
+        if (i < n_old && i < n_new && memcmp(&old[i], &new[i], sizeof(item_t)) == 0) {
+            continue;
+        }
+        if (i < n_new) {
+            changed[i] = true;
+        }
+        if (i >= n_old) {
+            continue;
+        }
+        if (i < n_new && old[i].kind == TEXT && new[i].kind == TEXT
+                && old[i].x == new[i].x && old[i].y == new[i].y
+                && old[i].font == new[i].font && old[i].back == new[i].back) {
+            if (length[i] < old[i].length) {
+                length[i] = old[i].length;  // Blanks overwrite the rest
+            }
+            continue;
+        }
+        draw(&old[i], old[i].length, true);
+        erased[n_erased++] = bounds(&old[i], old[i].length);
+    }
+
+    /* Draw in list order: the changed primitives and the unchanged ones
+     * overlapping an erased area or a primitive drawn before */
+    box_t drawn[DISP_ITEMS];
+    uint16_t n_drawn = 0;
+    for (uint16_t i = 0; i < n_new; i++) {
+        box_t b = bounds(&new[i], length[i]);
+        bool repaint = changed[i];
+        for (uint16_t k = 0; k < n_erased && !repaint; k++) {
+            repaint = overlap(&b, &erased[k]);
+        }
+        for (uint16_t k = 0; k < n_drawn && !repaint; k++) {
+            repaint = overlap(&b, &drawn[k]);
+        }
+        if (repaint) {
+            draw(&new[i], length[i], false);
+            drawn[n_drawn++] = b;
+        }
+    }
+
+    shown = building;
+    valid = true;
+}
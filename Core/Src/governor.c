@@ -0,0 +1,315 @@
+/** ***************************************************************************
+ * @file
+ * @brief Load governor: sheds features when the main loop falls behind
+ *
+ * Budgets
+ * =======
+ * The work of the main loop is split into stages (GOV_stage_t),
+ * each enclosed in GOV_begin() and GOV_end(). The costs are summed
+ * per frame period and checked by GOV_frame() when a new frame is processed.
+ * Each stage has a budget of the frame period (budget_permille[]).
+ * The frame period follows the sampling rate, which MAINS_apply()
+ * passes to GOV_set_rate() (e.g. 299 ms at 214 Hz for 16.7 Hz mains).
+ * A frame period is under pressure if
+ * - a stage takes more than its budget,
+ * - all stages together take more than GOV_LOAD_HIGH or
+ * - the frame waited more than GOV_LATE_US to be processed.
+ * The acquisition restarts only after a frame has been processed
+ * (see calculate_pos()), a slow loop lowers the frame rate.
+ *
+ * Shedding
+ * ========
+ * After GOV_RAISE_FRAMES under pressure the next feature is shed,
+ * in the order of GOV_feature_t:
+ * | Level | Shed                                   | Call site               |
+ * | :---- | :------------------------------------- | :---------------------- |
+ * | 1     | display refresh, every 2nd frame       | GOV_draw_due()          |
+ * | 2     | text pages, once per second            | GOV_draw_due()          |
+ * | 3     | memory reports, trace dumps, snapshots | GOV_shed() in main()    |
+ * The acquisition, the signal processing, the capture and the commands
+ * are never shed.
+ *
+ * Restoring
+ * =========
+ * The first frame period after shedding gives the factor of each stage:
+ * cost before / cost after (factor[]). The costs with the feature back
+ * are predicted with this factor. After relax_frames with a predicted
+ * load below GOV_LOAD_LOW and no stage predicted over its budget,
+ * the last shed feature is restored. A feature that was needed
+ * is not restored as long as the load is the same.
+ * @n If a restored feature still brings back the pressure within
+ * relax_frames, relax_frames is doubled up to GOV_RELAX_MAX,
+ * so the level does not toggle. It returns to GOV_RELAX_FRAMES
+ * when level 0 holds as long.
+ *
+ * The level is shown in the title of each page and with the costs
+ * on the diagnostics page (see menu.c).
+ * Tools/host/governor_sim drives the governor with injected costs.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <string.h>
+#include "governor.h"
+#include "profiling.h"
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const uint16_t budget_permille[GOV_STAGES] = {  ///< Budget of each stage
+        [GOV_DSP]       = 150,
+        [GOV_LCD]       = 400,
+        [GOV_TELEMETRY] = 150,
+        [GOV_INPUT]     = 100,
+};
+
+static GOV_status_t status;             ///< State of the governor
+static uint32_t frame_us = GOV_FRAME_US; ///< Frame period, see GOV_set_rate()
+static uint32_t cost_us[GOV_STAGES];    ///< Costs of the running frame period
+static uint32_t before_us[GOV_STAGES];  ///< Costs of the frame period before the last shedding
+static bool measure = false;            ///< Next frame period gives the factors of the level
+static uint16_t factor[GOV_LEVELS+1][GOV_STAGES];   ///< Cost without / with the shed feature [permille]
+static uint32_t restored_frame = 0;     ///< Frame of the last restored feature
+static bool restored = false;           ///< A feature has been restored since the last shedding
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Start with all features
+ *****************************************************************************/
+void GOV_init(void)
+{
+    memset(&status, 0, sizeof(status));
+    memset(cost_us, 0, sizeof(cost_us));
+    status.relax_frames = GOV_RELAX_FRAMES;
+    restored = false;
+    measure = false;
+}
+
+
+/** ***************************************************************************
+ * @brief Set the frame period from the sampling rate
+ * @param [in] fs sampling frequency [Hz], 0 = GOV_FRAME_US (software triggered)
+ *
+ * The budgets scale with the period. GOV_init() keeps it.
+ *****************************************************************************/
+void GOV_set_rate(uint32_t fs)
+{
+    frame_us = (fs > 0) ? (uint32_t)(1000000ULL*ADC_NUMS/fs) : GOV_FRAME_US;
+}
+
+
+/** ***************************************************************************
+ * @brief Frame period
+ * @return [us]
+ *****************************************************************************/
+uint32_t GOV_get_frame_us(void)
+{
+    return frame_us;
+}
+
+
+/** ***************************************************************************
+ * @brief Factor of the costs before and after shedding
+ * @param [in] before cost [us]
+ * @param [in] after cost [us]
+ * @return before / after [permille], GOV_FACTOR_MAX if nothing is left
+ *****************************************************************************/
+static uint16_t cost_factor(uint32_t before, uint32_t after)
+{
+    if (before <= after) {
+        return 1000;                    // Nothing saved
+    }
+    if (after == 0 || before / after >= GOV_FACTOR_MAX / 1000) {
+        return GOV_FACTOR_MAX;
+    }
+    return (uint64_t)before * 1000 / after;
+}
+
+
+/** ***************************************************************************
+ * @brief Start of a stage
+ * @return start, pass it to GOV_end()
+ *****************************************************************************/
+uint32_t GOV_begin(void)
+{
+    return PROF_get_cycles();
+}
+
+
+/** ***************************************************************************
+ * @brief End of a stage
+ * @param [in] stage
+ * @param [in] start return value of GOV_begin()
+ *****************************************************************************/
+void GOV_end(GOV_stage_t stage, uint32_t start)
+{
+    GOV_add_cost(stage, PROF_cycles_to_us(PROF_get_cycles() - start));
+}
+
+
+/** ***************************************************************************
+ * @brief Charge a cost to a stage
+ * @param [in] stage
+ * @param [in] us CPU time
+ *****************************************************************************/
+void GOV_add_cost(GOV_stage_t stage, uint32_t us)
+{
+    if (stage < GOV_STAGES) {
+        cost_us[stage] += us;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Close the frame period and decide the level
+ * @param [in] age_us age of the new frame, see MEAS_get_frame_age_us()
+ *
+ * Call once per processed frame, after the signal processing.
+ *****************************************************************************/
+void GOV_frame(uint32_t age_us)
+{
+    uint32_t total = 0;
+    bool over = false;
+    for (int s = 0; s < GOV_STAGES; s++) {
+        total += cost_us[s];
+        if (cost_us[s] > GOV_get_budget_us(s)) {
+            status.over[s]++;
+            over = true;
+        }
+        status.cost_us[s] = cost_us[s];
+        cost_us[s] = 0;
+    }
+    bool late = (age_us > GOV_LATE_US);
+    status.late += late;
+    status.age_us = age_us;
+    status.frames++;
+
+    if (measure) {                      // First frame period after shedding
+        for (int s = 0; s < GOV_STAGES; s++) {
+            factor[status.level][s] = cost_factor(before_us[s], status.cost_us[s]);
+        }
+        measure = false;
+    }
+
+    if (over || late || total > frame_us / 1000 * GOV_LOAD_HIGH) {
+        status.relief = 0;
+        if (status.pressure < UINT8_MAX) {
+            status.pressure++;
+        }
+        if (status.pressure >= GOV_RAISE_FRAMES && status.level < GOV_LEVELS) {
+            if (restored && status.frames - restored_frame <= status.relax_frames) {
+                status.relax_frames *= 2;   // The restored feature was needed
+                if (status.relax_frames > GOV_RELAX_MAX) {
+                    status.relax_frames = GOV_RELAX_MAX;
+                }
+            }
+            restored = false;
+            memcpy(before_us, status.cost_us, sizeof(before_us));
+            measure = true;
+            status.level++;
+            status.changes++;
+            status.pressure = 0;
+        }
+        return;
+    }
+    status.pressure = 0;
+
+    /* Costs with the last shed feature restored */
+    uint32_t predicted = 0;
+    bool fits = true;
+    for (int s = 0; s < GOV_STAGES; s++) {
+        uint32_t cost = status.cost_us[s];
+        if (status.level > 0) {
+            cost = (uint64_t)cost * factor[status.level][s] / 1000;
+        }
+        predicted += cost;
+        fits &= (cost <= GOV_get_budget_us(s));
+    }
+    if (!fits || predicted >= frame_us / 1000 * GOV_LOAD_LOW) {
+        status.relief = 0;              // The feature is still needed
+        return;
+    }
+    if (status.relief < UINT16_MAX) {
+        status.relief++;
+    }
+    if (status.relief < status.relax_frames) {
+        return;
+    }
+    status.relief = 0;
+    if (status.level > 0) {
+        status.level--;
+        status.changes++;
+        restored_frame = status.frames;
+        restored = true;
+    } else {
+        status.relax_frames = GOV_RELAX_FRAMES;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Number of shed features
+ * @return 0 (everything runs) ... GOV_LEVELS
+ *****************************************************************************/
+uint8_t GOV_get_level(void)
+{
+    return status.level;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if a feature is shed
+ * @param [in] feature
+ *****************************************************************************/
+bool GOV_shed(GOV_feature_t feature)
+{
+    return status.level > feature;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if the page is drawn in this pass of the main loop
+ * @param [in] new_frame a frame has been processed in this pass
+ * @param [in] text_page diagnostics, memory or session page
+ *
+ * Call after GOV_frame().
+ *****************************************************************************/
+bool GOV_draw_due(bool new_frame, bool text_page)
+{
+    if (text_page && GOV_shed(GOV_SHED_PAGES)) {
+        return new_frame && (status.frames % GOV_PAGE_FRAMES == 0);
+    }
+    if (GOV_shed(GOV_SHED_UI)) {
+        return new_frame && (status.frames % GOV_UI_DIVIDER == 0);
+    }
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Budget of a stage
+ * @param [in] stage
+ * @return CPU time per frame period [us]
+ *****************************************************************************/
+uint32_t GOV_get_budget_us(GOV_stage_t stage)
+{
+    return (stage < GOV_STAGES) ? frame_us / 1000 * budget_permille[stage] : 0;
+}
+
+
+/** ***************************************************************************
+ * @brief State and costs of the last frame period
+ *****************************************************************************/
+GOV_status_t GOV_get_status(void)
+{
+    return status;
+}
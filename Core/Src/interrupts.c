@@ -0,0 +1,261 @@
+/** ***************************************************************************
+ * @file
+ * @brief Interrupt priorities, deferred work and latency measurement
+ *
+ * Priorities
+ * ==========
+ * All 4 priority bits are used for preemption (no subpriorities).
+ * @n The acquisition has the highest priority, so no other handler
+ * delays the reading of the ADC. The priorities are defined in interrupts.h
+ * and set by the modules before they enable their interrupts.
+ * @n SysTick is above the user interface, because the blocking I2C transfers
+ * of the touch controller need HAL_GetTick() for their timeouts.
+ *
+ * Deferred work
+ * =============
+ * Long work requested by an interrupt handler is passed to IRQ_defer().
+ * It is executed by the PendSV handler with the lowest priority,
+ * so it can be preempted by every other interrupt.
+ *
+ * Critical sections
+ * =================
+ * IRQ_mask() masks the interrupts up to a priority with BASEPRI,
+ * interrupts of higher priority are still served.
+ * Data shared with a handler is protected by masking its priority:
+ * @code
+ * uint32_t basepri = IRQ_mask(IRQ_PRIO_BUTTON);
+ * ... // Access data shared with EXTI0_IRQHandler()
+ * IRQ_unmask(basepri);
+ * @endcode
+ * @note BASEPRI can not mask priority 0,
+ * IRQ_mask(IRQ_PRIO_ACQ) therefore disables all interrupts with PRIMASK.
+ *
+ * Latency
+ * =======
+ * The handlers call IRQ_enter() first and IRQ_exit() last.
+ * The cycles in between are measured with the DWT counter
+ * and the longest time of each source is stored.
+ * Where the time of the event is known, the handler calls IRQ_latency()
+ * with the cycles from the event to the handler entry:
+ * - SysTick: cycles since the reload of the counter (LOAD - VAL)
+ * - ADC: cycles since the entry of the TIM2 handler, which is called
+ *   at the trigger of the conversion. This includes the conversion time
+ *   of the injected group (the pads).
+ *
+ * With TRACE_ENABLED, IRQ_enter() and IRQ_exit() also record
+ * TRACE_ISR_ENTER and TRACE_ISR_EXIT for the sources in IRQ_TRACE_MASK.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "interrupts.h"
+#include "profiling.h"
+#include "trace.h"
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static IRQ_stats_t stats[IRQ_SOURCES];      ///< Worst case timing of each source
+static IRQ_job_t jobs[IRQ_MAX_JOBS];        ///< Pending deferred jobs
+
+static const char *names[IRQ_SOURCES] = {   ///< Short names for the display
+        [IRQ_SRC_ADC]      = "ADC",
+        [IRQ_SRC_ACQ_DMA]  = "DMA",
+        [IRQ_SRC_TIM2]     = "TIM2",
+        [IRQ_SRC_SYSTICK]  = "Tick",
+        [IRQ_SRC_SERIAL]   = "UART",
+        [IRQ_SRC_BUZZER]   = "TIM5",
+        [IRQ_SRC_BUTTON]   = "Btn",
+        [IRQ_SRC_TOUCH]    = "TS",
+        [IRQ_SRC_DEFERRED] = "PSV",
+};
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Set the priority grouping and the priorities of the core exceptions
+ *
+ * @note Call after SystemClock_Config() and before the peripherals are initialized.
+ *****************************************************************************/
+void IRQ_init(void)
+{
+    NVIC_SetPriorityGrouping(0x3);      // 4 bits preemption, 0 bits subpriority
+    HAL_InitTick(IRQ_PRIO_TICK);        // Also stored for later HAL_InitTick() calls
+    NVIC_SetPriority(PendSV_IRQn, IRQ_PRIO_DEFERRED);
+}
+
+
+/** ***************************************************************************
+ * @brief Mask interrupts of lower or equal priority
+ * @param [in] priority
+ * @return Previous mask for IRQ_unmask()
+ *
+ * The mask is only raised, nested calls are possible.
+ *****************************************************************************/
+uint32_t IRQ_mask(uint32_t priority)
+{
+    uint32_t basepri = __get_BASEPRI() | (__get_PRIMASK() << 31);
+    if (priority == 0) {
+        __disable_irq();                // BASEPRI = 0 would mask nothing
+    } else {
+        __set_BASEPRI_MAX(priority << (8U - __NVIC_PRIO_BITS));
+    }
+    return basepri;
+}
+
+
+/** ***************************************************************************
+ * @brief Restore the mask
+ * @param [in] basepri value returned by IRQ_mask()
+ *****************************************************************************/
+void IRQ_unmask(uint32_t basepri)
+{
+    __set_BASEPRI(basepri & 0xFF);
+    if (!(basepri >> 31)) {
+        __enable_irq();
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Execute a job in the PendSV handler
+ * @param [in] job
+ *
+ * A job which is already pending is not added a second time.
+ * If IRQ_MAX_JOBS are pending, the job is dropped.
+ *****************************************************************************/
+void IRQ_defer(IRQ_job_t job)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    int free = -1;
+    for (int i = 0; i < IRQ_MAX_JOBS; i++) {
+        if (jobs[i] == job) {
+            free = -2;                  // Already pending
+            break;
+        }
+        if (jobs[i] == 0 && free == -1) {
+            free = i;
+        }
+    }
+    if (free >= 0) {
+        jobs[free] = job;
+    }
+    __set_PRIMASK(primask);
+    SCB->ICSR = SCB_ICSR_PENDSVSET_Msk; // Request PendSV
+}
+
+
+/** ***************************************************************************
+ * @brief Start of a handler
+ * @param [in] source
+ * @return Cycle count for IRQ_exit()
+ *****************************************************************************/
+uint32_t IRQ_enter(IRQ_source_t source)
+{
+    uint32_t start = DWT->CYCCNT;
+    if (IRQ_TRACE_MASK & (1UL << source)) {
+        TRACE(TRACE_ISR_ENTER, source);
+    }
+    return start;
+}
+
+
+/** ***************************************************************************
+ * @brief End of a handler
+ * @param [in] source
+ * @param [in] start value returned by IRQ_enter()
+ *****************************************************************************/
+void IRQ_exit(IRQ_source_t source, uint32_t start)
+{
+    uint32_t ns = PROF_cycles_to_ns(DWT->CYCCNT - start);
+    stats[source].count++;
+    if (ns > stats[source].max_run_ns) {
+        stats[source].max_run_ns = ns;
+    }
+    if (IRQ_TRACE_MASK & (1UL << source)) {
+        TRACE(TRACE_ISR_EXIT, source);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Record the entry latency of a handler
+ * @param [in] source
+ * @param [in] cycles from the event to the handler entry
+ *****************************************************************************/
+void IRQ_latency(IRQ_source_t source, uint32_t cycles)
+{
+    uint32_t ns = PROF_cycles_to_ns(cycles);
+    if (ns > stats[source].max_latency_ns) {
+        stats[source].max_latency_ns = ns;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Worst case timing of a source
+ * @param [in] source
+ * @return stats
+ *****************************************************************************/
+IRQ_stats_t IRQ_get_stats(IRQ_source_t source)
+{
+    IRQ_stats_t s;
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_ACQ);
+    s = stats[source];
+    IRQ_unmask(basepri);
+    return s;
+}
+
+
+/** ***************************************************************************
+ * @brief Short name of a source
+ * @param [in] source
+ * @return name
+ *****************************************************************************/
+const char *IRQ_get_name(IRQ_source_t source)
+{
+    return names[source];
+}
+
+
+/** ***************************************************************************
+ * @brief Restart the worst case measurement
+ *****************************************************************************/
+void IRQ_reset_stats(void)
+{
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_ACQ);
+    for (int i = 0; i < IRQ_SOURCES; i++) {
+        stats[i] = (IRQ_stats_t){0};
+    }
+    IRQ_unmask(basepri);
+}
+
+
+/** ***************************************************************************
+ * @brief PendSV handler, executes the deferred jobs
+ *
+ * Replaces the empty handler of stm32f4xx_it.c.
+ *****************************************************************************/
+void PendSV_Handler(void)
+{
+    uint32_t start = IRQ_enter(IRQ_SRC_DEFERRED);
+    for (int i = 0; i < IRQ_MAX_JOBS; i++) {
+        __disable_irq();
+        IRQ_job_t job = jobs[i];
+        jobs[i] = 0;
+        __enable_irq();
+        if (job) {
+            job();
+        }
+    }
+    IRQ_exit(IRQ_SRC_DEFERRED, start);
+}
@@ -4,6 +4,39 @@
  *
  * Initialization is done for the system, the blue user button, the user LEDs,
  * and the LCD display with the touchscreen.
+ * @n The acquisition is started first. The first frame is processed
+ * while BSP_LCD_Init() waits for the display (see HAL_Delay()),
+ * the touchscreen and the hint follow in the while-loop.
+ * The times of the boot stages are shown below the hint.
+ * @n CPU time, peripheral activity and the estimated energy
+ * are accounted by the subsystems (see power.c) and reported on USART1.
+ * @n The interrupt priorities are defined in interrupts.h,
+ * the acquisition has the highest priority.
+ * The pads and the Hall sensors are sampled as channel groups
+ * at different rates (see measuring.c), or by the other backend
+ * selected with CFG_BACKEND (see acquisition.c).
+ * The mains frequency (50 Hz, 60 Hz or 16.7 Hz) is detected on the first frame
+ * and then periodically, rate and bin of the analysis follow it (see mains.c).
+ * @n main() runs on its own stack in CCMRAM (see memory.c).
+ * @n The raw frames of each measurement setting are captured
+ * into a file on USART1 (see capture.c).
+ * @n The settings are shared with the command interface on USART1
+ * (see settings.c and command.c), a command changes them
+ * like the touchscreen does.
+ * A snapshot of the screen can be requested remotely (see snapshot.c).
+ * @n The statistics of each measurement setting are kept
+ * as a session (see session.c).
+ * Load changes are detected on the current and the Hall sensors,
+ * logged and signaled on the buzzer (see detector.c).
+ * @n The stages of the loop are timed against the frame period,
+ * under pressure the governor sheds display refresh, text pages
+ * and telemetry detail, never the acquisition (see governor.c).
+ * The pages are drawn through a display list, only the changes
+ * reach the frame buffer (see display.c).
+ * @n The stored settings, the background field and the crosstalk decoupling are restored
+ * from the flash and written back when they change (see storage.c).
+ * @n The build configuration "Bench" (BENCH_FIRMWARE) runs the
+ * benchmark suite of bench.c instead of the application.
  * @n Then the code enters an infinite while-loop, where it checks for
  * user input and starts the requested measurement.
  *
@@ -27,25 +60,48 @@
 #include "pushbutton.h"
 #include "menu.h"
 #include "measuring.h"
+#include "acquisition.h"
+#include "mains.h"
 #include "buzzer.h"
 #include "calculations.h"
+#include "profiling.h"
+#include "clock.h"
+#include "serial.h"
+#include "power.h"
+#include "interrupts.h"
+#include "memory.h"
+#include "arena.h"
+#include "trace.h"
+#include "bench.h"
+#include "capture.h"
+#include "settings.h"
+#include "command.h"
+#include "snapshot.h"
+#include "session.h"
+#include "detector.h"
+#include "governor.h"
+#include "display.h"
+#include "storage.h"
 
 
 /******************************************************************************
  * Defines
  *****************************************************************************/
 
-#define NOTHING         1   ///< Task: empty
-#define SINGLE_MEAS     2   ///< Task: Single measurement
-#define AVERAGE_MEAS    3   ///< Task: Average measurement
+#define NOTHING         CFG_MODE_NOTHING    ///< Task: empty
+#define SINGLE_MEAS     CFG_MODE_SINGLE     ///< Task: Single measurement
+#define AVERAGE_MEAS    CFG_MODE_AVERAGE    ///< Task: Average measurement
 
-#define MAX_SUBTASKS    2   ///< Max Subtasks
-#define SUB_VALUES      1   ///< Subtask: Show measurement in numbers
-#define SUB_GRAPHIC     2   ///< Subtask: Show measurement visualized
+#define MAX_SUBTASKS    CFG_PAGES           ///< Max Subtasks
+#define SUB_VALUES      CFG_PAGE_VALUES     ///< Subtask: Show measurement in numbers
+#define SUB_GRAPHIC     CFG_PAGE_GRAPHIC    ///< Subtask: Show measurement visualized
+#define SUB_DIAG        CFG_PAGE_DIAG       ///< Subtask: Show diagnostics
+#define SUB_MEMORY      CFG_PAGE_MEMORY     ///< Subtask: Show memory usage
+#define SUB_SESSION     CFG_PAGE_SESSION    ///< Subtask: Show session statistics
 
-#define MAX_TABLES      1   ///< Max Tables --> 1: one phase / 2: one phase and two phase
-#define TABLE_ONE_PHASE 1   ///< Table: one phase
-#define TABLE_TWO_PHASE 2   ///< Table: two phase
+#define MAX_TABLES      CFG_TABLES          ///< Max Tables --> 1: one phase / 2: one phase and two phase
+#define TABLE_ONE_PHASE CFG_TABLE_ONE_PHASE ///< Table: one phase
+#define TABLE_TWO_PHASE CFG_TABLE_TWO_PHASE ///< Table: two phase
 
 #define MAX_DISTANCE    200 ///< Needed for buzzer feedback
 
@@ -56,6 +112,7 @@
 
 static void SystemClock_Config(void);   ///< System Clock Configuration
 static void gyro_disable(void);         ///< Disable the onboard gyroscope
+static void boot_first_frame(void);     ///< Process the first frame
 
 /** ***************************************************************************
  * @brief  Main function
@@ -64,10 +121,35 @@ static void gyro_disable(void);         ///< Disable the onboard gyroscope
  * Initialization and infinite while loop
  *****************************************************************************/
 int main(void) {
+    MEM_init();                         // Paint the stacks for the high watermarks
+
     HAL_Init();                         // Initialize the system
 
     SystemClock_Config();               // Configure system clocks
 
+    PROF_init();                        // Cycle counter and boot timeline
+
+    IRQ_init();                         // Priority grouping, SysTick and PendSV
+
+#ifdef BENCH_FIRMWARE
+    BENCH_main();                       // Benchmark image, does not return
+#endif
+
+    /* Start the acquisition first, the first frame is sampled
+     * and processed while the LCD is initialized (see HAL_Delay()) */
+    gyro_disable();             // Disable gyro, use those analog inputs
+
+    MEAS_GPIO_analog_init();    // Configure GPIOs in analog mode
+    MEAS_timer_init();          // Configure the timer
+
+    FFT_Init();                 // Configure the mains DFT
+    STO_init();                 // Restore the settings and the background
+
+    ACQ_select(CFG_get(CFG_BACKEND));   // Start the first acquisition
+    MAINS_set_mode(CFG_get(CFG_MAINS)); // Rate of a fixed mains frequency
+    ACQ_start();
+    PROF_boot_mark(PROF_BOOT_ACQ_START);
+
 #ifdef FLIPPED_LCD
     BSP_LCD_Init_Flipped();             // Initialize the LCD for flipped orientation
 #else
@@ -77,8 +159,7 @@ int main(void) {
     BSP_LCD_SelectLayer(LCD_FOREGROUND_LAYER);
     BSP_LCD_DisplayOn();
     BSP_LCD_Clear(LCD_COLOR_WHITE);
-
-    BSP_TS_Init(BSP_LCD_GetXSize(), BSP_LCD_GetYSize());    // Touchscreen
+    PROF_boot_mark(PROF_BOOT_LCD);
 
     PB_init();                  // Initialize the user pushbutton
     PB_enableIRQ();             // Enable interrupt on user pushbutton
@@ -86,26 +167,36 @@ int main(void) {
     BSP_LED_Init(LED3);         // Toggles in while loop
     BSP_LED_Init(LED4);         // Is toggled by user button
 
+    BUZZER_init();              // Configure buzzer
+
     MENU_draw();                // Draw the menu
-    MENU_hint();                // Show hint at startup
+    PROF_boot_mark(PROF_BOOT_MENU);
 
-    gyro_disable();             // Disable gyro, use those analog inputs
+    CLOCK_init();               // Reduce the core clock when idle
 
-    MEAS_GPIO_analog_init();    // Configure GPIOs in analog mode
-    MEAS_timer_init();          // Configure the timer
+    ARENA_init((void *)ARENA_SDRAM_BASE, ARENA_SDRAM_SIZE); // SDRAM behind the LCD layers
 
-    BUZZER_init();              // Configure buzzer
+    SER_init();                 // Telemetry and commands on USART1
+    PWR_init();                 // Energy accounting
+    CAP_init();                 // Raw frame capture on USART1
+    CMD_init();                 // Reading history of the commands
+    GOV_init();                 // Load governor, all features on
 
-    FFT_Init();                 // Configure FFT
+    /* The touchscreen and the hint are initialized in the while loop */
+    bool hint_done = false;
 
     // Task
-    uint8_t task        = NOTHING;
-    uint8_t subtask     = SUB_GRAPHIC;
-    uint8_t table_cable = TABLE_ONE_PHASE;
+    uint8_t task        = CFG_get(CFG_MODE);
+    uint8_t subtask     = CFG_get(CFG_PAGE);
+    uint8_t table_cable = CFG_get(CFG_TABLE);
+    uint8_t averaging   = CFG_get(CFG_AVERAGING);
+    MAINS_t mains       = MAINS_get();
 
     uint8_t task_old        = task;
     uint8_t subttask_old    = subtask;
     uint8_t table_cable_old = table_cable;
+    uint8_t averaging_old   = averaging;
+    MAINS_t mains_old       = mains;
 
     // Measurement
     int16_t  x_distance = 0;
@@ -116,7 +207,7 @@ int main(void) {
     uint8_t responsive_counter = 0; //Responsiveness for touch
 
     bool flag_setting_change = false;
-    bool flag_blue_btn       = false;
+    bool flag_blue_btn       = false;   // LED4 follows a restored buzzer in the first pass
 
     char text[20];
 
@@ -125,7 +216,34 @@ int main(void) {
 
         BSP_LED_Toggle(LED3); // Visual feedback when running
 
-        MENU_check_transition();
+        uint32_t stage = GOV_begin();
+        if (!PROF_boot_reached(PROF_BOOT_FIRST_FRAME)) {
+            boot_first_frame();     // LCD was faster than the first frame
+        }
+        else if (!PROF_boot_reached(PROF_BOOT_TOUCH)) {
+            BSP_TS_Init(BSP_LCD_GetXSize(), BSP_LCD_GetYSize());    // Touchscreen
+            PROF_boot_mark(PROF_BOOT_TOUCH);
+        }
+        else {
+            PWR_begin(PWR_TOUCH);
+            PWR_busy_start(PWR_TOUCH);
+            MENU_check_transition();
+            PWR_busy_stop(PWR_TOUCH);
+            PWR_end();
+        }
+
+        if (!hint_done && PROF_boot_complete()) {
+            if (task != NOTHING) {
+                hint_done = true;       // Measurement started, hint not needed
+            }
+            else if (MENU_hint_step()) {
+                MENU_boot_timeline();   // Show hint at startup line by line
+                hint_done = true;
+            }
+        }
+
+        CMD_update();               // Remote commands change the settings
+        GOV_end(GOV_INPUT, stage);
 
         switch (MENU_get_transition()) { // Handle user menu choice
             case MENU_NONE:
@@ -136,11 +254,11 @@ int main(void) {
                 break;
 
             case MENU_SINGLE:
-                task = SINGLE_MEAS;
+                CFG_set(CFG_MODE, SINGLE_MEAS);
                 break;
 
             case MENU_MULTI:
-                task = AVERAGE_MEAS;
+                CFG_set(CFG_MODE, AVERAGE_MEAS);
                 break;
 
             case MENU_CABLE:
@@ -152,6 +270,7 @@ int main(void) {
                         if(table_cable > MAX_TABLES){
                             table_cable = 1;
                         }
+                        CFG_set(CFG_TABLE, table_cable);
                     }
                     responsive_counter = 0;
                 }
@@ -165,6 +284,7 @@ int main(void) {
                         if(subtask > MAX_SUBTASKS){
                             subtask = 1;
                         }
+                        CFG_set(CFG_PAGE, subtask);
                     }
                     responsive_counter = 0;
                 }
@@ -174,18 +294,52 @@ int main(void) {
                 break;
         }
 
+        task        = CFG_get(CFG_MODE);
+        subtask     = CFG_get(CFG_PAGE);
+        table_cable = CFG_get(CFG_TABLE);
+        averaging   = CFG_get(CFG_AVERAGING);
+        DET_set_sensitivity(CFG_get(CFG_DETECT));
+
+        bool backend_changed = false;
+        if(ACQ_get_backend() != (ACQ_backend_t)CFG_get(CFG_BACKEND)){
+            ACQ_select(CFG_get(CFG_BACKEND));   // Aborts the running frame
+            MAINS_apply();                      // Rate of the mains frequency
+            backend_changed = true;
+        }
+        MAINS_set_mode(CFG_get(CFG_MAINS));
+        mains = MAINS_get();                    // Also changed by a detection
+
+        if(flag_blue_btn != CFG_get(CFG_BUZZER)){
+            BSP_LED_Toggle(LED4);       // Buzzer switched by a command
+            flag_blue_btn = !flag_blue_btn;
+        }
+
         flag_setting_change = false;
 
         if(task_old != task || subttask_old != subtask || table_cable_old != table_cable){
             flag_setting_change = true;
         }
 
+        if(task_old != task || table_cable_old != table_cable || averaging_old != averaging
+                || backend_changed || mains_old != mains){
+            CAP_stop();                 // One capture session per measurement setting
+            if(task != NOTHING){
+                CAP_start();
+            }
+            SES_reset();                // Same for the statistics
+            DET_reset();                // and the levels of the load detection
+        }
+
         task_old        = task;
         subttask_old    = subtask;
         table_cable_old = table_cable;
+        averaging_old   = averaging;
+        mains_old       = mains;
 
         if(flag_setting_change){
 
+            BUZZER_stop_melody();
+
             if(task == SINGLE_MEAS && table_cable == TABLE_ONE_PHASE){
                 snprintf(text, 18, "SINGLE: ONE PHASE");
             }
@@ -202,12 +356,32 @@ int main(void) {
                 snprintf(text, 19, "AVERAGE: TWO PHASE");
             }
 
+            PWR_begin(PWR_LCD);
             if(subtask == SUB_VALUES){
                 MENU_values_init((uint8_t *)text);
             }
             else if(subtask == SUB_GRAPHIC){
                 MENU_visual_init((uint8_t *)text);
             }
+            else if(subtask == SUB_DIAG){
+                MENU_diag_init((uint8_t *)text);
+            }
+            else if(subtask == SUB_MEMORY){
+                MENU_memory_init((uint8_t *)text);
+            }
+            else if(subtask == SUB_SESSION){
+                MENU_session_init((uint8_t *)text);
+            }
+            PWR_end();
+        }
+
+        bool new_frame = (task != NOTHING && MEAS_data_ready);
+        bool processed = false;         // The pipeline accepted the frame
+        uint32_t frame_age_us = 0;
+        stage = GOV_begin();
+        if(new_frame){
+            frame_age_us = MEAS_get_frame_age_us();
+            CLOCK_set(CLOCK_FULL);      // Full speed for the DSP burst
         }
 
         switch(task){
@@ -223,7 +397,9 @@ int main(void) {
 
             case SINGLE_MEAS:
 
-                calculate_pos(1);
+                PWR_begin(PWR_DSP);
+                processed = calculate_pos(1);
+                PWR_end();
 
                 y_distance = get_Y_Pos();
                 x_distance = get_X_Pos();
@@ -236,7 +412,9 @@ int main(void) {
 
             case AVERAGE_MEAS:
 
-                calculate_pos(3);
+                PWR_begin(PWR_DSP);
+                processed = calculate_pos(averaging);
+                PWR_end();
 
                 y_distance = get_Y_Pos();
                 x_distance = get_X_Pos();
@@ -248,25 +426,73 @@ int main(void) {
                 break;
         }
 
+        if(processed){                  // A rejected frame would repeat the last reading
+            PWR_count_measurement();
+            CAP_add_frame();            // ADC buffer is kept until the next calculate_pos()
+            CMD_add_reading(x_distance, y_distance, angle, current, get_clip_flags());
+            SES_add_reading(x_distance, y_distance, angle, current);
+            DET_add_frame(HAL_GetTick(), current,
+                    calculate_amplitude(get_channel_phasor(CALC_LHALL)),
+                    calculate_amplitude(get_channel_phasor(CALC_RHALL)), get_clip_flags());
+        }
+        if(new_frame){
+            MAINS_add_frame(HAL_GetTick());     // Periodic detection, may change the rate
+        }
+        GOV_end(GOV_DSP, stage);
+        if(new_frame){
+            GOV_frame(frame_age_us);    // Decide what is shed from now on
+        }
+
+        CLOCK_set(CLOCK_LOW);
+
         if(task != NOTHING){
-            switch(subtask){
-                case SUB_VALUES:
-                    MENU_values_act(x_distance,y_distance,angle,current);
-                    break;
-                case SUB_GRAPHIC:
-                    MENU_visual_act(x_distance,y_distance,current);
-                    break;
-                default:
-                    MENU_empty(); // Should never occur
-                    break;
+            stage = GOV_begin();
+            PWR_begin(PWR_LCD);
+            MENU_load_act(GOV_get_level());
+            if(GOV_draw_due(new_frame, subtask >= SUB_DIAG)){
+                DISP_begin();   // Only the changes of the page are drawn
+                switch(subtask){
+                    case SUB_VALUES:
+                        MENU_values_act(x_distance,y_distance,angle,current);
+                        MENU_clip_act(get_clip_flags());
+                        break;
+                    case SUB_GRAPHIC:
+                        MENU_visual_act(x_distance,y_distance,current);
+                        break;
+                    case SUB_DIAG:
+                        MENU_diag_act();
+                        break;
+                    case SUB_MEMORY:
+                        MENU_memory_act();
+                        break;
+                    case SUB_SESSION:
+                        MENU_session_act();
+                        break;
+                    default:
+                        MENU_empty(); // Should never occur
+                        break;
+                }
+                DISP_commit();
+            }
+            PWR_end();
+            GOV_end(GOV_LCD, stage);
+
+            if (new_frame) {
+                uint32_t age_us = MEAS_get_frame_age_us();
+                if (age_us > TRACE_LATE_US) {
+                    TRACE_TRIGGER(age_us / 1000);   // Frame drawn too late
+                }
             }
 
             if (PB_pressed()) {
                 BSP_LED_Toggle(LED4);
                 flag_blue_btn = !flag_blue_btn;
+                CFG_set(CFG_BUZZER, flag_blue_btn);
             }
 
-            if(flag_blue_btn && (x_distance != CALC_OUTOF_X_RANGE) && (y_distance != CALC_OUTOF_Y_RANGE)){
+            /* The alert of a load change plays first, see detector.c */
+            if(!BUZZER_melody_playing() && flag_blue_btn
+                    && (x_distance != CALC_OUTOF_X_RANGE) && (y_distance != CALC_OUTOF_Y_RANGE)){
 
                 if(!BUZZER_get_status()){
                     BUZZER_turn_on();
@@ -274,17 +500,78 @@ int main(void) {
 
                 BUZZER_set_note((MAX_DISTANCE - y_distance ) / 10); // Set frequency when buzzer on
             }
-            else{
+            else if(!BUZZER_melody_playing()){
 
                 if(BUZZER_get_status()){
                     BUZZER_turn_off();
                 }
             }
         }
+        BUZZER_update();
+        stage = GOV_begin();
+        PWR_update();
+        if(!GOV_shed(GOV_SHED_TELEMETRY)){
+            MEM_update();
+            TRACE_UPDATE();
+            SNAP_update();              // Waits like with a full queue
+        }
+        CAP_update();
+        DET_update();
+        STO_update(HAL_GetTick());
+        GOV_end(GOV_TELEMETRY, stage);
+
         HAL_Delay(10);
     }
 }
 
+
+/** ***************************************************************************
+ * @brief Process the first frame after startup
+ *
+ * Marks PROF_BOOT_FIRST_FRAME in the boot timeline
+ * as soon as the first frame has been processed, even if the position
+ * is out of range: the touch controller is initialized after it.
+ * The mains frequency is detected on this frame.
+ *****************************************************************************/
+static void boot_first_frame(void)
+{
+    if (MEAS_data_ready) {
+        if (calculate_pos(1)) {
+            PROF_boot_mark(PROF_BOOT_FIRST_FRAME);
+        }
+        reset_sample_counter();
+        MAINS_add_frame(HAL_GetTick()); // The ADC buffer is kept until the next ACQ_start()
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Wait for a number of milliseconds
+ * @param [in] Delay [ms]
+ *
+ * Overrides the weak HAL_Delay() of the HAL library.
+ * @n While booting, the first frame is processed in the waiting time,
+ * e.g. during the delays in BSP_LCD_Init().
+ * @n The core sleeps with reduced clock while waiting (see clock.c).
+ *****************************************************************************/
+void HAL_Delay(uint32_t Delay)
+{
+    uint32_t tickstart = HAL_GetTick();
+    uint32_t wait = Delay;
+
+    if (wait < HAL_MAX_DELAY) {
+        wait += (uint32_t)(uwTickFreq);    // Guarantee minimum wait
+    }
+
+    while ((HAL_GetTick() - tickstart) < wait) {
+        if (PROF_boot_reached(PROF_BOOT_ACQ_START)
+                && !PROF_boot_reached(PROF_BOOT_FIRST_FRAME)) {
+            boot_first_frame();
+        }
+        CLOCK_sleep();                  // Wait for the next interrupt
+    }
+}
+
 /** ***************************************************************************
  * @brief System Clock Configuration
  *
@@ -344,12 +631,12 @@ static void gyro_disable(void)
     GPIOC->MODER &= ~GPIO_MODER_MODER1; // Reset mode for PC1
     GPIOC->MODER |= GPIO_MODER_MODER1_0;    // Set PC1 as output
     GPIOC->BSRR |= GPIO_BSRR_BR1;       // Set GYRO (CS) to 0 for a short time
-    HAL_Delay(10);                      // Wait some time
+    HAL_Delay(1);                       // Wait some time
     GPIOC->MODER |= GPIO_MODER_MODER1_Msk; // Analog mode PC1 = ADC123_IN11
     __HAL_RCC_GPIOF_CLK_ENABLE();       // Enable Clock for GPIO port F
     GPIOF->OSPEEDR &= ~GPIO_OSPEEDR_OSPEED8;    // Reset speed of PF8
     GPIOF->AFR[1] &= ~GPIO_AFRH_AFSEL8;         // Reset alternate func. of PF8
     GPIOF->PUPDR &= ~GPIO_PUPDR_PUPD8;          // Reset pulup/down of PF8
-    HAL_Delay(10);                      // Wait some time
+    HAL_Delay(1);                       // Wait some time
     GPIOF->MODER |= GPIO_MODER_MODER8_Msk; // Analog mode for PF6 = ADC3_IN4
 }
@@ -0,0 +1,297 @@
+/** ***************************************************************************
+ * @file
+ * @brief Detection of the mains frequency and retargeting of the acquisition
+ *
+ * Profiles
+ * ========
+ * The pipeline uses one DFT bin of a frame of ADC_NUMS samples (see calculations.c).
+ * The mains frequency must be centred on that bin, otherwise the amplitude
+ * depends on the frequency deviation and the background fit loses its phase.
+ * Each mains frequency has a profile with the rate of the pads and the bin:
+ * | Profile     | fs [Hz] | Bin | Frame    | Pad gain |
+ * | :---------- | :------ | :-- | :------- | :------- |
+ * | MAINS_50HZ  | 640     | 5   | 100 ms   | 1        |
+ * | MAINS_60HZ  | 640     | 6   | 100 ms   | 50/60    |
+ * | MAINS_16HZ7 | 214     | 5   | 299 ms   | 50/16.7  |
+ * The frame length stays ADC_NUMS, the buffers and the DMA are sized for it.
+ * 60 Hz fits in the frame of 50 Hz with one period more. 16.7 Hz needs
+ * a lower rate, 214 Hz is the nearest one both DSP backends can make
+ * (the bin is off by 0.006, the loss of amplitude is below 0.01 %).
+ * The Hall sensors of ACQ_GROUPS follow at MEAS_HALL_RATIO times the rate.
+ *
+ * Calibration
+ * ===========
+ * The LUTs are measured at 50 Hz. The pads couple capacitively to the cable,
+ * their amplitude rises with the frequency, the Hall sensors measure the field
+ * directly. MAINS_get_config() gives CALC_config_default with the rate, the bin
+ * and a pad gain which scales the pad amplitudes back to those of the LUTs.
+ * Increment CALC_CAL_VERSION when LUTs measured at 60 Hz or 16.7 Hz replace the gain.
+ *
+ * Detection
+ * =========
+ * MAINS_detect() runs a Goertzel filter at each mains frequency over every channel
+ * of one frame, after the mean of the channel is removed. The frequencies need not
+ * be on a bin of the frame, so the frames of any profile are used as they are.
+ * A frequency is dominant if its amplitude (root sum square of the channels)
+ * is at least MAINS_MIN_RMS and MAINS_MARGIN times that of the others.
+ * About 1000 multiply-adds per frame, the cost is negligible.
+ *
+ * Setting
+ * =======
+ * CFG_MAINS is MAINS_AUTO or 1 + MAINS_t for a fixed frequency.
+ * In MAINS_AUTO, MAINS_add_frame() detects on the first frame after the start
+ * and then every MAINS_PERIOD_MS. A frequency which is not the current one
+ * is applied at once: MAINS_apply() sets the rate with ACQ_set_rate()
+ * (aborts the running frame) and the calibration with set_calibration().
+ * ACQ_select() sets the rate of its table, MAINS_apply() must follow it.
+ * @note The background and the decoupling are kept, capture them again
+ * after a change of the frequency.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <math.h>
+#include "mains.h"
+#include "measuring.h"
+#include "acquisition.h"
+#include "governor.h"
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const MAINS_profile_t profiles[MAINS_PROFILES] = {
+        [MAINS_50HZ]  = {"50 Hz", 50000, ADC_FS, CALC_MAINS_BIN, 1.0f},
+        [MAINS_60HZ]  = {"60 Hz", 60000, ADC_FS, 6, 50.0f/60},
+        [MAINS_16HZ7] = {"16.7 Hz", 16700, 214, 5, 50.0f/16.7f},
+};
+
+static uint8_t mode = 0xFF;             ///< CFG_MAINS, 0xFF = not set yet
+static MAINS_t current = MAINS_50HZ;    ///< Profile of the acquisition and the pipeline
+static bool detect_due = true;          ///< Detect on the next frame
+static uint32_t detect_ms = 0;          ///< Time of the last detection
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Profile of a mains frequency
+ * @return the one of MAINS_50HZ if mains is invalid
+ *****************************************************************************/
+const MAINS_profile_t *MAINS_get_profile(MAINS_t mains)
+{
+    if ((uint32_t)mains >= MAINS_PROFILES) {
+        mains = MAINS_50HZ;
+    }
+    return &profiles[mains];
+}
+
+
+/** ***************************************************************************
+ * @brief Profile of a frequency, e.g. from the header of a capture file
+ * @param [in] mains_mhz [mHz], 0 = MAINS_50HZ (files without the frequency)
+ * @return MAINS_PROFILES if there is no profile
+ *****************************************************************************/
+MAINS_t MAINS_find(uint32_t mains_mhz)
+{
+    if (mains_mhz == 0) {
+        return MAINS_50HZ;
+    }
+    for (int i = 0; i < MAINS_PROFILES; i++) {
+        if (profiles[i].mains_mhz == mains_mhz) {
+            return (MAINS_t)i;
+        }
+    }
+    return MAINS_PROFILES;
+}
+
+
+/** ***************************************************************************
+ * @brief Parameters of the pipeline for a mains frequency
+ * @param [out] config CALC_config_default with fs, bin and pad_gain of the profile
+ *****************************************************************************/
+void MAINS_get_config(MAINS_t mains, CALC_config_t *config)
+{
+    const MAINS_profile_t *p = MAINS_get_profile(mains);
+    *config = CALC_config_default;
+    config->fs = p->fs;
+    config->bin = p->bin;
+    config->pad_gain = p->pad_gain;
+}
+
+
+/** ***************************************************************************
+ * @brief Power of one frequency in a channel, Goertzel filter
+ * @param [in] x first sample of the channel
+ * @param [in] stride distance between two samples
+ * @param [in] length samples
+ * @param [in] mean of the channel, removed from each sample
+ * @param [in] coeff 2 cos(2 pi f / fs)
+ * @return |X(f)|^2
+ *****************************************************************************/
+static float goertzel(const uint32_t *x, uint32_t stride, uint32_t length, float mean, float coeff)
+{
+    float s1 = 0;
+    float s2 = 0;
+    for (uint32_t n = 0; n < length; n++) {
+        float s = ((float)x[n*stride] - mean) + coeff*s1 - s2;
+        s2 = s1;
+        s1 = s;
+    }
+    return s1*s1 + s2*s2 - coeff*s1*s2;
+}
+
+
+/** ***************************************************************************
+ * @brief Find the dominant mains frequency in one frame
+ * @param [in] samples interleaved, sample n of channel c at samples[n*channels + c]
+ * @param [in] channels columns of the frame
+ * @param [in] length samples per channel
+ * @param [in] fs sampling frequency [Hz]
+ * @param [out] result amplitudes and the strongest frequency
+ * @return true if the strongest frequency is dominant
+ *
+ * Frequencies at or above fs/2 are not measured.
+ *****************************************************************************/
+bool MAINS_detect(const uint32_t *samples, uint8_t channels, uint16_t length, uint32_t fs,
+                  MAINS_result_t *result)
+{
+    float coeff[MAINS_PROFILES];
+    float power[MAINS_PROFILES] = {0};
+
+    result->dominant = MAINS_50HZ;
+    for (int i = 0; i < MAINS_PROFILES; i++) {
+        result->rms[i] = 0;
+    }
+    if (fs == 0 || length == 0) {
+        return false;
+    }
+    for (int i = 0; i < MAINS_PROFILES; i++) {
+        coeff[i] = 2*cosf(2*(float)M_PI*profiles[i].mains_mhz/1000/fs);
+    }
+    for (uint32_t c = 0; c < channels; c++) {
+        uint32_t sum = 0;
+        for (uint32_t n = 0; n < length; n++) {
+            sum += samples[n*channels + c];
+        }
+        float mean = (float)sum / length;
+        for (int i = 0; i < MAINS_PROFILES; i++) {
+            if (2*profiles[i].mains_mhz < 1000*fs) {
+                power[i] += goertzel(&samples[c], channels, length, mean, coeff[i]);
+            }
+        }
+    }
+    for (int i = 0; i < MAINS_PROFILES; i++) {
+        /* |X| * sqrt(2) / N = RMS value, as calculate_amplitude() */
+        result->rms[i] = sqrtf(power[i])*(float)M_SQRT2/length;
+        if (result->rms[i] > result->rms[result->dominant]) {
+            result->dominant = (MAINS_t)i;
+        }
+    }
+    float dominant = result->rms[result->dominant];
+    if (dominant < MAINS_MIN_RMS) {
+        return false;
+    }
+    for (MAINS_t i = MAINS_50HZ; i < MAINS_PROFILES; i++) {
+        if (i != result->dominant && dominant < MAINS_MARGIN*result->rms[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Apply CFG_MAINS
+ * @param [in] value MAINS_AUTO or 1 + MAINS_t, invalid values are MAINS_AUTO
+ *
+ * Call in every pass of the main loop. A fixed frequency is applied at once,
+ * MAINS_AUTO detects on the next frame.
+ *****************************************************************************/
+void MAINS_set_mode(uint8_t value)
+{
+    if (value > MAINS_PROFILES) {
+        value = MAINS_AUTO;
+    }
+    if (value == mode) {
+        return;
+    }
+    mode = value;
+    if (mode == MAINS_AUTO) {
+        detect_due = true;
+        return;
+    }
+    current = (MAINS_t)(mode - 1);
+    MAINS_apply();
+}
+
+
+/** ***************************************************************************
+ * @brief Set rate and calibration of the current profile
+ *
+ * The running frame is aborted. The pipeline accepts the rate TIM2 makes,
+ * the budgets of the governor follow its frame period.
+ *****************************************************************************/
+void MAINS_apply(void)
+{
+    CALC_config_t config;
+    MAINS_get_config(current, &config);
+    if (ACQ_set_rate(config.fs)) {
+        config.fs = ACQ_get_rate();     // Rounded to the prescaler
+    }
+    set_calibration(&config);
+    GOV_set_rate(ACQ_get_rate());
+}
+
+
+/** ***************************************************************************
+ * @brief Detect the mains frequency on the last frame when it is due
+ * @param [in] now_ms HAL_GetTick()
+ * @return true if the profile has changed
+ *
+ * Call after the frame has been processed and before the next ACQ_start().
+ *****************************************************************************/
+bool MAINS_add_frame(uint32_t now_ms)
+{
+    if (mode != MAINS_AUTO || (!detect_due && now_ms - detect_ms < MAINS_PERIOD_MS)) {
+        return false;
+    }
+    ACQ_frame_t frame = ACQ_get_frame();
+    if (frame.fs == 0 || frame.overrun) {
+        return false;                   // Try the next frame
+    }
+    detect_due = false;
+    detect_ms = now_ms;
+    MAINS_result_t result;
+    if (!MAINS_detect(frame.samples, frame.channels, frame.length, frame.fs, &result)
+            || result.dominant == current) {
+        return false;
+    }
+    current = result.dominant;
+    MAINS_apply();
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Current profile
+ *****************************************************************************/
+MAINS_t MAINS_get(void)
+{
+    return current;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if the frequency is detected (CFG_MAINS = MAINS_AUTO)
+ *****************************************************************************/
+bool MAINS_is_auto(void)
+{
+    return mode == MAINS_AUTO;
+}
@@ -14,6 +14,40 @@
  * - Simple DAC output is demonstrated as well
  * - Analog mode configuration for GPIOs
  * - Display recorded data on the graphics display
+ * - Channel groups at different rates = regular and injected group of one ADC
+ *
+ *
+ * Channel groups
+ * ==============
+ *
+ * The pads need a long integration at 50 Hz, the Hall sensors
+ * profit from a higher sampling rate (true RMS, harmonics).
+ * ADC3_groups_init() samples them as two groups of ADC3:
+ * - Regular group: the Hall sensors at MEAS_HALL_FS, triggered by TIM2 TRGO,
+ *   transfered by DMA2_Stream1 into a buffer of their own.
+ * - Injected group: the pads at ADC_FS, triggered by TIM4 TRGO.
+ *   TIM4 counts the TIM2 updates (external clock mode 1),
+ *   so each pad sample is taken at the trigger of every MEAS_HALL_RATIO-th
+ *   Hall sample. The end of conversion interrupt stores them.
+ *
+ * An injected trigger delays the regular conversion by the two pad conversions,
+ * a few us. A frame is complete when the Hall buffer is full,
+ * it has the same duration in both groups and both start at the same trigger
+ * (see MEAS_get_group()). The Hall sensors of every MEAS_HALL_RATIO-th trigger
+ * are copied next to the pads, so the interleaved 4 channel frame
+ * (MEAS_get_samples()) of the capture and the telemetry is unchanged.
+ *
+ *
+ * Common frame
+ * ============
+ *
+ * Every configuration ends its frame in frame_complete(): the time,
+ * the number and an ADC overrun of the frame (MEAS_get_timing()),
+ * the TRACE_FRAME event and MEAS_data_ready are the same for all.
+ * The timer driven ones start TIM2 with trigger_start() at the rate
+ * of MEAS_set_rate(), MEAS_stop() aborts any of them.
+ * All run with ADCCLK = 84 MHz / 8, so their sample rates can be compared.
+ * acquisition.c selects one at runtime and describes the layout of its buffer.
  *
  * Peripherals @ref HowTo
  *
@@ -63,29 +97,42 @@
 
 #include "measuring.h"
 #include "main.h"
+#include "power.h"
+#include "interrupts.h"
+#include "clock.h"
+#include "trace.h"
 
 /******************************************************************************
  * Defines
  *****************************************************************************/
 #define ADC_DAC_RES     12          ///< Resolution
-#define ADC_FS          640 ///< Sampling freq. => 12.8 samples for a 50Hz period
 #define ADC_CLOCK       84000000    ///< APB2 peripheral clock frequency
 #define ADC_CLOCKS_PS   15          ///< Clocks/sample: 3 hold + 12 conversion
 #define TIM_CLOCK       84000000    ///< APB1 timer clock frequency
 #define TIM_TOP         9           ///< Timer top value
-#define TIM_PRESCALE    (TIM_CLOCK/ADC_FS/(TIM_TOP+1)-1) ///< Clock prescaler
+#define TIM_PRESCALE    (TIM_CLOCK/MEAS_HALL_FS/(TIM_TOP+1)-1) ///< Clock prescaler
 
 
 /******************************************************************************
  * Variables
  *****************************************************************************/
-bool MEAS_data_ready = false;           ///< New data is ready
+volatile bool MEAS_data_ready = false;  ///< New data is ready
 bool MEAS_copy = false;
 uint32_t MEAS_input_count = 1;          ///< 1 or 2 input channels?
 bool DAC_active = false;                ///< DAC output active?
 
-static uint32_t ADC_sample_count = 0;   ///< Index for buffer
+static volatile uint32_t ADC_sample_count = 0;  ///< Index for buffer
+static uint32_t trigger_cycles = 0;     ///< Cycle count at the last TIM2 update
+static volatile uint32_t frame_us = 0;  ///< Time when the last buffer was full
+static uint16_t frame_count = 0;        ///< Number of captured buffers
 static uint32_t ADC_samples[4*ADC_NUMS];///< ADC values of 4 input channels. The 4 channels are stored after each other in the array.
+static uint32_t hall_samples[2*MEAS_HALL_NUMS]; ///< Hall sensors at MEAS_HALL_FS, interleaved
+static volatile uint32_t pad_count = 0; ///< Pad samples of the running frame
+static volatile bool acquiring = false; ///< Channel groups are sampled
+static uint32_t start_us = 0;           ///< Time of the first trigger of the frame
+static uint32_t trigger_fs = MEAS_HALL_FS;  ///< TIM2 update rate, see MEAS_set_rate()
+static uint32_t frame_fs = MEAS_HALL_FS;    ///< TIM2 update rate of the frame in the buffer
+static volatile bool overrun = false;   ///< An ADC lost a conversion in the last frame
 static uint32_t DAC_sample = 0;         ///< DAC output value
 
 
@@ -162,6 +209,34 @@ void ADC_reset(void) {
 }
 
 
+/** ***************************************************************************
+ * @brief Start TIM2 from 0, the first update triggers the ADC(s)
+ *****************************************************************************/
+static void trigger_start(void)
+{
+    TIM2->CNT = 0;
+    start_us = CLOCK_get_us() + 1000000UL/trigger_fs;   // First update
+    frame_fs = trigger_fs;              // Kept if the rate changes while the frame is processed
+    TIM2->CR1 |= TIM_CR1_CEN;           // Enable timer
+}
+
+
+/** ***************************************************************************
+ * @brief Mark the frame as complete, the same for all configurations
+ *
+ * Call before ADC_reset(), which clears the overrun flags.
+ *****************************************************************************/
+static void frame_complete(void)
+{
+    overrun = ((ADC1->SR | ADC2->SR | ADC3->SR) & ADC_SR_OVR) != 0;
+    PWR_busy_stop(PWR_ACQ);
+    frame_us = CLOCK_get_us();
+    frame_count++;                      // Not in TRACE(), which is empty without TRACE_ENABLED
+    TRACE(TRACE_FRAME, frame_count);
+    MEAS_data_ready = true;
+}
+
+
 /** ***************************************************************************
  * @brief Initialize the ADC in single conversion mode
  *
@@ -172,6 +247,7 @@ void ADC3_IN4_single_init(void)
     MEAS_input_count = 1;               // Only 1 input is converted
     __HAL_RCC_ADC3_CLK_ENABLE();        // Enable Clock for ADC3
     ADC3->SQR3 |= (4UL << ADC_SQR3_SQ1_Pos);    // Input 4 = first conversion
+    ADC->CCR |=  (3UL <<ADC_CCR_ADCPRE_Pos);    // ADC Prescaler DIV8
 }
 
 
@@ -184,6 +260,7 @@ void ADC3_IN4_single_read(void)
 {
     ADC3->CR2 |= ADC_CR2_ADON;          // Enable ADC3
     HAL_Delay(1);                       // ADC needs some time to stabilize
+    start_us = CLOCK_get_us();
     ADC3->CR2 |= ADC_CR2_SWSTART;
     while (!(ADC3->SR & ADC_SR_EOC)) { ; }  // Wait for end of conversion
     ADC_samples[0] = ADC3->DR;          // Read the converted value
@@ -191,8 +268,8 @@ void ADC3_IN4_single_read(void)
     if (DAC_active) {
         DAC_increment();
     }
+    frame_complete();
     ADC_reset();
-    MEAS_data_ready = true;
 }
 
 
@@ -204,13 +281,43 @@ void ADC3_IN4_single_read(void)
 void MEAS_timer_init(void)
 {
     __HAL_RCC_TIM2_CLK_ENABLE();        // Enable Clock for TIM2
-    TIM2->PSC = TIM_PRESCALE;           // Prescaler for clock freq. = 1MHz
+    TIM2->PSC = TIM_PRESCALE;           // Prescaler for clock freq. = 10*MEAS_HALL_FS
+    TIM2->CR1 |= TIM_CR1_URS;           // Only an overflow sets UIF, see MEAS_set_rate()
     TIM2->ARR = TIM_TOP;                // Auto reload = counter top value
     TIM2->CR2 |= TIM_CR2_MMS_1;         // TRGO on update
     /* If timer interrupt is not needed, comment the following lines */
     TIM2->DIER |= TIM_DIER_UIE;         // Enable update interrupt
+    NVIC_SetPriority(TIM2_IRQn, IRQ_PRIO_ACQ); // Acquisition first
     NVIC_ClearPendingIRQ(TIM2_IRQn);    // Clear pending interrupt on line 0
     NVIC_EnableIRQ(TIM2_IRQn);          // Enable interrupt line 0 in the NVIC
+
+    /* TIM4 divides the TIM2 updates for the injected group */
+    __HAL_RCC_TIM4_CLK_ENABLE();        // Enable Clock for TIM4
+    TIM4->PSC = 0;                      // Count every TIM2 update
+    TIM4->ARR = MEAS_HALL_RATIO-1;      // Update at every MEAS_HALL_RATIO-th
+    TIM4->SMCR = (1UL << TIM_SMCR_TS_Pos)   // Trigger input ITR1 = TIM2 TRGO
+               | (7UL << TIM_SMCR_SMS_Pos); // External clock mode 1
+    TIM4->CR2 = TIM_CR2_MMS_1;          // TRGO on update
+}
+
+
+/** ***************************************************************************
+ * @brief Set the rate of the TIM2 updates which trigger the ADC(s)
+ * @param [in] fs updates per second, 129 ... 8400000 Hz
+ * @return rate set, the nearest one of the prescaler
+ *
+ * MEAS_HALL_FS after MEAS_timer_init(). Call while no frame is sampled,
+ * the prescaler is loaded at once by an update event (UG).
+ *****************************************************************************/
+uint32_t MEAS_set_rate(uint32_t fs)
+{
+    uint32_t prescale = (TIM_CLOCK/(TIM_TOP+1) + fs/2)/fs;
+    if (prescale < 1) { prescale = 1; }
+    if (prescale > 65536) { prescale = 65536; }
+    TIM2->PSC = prescale - 1;
+    TIM2->EGR = TIM_EGR_UG;             // Load the prescaler, no UIF (URS)
+    trigger_fs = TIM_CLOCK/(TIM_TOP+1)/prescale;
+    return trigger_fs;
 }
 
 
@@ -256,10 +363,12 @@ void ADC3_IN4_timer_init(void)
  *****************************************************************************/
 void ADC3_IN4_timer_start(void)
 {
+    NVIC_SetPriority(ADC_IRQn, IRQ_PRIO_ACQ); // Acquisition first
     NVIC_ClearPendingIRQ(ADC_IRQn);     // Clear pending interrupt on line 0
     NVIC_EnableIRQ(ADC_IRQn);           // Enable interrupt line 0 in the NVIC
     ADC3->CR2 |= ADC_CR2_ADON;          // Enable ADC3
-    TIM2->CR1 |= TIM_CR1_CEN;           // Enable timer
+    trigger_start();                    // Enable timer
+    PWR_busy_start(PWR_ACQ);            // ADC busy until the buffer is full
 }
 
 
@@ -282,6 +391,7 @@ void ADC3_IN4_DMA_init(void)
     ADC3->CR2 |= (1UL << ADC_CR2_EXTEN_Pos);    // En. ext. trigger on rising e.
     ADC3->CR2 |= (6UL << ADC_CR2_EXTSEL_Pos);   // Timer 2 TRGO event
     ADC3->CR2 |= ADC_CR2_DMA;           // Enable DMA mode
+    ADC->CCR |=  (3UL <<ADC_CCR_ADCPRE_Pos);    // ADC Prescaler DIV8
     __HAL_RCC_DMA2_CLK_ENABLE();        // Enable Clock for DMA2
     DMA2_Stream1->CR &= ~DMA_SxCR_EN;   // Disable the DMA stream 1
     while (DMA2_Stream1->CR & DMA_SxCR_EN) { ; }    // Wait for DMA to finish
@@ -305,10 +415,12 @@ void ADC3_IN4_DMA_init(void)
 void ADC3_IN4_DMA_start(void)
 {
     DMA2_Stream1->CR |= DMA_SxCR_EN;    // Enable DMA
+    NVIC_SetPriority(DMA2_Stream1_IRQn, IRQ_PRIO_ACQ); // Acquisition first
     NVIC_ClearPendingIRQ(DMA2_Stream1_IRQn);    // Clear pending DMA interrupt
     NVIC_EnableIRQ(DMA2_Stream1_IRQn);  // Enable DMA interrupt in the NVIC
     ADC3->CR2 |= ADC_CR2_ADON;          // Enable ADC3
-    TIM2->CR1 |= TIM_CR1_CEN;           // Enable timer
+    trigger_start();                    // Enable timer
+    PWR_busy_start(PWR_ACQ);            // ADC busy until the buffer is full
 }
 
 
@@ -334,6 +446,7 @@ void ADC1_IN13_ADC2_IN5_dual_init(void)
     __HAL_RCC_ADC2_CLK_ENABLE();        // Enable Clock for ADC2
     ADC->CCR |= ADC_CCR_DMA_1;          // Enable DMA mode 2 = dual DMA
     ADC->CCR |= ADC_CCR_MULTI_1 | ADC_CCR_MULTI_2; // ADC1 and ADC2
+    ADC->CCR |=  (3UL <<ADC_CCR_ADCPRE_Pos);    // ADC Prescaler DIV8
     ADC1->CR2 |= (1UL << ADC_CR2_EXTEN_Pos);    // En. ext. trigger on rising e.
     ADC1->CR2 |= (6UL << ADC_CR2_EXTSEL_Pos);   // Timer 2 TRGO event
     ADC1->SQR3 |= (13UL << ADC_SQR3_SQ1_Pos);   // Input 13 = first conversion
@@ -361,11 +474,13 @@ void ADC1_IN13_ADC2_IN5_dual_init(void)
 void ADC1_IN13_ADC2_IN5_dual_start(void)
 {
     DMA2_Stream4->CR |= DMA_SxCR_EN;    // Enable DMA
+    NVIC_SetPriority(DMA2_Stream4_IRQn, IRQ_PRIO_ACQ); // Acquisition first
     NVIC_ClearPendingIRQ(DMA2_Stream4_IRQn);    // Clear pending DMA interrupt
     NVIC_EnableIRQ(DMA2_Stream4_IRQn);  // Enable DMA interrupt in the NVIC
     ADC1->CR2 |= ADC_CR2_ADON;          // Enable ADC1
     ADC2->CR2 |= ADC_CR2_ADON;          // Enable ADC2
-    TIM2->CR1 |= TIM_CR1_CEN;           // Enable timer
+    trigger_start();                    // Enable timer
+    PWR_busy_start(PWR_ACQ);            // ADC busy until the buffer is full
 }
 
 
@@ -391,6 +506,7 @@ void ADC2_IN13_IN5_scan_init(void)
     ADC2->CR2 |= (1UL << ADC_CR2_EXTEN_Pos);    // En. ext. trigger on rising e.
     ADC2->CR2 |= (6UL << ADC_CR2_EXTSEL_Pos);   // Timer 2 TRGO event
     ADC2->CR2 |= ADC_CR2_DMA;           // Enable DMA mode
+    ADC->CCR |=  (3UL <<ADC_CCR_ADCPRE_Pos);    // ADC Prescaler DIV8
     __HAL_RCC_DMA2_CLK_ENABLE();        // Enable Clock for DMA2
     DMA2_Stream3->CR &= ~DMA_SxCR_EN;   // Disable the DMA stream 3
     while (DMA2_Stream3->CR & DMA_SxCR_EN) { ; }    // Wait for DMA to finish
@@ -414,10 +530,12 @@ void ADC2_IN13_IN5_scan_init(void)
 void ADC2_IN13_IN5_scan_start(void)
 {
     DMA2_Stream3->CR |= DMA_SxCR_EN;    // Enable DMA
+    NVIC_SetPriority(DMA2_Stream3_IRQn, IRQ_PRIO_ACQ); // Acquisition first
     NVIC_ClearPendingIRQ(DMA2_Stream3_IRQn);    // Clear pending DMA interrupt
     NVIC_EnableIRQ(DMA2_Stream3_IRQn);  // Enable DMA interrupt in the NVIC
     ADC2->CR2 |= ADC_CR2_ADON;          // Enable ADC2
-    TIM2->CR1 |= TIM_CR1_CEN;           // Enable timer
+    trigger_start();                    // Enable timer
+    PWR_busy_start(PWR_ACQ);            // ADC busy until the buffer is full
 }
 
 
@@ -443,6 +561,7 @@ void ADC3_IN13_IN4_scan_init(void)
     ADC3->CR2 |= (1UL << ADC_CR2_EXTEN_Pos);    // En. ext. trigger on rising e.
     ADC3->CR2 |= (6UL << ADC_CR2_EXTSEL_Pos);   // Timer 2 TRGO event
     ADC3->CR2 |= ADC_CR2_DMA;           // Enable DMA mode
+    ADC->CCR |=  (3UL <<ADC_CCR_ADCPRE_Pos);    // ADC Prescaler DIV8
     __HAL_RCC_DMA2_CLK_ENABLE();        // Enable Clock for DMA2
     DMA2_Stream1->CR &= ~DMA_SxCR_EN;   // Disable the DMA stream 1
     while (DMA2_Stream1->CR & DMA_SxCR_EN) { ; }    // Wait for DMA to finish
@@ -467,10 +586,151 @@ void ADC3_IN13_IN4_scan_init(void)
 void ADC3_IN13_IN4_scan_start(void)
 {
     DMA2_Stream1->CR |= DMA_SxCR_EN;    // Enable DMA
+    NVIC_SetPriority(DMA2_Stream1_IRQn, IRQ_PRIO_ACQ); // Acquisition first
     NVIC_ClearPendingIRQ(DMA2_Stream1_IRQn);    // Clear pending DMA interrupt
     NVIC_EnableIRQ(DMA2_Stream1_IRQn);  // Enable DMA interrupt in the NVIC
     ADC3->CR2 |= ADC_CR2_ADON;          // Enable ADC3
-    TIM2->CR1 |= TIM_CR1_CEN;           // Enable timer
+    trigger_start();                    // Enable timer
+    PWR_busy_start(PWR_ACQ);            // ADC busy until the buffer is full
+}
+
+
+/** ***************************************************************************
+ * @brief Initialize ADC3, TIM4 and DMA for the channel groups
+ *
+ * Regular group at MEAS_HALL_FS (TIM2 TRGO) with DMA2_Stream1 Channel2:
+ * - ADC3_IN6 = GPIO PF8: COIL_LEFT
+ * - ADC3_IN11 = GPIO PC1: COIL_RIGHT
+ *
+ * Injected group at ADC_FS (TIM4 TRGO) with end of conversion interrupt:
+ * - ADC3_IN4 = GPIO PF6: PAD_LEFT
+ * - ADC3_IN13 = GPIO PC3: PAD_RIGHT
+ *
+ * @note Does nothing while a frame is sampled, calculate_pos() calls it
+ * in every pass until the frame is complete.
+ *****************************************************************************/
+void ADC3_groups_init(void)
+{
+    if (acquiring) {
+        return;
+    }
+    MEAS_input_count = 4;               // 4 inputs to convert
+    __HAL_RCC_ADC3_CLK_ENABLE();        // Enable Clock for ADC3
+    ADC3->SQR1 = (1UL << ADC_SQR1_L_Pos);       // Regular group: 2 conversions
+    ADC3->SQR3 = ( 6UL << ADC_SQR3_SQ1_Pos)     // IN6  (PF8): COIL_LEFT
+               | (11UL << ADC_SQR3_SQ2_Pos);    // IN11 (PC1): COIL_RIGHT
+    ADC3->JSQR = (1UL << ADC_JSQR_JL_Pos)       // Injected group: 2 conversions, JSQ3 and JSQ4
+               | ( 4UL << ADC_JSQR_JSQ3_Pos)    // IN4  (PF6): PAD_LEFT  -> JDR1
+               | (13UL << ADC_JSQR_JSQ4_Pos);   // IN13 (PC3): PAD_RIGHT -> JDR2
+    ADC3->CR1 = ADC_CR1_SCAN                    // Turn on scan mode
+              | ADC_CR1_JEOCIE;                 // Interrupt after the injected group
+    ADC3->CR2 = (1UL << ADC_CR2_EXTEN_Pos)      // En. ext. trigger on rising e.
+              | (6UL << ADC_CR2_EXTSEL_Pos)     // Timer 2 TRGO event
+              | (1UL << ADC_CR2_JEXTEN_Pos)     // En. injected trigger on rising e.
+              | (9UL << ADC_CR2_JEXTSEL_Pos)    // Timer 4 TRGO event
+              | ADC_CR2_DMA;                    // Enable DMA mode
+    ADC->CCR |=  (3UL <<ADC_CCR_ADCPRE_Pos);    // ADC Prescaler DIV8
+
+    __HAL_RCC_DMA2_CLK_ENABLE();        // Enable Clock for DMA2
+    DMA2_Stream1->CR &= ~DMA_SxCR_EN;   // Disable the DMA stream 1
+    while (DMA2_Stream1->CR & DMA_SxCR_EN) { ; }    // Wait for DMA to finish
+    DMA2->LIFCR |= DMA_LIFCR_CTCIF1;    // Clear transfer complete interrupt fl.
+    DMA2_Stream1->CR = (2UL << DMA_SxCR_CHSEL_Pos)  // Select channel 2
+                     | DMA_SxCR_PL_1        // Priority high
+                     | DMA_SxCR_MSIZE_1     // Memory data size = 32 bit
+                     | DMA_SxCR_PSIZE_1     // Peripheral data size = 32 bit
+                     | DMA_SxCR_MINC        // Increment memory address pointer
+                     | DMA_SxCR_TCIE;       // Transfer complete interrupt enable
+    DMA2_Stream1->NDTR = 2*MEAS_HALL_NUMS;  // Number of data items to transfer
+    DMA2_Stream1->PAR = (uint32_t)&ADC3->DR;    // Peripheral register address
+    DMA2_Stream1->M0AR = (uint32_t)hall_samples;// Buffer memory loc. address
+}
+
+
+/** ***************************************************************************
+ * @brief Start DMA, ADC and the timers of the channel groups
+ *
+ * TIM4 starts at its top value, the first TIM2 update triggers both groups.
+ * @note Does nothing while a frame is sampled.
+ *****************************************************************************/
+void ADC3_groups_start(void)
+{
+    if (acquiring) {
+        return;
+    }
+    acquiring = true;
+    pad_count = 0;
+    DMA2_Stream1->CR |= DMA_SxCR_EN;    // Enable DMA
+    NVIC_SetPriority(DMA2_Stream1_IRQn, IRQ_PRIO_ACQ); // Acquisition first
+    NVIC_ClearPendingIRQ(DMA2_Stream1_IRQn);    // Clear pending DMA interrupt
+    NVIC_EnableIRQ(DMA2_Stream1_IRQn);  // Enable DMA interrupt in the NVIC
+    NVIC_SetPriority(ADC_IRQn, IRQ_PRIO_ACQ);   // Acquisition first
+    NVIC_ClearPendingIRQ(ADC_IRQn);     // Clear pending interrupt
+    NVIC_EnableIRQ(ADC_IRQn);           // Enable ADC interrupt in the NVIC
+    ADC3->CR2 |= ADC_CR2_ADON;          // Enable ADC3
+    TIM4->CNT = MEAS_HALL_RATIO-1;      // Next TIM2 update triggers the pads
+    TIM4->CR1 |= TIM_CR1_CEN;           // Enable divider
+    trigger_start();                    // Enable timer
+    PWR_busy_start(PWR_ACQ);            // ADC busy until the frame is complete
+}
+
+
+/** ***************************************************************************
+ * @brief Complete the frame of the channel groups
+ *
+ * Called when the Hall buffer is full. The last pad sample was triggered
+ * MEAS_HALL_RATIO-1 Hall samples before.
+ *****************************************************************************/
+static void groups_complete(void)
+{
+    TIM2->CR1 &= ~TIM_CR1_CEN;          // Disable timer
+    TIM4->CR1 &= ~TIM_CR1_CEN;          // Disable divider
+    ADC3->CR2 &= ~ADC_CR2_ADON;         // Disable ADC3
+    /* Hall sensors at the triggers of the pads into the 4 channel frame */
+    for (uint32_t i = 0; i < ADC_NUMS; i++) {
+        ADC_samples[4*i+2] = hall_samples[2*MEAS_HALL_RATIO*i];
+        ADC_samples[4*i+3] = hall_samples[2*MEAS_HALL_RATIO*i+1];
+    }
+    acquiring = false;
+    frame_complete();
+    ADC_reset();
+}
+
+
+/** ***************************************************************************
+ * @brief Abort the frame of any configuration
+ *
+ * Timers, ADCs, DMA streams and their interrupts are stopped,
+ * the next init and start begin a new frame. A complete frame is kept
+ * (MEAS_data_ready).
+ *****************************************************************************/
+void MEAS_stop(void)
+{
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_ACQ);
+    TIM2->CR1 &= ~TIM_CR1_CEN;          // Disable timer
+    TIM4->CR1 &= ~TIM_CR1_CEN;          // Disable divider
+    NVIC_DisableIRQ(ADC_IRQn);
+    NVIC_DisableIRQ(DMA2_Stream1_IRQn);
+    NVIC_DisableIRQ(DMA2_Stream3_IRQn);
+    NVIC_DisableIRQ(DMA2_Stream4_IRQn);
+    DMA2_Stream1->CR &= ~DMA_SxCR_EN;   // Disable the DMA streams
+    DMA2_Stream3->CR &= ~DMA_SxCR_EN;
+    DMA2_Stream4->CR &= ~DMA_SxCR_EN;
+    while ((DMA2_Stream1->CR | DMA2_Stream3->CR | DMA2_Stream4->CR) & DMA_SxCR_EN) { ; }
+    DMA2->LIFCR = DMA_LIFCR_CTCIF1 | DMA_LIFCR_CTCIF3;  // Clear transfer complete interrupt fl.
+    DMA2->HIFCR = DMA_HIFCR_CTCIF4;
+    NVIC_ClearPendingIRQ(ADC_IRQn);
+    NVIC_ClearPendingIRQ(DMA2_Stream1_IRQn);
+    NVIC_ClearPendingIRQ(DMA2_Stream3_IRQn);
+    NVIC_ClearPendingIRQ(DMA2_Stream4_IRQn);
+    ADC_reset();
+    PWR_busy_stop(PWR_ACQ);
+    acquiring = false;
+    pad_count = 0;
+    if (!MEAS_data_ready) {
+        ADC_sample_count = 0;
+    }
+    IRQ_unmask(basepri);
 }
 
 
@@ -479,13 +739,17 @@ void ADC3_IN13_IN4_scan_start(void)
  *
  * @note This interrupt handler was only used for debugging purposes
  * and to increment the DAC value.
+ * @n It records the time of the ADC trigger for the latency measurement.
  *****************************************************************************/
 void TIM2_IRQHandler(void)
 {
+    uint32_t start = IRQ_enter(IRQ_SRC_TIM2);
+    trigger_cycles = start;             // ADC conversion triggered now
     TIM2->SR &= ~TIM_SR_UIF;            // Clear pending interrupt flag
     if (DAC_active) {
         DAC_increment();
     }
+    IRQ_exit(IRQ_SRC_TIM2, start);
 }
 
 
@@ -494,19 +758,64 @@ void TIM2_IRQHandler(void)
  *
  * Reads one sample from the ADC3 DataRegister and transfers it to a buffer.
  * @n Stops when four times the ADC_NUMS samples have been read.
+ * @n With the channel groups it reads the pads of the injected group.
  *****************************************************************************/
 void ADC_IRQHandler(void)
 {
-    if (ADC3->SR & ADC_SR_EOC) {        // Check if ADC3 end of conversion
+    uint32_t start = IRQ_enter(IRQ_SRC_ADC);
+    PWR_begin(PWR_ACQ);
+    if (ADC3->SR & ADC_SR_JEOC) {       // Injected group of the pads converted
+        ADC3->SR &= ~ADC_SR_JEOC;       // Clear the flag
+        IRQ_latency(IRQ_SRC_ADC, start - trigger_cycles);
+        if (pad_count < ADC_NUMS) {
+            ADC_samples[4*pad_count]   = ADC3->JDR1;    // PAD_LEFT
+            ADC_samples[4*pad_count+1] = ADC3->JDR2;    // PAD_RIGHT
+            pad_count++;
+        }
+    }
+    /* The regular group of the channel groups is read by the DMA */
+    if ((ADC3->CR1 & ADC_CR1_EOCIE) && (ADC3->SR & ADC_SR_EOC)) {   // Check if ADC3 end of conversion
+        if ((ADC_sample_count % 4) == 0) {  // First conversion after trigger
+            IRQ_latency(IRQ_SRC_ADC, start - trigger_cycles);
+        }
         ADC_samples[ADC_sample_count++] = ADC3->DR; // Read input of 4 channels
         if (ADC_sample_count >= 4*ADC_NUMS) {       // Buffer full
             TIM2->CR1 &= ~TIM_CR1_CEN;  // Disable timer
             ADC3->CR2 &= ~ADC_CR2_ADON; // Disable ADC3
+            frame_complete();
             ADC_reset();
-            MEAS_data_ready = true;
         }
 
     }
+    PWR_end();
+    IRQ_exit(IRQ_SRC_ADC, start);
+}
+
+/** ***************************************************************************
+ * @brief Age of the last captured buffer
+ * @return Time since the buffer was full [us]
+ *****************************************************************************/
+uint32_t MEAS_get_frame_age_us(void)
+{
+    return CLOCK_get_us() - frame_us;
+}
+
+/** ***************************************************************************
+ * @brief Timing of the last frame
+ *
+ * number changes when a frame is complete, in every configuration.
+ *****************************************************************************/
+MEAS_timing_t MEAS_get_timing(void)
+{
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_ACQ);
+    MEAS_timing_t timing = {
+            .start_us = start_us,
+            .end_us = frame_us,
+            .number = frame_count,
+            .overrun = overrun,
+    };
+    IRQ_unmask(basepri);
+    return timing;
 }
 
 /** ***************************************************************************
@@ -518,26 +827,63 @@ void ADC_IRQHandler(void)
 uint32_t MEAS_return_data(int i){
     return ADC_samples[i];
 }
+
+/** ***************************************************************************
+ * @brief Returns the ADC buffer
+ *
+ * Interleaved samples of the 4 channels, valid while MEAS_data_ready is set.
+ *****************************************************************************/
+const uint32_t *MEAS_get_samples(void){
+    return ADC_samples;
+}
+
+/** ***************************************************************************
+ * @brief Returns the frame of a channel group
+ * @param [in] group
+ *
+ * Valid while MEAS_data_ready is set. Sample n of a group was taken
+ * at start_us + n * 1000000 / fs, the pads are in the ADC buffer.
+ * The Hall sensors are sampled at each TIM2 update of the frame,
+ * the pads at every MEAS_HALL_RATIO-th.
+ *****************************************************************************/
+MEAS_frame_t MEAS_get_group(MEAS_group_t group){
+    MEAS_frame_t frame = {ADC_samples, 4, ADC_NUMS, frame_fs / MEAS_HALL_RATIO, start_us};
+    if (group == MEAS_GROUP_HALLS) {
+        frame.samples = hall_samples;
+        frame.stride = 2;
+        frame.length = MEAS_HALL_NUMS;
+        frame.fs = frame_fs;
+    }
+    return frame;
+}
+
 /** ***************************************************************************
  * @brief Interrupt handler for DMA2 Stream1
  *
  * The samples from the ADC3 have been transfered to memory by the DMA2 Stream1
  * and are ready for processing.
+ * @n With the channel groups the Hall buffer is full and the frame is complete.
  *****************************************************************************/
 void DMA2_Stream1_IRQHandler(void)
 {
+    uint32_t start = IRQ_enter(IRQ_SRC_ACQ_DMA);
     if (DMA2->LISR & DMA_LISR_TCIF1) {  // Stream1 transfer compl. interrupt f.
         NVIC_DisableIRQ(DMA2_Stream1_IRQn); // Disable DMA interrupt in the NVIC
         NVIC_ClearPendingIRQ(DMA2_Stream1_IRQn);// Clear pending DMA interrupt
         DMA2_Stream1->CR &= ~DMA_SxCR_EN;   // Disable the DMA
         while (DMA2_Stream1->CR & DMA_SxCR_EN) { ; }    // Wait for DMA to finish
         DMA2->LIFCR |= DMA_LIFCR_CTCIF1;// Clear transfer complete interrupt fl.
-        TIM2->CR1 &= ~TIM_CR1_CEN;      // Disable timer
-        ADC3->CR2 &= ~ADC_CR2_ADON;     // Disable ADC3
-        ADC3->CR2 &= ~ADC_CR2_DMA;      // Disable DMA mode
-        ADC_reset();
-        MEAS_data_ready = true;
+        if (acquiring) {
+            groups_complete();          // Hall buffer of the channel groups
+        } else {
+            TIM2->CR1 &= ~TIM_CR1_CEN;  // Disable timer
+            ADC3->CR2 &= ~ADC_CR2_ADON; // Disable ADC3
+            ADC3->CR2 &= ~ADC_CR2_DMA;  // Disable DMA mode
+            frame_complete();
+            ADC_reset();
+        }
     }
+    IRQ_exit(IRQ_SRC_ACQ_DMA, start);
 }
 
 
@@ -549,6 +895,7 @@ void DMA2_Stream1_IRQHandler(void)
  *****************************************************************************/
 void DMA2_Stream3_IRQHandler(void)
 {
+    uint32_t start = IRQ_enter(IRQ_SRC_ACQ_DMA);
     if (DMA2->LISR & DMA_LISR_TCIF3) {  // Stream3 transfer compl. interrupt f.
         NVIC_DisableIRQ(DMA2_Stream3_IRQn); // Disable DMA interrupt in the NVIC
         NVIC_ClearPendingIRQ(DMA2_Stream3_IRQn);// Clear pending DMA interrupt
@@ -558,9 +905,10 @@ void DMA2_Stream3_IRQHandler(void)
         TIM2->CR1 &= ~TIM_CR1_CEN;      // Disable timer
         ADC2->CR2 &= ~ADC_CR2_ADON;     // Disable ADC2
         ADC2->CR2 &= ~ADC_CR2_DMA;      // Disable DMA mode
+        frame_complete();
         ADC_reset();
-        MEAS_data_ready = true;
     }
+    IRQ_exit(IRQ_SRC_ACQ_DMA, start);
 }
 
 
@@ -577,6 +925,7 @@ void DMA2_Stream3_IRQHandler(void)
  *****************************************************************************/
 void DMA2_Stream4_IRQHandler(void)
 {
+    uint32_t start = IRQ_enter(IRQ_SRC_ACQ_DMA);
     if (DMA2->HISR & DMA_HISR_TCIF4) {  // Stream4 transfer compl. interrupt f.
         NVIC_DisableIRQ(DMA2_Stream4_IRQn); // Disable DMA interrupt in the NVIC
         NVIC_ClearPendingIRQ(DMA2_Stream4_IRQn);// Clear pending DMA interrupt
@@ -592,9 +941,10 @@ void DMA2_Stream4_IRQHandler(void)
             ADC_samples[2*i+1] = (ADC_samples[i] >> 16);
             ADC_samples[2*i]   = (ADC_samples[i] & 0xffff);
         }
+        frame_complete();
         ADC_reset();
-        MEAS_data_ready = true;
     }
+    IRQ_exit(IRQ_SRC_ACQ_DMA, start);
 }
 
 
@@ -659,9 +1009,11 @@ void MEAS_show_data(void)
 }
 
 void reset_sample_counter(void){
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_ACQ);
     if(MEAS_data_ready){
         ADC_sample_count = 0;
         MEAS_data_ready=false;
     }
+    IRQ_unmask(basepri);
 }
 
@@ -0,0 +1,183 @@
+/** ***************************************************************************
+ * @file
+ * @brief Stack high watermarks and RAM budget
+ *
+ * Stacks
+ * ======
+ * The startup code switches main() to the process stack (PSP)
+ * at the end of the 64 KB CCMRAM. The interrupts use the main stack (MSP)
+ * at the end of the 192 KB RAM. So both stacks are measured separately.
+ * @note CCMRAM is not accessible by DMA.
+ * Buffers transferred by DMA must not be local variables of main().
+ *
+ * MEM_init() paints the unused part of both stacks with MEM_PAINT.
+ * The high watermark is the highest address, where the pattern was overwritten.
+ * @n The stack of main() contains the frames pushed by the interrupts
+ * (up to 104 bytes each with the FPU registers).
+ *
+ * Sections
+ * ========
+ * The sizes of the sections are taken from the symbols of the linker script,
+ * so the table is generated when the firmware is linked:
+ *
+ * | Memory | Section      | From       | To            |
+ * |--------|--------------|------------|---------------|
+ * | RAM    | .data        | _sdata     | _edata        |
+ * | RAM    | .bss         | _sbss      | _ebss         |
+ * | RAM    | IRQ stack    | _end       | _estack       |
+ * | CCMRAM | .ccmram      | _sccmram   | _eccmram      |
+ * | CCMRAM | main stack   | _eccmram   | _estack_main  |
+ *
+ * There is no heap, malloc() is not used.
+ * @n The usage is shown on the memory page and sent as SER_FRAME_MEMORY
+ * every MEM_REPORT_MS. Tools/ram_budget.py prints the same table
+ * and the largest stack frames (from the -fstack-usage files) on the host.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "memory.h"
+#include "serial.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define PAINT_MARGIN    64      ///< Bytes below the stack pointer not painted
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+/* Symbols of the linker script, only their addresses are used */
+extern uint32_t _sdata, _edata, _sbss, _ebss, _end, _estack;
+extern uint32_t _sccmram, _eccmram, _estack_main;
+
+static uint32_t last_report = 0;    ///< Tick of the last telemetry frame
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Fill a memory area with MEM_PAINT
+ * @param [in] from first word
+ * @param [in] to behind the last word
+ *****************************************************************************/
+static void paint(uint32_t *from, uint32_t *to)
+{
+    while (from < to) {
+        *from++ = MEM_PAINT;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Paint the unused part of both stacks
+ *
+ * @note Call first in main(), before the interrupts are enabled.
+ *****************************************************************************/
+void MEM_init(void)
+{
+    paint(&_eccmram, (uint32_t *)(__get_PSP() - PAINT_MARGIN));
+    paint(&_end, (uint32_t *)(__get_MSP() - PAINT_MARGIN));
+}
+
+
+/** ***************************************************************************
+ * @brief Get a section of the linker script
+ * @param [in] section
+ * @return name, start address and size
+ *****************************************************************************/
+MEM_section_t MEM_get_section(MEM_section_id_t section)
+{
+    MEM_section_t s = {"", 0, 0};
+    switch (section) {
+        case MEM_SECTION_DATA:
+            s = (MEM_section_t){".data", (uint32_t)&_sdata, (uint32_t)&_edata - (uint32_t)&_sdata};
+            break;
+        case MEM_SECTION_BSS:
+            s = (MEM_section_t){".bss", (uint32_t)&_sbss, (uint32_t)&_ebss - (uint32_t)&_sbss};
+            break;
+        case MEM_SECTION_IRQ_STACK:
+            s = (MEM_section_t){"IRQ stack", (uint32_t)&_end, (uint32_t)&_estack - (uint32_t)&_end};
+            break;
+        case MEM_SECTION_CCMRAM:
+            s = (MEM_section_t){".ccmram", (uint32_t)&_sccmram, (uint32_t)&_eccmram - (uint32_t)&_sccmram};
+            break;
+        case MEM_SECTION_MAIN_STACK:
+            s = (MEM_section_t){"main stack", (uint32_t)&_eccmram, (uint32_t)&_estack_main - (uint32_t)&_eccmram};
+            break;
+        default:
+            break;
+    }
+    return s;
+}
+
+
+/** ***************************************************************************
+ * @brief Size of a stack
+ * @param [in] stack
+ * @return bytes
+ *****************************************************************************/
+uint32_t MEM_get_stack_size(MEM_stack_id_t stack)
+{
+    return MEM_get_section((stack == MEM_STACK_MAIN) ?
+            MEM_SECTION_MAIN_STACK : MEM_SECTION_IRQ_STACK).size;
+}
+
+
+/** ***************************************************************************
+ * @brief High watermark of a stack
+ * @param [in] stack
+ * @return Maximum used bytes since MEM_init()
+ *
+ * Scans from the bottom of the stack up to the first overwritten word.
+ *****************************************************************************/
+uint32_t MEM_get_stack_used(MEM_stack_id_t stack)
+{
+    uint32_t *p   = (stack == MEM_STACK_MAIN) ? &_eccmram : &_end;
+    uint32_t *top = (stack == MEM_STACK_MAIN) ? &_estack_main : &_estack;
+    while (p < top && *p == MEM_PAINT) {
+        p++;
+    }
+    return (uint32_t)top - (uint32_t)p;
+}
+
+
+/** ***************************************************************************
+ * @brief Collect the memory usage
+ * @return report
+ *****************************************************************************/
+MEM_report_t MEM_get_report(void)
+{
+    MEM_report_t r;
+    for (int i = 0; i < MEM_SECTIONS; i++) {
+        r.section_size[i] = MEM_get_section(i).size;
+    }
+    for (int i = 0; i < MEM_STACKS; i++) {
+        r.stack_used[i] = MEM_get_stack_used(i);
+    }
+    return r;
+}
+
+
+/** ***************************************************************************
+ * @brief Send the report as SER_FRAME_MEMORY every MEM_REPORT_MS
+ *
+ * @note Call periodically from the main loop.
+ *****************************************************************************/
+void MEM_update(void)
+{
+    if (HAL_GetTick() - last_report >= MEM_REPORT_MS) {
+        last_report = HAL_GetTick();
+        MEM_report_t report = MEM_get_report();
+        SER_send_frame(SER_FRAME_MEMORY, &report, sizeof(report));
+    }
+}
@@ -14,6 +14,9 @@
  * @n   MENU_values_act(int16_t x_distance, uint16_t y_distance, int16_t angle,
  *      float current) and MENU_visual_act(int16_t x_distance,
  *      uint16_t y_distance, float current) display show the orientation to the cable.
+ * @n   The act functions describe their page in the display list of display.c
+ *      between DISP_begin() and DISP_commit() (see main()),
+ *      only the changes are drawn. The init functions draw the static parts.
  *
  * @author  Hanspeter Hochreutener, hhrt@zhaw.ch and Marco Rau, raumar02@students.zhaw.ch
  * @date    27.12.2022
@@ -25,6 +28,24 @@
  *****************************************************************************/
 
 #include "menu.h"
+#include "calculations.h"
+#include "profiling.h"
+#include "clock.h"
+#include "power.h"
+#include "interrupts.h"
+#include "memory.h"
+#include "arena.h"
+#include "session.h"
+#include "governor.h"
+#include "display.h"
+#include "mains.h"
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define DIAG_LINE_HIGHT     13      ///< Line height of the diagnostics page
+#define DIAG_COLUMNS        32      ///< Characters per line of the diagnostics page
 
 /******************************************************************************
  * Variables
@@ -36,8 +57,44 @@ static MENU_entry_t MENU_entry[MENU_ENTRY_COUNT] = {
         {"Single",     "Measurement",  LCD_COLOR_BLACK,    MENU_COLOR},
 };      ///< All the menu entries
 
-static uint16_t x_circle_old = 20;  ///< X erase position of old data
-static uint16_t y_circle_old = 20;  ///< Y erase position of old data
+/** One line of the startup hint */
+typedef struct {
+    const sFONT *font;                  ///< Font of the line
+    uint16_t x;                         ///< X position
+    uint16_t y;                         ///< Y position
+    Text_AlignModeTypdef mode;          ///< Alignment
+    const char *text;                   ///< Text of the line
+} MENU_hint_line_t;
+
+static const MENU_hint_line_t hint[] = {
+        {&Font24,  0,  10, CENTER_MODE, "Cable Monitor"},
+        {&Font12,  0,  35, CENTER_MODE, "by M. Rau & T. Roos"},
+        {&Font12, 10,  70, LEFT_MODE,   "Press black pushbutton to"},
+        {&Font12, 10,  85, LEFT_MODE,   "-> reset system"},
+        {&Font12, 10, 120, LEFT_MODE,   "Press blue pushbutton to"},
+        {&Font12, 10, 135, LEFT_MODE,   "-> Turn buzzer on/off"},
+        {&Font12, 10, 170, LEFT_MODE,   "Tap on the screen to"},
+        {&Font12, 10, 185, LEFT_MODE,   "-> change visual feedback"},
+        {&Font12, 10, 220, LEFT_MODE,   "To start measurement press on"},
+        {&Font12, 10, 235, LEFT_MODE,   "-> \"Average Measurement\" or"},
+        {&Font12, 10, 250, LEFT_MODE,   "-> \"Single Measurement\""},
+};      ///< Lines of the startup hint
+#define HINT_LINES  (sizeof(hint)/sizeof(hint[0]))    ///< Number of hint lines
+static uint32_t hint_line = 0;          ///< Next hint line to draw
+
+/** Label and decimals of the quantities on the session page */
+static const struct {
+    const char *label;                  ///< Name and unit
+    int decimals;                       ///< Digits after the point
+} session_quantity[SES_QUANTITIES] = {
+        [SES_CURRENT] = {"I [A]",  2},
+        [SES_X]       = {"X [mm]", 1},
+        [SES_Y]       = {"Y [mm]", 1},
+        [SES_ANGLE]   = {"Angle",  1},
+};
+static const SES_quantity_t session_short[2] = {SES_CURRENT, SES_Y};  ///< Shown in windows and times
+
+static uint8_t load_shown = 0xFF;   ///< Level shown in the title, 0xFF = redraw
 
 
 /******************************************************************************
@@ -59,6 +116,7 @@ void MENU_values_init(uint8_t *title)
 
     BSP_LCD_SetTextColor(LCD_COLOR_BLACK);
     BSP_LCD_DisplayStringAt(0, TITLE_HIGHT/2 - 5, (uint8_t *)title, CENTER_MODE);
+    load_shown = 0xFF;                  // Title redrawn
 
     BSP_LCD_SetBackColor(LCD_COLOR_WHITE);
     BSP_LCD_DisplayStringAt(10, TITLE_HIGHT+20,  (uint8_t *)"X-Distance:       mm", LEFT_MODE); // offset to cable
@@ -69,6 +127,8 @@ void MENU_values_init(uint8_t *title)
     BSP_LCD_DrawCircle(210,TITLE_HIGHT+102,2);                                                  // degree (°)
 
     BSP_LCD_DisplayStringAt(10, TITLE_HIGHT+140, (uint8_t *)"Current:          A ", LEFT_MODE); // current in cable
+
+    BSP_LCD_DisplayStringAt(10, TITLE_HIGHT+180, (uint8_t *)"Clipped:",             LEFT_MODE); // ADC clipping
 }
 
 
@@ -123,18 +183,48 @@ void MENU_values_act(int16_t x_distance, uint16_t y_distance, int16_t angle, flo
     if(current == CURR_OUTOF_Y_RANGE || current == CURR_OUTOF_Angle_RANGE){
         snprintf(text_current, 6, "NaNs");
     }
+    else if(current == CURR_ADC_CLIPPED){
+        snprintf(text_current, 6, "CLIP");
+    }
     else{
         snprintf(text_current, 7, " %.1f",(float)(current));
     }
 
     // display values
-    BSP_LCD_DisplayStringAt(160, TITLE_HIGHT+20,  (uint8_t *)text_x_distance,   LEFT_MODE);
-    BSP_LCD_DisplayStringAt(160, TITLE_HIGHT+40,  (uint8_t *)text_y_distance,   LEFT_MODE);
+    DISP_text(160, TITLE_HIGHT+20,  &Font16, LCD_COLOR_BLACK, LCD_COLOR_WHITE, text_x_distance);
+    DISP_text(160, TITLE_HIGHT+40,  &Font16, LCD_COLOR_BLACK, LCD_COLOR_WHITE, text_y_distance);
+
+    DISP_text(160, TITLE_HIGHT+80,  &Font16, LCD_COLOR_BLACK, LCD_COLOR_WHITE, text_abs_distance);
+    DISP_text(160, TITLE_HIGHT+100, &Font16, LCD_COLOR_BLACK, LCD_COLOR_WHITE, text_angle);
+
+    DISP_text(160, TITLE_HIGHT+140, &Font16, LCD_COLOR_BLACK, LCD_COLOR_WHITE, text_current);
+}
 
-    BSP_LCD_DisplayStringAt(160, TITLE_HIGHT+80,  (uint8_t *)text_abs_distance, LEFT_MODE);
-    BSP_LCD_DisplayStringAt(160, TITLE_HIGHT+100, (uint8_t *)text_angle,        LEFT_MODE);
 
-    BSP_LCD_DisplayStringAt(160, TITLE_HIGHT+140, (uint8_t *)text_current,      LEFT_MODE);
+/** ***************************************************************************
+ * @brief Display the clipped ADC channels
+ * @param [in] clip_flags bit n set = channel n clipped (see get_clip_flags())
+ *
+ * Lists the clipped channels (LP, RP, LH, RH) in red or "none".
+ * @note Call MENU_values_init() first
+ *****************************************************************************/
+void MENU_clip_act(uint8_t clip_flags)
+{
+    static const char *channel_name[CALC_CHANNELS] = {"LP", "RP", "LH", "RH"};
+    char text_clip[13] = "none";
+    uint32_t color = LCD_COLOR_BLACK;
+
+    if(clip_flags){
+        for(int i = 0; i < CALC_CHANNELS; i++){
+            text_clip[3*i]   = (clip_flags & (1u << i)) ? channel_name[i][0] : ' ';
+            text_clip[3*i+1] = (clip_flags & (1u << i)) ? channel_name[i][1] : ' ';
+            text_clip[3*i+2] = ' ';
+        }
+        text_clip[11] = '\0';
+        color = LCD_COLOR_RED;
+    }
+
+    DISP_text(105, TITLE_HIGHT+180, &Font16, color, LCD_COLOR_WHITE, text_clip);
 }
 
 
@@ -156,6 +246,7 @@ void MENU_visual_init(uint8_t *title)
 
     BSP_LCD_SetTextColor(LCD_COLOR_BLACK);
     BSP_LCD_DisplayStringAt(0, TITLE_HIGHT/2 - 5, (uint8_t *)title, CENTER_MODE);
+    load_shown = 0xFF;                  // Title redrawn
 
     BSP_LCD_SetBackColor(LCD_COLOR_WHITE);
 
@@ -180,27 +271,18 @@ void MENU_visual_act(int16_t x_distance, uint16_t y_distance, float current)
 
     snprintf(text_current, 8, "NaNs A"); // default
 
-    // erase old position
-    BSP_LCD_SetTextColor(LCD_COLOR_WHITE);
-    BSP_LCD_DrawCircle(x_circle_old,y_circle_old+TITLE_HIGHT,10);
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,x_circle_old,y_circle_old+TITLE_HIGHT);
+    // static elements, redrawn by DISP_commit() where the position crossed them
+    DISP_circle(120,TITLE_HIGHT+220,4,LCD_COLOR_BLACK);                     // origin
+    DISP_line(120,TITLE_HIGHT+220,10,TITLE_HIGHT+110,LCD_COLOR_BLACK);      // -45°
+    DISP_line(120,TITLE_HIGHT+220,120,TITLE_HIGHT+10,LCD_COLOR_BLACK);      // 0°
+    DISP_line(120,TITLE_HIGHT+220,230,TITLE_HIGHT+110,LCD_COLOR_BLACK);     // +45°
 
-    // set static elements
-    BSP_LCD_SetTextColor(LCD_COLOR_BLACK);
-    BSP_LCD_DrawCircle(120,TITLE_HIGHT+220,4);                  // origin
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,10,TITLE_HIGHT+110);   // -45°
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,120,TITLE_HIGHT+10);   // 0°
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,230,TITLE_HIGHT+110);  // +45°
-
-    BSP_LCD_SetTextColor(LCD_COLOR_LIGHTGRAY);                  // intermediate steps
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,10,TITLE_HIGHT+156);   // -60°
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,10,TITLE_HIGHT+30);    // -30°
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,66,TITLE_HIGHT+10);    // -15°
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,174,TITLE_HIGHT+10);   // +15°
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,230,TITLE_HIGHT+30);   // +30°
-    BSP_LCD_DrawLine(120,TITLE_HIGHT+220,230,TITLE_HIGHT+156);  // +60°
-
-    BSP_LCD_SetTextColor(LCD_COLOR_RED);
+    DISP_line(120,TITLE_HIGHT+220,10,TITLE_HIGHT+156,LCD_COLOR_LIGHTGRAY);  // -60°, intermediate steps
+    DISP_line(120,TITLE_HIGHT+220,10,TITLE_HIGHT+30,LCD_COLOR_LIGHTGRAY);   // -30°
+    DISP_line(120,TITLE_HIGHT+220,66,TITLE_HIGHT+10,LCD_COLOR_LIGHTGRAY);   // -15°
+    DISP_line(120,TITLE_HIGHT+220,174,TITLE_HIGHT+10,LCD_COLOR_LIGHTGRAY);  // +15°
+    DISP_line(120,TITLE_HIGHT+220,230,TITLE_HIGHT+30,LCD_COLOR_LIGHTGRAY);  // +30°
+    DISP_line(120,TITLE_HIGHT+220,230,TITLE_HIGHT+156,LCD_COLOR_LIGHTGRAY); // +60°
 
     // check if cable in range
     if ( x_distance != CALC_OUTOF_X_RANGE && y_distance != CALC_OUTOF_Y_RANGE ){
@@ -210,28 +292,314 @@ void MENU_visual_act(int16_t x_distance, uint16_t y_distance, float current)
         uint16_t y_circle = 220 - y_distance;
 
         // display position to device
-        BSP_LCD_DrawCircle(x_circle,y_circle+TITLE_HIGHT,10);
-        BSP_LCD_DrawLine(120,TITLE_HIGHT+220,x_circle,y_circle+TITLE_HIGHT);
+        DISP_circle(x_circle,y_circle+TITLE_HIGHT,10,LCD_COLOR_RED);
+        DISP_line(120,TITLE_HIGHT+220,x_circle,y_circle+TITLE_HIGHT,LCD_COLOR_RED);
 
         // calculate distance to device
         snprintf(text_position, 8, "%4d mm",(int)(hypot(x_distance, y_distance)));
 
         // check if current measurement possible
-        if(current != CURR_OUTOF_Y_RANGE && current !=  CURR_OUTOF_Angle_RANGE){
+        if(current == CURR_ADC_CLIPPED){
+            snprintf(text_current, 9, "CLIP A");
+        }
+        else if(current != CURR_OUTOF_Y_RANGE && current !=  CURR_OUTOF_Angle_RANGE){
             snprintf(text_current, 9, " %.1f A",(float)(current));
         }
-
-        // set new position for erase
-        x_circle_old = x_circle;
-        y_circle_old = y_circle;
     }
     else{
         snprintf(text_position, 9, "NaNs mm"); // when no cable detected
     }
 
     // display distance to device
-    BSP_LCD_DisplayStringAt(150, TITLE_HIGHT+215, (uint8_t *)text_position,LEFT_MODE);
-    BSP_LCD_DisplayStringAt(20, TITLE_HIGHT+215, (uint8_t *)text_current,LEFT_MODE);
+    DISP_text(150, TITLE_HIGHT+215, &Font16, LCD_COLOR_RED, LCD_COLOR_WHITE, text_position);
+    DISP_text(20, TITLE_HIGHT+215, &Font16, LCD_COLOR_RED, LCD_COLOR_WHITE, text_current);
+}
+
+
+/** ***************************************************************************
+ * @brief Display the level of the load governor in the title
+ * @param [in] level see GOV_get_level()
+ *
+ * Drawn only when the level changes, "LOAD n" in red while features
+ * are shed, nothing at level 0.
+ * @note Call after an init function of the page
+ *****************************************************************************/
+void MENU_load_act(uint8_t level)
+{
+    if (level == load_shown) {
+        return;
+    }
+    load_shown = level;
+    char text[8] = "      ";
+    if (level > 0) {
+        snprintf(text, sizeof(text), "LOAD %d", level);
+    }
+    sFONT *font = BSP_LCD_GetFont();    // Restored for the caller
+    uint32_t back = BSP_LCD_GetBackColor();
+    uint32_t color = BSP_LCD_GetTextColor();
+    BSP_LCD_SetFont(&Font8);
+    BSP_LCD_SetBackColor(MENU_COLOR);
+    BSP_LCD_SetTextColor(LCD_COLOR_RED);
+    BSP_LCD_DisplayStringAt(BSP_LCD_GetXSize()-40, 7, (uint8_t *)text, LEFT_MODE);
+    BSP_LCD_SetFont(font);
+    BSP_LCD_SetBackColor(back);
+    BSP_LCD_SetTextColor(color);
+}
+
+
+/** ***************************************************************************
+ * @brief Initialize the diagnostics page
+ * @param [in] Title
+ *
+ * @note Call MENU_diag_act() to show new data.
+ *****************************************************************************/
+void MENU_diag_init(uint8_t *title)
+{
+    MENU_visual_init(title);
+    IRQ_reset_stats();                  // Worst case since the page is shown
+}
+
+
+/** ***************************************************************************
+ * @brief Add one line of the diagnostics page to the display list
+ * @param [in] y position, is advanced to the next line
+ * @param [in] text at most DIAG_COLUMNS characters
+ *
+ * A shorter text than before is padded by DISP_commit().
+ *****************************************************************************/
+static void diag_line(uint16_t *y, const char *text)
+{
+    DISP_text(5, *y, &Font12, LCD_COLOR_BLACK, LCD_COLOR_WHITE, text);
+    *y += DIAG_LINE_HIGHT;
+}
+
+
+/** ***************************************************************************
+ * @brief Display the diagnostics
+ *
+ * Shows the clock state residency, the boot timeline with the mains frequency,
+ * the energy report of the last window,
+ * the level of the load governor with the costs of its stages
+ * and the worst case latency and run time of the interrupts.
+ * @note Call MENU_diag_init() first
+ *****************************************************************************/
+void MENU_diag_act(void)
+{
+    char text[DIAG_COLUMNS+1];
+    uint16_t y = TITLE_HIGHT+5;
+
+    diag_line(&y, "Clock residency");
+    snprintf(text, sizeof(text), " sleep    %3d.%d %%",
+            (int)(CLOCK_get_residency_permille(CLOCK_SLEEP)/10), (int)(CLOCK_get_residency_permille(CLOCK_SLEEP)%10));
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), "  84 MHz  %3d.%d %%",
+            (int)(CLOCK_get_residency_permille(CLOCK_LOW)/10), (int)(CLOCK_get_residency_permille(CLOCK_LOW)%10));
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), " 168 MHz  %3d.%d %%",
+            (int)(CLOCK_get_residency_permille(CLOCK_FULL)/10), (int)(CLOCK_get_residency_permille(CLOCK_FULL)%10));
+    diag_line(&y, text);
+
+    snprintf(text, sizeof(text), "Boot [ms]   mains %s%s",
+            MAINS_get_profile(MAINS_get())->name, MAINS_is_auto() ? "" : " fixed");
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), " LCD %d  frame %d  touch %d",
+            (int)(PROF_boot_get_us(PROF_BOOT_LCD)/1000),
+            (int)(PROF_boot_get_us(PROF_BOOT_FIRST_FRAME)/1000),
+            (int)(PROF_boot_get_us(PROF_BOOT_TOUCH)/1000));
+    diag_line(&y, text);
+
+    PWR_report_t report = PWR_get_report();
+    uint32_t window_ms = (report.window_ms > 0) ? report.window_ms : 1;
+    uint32_t cpu[PWR_SUBSYSTEMS];       // CPU share [permille]
+    for (int i = 0; i < PWR_SUBSYSTEMS; i++) {
+        cpu[i] = report.active_us[i] / window_ms;
+    }
+    diag_line(&y, "Energy [uJ]");
+    snprintf(text, sizeof(text), " %d in %d ms  %d / meas",
+            (int)report.energy_uj, (int)report.window_ms, (int)report.energy_per_meas_uj);
+    diag_line(&y, text);
+    GOV_status_t gov = GOV_get_status();     // Level and stage costs DSP/LCD/TLM/IN
+    snprintf(text, sizeof(text), "CPU   load %d: %d/%d/%d/%d ms", gov.level,
+            (int)(gov.cost_us[GOV_DSP]/1000), (int)(gov.cost_us[GOV_LCD]/1000),
+            (int)(gov.cost_us[GOV_TELEMETRY]/1000), (int)(gov.cost_us[GOV_INPUT]/1000));
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), " ACQ %d.%d%% DSP %d.%d%% LCD %d.%d%%",
+            (int)(cpu[PWR_ACQ]/10), (int)(cpu[PWR_ACQ]%10),
+            (int)(cpu[PWR_DSP]/10), (int)(cpu[PWR_DSP]%10),
+            (int)(cpu[PWR_LCD]/10), (int)(cpu[PWR_LCD]%10));
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), " TS %d.%d%% BUZ %d.%d%% main %d.%d%%",
+            (int)(cpu[PWR_TOUCH]/10), (int)(cpu[PWR_TOUCH]%10),
+            (int)(cpu[PWR_BUZZER]/10), (int)(cpu[PWR_BUZZER]%10),
+            (int)(cpu[PWR_MAIN]/10), (int)(cpu[PWR_MAIN]%10));
+    diag_line(&y, text);
+
+    diag_line(&y, "IRQ max latency/run [us]");
+    for (int i = 0; i < IRQ_SOURCES; i += 2) {
+        char column[2][DIAG_COLUMNS/2+1];
+        for (int j = 0; j < 2; j++) {
+            column[j][0] = '\0';
+            if (i+j < IRQ_SOURCES) {
+                IRQ_stats_t s = IRQ_get_stats(i+j);
+                snprintf(column[j], sizeof(column[j]), " %-4s %2d.%d/%2d.%d",
+                        IRQ_get_name(i+j),
+                        (int)(s.max_latency_ns/1000), (int)((s.max_latency_ns/100)%10),
+                        (int)(s.max_run_ns/1000), (int)((s.max_run_ns/100)%10));
+            }
+        }
+        snprintf(text, sizeof(text), "%s%s", column[0], column[1]);
+        diag_line(&y, text);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Initialize the memory page
+ * @param [in] Title
+ *
+ * @note Call MENU_memory_act() to show new data.
+ *****************************************************************************/
+void MENU_memory_init(uint8_t *title)
+{
+    MENU_visual_init(title);
+}
+
+
+/** ***************************************************************************
+ * @brief Display the memory usage
+ *
+ * Shows the sections of the linker script, the high watermarks
+ * of the stacks (see memory.c), the static DSP state (see calculations.c)
+ * and the usage of the SDRAM arenas (see arena.c).
+ * @note Call MENU_memory_init() first
+ *****************************************************************************/
+void MENU_memory_act(void)
+{
+    char text[DIAG_COLUMNS+1];
+    uint16_t y = TITLE_HIGHT+5;
+
+    diag_line(&y, "Section    Start     Size");
+    for (int i = 0; i < MEM_SECTIONS; i++) {
+        MEM_section_t s = MEM_get_section(i);
+        snprintf(text, sizeof(text), "%-10s %08X %6d", s.name, (unsigned int)s.start, (int)s.size);
+        diag_line(&y, text);
+    }
+    uint32_t ram = MEM_get_section(MEM_SECTION_DATA).size + MEM_get_section(MEM_SECTION_BSS).size;
+    uint32_t ccm = MEM_get_section(MEM_SECTION_CCMRAM).size;
+    snprintf(text, sizeof(text), "Static RAM %6d / 196608", (int)ram);
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), "Static CCM %6d /  65536", (int)ccm);
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), "Stack main %6d / %6d",
+            (int)MEM_get_stack_used(MEM_STACK_MAIN), (int)MEM_get_stack_size(MEM_STACK_MAIN));
+    diag_line(&y, text);
+    snprintf(text, sizeof(text), "Stack IRQ  %6d / %6d",
+            (int)MEM_get_stack_used(MEM_STACK_IRQ), (int)MEM_get_stack_size(MEM_STACK_IRQ));
+    diag_line(&y, text);
+    uint32_t fft_state;
+    uint32_t dsp_state = get_dsp_state_bytes(&fft_state);
+    snprintf(text, sizeof(text), "DSP state  %6d (FFT %d)", (int)dsp_state, (int)fft_state);
+    diag_line(&y, text);
+
+    diag_line(&y, "SDRAM [KB] Used/Size  Peak Fail");
+    for (int i = 0; i < ARENA_COUNT; i++) {
+        ARENA_stats_t s = ARENA_get_stats(i);
+        snprintf(text, sizeof(text), "%-10s %4d/%4d %5d %4d", s.name,
+                (int)(s.used/1024), (int)(s.size/1024), (int)(s.peak/1024), (int)s.failures);
+        diag_line(&y, text);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Initialize the session page
+ * @param [in] Title
+ *
+ * @note Call MENU_session_act() to show new data.
+ *****************************************************************************/
+void MENU_session_init(uint8_t *title)
+{
+    MENU_visual_init(title);
+}
+
+
+/** ***************************************************************************
+ * @brief Format a time as h:mm:ss
+ * @param [out] text at least 12 characters
+ * @param [in] ms time [ms]
+ *****************************************************************************/
+static void session_time(char *text, uint32_t ms)
+{
+    uint32_t s = ms / 1000;
+    snprintf(text, 12, "%d:%02d:%02d", (int)(s / 3600), (int)(s / 60 % 60), (int)(s % 60));
+}
+
+
+/** ***************************************************************************
+ * @brief Display the session statistics
+ *
+ * Shows the duration, mean, standard deviation, min and max
+ * of each quantity, the time-weighted means, the decaying windows
+ * and when the min and max occurred (see session.c).
+ * @note Call MENU_session_init() first
+ *****************************************************************************/
+void MENU_session_act(void)
+{
+    char text[DIAG_COLUMNS+1];
+    char t0[12], t1[12];
+    uint16_t y = TITLE_HIGHT+5;
+    SES_summary_t summary;
+    SES_get_summary(&summary);
+
+    session_time(t0, summary.duration_ms);
+    snprintf(text, sizeof(text), "Session %s  %d readings", t0, (int)summary.readings);
+    diag_line(&y, text);
+    diag_line(&y, "        mean   std   min   max");
+    for (int q = 0; q < SES_QUANTITIES; q++) {
+        const SES_stats_t *s = &summary.quantity[q];
+        int d = session_quantity[q].decimals;
+        if (s->count == 0) {
+            snprintf(text, sizeof(text), "%-6s     -", session_quantity[q].label);
+        } else {
+            snprintf(text, sizeof(text), "%-6s%6.*f%6.*f%6.*f%6.*f", session_quantity[q].label,
+                    d, s->mean, d, s->std, d, s->min, d, s->max);
+        }
+        diag_line(&y, text);
+    }
+
+    diag_line(&y, "Time-weighted mean  covered");
+    for (int q = 0; q < SES_QUANTITIES; q++) {
+        const SES_stats_t *s = &summary.quantity[q];
+        uint32_t permille = 0;          // Share of the session covered
+        if (summary.duration_ms > 0) {
+            permille = (uint64_t)s->covered_ms * 1000 / summary.duration_ms;
+        }
+        snprintf(text, sizeof(text), "%-6s%8.*f %6d.%d %%", session_quantity[q].label,
+                session_quantity[q].decimals, s->time_mean, (int)(permille/10), (int)(permille%10));
+        diag_line(&y, text);
+    }
+
+    snprintf(text, sizeof(text), "Window %2d s mean/std, %d s", summary.window_s[0], summary.window_s[1]);
+    diag_line(&y, text);
+    for (int i = 0; i < 2; i++) {
+        int q = session_short[i];
+        const SES_stats_t *s = &summary.quantity[q];
+        int d = session_quantity[q].decimals;
+        snprintf(text, sizeof(text), "%-6s%6.*f/%-5.*f%6.*f/%.*f", session_quantity[q].label,
+                d, s->window[0].mean, d, s->window[0].std, d, s->window[1].mean, d, s->window[1].std);
+        diag_line(&y, text);
+    }
+
+    diag_line(&y, "Time of min / max");
+    for (int i = 0; i < 2; i++) {
+        int q = session_short[i];
+        const SES_stats_t *s = &summary.quantity[q];
+        session_time(t0, s->min_ms - summary.start_ms);
+        session_time(t1, s->max_ms - summary.start_ms);
+        snprintf(text, sizeof(text), "%-6s %9s %9s", session_quantity[q].label,
+                (s->count > 0) ? t0 : "-", (s->count > 0) ? t1 : "-");
+        diag_line(&y, text);
+    }
 }
 
 
@@ -268,26 +636,56 @@ void MENU_draw(void)
  *****************************************************************************/
 void MENU_hint(void)
 {
-    BSP_LCD_SetBackColor(LCD_COLOR_WHITE);
-    BSP_LCD_SetTextColor(LCD_COLOR_BLACK);
+    while(!MENU_hint_step()){
+        ;
+    }
+}
 
-    BSP_LCD_SetFont(&Font24);
-    BSP_LCD_DisplayStringAt(0,10, (uint8_t *)"Cable Monitor", CENTER_MODE);
-    BSP_LCD_SetFont(&Font12);
-    BSP_LCD_DisplayStringAt(0,35, (uint8_t *)"by M. Rau & T. Roos", CENTER_MODE);
 
-    BSP_LCD_DisplayStringAt(10, 70, (uint8_t *)"Press black pushbutton to", LEFT_MODE);
-    BSP_LCD_DisplayStringAt(10, 85, (uint8_t *)"-> reset system",           LEFT_MODE);
+/** ***************************************************************************
+ * @brief Draws the next line of the startup hint.
+ * @return true when the hint is complete
+ *
+ * Drawing one line per call keeps the text rendering
+ * out of the way of the first measurement at startup.
+ *****************************************************************************/
+bool MENU_hint_step(void)
+{
+    if(hint_line < HINT_LINES){
+        BSP_LCD_SetBackColor(LCD_COLOR_WHITE);
+        BSP_LCD_SetTextColor(LCD_COLOR_BLACK);
+        BSP_LCD_SetFont((sFONT *)hint[hint_line].font);
+        BSP_LCD_DisplayStringAt(hint[hint_line].x, hint[hint_line].y,
+                (uint8_t *)hint[hint_line].text, hint[hint_line].mode);
+        hint_line++;
+    }
+    return hint_line >= HINT_LINES;
+}
 
-    BSP_LCD_DisplayStringAt(10, 120, (uint8_t *)"Press blue pushbutton to", LEFT_MODE);
-    BSP_LCD_DisplayStringAt(10, 135, (uint8_t *)"-> Turn buzzer on/off",    LEFT_MODE);
 
-    BSP_LCD_DisplayStringAt(10, 170, (uint8_t *)"Tap on the screen to",      LEFT_MODE);
-    BSP_LCD_DisplayStringAt(10, 185, (uint8_t *)"-> change visual feedback", LEFT_MODE);
+/** ***************************************************************************
+ * @brief Shows the boot timeline below the startup hint.
+ *
+ * Times are in ms since the system clock was configured.
+ * Two Font8 lines fit between the last hint line (ends at y = 261)
+ * and the menu bar (y = 280).
+ * @note Call when PROF_boot_complete() returns true.
+ *****************************************************************************/
+void MENU_boot_timeline(void)
+{
+    char text[36];
+
+    snprintf(text, sizeof(text), "Boot ms: LCD %d  Touch %d",
+            (int)(PROF_boot_get_us(PROF_BOOT_LCD)/1000), (int)(PROF_boot_get_us(PROF_BOOT_TOUCH)/1000));
+    BSP_LCD_SetBackColor(LCD_COLOR_WHITE);
+    BSP_LCD_SetTextColor(LCD_COLOR_DARKGRAY);
+    BSP_LCD_SetFont(&Font8);
+    BSP_LCD_DisplayStringAt(10, 264, (uint8_t *)text, LEFT_MODE);
 
-    BSP_LCD_DisplayStringAt(10, 220, (uint8_t *)"To start measurement press on", LEFT_MODE);
-    BSP_LCD_DisplayStringAt(10, 235, (uint8_t *)"-> \"Average Measurement\" or", LEFT_MODE);
-    BSP_LCD_DisplayStringAt(10, 250, (uint8_t *)"-> \"Single Measurement\"",     LEFT_MODE);
+    snprintf(text, sizeof(text), "First frame after %d ms",
+            (int)(PROF_boot_get_us(PROF_BOOT_FIRST_FRAME)/1000));
+    BSP_LCD_DisplayStringAt(10, 272, (uint8_t *)text, LEFT_MODE);
+    BSP_LCD_SetTextColor(LCD_COLOR_BLACK);
 }
 
 
@@ -315,6 +713,7 @@ void MENU_clear(void)
     BSP_LCD_SetTextColor(LCD_COLOR_WHITE);
     BSP_LCD_SetBackColor(LCD_COLOR_WHITE);
     BSP_LCD_FillRect(0,0, BSP_LCD_GetXSize(), BSP_LCD_GetYSize()-MENU_HEIGHT);
+    DISP_invalidate();                  // Nothing of the display list is left
 }
 
 /** ***************************************************************************
@@ -358,8 +757,10 @@ MENU_entry_t MENU_get_entry(const MENU_item_t item)
  *****************************************************************************/
 MENU_item_t MENU_get_transition(void)
 {
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_DEFERRED);   // Shared with touch_job()
     MENU_item_t item = MENU_transition;
     MENU_transition = MENU_NONE;
+    IRQ_unmask(basepri);
     return item;
 }
 
@@ -435,26 +836,42 @@ void MENU_check_transition(void)
 
 
 
+/** ***************************************************************************
+ * @brief Deferred work of the touchscreen interrupt
+ *
+ * Executed by the PendSV handler with the lowest priority,
+ * because the I2C transfers with the touch controller are blocking.
+ *****************************************************************************/
+static void touch_job(void)
+{
+    if (BSP_TS_ITGetStatus()) {            // Get interrupt status
+        BSP_TS_ITClear();                    // Clear touchscreen controller int.
+        MENU_check_transition();
+    }
+}
+
+
 /** ***************************************************************************
  * @brief Interrupt handler for the touchscreen
  *
  * @note BSP_TS_ITConfig(); must be called in the main function
  * to enable touchscreen interrupt.
+ * Set the priority with NVIC_SetPriority(EXTI15_10_IRQn, IRQ_PRIO_TOUCH) afterwards.
  * @note There are timing issues when interrupt is enabled.
  * It seems that polling is the better choice with this evaluation board.
  * @n Call MENU_check_transition() from the while loop in main for polling.
  *
  * The touchscreen interrupt is connected to PA15.
  * @n The interrupt handler for external line 15 to 10 is called.
+ * It only clears the interrupt, the touch controller is read
+ * by touch_job() (see IRQ_defer()).
  *****************************************************************************/
 void EXTI15_10_IRQHandler(void)
 {
+    uint32_t start = IRQ_enter(IRQ_SRC_TOUCH);
     if (EXTI->PR & EXTI_PR_PR15) {        // Check if interrupt on touchscreen
         EXTI->PR |= EXTI_PR_PR15;        // Clear pending interrupt on line 15
-        if (BSP_TS_ITGetStatus()) {        // Get interrupt status
-            BSP_TS_ITClear();                // Clear touchscreen controller int.
-            MENU_check_transition();
-        }
-        EXTI->PR |= EXTI_PR_PR15;        // Clear pending interrupt on line 15
+        IRQ_defer(touch_job);
     }
+    IRQ_exit(IRQ_SRC_TOUCH, start);
 }
@@ -0,0 +1,311 @@
+/** ***************************************************************************
+ * @file
+ * @brief Accounting of CPU time, peripheral activity and energy
+ *
+ * Active time
+ * ===========
+ * Code of a subsystem is enclosed in PWR_begin(subsystem) and PWR_end().
+ * The cycles of the DWT counter in between are charged to the subsystem.
+ * Calls may be nested, e.g. by interrupt handlers,
+ * the cycles are always charged to the innermost subsystem.
+ * CLOCK_set() calls PWR_clock_change() before it switches the clock,
+ * so every interval is converted with the clock it ran at.
+ * @n The remaining time the core is awake is charged to PWR_MAIN,
+ * the time the core sleeps is taken from the residency of clock.c.
+ *
+ * Busy time
+ * =========
+ * PWR_busy_start() and PWR_busy_stop() mark the time a peripheral
+ * works in the background, e.g. the ADC during an acquisition
+ * or the LTDC (with its DMA) reading the frame buffer.
+ *
+ * Energy
+ * ======
+ * The energy of a window of PWR_REPORT_MS is estimated with a power model:
+ * @n E = VDD * ( I_run_full * t_168MHz + I_run_low * t_84MHz + I_sleep * t_sleep
+ *               + sum( I_busy[subsystem] * t_busy[subsystem] ) )
+ * @n Divided by the number of measurements (processed frames) in the window
+ * this gives the energy per measurement.
+ * The default model uses typical values of the data sheets,
+ * PWR_set_model() replaces it by measured values.
+ * @n After each window the report is sent as SER_FRAME_POWER
+ * and shown on the diagnostics page.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "power.h"
+#include "clock.h"
+#include "serial.h"
+#include "profiling.h"
+#include "trace.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define STACK_DEPTH     6       ///< Max nesting of PWR_begin()
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static PWR_model_t model = {                ///< Power model
+        .vdd_mv      = 3000,
+        .run_full_ua = 50000,               // 168 MHz, code in flash, ART on
+        .run_low_ua  = 27000,               // 84 MHz
+        .sleep_ua    = 12000,               // Sleep at 84 MHz
+        .busy_ua     = {
+                [PWR_MAIN]   = 0,
+                [PWR_ACQ]    = 1600,        // ADC3 and TIM2
+                [PWR_DSP]    = 0,
+                [PWR_LCD]    = 30000,       // LTDC, SDRAM, backlight
+                [PWR_TOUCH]  = 1000,        // I2C3 and STMPE811
+                [PWR_BUZZER] = 5000,        // Piezo buzzer and TIM5
+        },
+};
+
+static PWR_subsystem_t stack[STACK_DEPTH] = {PWR_MAIN}; ///< Nested subsystems
+static uint32_t depth = 0;                  ///< Index of the innermost subsystem
+static uint32_t overflow = 0;               ///< PWR_begin() calls beyond STACK_DEPTH, not pushed
+static uint32_t last_cycles = 0;            ///< DWT count of the last charge
+
+static uint32_t active_ns[PWR_SUBSYSTEMS];  ///< CPU time in the window
+static uint32_t busy_us[PWR_SUBSYSTEMS];    ///< Busy time in the window
+static uint32_t busy_since[PWR_SUBSYSTEMS]; ///< Start of the running busy time
+static uint32_t busy_flags = 0;             ///< Bit n set = subsystem n busy
+static uint32_t measurements = 0;           ///< Measurements in the window
+
+static uint32_t window_start_us = 0;        ///< Start of the window
+static uint32_t clock_ms[CLOCK_STATES];     ///< Clock residency at window start
+static PWR_report_t report;                 ///< Report of the last window
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Charge the cycles since the last charge to the innermost subsystem
+ *
+ * @note Call with interrupts disabled.
+ *****************************************************************************/
+static void charge(void)
+{
+    uint32_t now = DWT->CYCCNT;
+    active_ns[stack[depth]] += PROF_cycles_to_ns(now - last_cycles);
+    last_cycles = now;
+}
+
+
+/** ***************************************************************************
+ * @brief Charge the running interval before the core clock changes
+ *
+ * @note Called by CLOCK_set() with interrupts disabled.
+ *****************************************************************************/
+void PWR_clock_change(void)
+{
+    charge();
+}
+
+
+/** ***************************************************************************
+ * @brief Start the accounting
+ *
+ * @note Call after PROF_init() and CLOCK_init().
+ *****************************************************************************/
+void PWR_init(void)
+{
+    last_cycles = DWT->CYCCNT;
+    window_start_us = CLOCK_get_us();
+    for (int i = 0; i < CLOCK_STATES; i++) {
+        clock_ms[i] = CLOCK_get_residency_ms(i);
+    }
+    PWR_busy_start(PWR_LCD);            // LTDC is always reading the frame buffer
+}
+
+
+/** ***************************************************************************
+ * @brief Replace the power model
+ * @param [in] new_model
+ *****************************************************************************/
+void PWR_set_model(const PWR_model_t *new_model)
+{
+    model = *new_model;
+}
+
+
+/** ***************************************************************************
+ * @brief Get the power model
+ * @return model
+ *****************************************************************************/
+PWR_model_t PWR_get_model(void)
+{
+    return model;
+}
+
+
+/** ***************************************************************************
+ * @brief Start charging CPU time to a subsystem
+ * @param [in] subsystem
+ *
+ * @note Each call must be followed by a call of PWR_end().
+ *****************************************************************************/
+void PWR_begin(PWR_subsystem_t subsystem)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    charge();
+    if (depth >= STACK_DEPTH-1) {
+        overflow++;                     // Charged to the outer subsystem
+    } else {
+        stack[++depth] = subsystem;
+        if (__get_IPSR() == 0) {        // Handlers are traced by IRQ_enter()
+            TRACE(TRACE_BEGIN, subsystem);
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+
+/** ***************************************************************************
+ * @brief Stop charging CPU time to the subsystem of the last PWR_begin()
+ *****************************************************************************/
+void PWR_end(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    charge();
+    if (overflow > 0) {
+        overflow--;                     // Matches a PWR_begin() which was not pushed
+    } else if (depth > 0) {
+        if (__get_IPSR() == 0) {
+            TRACE(TRACE_END, stack[depth]);
+        }
+        depth--;
+    }
+    __set_PRIMASK(primask);
+}
+
+
+/** ***************************************************************************
+ * @brief Mark the peripheral of a subsystem as busy
+ * @param [in] subsystem
+ *
+ * Calls while the subsystem is busy are ignored.
+ *****************************************************************************/
+void PWR_busy_start(PWR_subsystem_t subsystem)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!(busy_flags & (1UL << subsystem))) {
+        busy_flags |= (1UL << subsystem);
+        busy_since[subsystem] = CLOCK_get_us();
+    }
+    __set_PRIMASK(primask);
+}
+
+
+/** ***************************************************************************
+ * @brief Mark the peripheral of a subsystem as idle
+ * @param [in] subsystem
+ *****************************************************************************/
+void PWR_busy_stop(PWR_subsystem_t subsystem)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (busy_flags & (1UL << subsystem)) {
+        busy_flags &= ~(1UL << subsystem);
+        busy_us[subsystem] += CLOCK_get_us() - busy_since[subsystem];
+    }
+    __set_PRIMASK(primask);
+}
+
+
+/** ***************************************************************************
+ * @brief Count a processed frame
+ *****************************************************************************/
+void PWR_count_measurement(void)
+{
+    measurements++;
+}
+
+
+/** ***************************************************************************
+ * @brief Close the window after PWR_REPORT_MS
+ *
+ * Calculates the report, sends it as SER_FRAME_POWER and starts a new window.
+ * @note Call periodically from the main loop.
+ *****************************************************************************/
+void PWR_update(void)
+{
+    uint32_t now = CLOCK_get_us();
+    if (now - window_start_us < PWR_REPORT_MS*1000) {
+        return;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    charge();
+    PWR_report_t r = {0};
+    r.window_ms = (now - window_start_us) / 1000;
+    r.measurements = measurements;
+    for (int i = 0; i < PWR_SUBSYSTEMS; i++) {
+        if (busy_flags & (1UL << i)) {      // Split running busy time
+            busy_us[i] += now - busy_since[i];
+            busy_since[i] = now;
+        }
+        r.active_us[i] = active_ns[i] / 1000;
+        r.busy_us[i] = busy_us[i];
+        active_ns[i] = 0;
+        busy_us[i] = 0;
+    }
+    measurements = 0;
+    window_start_us = now;
+    __set_PRIMASK(primask);
+
+    /* Clock residency of the window */
+    uint32_t ms[CLOCK_STATES];
+    for (int i = 0; i < CLOCK_STATES; i++) {
+        uint32_t total = CLOCK_get_residency_ms(i);
+        ms[i] = total - clock_ms[i];
+        clock_ms[i] = total;
+    }
+    r.sleep_us = ms[CLOCK_SLEEP] * 1000;
+
+    /* Main loop = awake time not charged to any other subsystem */
+    uint32_t awake_us = (ms[CLOCK_LOW] + ms[CLOCK_FULL]) * 1000;
+    uint32_t others_us = 0;
+    for (int i = PWR_MAIN+1; i < PWR_SUBSYSTEMS; i++) {
+        others_us += r.active_us[i];
+    }
+    r.active_us[PWR_MAIN] = (awake_us > others_us) ? awake_us - others_us : 0;
+
+    /* Energy [uJ] = V [mV] * I [uA] * t [ms] / 1e6 */
+    uint64_t charge_uams = (uint64_t)model.run_full_ua * ms[CLOCK_FULL]
+            + (uint64_t)model.run_low_ua * ms[CLOCK_LOW]
+            + (uint64_t)model.sleep_ua * ms[CLOCK_SLEEP];
+    for (int i = 0; i < PWR_SUBSYSTEMS; i++) {
+        charge_uams += (uint64_t)model.busy_ua[i] * (r.busy_us[i] / 1000);
+    }
+    r.energy_uj = (uint32_t)((charge_uams * model.vdd_mv) / 1000000);
+    r.energy_per_meas_uj = (r.measurements > 0) ? r.energy_uj / r.measurements : 0;
+
+    report = r;
+    SER_send_frame(SER_FRAME_POWER, &report, sizeof(report));
+}
+
+
+/** ***************************************************************************
+ * @brief Report of the last completed window
+ * @return report
+ *****************************************************************************/
+PWR_report_t PWR_get_report(void)
+{
+    return report;
+}
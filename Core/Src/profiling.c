@@ -0,0 +1,141 @@
+/** ***************************************************************************
+ * @file
+ * @brief Cycle counting with the DWT and the boot timeline
+ *
+ * Cycle counter
+ * =============
+ * The DWT (Data Watchpoint and Trace unit) of the Cortex-M4 contains a 32 bit
+ * counter which is incremented with every core clock cycle.
+ * @n PROF_init() enables the counter, PROF_get_cycles() reads it.
+ * At 168 MHz the counter overflows after about 25 s,
+ * differences of two readings are correct as long as they are shorter.
+ *
+ * Boot timeline
+ * =============
+ * main() calls PROF_boot_mark() when a boot stage is reached.
+ * The time of each stage is stored relative to PROF_BOOT_CLOCK,
+ * which is marked by PROF_init() right after the system clock is configured.
+ * @n The timeline is shown on the start screen by MENU_boot_timeline().
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "profiling.h"
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static uint32_t boot_cycles[PROF_BOOT_STAGES];  ///< Cycle count of each boot stage
+static uint32_t boot_reached = 0;               ///< Bit n set = boot stage n reached
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Enable the DWT cycle counter and start the boot timeline
+ *
+ * @note Call after SystemClock_Config() so that the timeline
+ * is measured with the final core clock.
+ *****************************************************************************/
+void PROF_init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // Enable trace and debug blocks
+    DWT->CYCCNT = 0;                                // Reset the cycle counter
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;            // Enable the cycle counter
+    PROF_boot_mark(PROF_BOOT_CLOCK);
+}
+
+
+/** ***************************************************************************
+ * @brief Read the cycle counter
+ * @return Core clock cycles since PROF_init()
+ *****************************************************************************/
+uint32_t PROF_get_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+
+/** ***************************************************************************
+ * @brief Convert core clock cycles to microseconds
+ * @param [in] cycles
+ * @return microseconds
+ *****************************************************************************/
+uint32_t PROF_cycles_to_us(uint32_t cycles)
+{
+    return (uint32_t)(((uint64_t)cycles * 1000000) / SystemCoreClock);
+}
+
+
+/** ***************************************************************************
+ * @brief Convert core clock cycles to nanoseconds
+ * @param [in] cycles
+ * @return nanoseconds
+ *
+ * Uses 32 bit arithmetic only, so it is fast enough for interrupt handlers.
+ * Intervals up to about 4 s at 168 MHz are converted.
+ *****************************************************************************/
+uint32_t PROF_cycles_to_ns(uint32_t cycles)
+{
+    uint32_t mhz = SystemCoreClock / 1000000;
+    /* Avoid an overflow of cycles*1000 for long intervals */
+    return (cycles < 4000000) ? (cycles * 1000) / mhz : (cycles / mhz) * 1000;
+}
+
+
+/** ***************************************************************************
+ * @brief Mark a boot stage as reached
+ * @param [in] stage
+ *
+ * Only the first call for each stage is recorded.
+ *****************************************************************************/
+void PROF_boot_mark(PROF_boot_stage_t stage)
+{
+    if (stage < PROF_BOOT_STAGES && !PROF_boot_reached(stage)) {
+        boot_cycles[stage] = PROF_get_cycles();
+        boot_reached |= (1UL << stage);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Check if a boot stage was reached
+ * @param [in] stage
+ * @return true if PROF_boot_mark() was called for this stage
+ *****************************************************************************/
+bool PROF_boot_reached(PROF_boot_stage_t stage)
+{
+    return (boot_reached & (1UL << stage)) != 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if all boot stages were reached
+ * @return true when the boot timeline is complete
+ *****************************************************************************/
+bool PROF_boot_complete(void)
+{
+    return boot_reached == ((1UL << PROF_BOOT_STAGES) - 1);
+}
+
+
+/** ***************************************************************************
+ * @brief Time of a boot stage
+ * @param [in] stage
+ * @return Microseconds since PROF_BOOT_CLOCK or 0 if the stage was not reached
+ *****************************************************************************/
+uint32_t PROF_boot_get_us(PROF_boot_stage_t stage)
+{
+    uint32_t us = 0;
+    if (stage < PROF_BOOT_STAGES && PROF_boot_reached(stage)) {
+        us = PROF_cycles_to_us(boot_cycles[stage] - boot_cycles[PROF_BOOT_CLOCK]);
+    }
+    return us;
+}
@@ -18,6 +18,7 @@
 #include "stm32f429i_discovery.h"
 
 #include "pushbutton.h"
+#include "interrupts.h"
 
 
 /******************************************************************************
@@ -28,7 +29,7 @@
 /******************************************************************************
  * Variables
  *****************************************************************************/
-static bool PB_pressed_flag = false;	///< USER pushbutton pressed flag
+static volatile bool PB_pressed_flag = false;	///< USER pushbutton pressed flag
 
 
 /******************************************************************************
@@ -59,6 +60,7 @@ void PB_enableIRQ(void)
 	SYSCFG->EXTICR[0] |= SYSCFG_EXTICR1_EXTI0_PA;	// EXTI multiplexer
 	EXTI->RTSR |= EXTI_RTSR_TR0;		// Rising Trigger Select on int. line 0
 	EXTI->IMR |= EXTI_IMR_MR0;			// Interrupt Mask enable on int. line 0
+	NVIC_SetPriority(EXTI0_IRQn, IRQ_PRIO_BUTTON);
 	NVIC_ClearPendingIRQ(EXTI0_IRQn);	// Clear pending interrupt on line 0
 	NVIC_EnableIRQ(EXTI0_IRQn);			// Enable interrupt line 0 in the NVIC
 }
@@ -71,8 +73,10 @@ void PB_enableIRQ(void)
  *****************************************************************************/
 bool PB_pressed(void)
 {
+	uint32_t basepri = IRQ_mask(IRQ_PRIO_BUTTON);
 	bool pressed = PB_pressed_flag;		// Read/store value of flag
 	PB_pressed_flag = false;			// Reset flag
+	IRQ_unmask(basepri);
 	return pressed;
 }
 
@@ -85,9 +89,11 @@ bool PB_pressed(void)
  *****************************************************************************/
 void EXTI0_IRQHandler(void)
 {
+	uint32_t start = IRQ_enter(IRQ_SRC_BUTTON);
 	if (EXTI->PR & EXTI_PR_PR0) {		// Check if interrupt on line 0
 		EXTI->PR |= EXTI_PR_PR0;		// Clear pending interrupt on line 0
 		PB_pressed_flag = true;			// Set flag
 	}
+	IRQ_exit(IRQ_SRC_BUTTON, start);
 }
 
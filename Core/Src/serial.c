@@ -0,0 +1,350 @@
+/** ***************************************************************************
+ * @file
+ * @brief Non-blocking transmission and reception over USART1
+ *
+ * USART1 is connected to the virtual COM port of the ST-LINK.
+ * - USART1_TX = GPIO PA9
+ * - USART1_RX = GPIO PA10
+ *
+ * Transmit queue
+ * ==============
+ * SER_write() copies the data into a ring buffer and returns immediately.
+ * DMA2 Stream7 Channel4 transfers the largest contiguous block of the ring
+ * buffer to USART1. The transfer complete interrupt releases the block
+ * and starts the next one.
+ * @n If there is not enough space in the queue, nothing is written,
+ * the data is counted as dropped and false is returned.
+ * The measurement is never blocked by the serial output.
+ * @note The queue is protected by masking IRQ_PRIO_SERIAL,
+ * so do not call SER_write() from handlers with a higher priority.
+ *
+ * Receive ring
+ * ============
+ * DMA2 Stream5 Channel4 writes the received bytes into a circular buffer,
+ * no interrupt per byte is needed.
+ * The half transfer, transfer complete and USART1 idle line interrupts
+ * publish the write position of the DMA (rx_head). The idle line interrupt
+ * follows each burst of the host, so a command is visible as soon as
+ * its last byte has been received.
+ * @n SER_read() copies the published bytes and returns immediately.
+ * Up to half of the buffer may be written but not yet published,
+ * so the reader must keep up to within SER_RX_SIZE/2 bytes.
+ * If it falls behind, the unread bytes may already be overwritten:
+ * they are discarded and counted (SER_get_rx_lost()).
+ *
+ * Frames
+ * ======
+ * Binary data is sent in frames:
+ *
+ * | Byte   | Content                                        |
+ * |--------|------------------------------------------------|
+ * | 0      | SER_FRAME_START = 0xA5                         |
+ * | 1      | Type (SER_frame_type_t)                        |
+ * | 2, 3   | Payload length n, little endian                |
+ * | 4..n+3 | Payload, multi byte values are little endian   |
+ * | n+4    | Checksum: 8 bit sum of bytes 1..n+3, negated   |
+ *
+ * The sum of bytes 1..n+4 of a valid frame is 0 (modulo 256).
+ * Tools/serial_frames.py decodes the frames on the host.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "serial.h"
+#include "interrupts.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define APB2_CLOCK      84000000    ///< APB2 peripheral clock frequency
+#define TX_MASK         (SER_TX_SIZE-1) ///< Index mask of the transmit queue
+#define RX_MASK         (SER_RX_SIZE-1) ///< Index mask of the receive ring
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static uint8_t tx_buffer[SER_TX_SIZE];      ///< Transmit queue
+static volatile uint32_t tx_head = 0;       ///< Next free position
+static volatile uint32_t tx_tail = 0;       ///< Start of the data not yet sent
+static volatile uint32_t tx_dma_length = 0; ///< Bytes in the running DMA transfer
+static uint32_t tx_dropped = 0;             ///< Bytes not written, queue full
+
+static uint8_t rx_buffer[SER_RX_SIZE];      ///< Receive ring, written by the DMA
+static volatile uint32_t rx_head = 0;       ///< Bytes received and published
+static uint32_t rx_position = 0;            ///< DMA position at the last publication
+static uint32_t rx_tail = 0;                ///< Bytes read by SER_read()
+static uint32_t rx_lost = 0;                ///< Bytes discarded, reader too slow
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Start the DMA for the next contiguous block of the queue
+ *
+ * @note Call with interrupts disabled.
+ *****************************************************************************/
+static void tx_start(void)
+{
+    if (tx_dma_length == 0 && tx_head != tx_tail) {
+        uint32_t tail = tx_tail & TX_MASK;
+        uint32_t length = tx_head - tx_tail;
+        if (tail + length > SER_TX_SIZE) {
+            length = SER_TX_SIZE - tail;    // Up to the end of the buffer
+        }
+        tx_dma_length = length;
+        DMA2->HIFCR = DMA_HIFCR_CTCIF7 | DMA_HIFCR_CHTIF7 | DMA_HIFCR_CTEIF7
+                | DMA_HIFCR_CDMEIF7 | DMA_HIFCR_CFEIF7;  // Clear all flags
+        DMA2_Stream7->M0AR = (uint32_t)&tx_buffer[tail];
+        DMA2_Stream7->NDTR = length;
+        DMA2_Stream7->CR |= DMA_SxCR_EN;    // Enable DMA
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Publish the bytes the receive DMA has written since the last call
+ *
+ * @note Called by the handlers of IRQ_PRIO_SERIAL only.
+ *****************************************************************************/
+static void rx_publish(void)
+{
+    uint32_t position = (SER_RX_SIZE - DMA2_Stream5->NDTR) & RX_MASK;
+    rx_head += (position - rx_position) & RX_MASK;
+    rx_position = position;
+}
+
+
+/** ***************************************************************************
+ * @brief Initialize USART1, the transmit DMA and the receive DMA
+ *
+ * 8 data bits, no parity, 1 stop bit, SER_BAUDRATE
+ *****************************************************************************/
+void SER_init(void)
+{
+    __HAL_RCC_GPIOA_CLK_ENABLE();       // Enable Clock for GPIO port A
+    GPIOA->MODER &= ~(GPIO_MODER_MODER9 | GPIO_MODER_MODER10);
+    GPIOA->MODER |= GPIO_MODER_MODER9_1 | GPIO_MODER_MODER10_1; // Alternate f.
+    GPIOA->AFR[1] &= ~(GPIO_AFRH_AFSEL9 | GPIO_AFRH_AFSEL10);
+    GPIOA->AFR[1] |= (7UL << GPIO_AFRH_AFSEL9_Pos) | (7UL << GPIO_AFRH_AFSEL10_Pos); // AF7 = USART1
+    GPIOA->PUPDR |= GPIO_PUPDR_PUPD10_0;    // Pull-up on RX
+
+    __HAL_RCC_USART1_CLK_ENABLE();      // Enable Clock for USART1
+    USART1->BRR = (APB2_CLOCK + SER_BAUDRATE/2) / SER_BAUDRATE;   // Baudrate
+    USART1->CR3 |= USART_CR3_DMAT | USART_CR3_DMAR; // DMA for transmission and reception
+
+    __HAL_RCC_DMA2_CLK_ENABLE();        // Enable Clock for DMA2
+    DMA2_Stream5->CR &= ~DMA_SxCR_EN;   // Disable the DMA stream 5
+    while (DMA2_Stream5->CR & DMA_SxCR_EN) { ; }    // Wait for DMA to finish
+    DMA2->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5
+            | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;  // Clear all flags
+    DMA2_Stream5->CR = (4UL << DMA_SxCR_CHSEL_Pos)  // Select channel 4
+            | DMA_SxCR_MINC             // Peripheral to memory, increment memory
+            | DMA_SxCR_CIRC             // Circular mode
+            | DMA_SxCR_HTIE | DMA_SxCR_TCIE;    // Half and complete interrupts
+    DMA2_Stream5->PAR = (uint32_t)&USART1->DR;  // Peripheral register address
+    DMA2_Stream5->M0AR = (uint32_t)rx_buffer;   // Receive ring
+    DMA2_Stream5->NDTR = SER_RX_SIZE;
+    DMA2_Stream5->CR |= DMA_SxCR_EN;    // Enable DMA
+    NVIC_SetPriority(DMA2_Stream5_IRQn, IRQ_PRIO_SERIAL);
+    NVIC_ClearPendingIRQ(DMA2_Stream5_IRQn);    // Clear pending DMA interrupt
+    NVIC_EnableIRQ(DMA2_Stream5_IRQn);  // Enable DMA interrupt in the NVIC
+
+    USART1->CR1 |= USART_CR1_IDLEIE;    // Idle line interrupt enable
+    USART1->CR1 |= USART_CR1_TE | USART_CR1_RE | USART_CR1_UE;  // Enable
+    NVIC_SetPriority(USART1_IRQn, IRQ_PRIO_SERIAL);
+    NVIC_ClearPendingIRQ(USART1_IRQn);  // Clear pending USART interrupt
+    NVIC_EnableIRQ(USART1_IRQn);        // Enable USART interrupt in the NVIC
+
+    DMA2_Stream7->CR &= ~DMA_SxCR_EN;   // Disable the DMA stream 7
+    while (DMA2_Stream7->CR & DMA_SxCR_EN) { ; }    // Wait for DMA to finish
+    DMA2_Stream7->CR = (4UL << DMA_SxCR_CHSEL_Pos)  // Select channel 4
+            | DMA_SxCR_DIR_0            // Memory to peripheral
+            | DMA_SxCR_MINC             // Increment memory address pointer
+            | DMA_SxCR_TCIE;            // Transfer complete interrupt enable
+    DMA2_Stream7->PAR = (uint32_t)&USART1->DR;  // Peripheral register address
+    NVIC_SetPriority(DMA2_Stream7_IRQn, IRQ_PRIO_SERIAL);
+    NVIC_ClearPendingIRQ(DMA2_Stream7_IRQn);    // Clear pending DMA interrupt
+    NVIC_EnableIRQ(DMA2_Stream7_IRQn);  // Enable DMA interrupt in the NVIC
+}
+
+
+/** ***************************************************************************
+ * @brief Queue data for transmission
+ * @param [in] data
+ * @param [in] length [bytes]
+ * @return true if queued, false if the queue is full (nothing queued)
+ *****************************************************************************/
+bool SER_write(const void *data, uint32_t length)
+{
+    const uint8_t *bytes = data;
+    bool queued = false;
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_SERIAL);
+    if (SER_TX_SIZE - (tx_head - tx_tail) >= length) {
+        for (uint32_t i = 0; i < length; i++) {
+            tx_buffer[(tx_head + i) & TX_MASK] = bytes[i];
+        }
+        tx_head += length;
+        tx_start();
+        queued = true;
+    } else {
+        tx_dropped += length;
+    }
+    IRQ_unmask(basepri);
+    return queued;
+}
+
+
+/** ***************************************************************************
+ * @brief Queue a frame for transmission
+ * @param [in] type of the frame
+ * @param [in] payload
+ * @param [in] length of the payload [bytes]
+ * @return true if queued, false if the queue is full (nothing queued)
+ *
+ * The frame is either queued completely or not at all.
+ *****************************************************************************/
+bool SER_send_frame(SER_frame_type_t type, const void *payload, uint16_t length)
+{
+    const uint8_t *bytes = payload;
+    uint8_t header[4] = {SER_FRAME_START, type, length & 0xFF, length >> 8};
+    uint8_t sum = header[1] + header[2] + header[3];
+    bool queued = false;
+    uint32_t basepri = IRQ_mask(IRQ_PRIO_SERIAL);
+    if (SER_get_free() >= (uint32_t)length + SER_FRAME_OVERHEAD) {
+        for (uint32_t i = 0; i < length; i++) {
+            sum += bytes[i];
+        }
+        sum = -sum;
+        SER_write(header, sizeof(header));
+        SER_write(payload, length);
+        SER_write(&sum, 1);
+        queued = true;
+    } else {
+        tx_dropped += length + SER_FRAME_OVERHEAD;
+    }
+    IRQ_unmask(basepri);
+    return queued;
+}
+
+
+/** ***************************************************************************
+ * @brief Free space in the transmit queue
+ * @return bytes
+ *****************************************************************************/
+uint32_t SER_get_free(void)
+{
+    return SER_TX_SIZE - (tx_head - tx_tail);
+}
+
+
+/** ***************************************************************************
+ * @brief Bytes dropped because the queue was full
+ * @return bytes
+ *****************************************************************************/
+uint32_t SER_get_dropped(void)
+{
+    return tx_dropped;
+}
+
+
+/** ***************************************************************************
+ * @brief Read received bytes, does not wait
+ * @param [out] data
+ * @param [in] length max bytes to read
+ * @return bytes read, 0 if nothing has been received
+ *****************************************************************************/
+uint32_t SER_read(void *data, uint32_t length)
+{
+    uint8_t *bytes = data;
+    uint32_t head = rx_head;
+    if (head - rx_tail > SER_RX_SIZE/2) {   // The DMA may have overwritten them
+        rx_lost += head - rx_tail;
+        rx_tail = head;
+    }
+    if (length > head - rx_tail) {
+        length = head - rx_tail;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        bytes[i] = rx_buffer[(rx_tail + i) & RX_MASK];
+    }
+    rx_tail += length;
+    return length;
+}
+
+
+/** ***************************************************************************
+ * @brief Received bytes discarded because SER_read() was called too late
+ * @return bytes
+ *****************************************************************************/
+uint32_t SER_get_rx_lost(void)
+{
+    return rx_lost;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if data is being transmitted
+ * @return true while the queue is not empty
+ *****************************************************************************/
+bool SER_tx_busy(void)
+{
+    return tx_head != tx_tail;
+}
+
+
+/** ***************************************************************************
+ * @brief Interrupt handler for DMA2 Stream7
+ *
+ * A block of the transmit queue has been transfered to USART1.
+ * The next block is started.
+ *****************************************************************************/
+void DMA2_Stream7_IRQHandler(void)
+{
+    uint32_t start = IRQ_enter(IRQ_SRC_SERIAL);
+    if (DMA2->HISR & DMA_HISR_TCIF7) {  // Stream7 transfer compl. interrupt f.
+        DMA2->HIFCR = DMA_HIFCR_CTCIF7; // Clear transfer complete interrupt fl.
+        tx_tail += tx_dma_length;
+        tx_dma_length = 0;
+        tx_start();
+    }
+    IRQ_exit(IRQ_SRC_SERIAL, start);
+}
+
+
+/** ***************************************************************************
+ * @brief Interrupt handler for DMA2 Stream5
+ *
+ * The receive DMA has filled the first or the second half of the ring.
+ *****************************************************************************/
+void DMA2_Stream5_IRQHandler(void)
+{
+    uint32_t start = IRQ_enter(IRQ_SRC_SERIAL);
+    DMA2->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5;  // Clear both flags
+    rx_publish();
+    IRQ_exit(IRQ_SRC_SERIAL, start);
+}
+
+
+/** ***************************************************************************
+ * @brief Interrupt handler for USART1
+ *
+ * The line has been idle for one character after a burst of bytes.
+ *****************************************************************************/
+void USART1_IRQHandler(void)
+{
+    uint32_t start = IRQ_enter(IRQ_SRC_SERIAL);
+    if (USART1->SR & USART_SR_IDLE) {
+        (void)USART1->DR;               // Read SR then DR clears IDLE
+        rx_publish();
+    }
+    IRQ_exit(IRQ_SRC_SERIAL, start);
+}
@@ -0,0 +1,198 @@
+/** ***************************************************************************
+ * @file
+ * @brief Statistics of current and position over a monitoring session
+ *
+ * Each processed frame is added with SES_add_reading().
+ * For each quantity (SES_quantity_t) the statistics are updated
+ * incrementally, in constant time and memory however long the session is:
+ * - Mean and standard deviation with Welford's algorithm.
+ *   Mean and sum of squared deviations are kept in double,
+ *   in float the updates of a mean of some 10^6 readings would be lost.
+ * - Min and max with the time of their first occurrence.
+ * - The time-weighted mean: each reading is weighted with the time
+ *   until the next reading, at most SES_MAX_HOLD_MS.
+ *   Readings are not evenly spaced while averaging or when a frame is late,
+ *   and no time is counted while the reading is invalid.
+ * - SES_WINDOWS decaying windows: exponentially weighted mean and variance
+ *   with the time constants SES_WINDOW_SHORT_S and SES_WINDOW_LONG_S.
+ *   They show the recent level and its fluctuation.
+ *
+ * Only valid readings are added: the position needs x and y in range,
+ * the angle also an angle in range, the current a valid position
+ * and a current below the error codes (like CMD_add_reading()).
+ * @n main() starts a new session with SES_reset() when the measurement
+ * setting changes. The summary is shown on the session page (see menu.c)
+ * and exported with CMD_SESSION (see command.c, Tools/command.py).
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <math.h>
+#include <string.h>
+#include "session.h"
+#include "error_code.h"
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Running statistics of one quantity */
+typedef struct {
+    uint32_t count;                 ///< Valid readings
+    double mean;                    ///< Welford: mean
+    double m2;                      ///< Welford: sum of squared deviations from the mean
+    float min;                      ///< Smallest reading
+    float max;                      ///< Largest reading
+    uint32_t min_ms;                ///< Time of the first min
+    uint32_t max_ms;                ///< Time of the first max
+    double weighted_sum;            ///< Sum of reading * held time [ms]
+    uint32_t covered_ms;            ///< Sum of the held times
+    float last;                     ///< Last valid reading
+    uint32_t last_ms;               ///< Time of the last valid reading
+    bool held;                      ///< Last reading was valid, it is weighted until the next one
+    float ew_mean[SES_WINDOWS];     ///< Decaying windows: mean
+    float ew_var[SES_WINDOWS];      ///< Decaying windows: variance
+} accumulator_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const uint16_t window_s[SES_WINDOWS] = {     ///< Time constants
+        SES_WINDOW_SHORT_S, SES_WINDOW_LONG_S
+};
+
+static accumulator_t acc[SES_QUANTITIES];   ///< Statistics of each quantity
+static uint32_t start_ms = 0;               ///< Start of the session
+static uint32_t readings = 0;               ///< Readings added
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Add a reading of one quantity
+ * @param [in] a statistics of the quantity
+ * @param [in] valid false if the reading is an error code
+ * @param [in] value reading
+ * @param [in] now HAL_GetTick()
+ *****************************************************************************/
+static void update(accumulator_t *a, bool valid, float value, uint32_t now)
+{
+    uint32_t dt = now - a->last_ms;
+    if (a->held) {                      // Last reading held until now
+        uint32_t hold = (dt < SES_MAX_HOLD_MS) ? dt : SES_MAX_HOLD_MS;
+        a->weighted_sum += (double)a->last * hold;
+        a->covered_ms += hold;
+    }
+    a->held = valid;
+    if (!valid) {
+        return;
+    }
+
+    a->count++;
+    double delta = value - a->mean;
+    a->mean += delta / a->count;
+    a->m2 += delta * (value - a->mean);
+
+    if (a->count == 1 || value < a->min) {
+        a->min = value;
+        a->min_ms = now;
+    }
+    if (a->count == 1 || value > a->max) {
+        a->max = value;
+        a->max_ms = now;
+    }
+
+    for (int w = 0; w < SES_WINDOWS; w++) {
+        if (a->count == 1) {
+            a->ew_mean[w] = value;
+            a->ew_var[w] = 0;
+            continue;
+        }
+        float alpha = 1.0f - expf(-(float)dt / (window_s[w] * 1000.0f));
+        float diff = value - a->ew_mean[w];
+        float increment = alpha * diff;
+        a->ew_mean[w] += increment;
+        a->ew_var[w] = (1.0f - alpha) * (a->ew_var[w] + diff * increment);
+    }
+
+    a->last = value;
+    a->last_ms = now;
+}
+
+
+/** ***************************************************************************
+ * @brief Start a new session, the statistics are cleared
+ *****************************************************************************/
+void SES_reset(void)
+{
+    memset(acc, 0, sizeof(acc));
+    start_ms = HAL_GetTick();
+    readings = 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Add the reading of a processed frame
+ * @param [in] x position [mm] or error code
+ * @param [in] y position [mm] or error code
+ * @param [in] angle [degree] or error code
+ * @param [in] current [A] or error code
+ *****************************************************************************/
+void SES_add_reading(int x, int y, int angle, float current)
+{
+    uint32_t now = HAL_GetTick();
+    bool position = (x != CALC_OUTOF_X_RANGE && y != CALC_OUTOF_Y_RANGE);
+    /* The error codes of the current are >= 1000 A */
+    update(&acc[SES_CURRENT], position && current >= 0 && current < CURR_OUTOF_Y_RANGE,
+           current, now);
+    update(&acc[SES_X], position, x, now);
+    update(&acc[SES_Y], position, y, now);
+    update(&acc[SES_ANGLE], position && angle != CALC_OUTOF_ANGLE_RANGE, angle, now);
+    readings++;
+}
+
+
+/** ***************************************************************************
+ * @brief Summary of the session
+ * @param [out] summary
+ *
+ * The time-weighted mean is the mean while nothing has been held yet.
+ *****************************************************************************/
+void SES_get_summary(SES_summary_t *summary)
+{
+    memset(summary, 0, sizeof(*summary));
+    summary->start_ms = start_ms;
+    summary->duration_ms = HAL_GetTick() - start_ms;
+    summary->readings = readings;
+    for (int w = 0; w < SES_WINDOWS; w++) {
+        summary->window_s[w] = window_s[w];
+    }
+    for (int q = 0; q < SES_QUANTITIES; q++) {
+        const accumulator_t *a = &acc[q];
+        SES_stats_t *s = &summary->quantity[q];
+        s->count = a->count;
+        if (a->count == 0) {
+            continue;
+        }
+        s->mean = a->mean;
+        s->std = (a->count > 1) ? sqrt(a->m2 / (a->count - 1)) : 0;
+        s->time_mean = (a->covered_ms > 0) ? a->weighted_sum / a->covered_ms : a->mean;
+        s->covered_ms = a->covered_ms;
+        s->min = a->min;
+        s->max = a->max;
+        s->min_ms = a->min_ms;
+        s->max_ms = a->max_ms;
+        for (int w = 0; w < SES_WINDOWS; w++) {
+            s->window[w].mean = a->ew_mean[w];
+            s->window[w].std = sqrtf(a->ew_var[w]);
+        }
+    }
+}
@@ -0,0 +1,141 @@
+/** ***************************************************************************
+ * @file
+ * @brief Measurement settings shared by the menu and the command interface
+ *
+ * The touch menu, the pushbutton and the commands on USART1 (see command.c)
+ * all change the same settings with CFG_set().
+ * main() reads them with CFG_get() in each pass of its loop
+ * and applies a change like a change on the touchscreen.
+ * @n Each setting has a range, CFG_set() rejects values outside of it
+ * and keeps the old value.
+ * @n The stored settings are kept in the flash over a reset (see storage.c),
+ * the mode always starts with no measurement.
+ *
+ * | Setting       | Range                     | Default           | Stored |
+ * | :------------ | :------------------------ | :---------------- | :----- |
+ * | CFG_MODE      | CFG_MODE_NOTHING ... _AVERAGE | CFG_MODE_NOTHING | no  |
+ * | CFG_PAGE      | 1 ... CFG_PAGES           | CFG_PAGE_GRAPHIC  | yes    |
+ * | CFG_TABLE     | 1 ... CFG_TABLES          | CFG_TABLE_ONE_PHASE | yes  |
+ * | CFG_AVERAGING | 1 ... CFG_MAX_AVERAGING   | 3                 | yes    |
+ * | CFG_BUZZER    | 0, 1                      | 0                 | yes    |
+ * | CFG_DETECT    | 0 ... DET_SENSITIVITIES   | 2                 | yes    |
+ * | CFG_BACKEND   | 0 ... ACQ_DSP_BACKENDS-1  | ACQ_GROUPS        | yes    |
+ * | CFG_MAINS     | MAINS_AUTO ... MAINS_PROFILES | MAINS_AUTO    | yes    |
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "settings.h"
+#include "detector.h"
+#include "acquisition.h"
+#include "mains.h"
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Range and default of a setting */
+typedef struct {
+    int32_t min;            ///< Smallest valid value
+    int32_t max;            ///< Largest valid value
+    int32_t initial;        ///< Value after reset
+    bool stored;            ///< Kept in the flash
+} range_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const range_t ranges[CFG_SETTINGS] = {   ///< Valid values
+        [CFG_MODE]      = {CFG_MODE_NOTHING, CFG_MODE_AVERAGE, CFG_MODE_NOTHING, false},
+        [CFG_PAGE]      = {1, CFG_PAGES, CFG_PAGE_GRAPHIC, true},
+        [CFG_TABLE]     = {1, CFG_TABLES, CFG_TABLE_ONE_PHASE, true},
+        [CFG_AVERAGING] = {1, CFG_MAX_AVERAGING, 3, true},
+        [CFG_BUZZER]    = {0, 1, 0, true},
+        [CFG_DETECT]    = {0, DET_SENSITIVITIES, 2, true},
+        [CFG_BACKEND]   = {0, ACQ_DSP_BACKENDS-1, ACQ_GROUPS, true},
+        [CFG_MAINS]     = {MAINS_AUTO, MAINS_PROFILES, MAINS_AUTO, true},
+};
+
+static int32_t values[CFG_SETTINGS] = {         ///< Current values
+        [CFG_MODE]      = CFG_MODE_NOTHING,
+        [CFG_PAGE]      = CFG_PAGE_GRAPHIC,
+        [CFG_TABLE]     = CFG_TABLE_ONE_PHASE,
+        [CFG_AVERAGING] = 3,
+        [CFG_BUZZER]    = 0,
+        [CFG_DETECT]    = 2,
+        [CFG_BACKEND]   = ACQ_GROUPS,
+        [CFG_MAINS]     = MAINS_AUTO,
+};
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Value of a setting
+ * @param [in] id of the setting
+ * @return value, 0 if id is invalid
+ *****************************************************************************/
+int32_t CFG_get(CFG_id_t id)
+{
+    if ((uint32_t)id >= CFG_SETTINGS) {
+        return 0;
+    }
+    return values[id];
+}
+
+
+/** ***************************************************************************
+ * @brief Change a setting
+ * @param [in] id of the setting
+ * @param [in] value new value
+ * @return true if stored, false if id or value is invalid (nothing changed)
+ *****************************************************************************/
+bool CFG_set(CFG_id_t id, int32_t value)
+{
+    if ((uint32_t)id >= CFG_SETTINGS
+            || value < ranges[id].min || value > ranges[id].max) {
+        return false;
+    }
+    values[id] = value;
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Valid values of a setting
+ * @param [in] id of the setting
+ * @param [out] min smallest valid value
+ * @param [out] max largest valid value
+ * @return false if id is invalid
+ *****************************************************************************/
+bool CFG_get_range(CFG_id_t id, int32_t *min, int32_t *max)
+{
+    if ((uint32_t)id >= CFG_SETTINGS) {
+        return false;
+    }
+    *min = ranges[id].min;
+    *max = ranges[id].max;
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Check if a setting is kept in the flash
+ * @param [in] id of the setting
+ * @return false if id is invalid
+ *****************************************************************************/
+bool CFG_is_stored(CFG_id_t id)
+{
+    if ((uint32_t)id >= CFG_SETTINGS) {
+        return false;
+    }
+    return ranges[id].stored;
+}
@@ -0,0 +1,355 @@
+/** ***************************************************************************
+ * @file
+ * @brief Compressed snapshot of the LCD frame buffer streamed on USART1
+ *
+ * The raw frame buffer (240 x 320 ARGB8888 = 300 KB) would take 27 s
+ * on the UART. The displayed screen only has a few colors and large
+ * uniform areas, so it is reduced to a palette and run length coded.
+ *
+ * Palette
+ * =======
+ * Each color gets an 8 bit index the first time it occurs,
+ * a hash table maps the colors to their index.
+ * New entries are sent in the header of the chunk which first uses them.
+ * If more than SNAP_PALETTE_SIZE colors occur, further colors are mapped to
+ * the nearest entry and the chunks are flagged SNAP_LOSSY.
+ *
+ * Compression
+ * ===========
+ * Each line is coded on its own as a sequence of tokens.
+ * A token is one byte: operation (SNAP_OP_MASK) and length n,
+ * n = bits + 1 (1..63) or n = 64 + next byte (SNAP_LENGTH_EXT).
+ * | Token            | Data               | Pixels                           |
+ * | :--------------- | :----------------- | :------------------------------- |
+ * | SNAP_OP_LITERAL  | n palette indices  | the indices                      |
+ * | SNAP_OP_RUN      | 1 palette index    | the index n times                |
+ * | SNAP_OP_COPY     | -                  | n pixels of the line above       |
+ * SNAP_OP_COPY is a match at the fixed distance of one line (LZ77 style),
+ * vertical edges and repeated rows cost one token per line.
+ * The line above is the coded one, so it is never used in line 0.
+ *
+ * Streaming
+ * =========
+ * SNAP_start() only resets the state, SNAP_update() is called once per pass
+ * of the main loop and codes up to SNAP_LINES_PER_PASS lines.
+ * The lines are collected into chunks of up to SNAP_DATA_SIZE bytes,
+ * each sent as SER_FRAME_SNAPSHOT: SNAP_chunk_t, new palette entries, tokens.
+ * A chunk is only sent if the transmit queue has space for it,
+ * otherwise it waits for the next pass: nothing is dropped and
+ * the measurement is never blocked.
+ * @n The lines are read while the screen is updated,
+ * a snapshot may show lines of different passes (like a rolling shutter).
+ *
+ * Tools/snapshot.py triggers a snapshot (CMD_SNAPSHOT, see command.c),
+ * decodes it to PNG and reports the compression ratio and transfer time.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <string.h>
+#include "snapshot.h"
+#include "serial.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define LAYER           LTDC_Layer2     ///< Foreground layer, LCD_FOREGROUND_LAYER of the BSP
+#define PF_ARGB8888     0               ///< LTDC pixel format
+#define HASH_BITS       9               ///< Size of the color hash table
+#define HASH_SIZE       (1u << HASH_BITS)   ///< Entries of the color hash table
+#define HASH_LIMIT      (HASH_SIZE * 3 / 4) ///< Max used entries, keeps probing short
+#define HASH_EMPTY      0xFFFF          ///< Unused entry of the hash table
+#define LINE_MAX        (SNAP_MAX_WIDTH + 4)    ///< Max coded bytes of a line
+#define CHUNK_MAX       (sizeof(SNAP_chunk_t) + 4*SNAP_PALETTE_SIZE + SNAP_DATA_SIZE) ///< Max payload
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static bool running = false;                ///< Snapshot in progress
+static uint8_t number = 0;                  ///< Number of the last snapshot
+static const uint32_t *frame;               ///< Frame buffer of the layer
+static uint32_t pitch;                      ///< Pixels from one line to the next
+static uint16_t width;                      ///< Pixels of a line
+static uint16_t height;                     ///< Lines
+static uint16_t line;                       ///< Next line to add to the chunk
+static uint32_t start_ms;                   ///< HAL_GetTick() of SNAP_start()
+static uint8_t flags;                       ///< Flags of the next chunk
+
+static uint32_t palette[SNAP_PALETTE_SIZE]; ///< Colors of the indices
+static uint16_t palette_count;              ///< Used entries
+static uint16_t palette_sent;               ///< Entries sent in earlier chunks
+static uint32_t hash_color[HASH_SIZE];      ///< Colors in the hash table
+static uint16_t hash_index[HASH_SIZE];      ///< Palette index of the color or HASH_EMPTY
+static uint16_t hash_used;                  ///< Used entries of the hash table
+
+static uint8_t above[SNAP_MAX_WIDTH];       ///< Indices of the last coded line
+static uint8_t coded[LINE_MAX];             ///< Tokens of the line not yet in the chunk
+static uint32_t coded_length;               ///< Bytes in coded[]
+static bool coded_pending = false;          ///< coded[] holds line
+static uint8_t data[SNAP_DATA_SIZE];        ///< Tokens of the chunk
+static uint32_t data_length;                ///< Bytes in data[]
+static uint16_t chunk_lines;                ///< Lines in data[]
+static uint8_t payload[CHUNK_MAX];          ///< Chunk being sent
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Palette entry closest to a color (sum of squared RGB differences)
+ *****************************************************************************/
+static uint8_t nearest(uint32_t color)
+{
+    uint32_t best = 0, best_distance = UINT32_MAX;
+    for (uint32_t i = 0; i < palette_count; i++) {
+        int32_t r = (int32_t)((color >> 16) & 0xFF) - (int32_t)((palette[i] >> 16) & 0xFF);
+        int32_t g = (int32_t)((color >> 8) & 0xFF) - (int32_t)((palette[i] >> 8) & 0xFF);
+        int32_t b = (int32_t)(color & 0xFF) - (int32_t)(palette[i] & 0xFF);
+        uint32_t distance = r*r + g*g + b*b;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+/** ***************************************************************************
+ * @brief Palette index of a color, a new color is added to the palette
+ *****************************************************************************/
+static uint8_t lookup(uint32_t color)
+{
+    uint32_t h = (color * 0x9E3779B1u) >> (32 - HASH_BITS);
+    while (hash_index[h] != HASH_EMPTY) {
+        if (hash_color[h] == color) {
+            return hash_index[h];
+        }
+        h = (h + 1) & (HASH_SIZE - 1);
+    }
+    uint8_t index;
+    if (palette_count < SNAP_PALETTE_SIZE) {
+        index = palette_count;
+        palette[palette_count++] = color;
+    } else {
+        index = nearest(color);
+        flags |= SNAP_LOSSY;
+    }
+    if (hash_used < HASH_LIMIT) {       // Else looked up again next time
+        hash_color[h] = color;
+        hash_index[h] = index;
+        hash_used++;
+    }
+    return index;
+}
+
+
+/** ***************************************************************************
+ * @brief Store a token
+ * @param [in] length 1 ... SNAP_MAX_LENGTH
+ * @return bytes stored
+ *****************************************************************************/
+static uint32_t put_token(uint8_t *out, uint8_t op, uint32_t length)
+{
+    if (length < 64) {
+        out[0] = op | (length - 1);
+        return 1;
+    }
+    out[0] = op | SNAP_LENGTH_EXT;
+    out[1] = length - 64;
+    return 2;
+}
+
+
+/** ***************************************************************************
+ * @brief Store literal indices, split into tokens of SNAP_MAX_LENGTH
+ * @return bytes stored
+ *****************************************************************************/
+static uint32_t put_literal(uint8_t *out, const uint8_t *indices, uint32_t count)
+{
+    uint32_t n = 0;
+    while (count > 0) {
+        uint32_t length = (count > SNAP_MAX_LENGTH) ? SNAP_MAX_LENGTH : count;
+        n += put_token(&out[n], SNAP_OP_LITERAL, length);
+        memcpy(&out[n], indices, length);
+        n += length;
+        indices += length;
+        count -= length;
+    }
+    return n;
+}
+
+
+/** ***************************************************************************
+ * @brief Code a line of the frame buffer into coded[]
+ *
+ * At each pixel the longest of copy and run is taken if it pays off,
+ * else the pixel is added to the pending literal.
+ *****************************************************************************/
+static void code_line(uint16_t y)
+{
+    const uint32_t *pixels = &frame[y * pitch];
+    uint8_t indices[SNAP_MAX_WIDTH];
+    for (uint32_t x = 0; x < width; x++) {
+        indices[x] = lookup(pixels[x]);
+    }
+    uint32_t n = 0, x = 0, literal = 0;
+    while (x < width) {
+        uint32_t copy = 0;
+        if (y > 0) {
+            while (x + copy < width && copy < SNAP_MAX_LENGTH && indices[x + copy] == above[x + copy]) {
+                copy++;
+            }
+        }
+        uint32_t run = 1;
+        while (x + run < width && run < SNAP_MAX_LENGTH && indices[x + run] == indices[x]) {
+            run++;
+        }
+        if (copy >= 2 && copy >= run) {
+            n += put_literal(&coded[n], &indices[x - literal], literal);
+            n += put_token(&coded[n], SNAP_OP_COPY, copy);
+            literal = 0;
+            x += copy;
+        } else if (run >= 3) {
+            n += put_literal(&coded[n], &indices[x - literal], literal);
+            n += put_token(&coded[n], SNAP_OP_RUN, run);
+            coded[n++] = indices[x];
+            literal = 0;
+            x += run;
+        } else {
+            literal++;
+            x++;
+        }
+    }
+    n += put_literal(&coded[n], &indices[x - literal], literal);
+    memcpy(above, indices, width);
+    coded_length = n;
+}
+
+
+/** ***************************************************************************
+ * @brief Send the collected lines with the new palette entries
+ * @param [in] last true for the last chunk of the snapshot
+ * @return true if queued, false if the transmit queue is full (kept)
+ *****************************************************************************/
+static bool send_chunk(bool last)
+{
+    uint32_t palette_new = palette_count - palette_sent;
+    uint32_t length = sizeof(SNAP_chunk_t) + 4*palette_new + data_length;
+    if (SER_get_free() < length + SER_FRAME_OVERHEAD) {
+        return false;
+    }
+    SNAP_chunk_t header = {
+            .snapshot = number,
+            .flags = flags | (last ? SNAP_LAST : 0),
+            .width = width,
+            .height = height,
+            .first_line = line - chunk_lines,
+            .lines = chunk_lines,
+            .palette_first = palette_sent,
+            .palette_new = palette_new,
+            .reserved = 0,
+            .elapsed_ms = HAL_GetTick() - start_ms,
+    };
+    memcpy(payload, &header, sizeof(header));
+    memcpy(&payload[sizeof(header)], &palette[palette_sent], 4*palette_new);
+    memcpy(&payload[sizeof(header) + 4*palette_new], data, data_length);
+    SER_send_frame(SER_FRAME_SNAPSHOT, payload, length);
+    palette_sent = palette_count;
+    flags &= ~SNAP_FIRST;
+    data_length = 0;
+    chunk_lines = 0;
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Start a snapshot of the foreground layer
+ * @return false if a snapshot is running or the layer is not supported
+ *
+ * The layer must be ARGB8888 with at most SNAP_MAX_WIDTH pixels per line.
+ *****************************************************************************/
+bool SNAP_start(void)
+{
+    uint32_t line_bytes = (LAYER->CFBLR & LTDC_LxCFBLR_CFBLL_Msk) - 3;  // CFBLL = bytes + 3
+    if (running || (LAYER->PFCR & LTDC_LxPFCR_PF_Msk) != PF_ARGB8888
+            || line_bytes / 4 > SNAP_MAX_WIDTH) {
+        return false;
+    }
+    frame = (const uint32_t *)LAYER->CFBAR;
+    pitch = ((LAYER->CFBLR & LTDC_LxCFBLR_CFBP_Msk) >> LTDC_LxCFBLR_CFBP_Pos) / 4;
+    width = line_bytes / 4;
+    height = LAYER->CFBLNR & LTDC_LxCFBLNR_CFBLNBR_Msk;
+    number++;
+    line = 0;
+    start_ms = HAL_GetTick();
+    flags = SNAP_FIRST;
+    palette_count = 0;
+    palette_sent = 0;
+    memset(hash_index, 0xFF, sizeof(hash_index));
+    hash_used = 0;
+    coded_pending = false;
+    data_length = 0;
+    chunk_lines = 0;
+    running = true;
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Code the next lines and send the full chunks
+ *
+ * Call once per pass of the main loop, returns without waiting.
+ *****************************************************************************/
+void SNAP_update(void)
+{
+    if (!running) {
+        return;
+    }
+    for (uint32_t i = 0; i < SNAP_LINES_PER_PASS; i++) {
+        if (!coded_pending) {
+            if (line == height) {
+                break;
+            }
+            code_line(line);
+            coded_pending = true;
+        }
+        if (data_length + coded_length > SNAP_DATA_SIZE && !send_chunk(false)) {
+            return;                     // Transmit queue full, next pass
+        }
+        memcpy(&data[data_length], coded, coded_length);
+        data_length += coded_length;
+        chunk_lines++;
+        line++;
+        coded_pending = false;
+    }
+    if (line == height && send_chunk(true)) {
+        running = false;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Check if a snapshot is in progress
+ *****************************************************************************/
+bool SNAP_busy(void)
+{
+    return running;
+}
+
+
+/** ***************************************************************************
+ * @brief Number of the last started snapshot, in each chunk header
+ *****************************************************************************/
+uint8_t SNAP_get_number(void)
+{
+    return number;
+}
@@ -28,6 +28,7 @@
 /* Includes ------------------------------------------------------------------*/
 #include "stm32f4xx_it.h"
 #include "stm32f4xx_hal.h"
+#include "interrupts.h"
 
 
 /* Private typedef -----------------------------------------------------------*/
@@ -121,15 +122,6 @@ void DebugMon_Handler(void)
 {
 }
 
-/**
- * @brief  This function handles PendSVC exception.
- * @param  None
- * @retval None
- */
-void PendSV_Handler(void)
-{
-}
-
 /**
  * @brief  This function handles SysTick Handler.
  * @param  None
@@ -137,7 +129,10 @@ void PendSV_Handler(void)
  */
 void SysTick_Handler(void)
 {
+	uint32_t start = IRQ_enter(IRQ_SRC_SYSTICK);
+	IRQ_latency(IRQ_SRC_SYSTICK, SysTick->LOAD - SysTick->VAL);	// Cycles since reload
 	HAL_IncTick();
+	IRQ_exit(IRQ_SRC_SYSTICK, start);
 }
 
 
@@ -0,0 +1,303 @@
+/** ***************************************************************************
+ * @file
+ * @brief Settings, background field and decoupling kept in the flash over a reset
+ *
+ * Records
+ * =======
+ * The last sector of bank 2 (sector 23, 128 KB) is reserved
+ * in the linker script (region STORAGE). Each change is appended
+ * as a new STO_record_t after the last one, the sector is only erased
+ * when it is full: 642 records per erase.
+ * STO_init() takes the valid record with the highest sequence number
+ * and applies it with CFG_set() (out of range values are rejected)
+ * set_background() and set_decoupling(). A record is valid if its check matches,
+ * the magic is programmed first and the check last,
+ * so a record cut by a reset is skipped.
+ *
+ * Writing
+ * =======
+ * STO_update() is called once per pass of the main loop.
+ * It writes a record when the stored settings (CFG_is_stored()),
+ * the background or the decoupling differ from the last record and have not changed
+ * for STO_DELAY_MS: a setting stepped through on the touchscreen
+ * is written once. Programming 51 words takes about 0.8 ms.
+ * @n A full sector is erased without waiting: the erase is started
+ * and STO_update() checks FLASH_SR_BSY in the following passes (1 ... 2 s).
+ * Bank 2 is erased while the code runs from bank 1 (read while write),
+ * the measurement goes on. The pending record is written after the erase,
+ * a reset during the erase loses the stored values.
+ * @n The flash is unlocked only while programming or erasing.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stddef.h>
+#include <string.h>
+#include "storage.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define KEY1            0x45670123UL    ///< First key of FLASH->KEYR
+#define KEY2            0xCDEF89ABUL    ///< Second key of FLASH->KEYR
+#define ERASED          0xFFFFFFFFUL    ///< Word of an erased sector
+#define WORDS           (sizeof(STO_record_t) / 4)  ///< Words of a record
+#define RECORDS         (STO_SIZE / sizeof(STO_record_t))   ///< Records in the sector
+#define SR_ERRORS       (FLASH_SR_PGSERR | FLASH_SR_PGPERR | FLASH_SR_PGAERR \
+                         | FLASH_SR_WRPERR | FLASH_SR_SOP)    ///< Error flags of FLASH->SR
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static STO_status_t status;             ///< State of the storage
+static STO_record_t stored;             ///< Content of the last record
+static STO_record_t pending;            ///< Content waiting to be stable
+static uint32_t pending_ms = 0;         ///< Time of the last change of pending
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Check of a record: FNV-1a over the words before the check
+ *****************************************************************************/
+static uint32_t checksum(const STO_record_t *record)
+{
+    const uint8_t *byte = (const uint8_t *)record;
+    uint32_t hash = 2166136261UL;
+    for (uint32_t i = 0; i < offsetof(STO_record_t, check); i++) {
+        hash = (hash ^ byte[i]) * 16777619UL;
+    }
+    return hash;
+}
+
+
+/** ***************************************************************************
+ * @brief Record of the current settings and background
+ * @param [out] record all but the check
+ *****************************************************************************/
+static void collect(STO_record_t *record)
+{
+    memset(record, 0, sizeof(*record));
+    for (int i = 0; i < CFG_SETTINGS; i++) {
+        if (CFG_is_stored(i)) {
+            record->setting[i] = CFG_get(i);
+        }
+    }
+    get_background(record->background);
+    get_decoupling(record->decoupling);
+}
+
+
+/** ***************************************************************************
+ * @brief Compare the content of two records (settings, background and decoupling)
+ *****************************************************************************/
+static bool same(const STO_record_t *a, const STO_record_t *b)
+{
+    return memcmp(a->setting, b->setting, sizeof(a->setting)) == 0
+            && memcmp(a->background, b->background, sizeof(a->background)) == 0
+            && memcmp(a->decoupling, b->decoupling, sizeof(a->decoupling)) == 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Record in the sector
+ * @param [in] index 0 ... RECORDS-1
+ *****************************************************************************/
+static const volatile STO_record_t *slot(uint32_t index)
+{
+    return (const volatile STO_record_t *)(STO_ADDRESS + index * sizeof(STO_record_t));
+}
+
+
+/** ***************************************************************************
+ * @brief Check if a record in the sector is free (all words erased)
+ *
+ * A record of another layout may have left words behind the magic.
+ *****************************************************************************/
+static bool is_free(uint32_t index)
+{
+    const volatile uint32_t *word = (const volatile uint32_t *)slot(index);
+    for (uint32_t i = 0; i < WORDS; i++) {
+        if (word[i] != ERASED) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Unlock the flash control register
+ *****************************************************************************/
+static void unlock(void)
+{
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = KEY1;
+        FLASH->KEYR = KEY2;
+    }
+    FLASH->SR = SR_ERRORS;              // Clear old errors (write 1)
+}
+
+
+/** ***************************************************************************
+ * @brief Append a record after the last one
+ * @param [in] record content, sequence and check are set here
+ *
+ * The sector must have space for the record and not be erasing.
+ *****************************************************************************/
+static void program(const STO_record_t *record)
+{
+    STO_record_t r = *record;
+    r.magic = STO_MAGIC;
+    r.sequence = status.sequence + 1;
+    r.check = checksum(&r);
+
+    unlock();
+    FLASH->CR = (FLASH->CR & ~FLASH_CR_PSIZE) | FLASH_CR_PSIZE_1 | FLASH_CR_PG;   // x32
+    volatile uint32_t *dest = (volatile uint32_t *)slot(status.records);
+    const uint32_t *src = (const uint32_t *)&r;
+    for (uint32_t i = 0; i < WORDS; i++) {  // Magic first, check last
+        dest[i] = src[i];
+        while (FLASH->SR & FLASH_SR_BSY) {
+        }
+    }
+    FLASH->CR &= ~FLASH_CR_PG;
+    FLASH->CR |= FLASH_CR_LOCK;
+
+    status.records++;                   // Used even if it failed
+    if ((FLASH->SR & SR_ERRORS) || slot(status.records - 1)->check != r.check) {
+        status.errors++;
+        return;
+    }
+    status.sequence = r.sequence;
+    status.writes++;
+    stored = r;
+}
+
+
+/** ***************************************************************************
+ * @brief Start the erase of the sector, STO_update() waits for it
+ *****************************************************************************/
+static void erase_start(void)
+{
+    unlock();
+    FLASH->CR = (FLASH->CR & ~(FLASH_CR_PSIZE | FLASH_CR_SNB))
+            | FLASH_CR_PSIZE_1 | FLASH_CR_SER | (STO_SECTOR << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+    status.erasing = true;
+}
+
+
+/** ***************************************************************************
+ * @brief Finish the erase of the sector
+ * @return false if the erase failed
+ *
+ * The data cache of the flash interface may still hold the old content.
+ *****************************************************************************/
+static bool erase_end(void)
+{
+    FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+    FLASH->CR |= FLASH_CR_LOCK;
+    if (FLASH->ACR & FLASH_ACR_DCEN) {
+        FLASH->ACR &= ~FLASH_ACR_DCEN;
+        FLASH->ACR |= FLASH_ACR_DCRST;
+        FLASH->ACR &= ~FLASH_ACR_DCRST;
+        FLASH->ACR |= FLASH_ACR_DCEN;
+    }
+    status.erasing = false;
+    status.records = 0;
+    if ((FLASH->SR & SR_ERRORS) || slot(0)->magic != ERASED) {
+        status.errors++;
+        status.records = RECORDS;       // Erase again after the delay
+        return false;
+    }
+    status.erases++;
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Restore the settings and the background of the last valid record
+ *
+ * Call after FFT_Init(), which clears the background.
+ *****************************************************************************/
+void STO_init(void)
+{
+    memset(&status, 0, sizeof(status));
+    int32_t last = -1;
+    for (uint32_t i = 0; i < RECORDS && !is_free(i); i++) {
+        STO_record_t r = *(const STO_record_t *)slot(i);
+        status.records = i + 1;
+        if (r.magic == STO_MAGIC && r.check == checksum(&r) && r.sequence > status.sequence) {
+            status.sequence = r.sequence;
+            last = i;
+        }
+    }
+    if (last >= 0) {
+        const STO_record_t *r = (const STO_record_t *)slot(last);
+        for (int i = 0; i < CFG_SETTINGS; i++) {
+            if (CFG_is_stored(i)) {
+                CFG_set(i, r->setting[i]);
+            }
+        }
+        set_background(r->background);
+        set_decoupling(r->decoupling);
+    }
+    collect(&stored);                   // Nothing to write until a change
+    pending = stored;
+}
+
+
+/** ***************************************************************************
+ * @brief Write a changed setting or background, continue an erase
+ * @param [in] now_ms HAL_GetTick()
+ *
+ * Call once per pass of the main loop, never waits for an erase.
+ *****************************************************************************/
+void STO_update(uint32_t now_ms)
+{
+    if (status.erasing) {
+        if (FLASH->SR & FLASH_SR_BSY) {
+            return;
+        }
+        if (!erase_end()) {
+            pending_ms = now_ms;
+        }
+    }
+    STO_record_t current;
+    collect(&current);
+    if (!same(&current, &pending)) {
+        pending = current;
+        pending_ms = now_ms;
+        return;
+    }
+    if (same(&pending, &stored) || now_ms - pending_ms < STO_DELAY_MS) {
+        return;
+    }
+    if (status.records >= RECORDS) {
+        erase_start();
+        return;
+    }
+    program(&pending);
+    if (!same(&pending, &stored)) {
+        pending_ms = now_ms;            // Failed, try again after the delay
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief State of the storage
+ *****************************************************************************/
+STO_status_t STO_get_status(void)
+{
+    return status;
+}
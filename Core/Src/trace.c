@@ -0,0 +1,137 @@
+/** ***************************************************************************
+ * @file
+ * @brief Event trace in a RAM ring
+ *
+ * Recording
+ * =========
+ * The macro TRACE(id, arg) records an event with its time in the ring TRACE_ring[].
+ * The ring holds the last TRACE_EVENTS events.
+ * Recorded are:
+ * - TRACE_ISR_ENTER, TRACE_ISR_EXIT: IRQ_enter() and IRQ_exit()
+ * - TRACE_FRAME: the ADC buffer is full
+ * - TRACE_BEGIN, TRACE_END: PWR_begin() and PWR_end() in the main loop,
+ *   i.e. DSP, rendering (PWR_LCD) and touch transactions
+ * - TRACE_CLOCK: CLOCK_set() changed the core clock
+ *
+ * The time is the HAL tick and the SysTick counter.
+ * Unlike the DWT counter, they also run while the core sleeps.
+ * The core clock is stored with each event, as SysTick counts core clock cycles.
+ * @n The ring is in CCMRAM, it is not transferred by DMA.
+ *
+ * Dump
+ * ====
+ * TRACE_TRIGGER() freezes the ring. The main loop calls TRACE_UPDATE(),
+ * which sends the frozen events in chunks of TRACE_CHUNK as SER_FRAME_TRACE,
+ * as long as there is space in the transmit queue.
+ * Afterwards the recording continues.
+ * @n main() triggers a dump when a frame is older than TRACE_LATE_US
+ * after it has been processed and drawn.
+ * Tools/trace_to_perfetto.py converts the dump into the Chrome trace format
+ * (JSON), which is shown by ui.perfetto.dev or chrome://tracing.
+ *
+ * Compile switch
+ * ==============
+ * Without TRACE_ENABLED in main.h the macros are empty,
+ * no code and no memory is used.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include "trace.h"
+
+#ifdef TRACE_ENABLED
+
+#include "serial.h"
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Payload of SER_FRAME_TRACE */
+typedef struct {
+    uint32_t index;                     ///< Number of the first event in the dump
+    uint32_t total;                     ///< Events in the dump
+    TRACE_event_t events[TRACE_CHUNK];  ///< Events, only the first ones may be valid
+} chunk_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+TRACE_event_t TRACE_ring[TRACE_EVENTS] __attribute__((section(".ccmram"))); ///< Event ring
+volatile uint32_t TRACE_head = 0;       ///< Number of recorded events
+volatile bool TRACE_frozen = false;     ///< Recording stopped for the dump
+uint32_t TRACE_mhz = 168;               ///< Core clock in MHz, set by CLOCK_set()
+
+static uint32_t dump_first = 0;         ///< Ring position of the oldest event
+static uint32_t dump_total = 0;         ///< Events in the dump
+static uint32_t dump_sent = 0;          ///< Events already sent
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Freeze the ring and start the dump
+ * @param [in] arg recorded with the TRACE_TRIGGERED event
+ *
+ * Ignored while a dump is in progress.
+ *****************************************************************************/
+void TRACE_trigger(uint16_t arg)
+{
+    if (TRACE_frozen) {
+        return;
+    }
+    TRACE_record(TRACE_TRIGGERED, arg);
+    TRACE_frozen = true;
+    dump_total = (TRACE_head < TRACE_EVENTS) ? TRACE_head : TRACE_EVENTS;
+    dump_first = TRACE_head - dump_total;
+    dump_sent = 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Send the next chunk of the dump
+ *
+ * @note Call periodically from the main loop.
+ *****************************************************************************/
+void TRACE_update(void)
+{
+    static chunk_t chunk;
+    while (TRACE_frozen && SER_get_free() >= sizeof(chunk) + SER_FRAME_OVERHEAD) {
+        uint32_t count = dump_total - dump_sent;
+        if (count > TRACE_CHUNK) {
+            count = TRACE_CHUNK;
+        }
+        chunk.index = dump_sent;
+        chunk.total = dump_total;
+        for (uint32_t i = 0; i < count; i++) {
+            chunk.events[i] = TRACE_ring[(dump_first + dump_sent + i) & (TRACE_EVENTS-1)];
+        }
+        SER_send_frame(SER_FRAME_TRACE, &chunk,
+                sizeof(chunk) - (TRACE_CHUNK - count) * sizeof(TRACE_event_t));
+        dump_sent += count;
+        if (dump_sent >= dump_total) {
+            TRACE_frozen = false;       // Continue recording
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Record a change of the core clock
+ * @param [in] mhz new core clock
+ *****************************************************************************/
+void TRACE_clock(uint32_t mhz)
+{
+    TRACE_mhz = mhz;
+    TRACE_record(TRACE_CLOCK, mhz);
+}
+
+#endif
@@ -88,10 +88,28 @@ LoopFillZerobss:
   cmp  r2, r3
   bcc  FillZerobss
 
+/* Zero fill the ccmram segment. */
+  ldr  r2, =_sccmram
+  b  LoopFillZeroccm
+FillZeroccm:
+  movs  r3, #0
+  str  r3, [r2], #4
+
+LoopFillZeroccm:
+  ldr  r3, = _eccmram
+  cmp  r2, r3
+  bcc  FillZeroccm
+
 /* Call the clock system intitialization function.*/
   bl  SystemInit   
 /* Call static constructors */
     bl __libc_init_array
+/* main() uses the process stack in CCMRAM, the interrupts the main stack */
+  ldr   r0, =_estack_main
+  msr   psp, r0
+  movs  r0, #2          /* CONTROL.SPSEL = 1: thread mode uses PSP */
+  msr   control, r0
+  isb
 /* Call the application's entry point.*/
   bl  main
   bx  lr    
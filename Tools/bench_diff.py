@@ -0,0 +1,90 @@
+"""Record and compare the result tables of the benchmark firmware (bench.c).
+
+usage: bench_diff.py record <port|file> <table.txt>
+       bench_diff.py <old.txt> <new.txt> [threshold_percent]
+
+record waits for one complete table and stores its lines.
+The comparison uses the fastest run (min) of each kernel, which is the
+least disturbed by the system. A kernel that is more than threshold_percent
+(default 5) slower is a regression, the exit code is then 1.
+Recorded captures of the raw serial data can be compared as well.
+"""
+
+import re
+import sys
+
+from serial_frames import FRAME_TEXT, open_port, read_frames
+
+HEADER = re.compile(r"BENCH,begin,([^,\r\n]*),(\d+),(\d+)")
+ROW = re.compile(r"BENCH,(\w+),(\d+),(\d+),(\d+)")
+
+
+def parse(text):
+    """Build info and {kernel: (min, mean, max)} of the last table in text."""
+    start = text.rfind("BENCH,begin")
+    if start < 0:
+        raise ValueError("no result table found")
+    header = HEADER.match(text, start)
+    build = "%s, %s MHz, %s runs" % header.groups() if header else "?"
+    rows = {}
+    for match in ROW.finditer(text, start):
+        rows[match.group(1)] = tuple(int(v) for v in match.groups()[1:])
+    return build, rows
+
+
+def load(name):
+    with open(name, "rb") as f:
+        return parse(f.read().decode("ascii", "replace"))
+
+
+def record(port, output):
+    lines = []
+    for frame_type, payload in read_frames(open_port(port)):
+        if frame_type != FRAME_TEXT:
+            continue
+        line = payload.decode("ascii", "replace")
+        if line.startswith("BENCH,begin"):
+            lines = []
+        lines.append(line)
+        if line.startswith("BENCH,end") and lines[0].startswith("BENCH,begin"):
+            with open(output, "w", newline="") as f:
+                f.write("".join(lines))
+            print("".join(lines), end="")
+            return 0
+    print("no complete result table received", file=sys.stderr)
+    return 2
+
+
+def compare(old_name, new_name, threshold):
+    old_build, old = load(old_name)
+    new_build, new = load(new_name)
+    print("old: %s\nnew: %s\n" % (old_build, new_build))
+    print("%-8s %10s %10s %8s" % ("kernel", "old min", "new min", "change"))
+    regressions = 0
+    for kernel in list(old) + [k for k in new if k not in old]:
+        if kernel not in old or kernel not in new:
+            print("%-8s %s" % (kernel, "only in " + ("new" if kernel in new else "old")))
+            continue
+        before, after = old[kernel][0], new[kernel][0]
+        change = 100.0 * (after - before) / before if before else 0.0
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        elif change < -threshold:
+            flag = "  faster"
+        print("%-8s %10d %10d %+7.1f%%%s" % (kernel, before, after, change, flag))
+    return 1 if regressions else 0
+
+
+def main():
+    if len(sys.argv) == 4 and sys.argv[1] == "record":
+        return record(sys.argv[2], sys.argv[3])
+    if len(sys.argv) in (3, 4) and sys.argv[1] != "record":
+        threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 5.0
+        return compare(sys.argv[1], sys.argv[2], threshold)
+    sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,157 @@
+"""Reader of the capture files (*.cmcap, see capture.c).
+
+The file is memory-mapped. Chunks and compressed frames are returned as
+memoryviews into the mapping (no copy), frames are decoded on access.
+
+    with CaptureFile("capture_1.cmcap") as cap:
+        print(cap.sample_rate, cap.channel_names, len(cap))
+        for number, channels in cap.frames(start=100):
+            lpad = channels[0]          # array of frame_length samples
+        channels = cap.frame(1234)      # random access
+
+usage: capture_file.py <file.cmcap> [frame]
+"""
+
+import bisect
+import mmap
+import struct
+import sys
+from array import array
+
+HEADER = struct.Struct("<4sHHIHBB8sIIIII20s")
+CHUNK = struct.Struct("<IHH")           # first_frame, frames, bytes
+TRAILER = struct.Struct("<4s3I")        # magic, chunks, frames, index_offset
+
+CHANNEL_NAMES = {0: "-", 1: "LPAD", 2: "RPAD", 3: "LHALL", 4: "RHALL"}
+
+
+class CaptureFile:
+    """Random access to the frames of a capture file."""
+
+    def __init__(self, path):
+        self._file = open(path, "rb")
+        self._map = mmap.mmap(self._file.fileno(), 0, access=mmap.ACCESS_READ)
+        self.view = memoryview(self._map)
+        (magic, self.version, self.header_size, self.sample_rate, self.frame_length,
+         self.channels, self.sample_bits, channel_map, self.calibration,
+         self.chunk_size, self.session, self.start_ms, self.mains_mhz, _) = HEADER.unpack_from(self.view)
+        if magic != b"CMCP":
+            raise ValueError("%s is not a capture file" % path)
+        self.channel_map = list(channel_map[:self.channels])
+        self.channel_names = [CHANNEL_NAMES.get(c, "?") for c in self.channel_map]
+        self.index = self._read_index()
+        self._firsts = [entry[0] for entry in self.index]
+
+    def _read_index(self):
+        """Index from the trailer, or from the chunk headers if it is missing."""
+        if len(self.view) >= self.header_size + TRAILER.size:
+            magic, chunks, _, offset = TRAILER.unpack_from(self.view, len(self.view) - TRAILER.size)
+            if magic == b"CIDX":
+                return [CHUNK.unpack_from(self.view, offset + i * CHUNK.size) for i in range(chunks)]
+        index = []
+        offset = self.header_size
+        following = 0                   # frame number after the last chunk
+        while offset + self.chunk_size <= len(self.view):
+            entry = CHUNK.unpack_from(self.view, offset)
+            if entry[1] == 0 or entry[0] < following or entry[2] > self.chunk_size - CHUNK.size:
+                break                   # unwritten chunk or start of the index
+            following = entry[0] + entry[1]
+            index.append(entry)
+            offset += self.chunk_size
+        return index
+
+    def close(self):
+        self.view.release()
+        self._map.close()
+        self._file.close()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        """Number of stored frames (without dropped ones)."""
+        return sum(entry[1] for entry in self.index)
+
+    def chunk(self, i):
+        """Compressed frames of chunk i as memoryview."""
+        offset = self.header_size + i * self.chunk_size + CHUNK.size
+        return self.view[offset:offset + self.index[i][2]]
+
+    def _frame_size(self, data, offset):
+        """Bytes of the compressed frame at offset."""
+        start = offset
+        for _ in range(self.channels):
+            bits = data[offset + 2]
+            offset += 3 + ((self.frame_length - 1) * bits + 7) // 8
+        return offset - start
+
+    def raw_frames(self, i):
+        """(number, memoryview) of the compressed frames of chunk i."""
+        first, frames, _ = self.index[i]
+        data = self.chunk(i)
+        offset = 0
+        for k in range(frames):
+            size = self._frame_size(data, offset)
+            yield first + k, data[offset:offset + size]
+            offset += size
+
+    def decode(self, raw):
+        """Samples of each channel of a compressed frame."""
+        channels = []
+        offset = 0
+        deltas = self.frame_length - 1
+        for _ in range(self.channels):
+            first = raw[offset] | (raw[offset + 1] << 8)
+            bits = raw[offset + 2]
+            size = (deltas * bits + 7) // 8
+            packed = int.from_bytes(raw[offset + 3:offset + 3 + size], "little")
+            offset += 3 + size
+            samples = array("H", [first])
+            value = first
+            mask = (1 << bits) - 1
+            for _ in range(deltas):
+                zigzag = packed & mask
+                packed >>= bits
+                value += (zigzag >> 1) ^ -(zigzag & 1)
+                samples.append(value)
+            channels.append(samples)
+        return channels
+
+    def frame(self, number):
+        """Samples of each channel of frame number, KeyError if not stored."""
+        i = bisect.bisect_right(self._firsts, number) - 1
+        if i >= 0:
+            for n, raw in self.raw_frames(i):
+                if n == number:
+                    return self.decode(raw)
+        raise KeyError("frame %d not in capture" % number)
+
+    def frames(self, start=0):
+        """Generator of (number, channels) from frame start."""
+        i = max(bisect.bisect_right(self._firsts, start) - 1, 0)
+        for chunk in range(i, len(self.index)):
+            for n, raw in self.raw_frames(chunk):
+                if n >= start:
+                    yield n, self.decode(raw)
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    with CaptureFile(sys.argv[1]) as cap:
+        frames = len(cap)
+        last = cap.index[-1][0] + cap.index[-1][1] if cap.index else 0
+        print("session %d, calibration %d, %d Hz, %d scans per frame, mains %g Hz, channels %s"
+              % (cap.session, cap.calibration, cap.sample_rate, cap.frame_length,
+                 (cap.mains_mhz or 50000) / 1000, " ".join(cap.channel_names)))
+        print("%d chunks, %d frames, %d dropped" % (len(cap.index), frames, last - frames))
+        if len(sys.argv) > 2:
+            for name, samples in zip(cap.channel_names, cap.frame(int(sys.argv[2]))):
+                print("%-6s %s" % (name, " ".join(str(s) for s in samples)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,47 @@
+"""Receive the capture files (SER_FRAME_CAPTURE, see capture.c).
+
+usage: capture_recv.py <port|file> [prefix]
+
+Each session is written to <prefix>_<session>.cmcap (default prefix "capture").
+The pieces are written at their file offsets, the device does not buffer the file.
+A session is complete when its trailer has been received.
+"""
+
+import struct
+import sys
+
+from serial_frames import FRAME_CAPTURE, open_port, read_frames
+
+STREAM = struct.Struct("<2I")           # session, offset
+TRAILER = struct.Struct("<4s3I")        # magic, chunks, frames, index_offset
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    prefix = sys.argv[2] if len(sys.argv) > 2 else "capture"
+    files = {}
+    for frame_type, payload in read_frames(open_port(sys.argv[1])):
+        if frame_type != FRAME_CAPTURE or len(payload) < STREAM.size:
+            continue
+        session, offset = STREAM.unpack_from(payload)
+        data = payload[STREAM.size:]
+        if session not in files:
+            name = "%s_%d.cmcap" % (prefix, session)
+            files[session] = open(name, "w+b")
+            print("%s: started" % name)
+        f = files[session]
+        f.seek(offset)
+        f.write(data)
+        if len(data) == TRAILER.size and data[:4] == b"CIDX":
+            magic, chunks, frames, index_offset = TRAILER.unpack(data)
+            print("%s: complete, %d frames in %d chunks" % (f.name, frames, chunks))
+            f.close()
+            del files[session]
+    for f in files.values():
+        print("%s: incomplete, no index" % f.name)
+        f.close()
+
+
+if __name__ == "__main__":
+    main()
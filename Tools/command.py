@@ -0,0 +1,341 @@
+"""Client of the command interface on USART1 (see command.c).
+
+usage: command.py <port> ping
+       command.py <port> get [setting]
+       command.py <port> set <setting> <value>
+       command.py <port> capture start|stop
+       command.py <port> stats
+       command.py <port> history [count]
+       command.py <port> session [reset] [--csv]
+       command.py <port> events [count]
+       command.py <port> null [clear]
+       command.py <port> crosstalk <channel>|apply|clear
+
+session prints the statistics of the running session (see session.c),
+reset starts a new one after reading them, --csv prints one line per quantity.
+events lists the last load changes (see detector.c) as CSV.
+null captures the background field, the probe must be away from the
+target cable (see calculations.c), clear removes it.
+crosstalk <channel> captures the column of the coupling matrix of one channel
+(lpad, rpad, lhall, rhall) with a stimulus on this channel only,
+apply decouples the channels with the inverse, clear removes it.
+Screen snapshots (CMD_SNAPSHOT) are taken with snapshot.py.
+The port is the virtual COM port of the ST-LINK or the pseudo-terminal
+of Tools/host/cmd_device. Frames of other types (telemetry, capture)
+on the same line are skipped. A command without response within the
+timeout is sent again with the same sequence number.
+"""
+
+import os
+import select
+import struct
+import sys
+import time
+
+from serial_frames import FRAME_START, FrameDecoder
+
+FRAME_COMMAND = 0x05
+FRAME_RESPONSE = 0x06
+
+PING, GET, SET, CAPTURE, STATS, HISTORY, SNAPSHOT, SESSION, EVENTS, NULL, CROSSTALK = range(11)
+STATUS = ["ok", "unknown command", "bad length", "bad argument", "busy"]
+SETTINGS = ["mode", "page", "table", "averaging", "buzzer", "detect", "backend", "mains"]  # CFG_id_t
+
+READING = struct.Struct("<I3h2Bf")      # CMD_reading_t
+STATS_FORMAT = struct.Struct("<6I2H4B16H")  # CMD_stats_t
+VALID_POSITION = 0x1
+VALID_CURRENT = 0x2
+HISTORY_MAX = 15
+SESSION_HEADER = struct.Struct("<3I2H")     # SES_summary_t
+SESSION_STATS = struct.Struct("<I3fI2f2I4f")  # SES_stats_t
+QUANTITIES = ["current", "x", "y", "angle"]  # SES_quantity_t
+EVENT = struct.Struct("<2I2bH2f")      # DET_event_t
+EVENTS_MAX = 12
+SIGNALS = ["current", "LHALL", "RHALL"]  # DET_signal_t
+CHANNELS = ["lpad", "rpad", "lhall", "rhall"]  # CALC_LPAD ... CALC_RHALL
+
+
+class CommandError(Exception):
+    pass
+
+
+class Port:
+    """Raw serial port: pyserial if installed, else a POSIX terminal."""
+
+    def __init__(self, name, baudrate=115200):
+        try:
+            import serial
+            self._serial = serial.Serial(name, baudrate, timeout=0)
+            self._fd = None
+        except ImportError:
+            import termios
+            import tty
+            self._serial = None
+            self._fd = os.open(name, os.O_RDWR | os.O_NOCTTY)
+            tty.setraw(self._fd)
+            attrs = termios.tcgetattr(self._fd)
+            speed = getattr(termios, "B%d" % baudrate)
+            attrs[4] = attrs[5] = speed
+            termios.tcsetattr(self._fd, termios.TCSANOW, attrs)
+
+    def write(self, data):
+        if self._serial is not None:
+            self._serial.write(data)
+        else:
+            os.write(self._fd, data)
+
+    def read(self, timeout):
+        """Available bytes, waits up to timeout [s] for the first one."""
+        if self._serial is not None:
+            self._serial.timeout = timeout
+            data = self._serial.read(1)
+            return data + self._serial.read(self._serial.in_waiting)
+        if not select.select([self._fd], [], [], timeout)[0]:
+            return b""
+        return os.read(self._fd, 4096)
+
+
+def encode(frame_type, payload):
+    header = bytes([frame_type, len(payload) & 0xFF, len(payload) >> 8])
+    body = header + payload
+    return bytes([FRAME_START]) + body + bytes([-sum(body) & 0xFF])
+
+
+class Client:
+    """Sends commands and collects the response records of the batches."""
+
+    def __init__(self, port, timeout=0.5, retries=3, listener=None):
+        self.port = Port(port) if isinstance(port, str) else port
+        self.listener = listener        # Called with (type, payload) of other frames
+        self.timeout = timeout
+        self.retries = retries
+        self.decoder = FrameDecoder()
+        self.sequence = 0
+        self.records = {}               # sequence -> (command, status, data)
+
+    def _receive(self, timeout):
+        for frame_type, payload in self.decoder.feed(self.port.read(timeout)):
+            if frame_type != FRAME_RESPONSE:
+                if self.listener is not None:
+                    self.listener(frame_type, payload)
+                continue
+            offset = 0
+            while offset + 4 <= len(payload):
+                seq, command, status, length = payload[offset:offset + 4]
+                self.records[seq] = (command, status, payload[offset + 4:offset + 4 + length])
+                offset += 4 + length
+
+    def request(self, command, args=b""):
+        """Data of the response, raises CommandError on an error status."""
+        self.sequence = (self.sequence + 1) & 0xFF
+        seq = self.sequence
+        self.records.pop(seq, None)
+        frame = encode(FRAME_COMMAND, bytes([seq, command]) + args)
+        for _ in range(self.retries):
+            self.port.write(frame)
+            deadline = time.monotonic() + self.timeout
+            while seq not in self.records and time.monotonic() < deadline:
+                self._receive(max(0.0, deadline - time.monotonic()))
+            if seq in self.records:
+                answered, status, data = self.records.pop(seq)
+                if answered != command:
+                    raise CommandError("response to command %d instead of %d" % (answered, command))
+                if status != 0:
+                    raise CommandError(STATUS[status] if status < len(STATUS) else "status %d" % status)
+                return data
+        raise CommandError("no response")
+
+    def ping(self):
+        protocol, settings, history_size, uptime = struct.unpack("<2BHI", self.request(PING))
+        return {"protocol": protocol, "settings": settings,
+                "history_size": history_size, "uptime_ms": uptime}
+
+    def get(self, setting=None):
+        if setting is None:
+            data = self.request(GET)
+            values = struct.unpack("<%di" % (len(data) // 4), data)
+            return dict(zip(SETTINGS, values))
+        _, value, low, high = struct.unpack("<B3i", self.request(GET, bytes([_setting_id(setting)])))
+        return value, low, high
+
+    def set(self, setting, value):
+        _, value = struct.unpack("<Bi", self.request(SET, struct.pack("<Bi", _setting_id(setting), value)))
+        return value
+
+    def capture(self, start):
+        active, dropped = struct.unpack("<BI", self.request(CAPTURE, bytes([1 if start else 0])))
+        return bool(active), dropped
+
+    def stats(self):
+        v = STATS_FORMAT.unpack(self.request(STATS))
+        names = ["uptime_ms", "readings", "valid_readings", "rx_lost", "tx_dropped",
+                 "capture_dropped", "commands", "errors", "clip_flags", "capture_active"]
+        stats = dict(zip(names, v))
+        stats["channels"] = [dict(zip(["min", "max", "mean", "clip_count"], v[12 + 4 * c:16 + 4 * c]))
+                             for c in range(4)]
+        return stats
+
+    def history(self, first, count=HISTORY_MAX):
+        """(first, readings) from number first on, first may be moved to the oldest."""
+        data = self.request(HISTORY, struct.pack("<IB", first, min(count, 255)))
+        first, n = struct.unpack_from("<IB", data)
+        readings = [READING.unpack_from(data, 5 + k * READING.size) for k in range(n)]
+        return first, readings
+
+    def snapshot(self):
+        """Start a screen snapshot, returns its number (see snapshot.py)."""
+        return self.request(SNAPSHOT)[0]
+
+    def session(self, reset=False):
+        """Statistics of the session, reset starts a new one afterwards."""
+        data = self.request(SESSION, bytes([1]) if reset else b"")
+        start, duration, readings, *windows = SESSION_HEADER.unpack_from(data)
+        session = {"start_ms": start, "duration_ms": duration, "readings": readings,
+                   "window_s": windows, "quantities": {}}
+        names = ["count", "mean", "std", "time_mean", "covered_ms", "min", "max", "min_ms", "max_ms"]
+        for q, name in enumerate(QUANTITIES):
+            v = SESSION_STATS.unpack_from(data, SESSION_HEADER.size + q * SESSION_STATS.size)
+            stats = dict(zip(names, v))
+            stats["windows"] = [(v[9 + 2 * w], v[10 + 2 * w]) for w in range(len(windows))]
+            session["quantities"][name] = stats
+        return session
+
+    def events(self, first, count=EVENTS_MAX):
+        """(first, events) like history(): (time_ms, onset_ms, signal, direction, frames, before, after)."""
+        data = self.request(EVENTS, struct.pack("<IB", first, min(count, 255)))
+        first, n = struct.unpack_from("<IB", data)
+        return first, [EVENT.unpack_from(data, 5 + k * EVENT.size) for k in range(n)]
+
+    def null(self, start=None):
+        """(frames left, background set), start True captures, False clears, None queries."""
+        frames, background = struct.unpack("<2B", self.request(NULL, b"" if start is None else bytes([int(start)])))
+        return frames, bool(background)
+
+    def crosstalk(self, op=None, channel=0):
+        """(frames left, captured columns, decoupled), op "clear", "apply", "capture" or None queries."""
+        args = b"" if op is None else bytes([2, channel]) if op == "capture" else bytes([["clear", "apply"].index(op)])
+        frames, columns, decoupled = struct.unpack("<3B", self.request(CROSSTALK, args))
+        return frames, columns, bool(decoupled)
+
+    def poll(self, timeout):
+        """Receive for timeout [s], other frames go to the listener."""
+        self._receive(timeout)
+
+    def recent(self, count):
+        """The last count readings: (number, time_ms, x, y, angle, clip, valid, current)."""
+        total = self.stats()["readings"]
+        first = max(0, total - count)
+        out = []
+        while first < total:
+            first, readings = self.history(first, min(HISTORY_MAX, total - first))
+            if not readings:
+                break
+            out += [(first + k,) + r for k, r in enumerate(readings)]
+            first += len(readings)
+        return out
+
+
+def _setting_id(setting):
+    if isinstance(setting, int):
+        return setting
+    if setting.isdigit():
+        return int(setting)
+    try:
+        return SETTINGS.index(setting)
+    except ValueError:
+        raise CommandError("unknown setting %s, one of %s" % (setting, ", ".join(SETTINGS)))
+
+
+def print_session(session, csv):
+    windows = session["window_s"]
+    if csv:
+        print("quantity,count,mean,std,time_mean,covered_ms,min,min_s,max,max_s,"
+              + ",".join("window%d_mean,window%d_std" % (w, w) for w in windows))
+    else:
+        print("session %.1f s, %d readings, windows %s s" % (
+            session["duration_ms"] / 1000.0, session["readings"], "/".join(map(str, windows))))
+    for name, q in session["quantities"].items():
+        min_s = (q["min_ms"] - session["start_ms"]) / 1000.0
+        max_s = (q["max_ms"] - session["start_ms"]) / 1000.0
+        if csv:
+            print("%s,%d,%g,%g,%g,%d,%g,%.1f,%g,%.1f," % (
+                name, q["count"], q["mean"], q["std"], q["time_mean"], q["covered_ms"],
+                q["min"], min_s, q["max"], max_s)
+                + ",".join("%g,%g" % w for w in q["windows"]))
+            continue
+        if q["count"] == 0:
+            print("%-8s n      0" % name)
+            continue
+        print("%-8s n %6d  mean %8.2f  std %6.2f  time mean %8.2f  min %8.2f (%.1f s)  max %8.2f (%.1f s)" % (
+            name, q["count"], q["mean"], q["std"], q["time_mean"], q["min"], min_s, q["max"], max_s))
+        print("%-8s windows %s" % ("", "  ".join("%.2f/%.2f" % w for w in q["windows"])))
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit(__doc__)
+    client = Client(sys.argv[1])
+    command, args = sys.argv[2], sys.argv[3:]
+    try:
+        if command == "ping":
+            print(client.ping())
+        elif command == "get" and not args:
+            for name, value in client.get().items():
+                print("%-10s %d" % (name, value))
+        elif command == "get" and len(args) == 1:
+            print("%s = %d (%d..%d)" % ((args[0],) + client.get(args[0])))
+        elif command == "set" and len(args) == 2:
+            print("%s = %d" % (args[0], client.set(args[0], int(args[1]))))
+        elif command == "capture" and args in (["start"], ["stop"]):
+            active, dropped = client.capture(args[0] == "start")
+            print("capture %s, %d frames dropped" % ("active" if active else "stopped", dropped))
+        elif command == "stats" and not args:
+            stats = client.stats()
+            for name, value in stats.items():
+                if name != "channels":
+                    print("%-16s %d" % (name, value))
+            for name, channel in zip(["LPAD", "RPAD", "LHALL", "RHALL"], stats["channels"]):
+                print("%-16s min %4d  max %4d  mean %4d  clipped %d" % (
+                    name, channel["min"], channel["max"], channel["mean"], channel["clip_count"]))
+        elif command == "history" and len(args) <= 1:
+            print("number,time_ms,x,y,angle,clip_flags,valid,current")
+            for r in client.recent(int(args[0]) if args else 50):
+                print("%d,%d,%d,%d,%d,%d,%d,%.2f" % r)
+        elif command == "events" and len(args) <= 1:
+            print("number,time_ms,onset_ms,signal,direction,frames,before,after")
+            first = max(0, client.events(1 << 31, 0)[0] - (int(args[0]) if args else 32))
+            while True:
+                first, events = client.events(first)
+                if not events:
+                    break
+                for k, (t, onset, signal, direction, frames, before, after) in enumerate(events):
+                    print("%d,%d,%d,%s,%d,%d,%.2f,%.2f" % (first + k, t, onset, SIGNALS[signal],
+                                                           direction, frames, before, after))
+                first += len(events)
+        elif command == "null" and args in ([], ["clear"]):
+            frames, background = client.null(not args)
+            while frames > 0:
+                time.sleep(0.1)
+                frames, background = client.null()
+            print("background %s" % ("set" if background else "cleared"))
+        elif command == "crosstalk" and len(args) == 1 and args[0] in CHANNELS + ["apply", "clear"]:
+            if args[0] in CHANNELS:
+                frames, columns, decoupled = client.crosstalk("capture", CHANNELS.index(args[0]))
+                while frames > 0:
+                    time.sleep(0.1)
+                    frames, columns, decoupled = client.crosstalk()
+            else:
+                frames, columns, decoupled = client.crosstalk(args[0])
+            print("columns %s captured, %s" % (" ".join(c if columns >> i & 1 else "-" for i, c in enumerate(CHANNELS)),
+                                              "decoupled" if decoupled else "not decoupled"))
+        elif command == "session" and set(args) <= {"reset", "--csv"}:
+            print_session(client.session("reset" in args), "--csv" in args)
+        else:
+            sys.exit(__doc__)
+    except CommandError as e:
+        sys.exit("error: %s" % e)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
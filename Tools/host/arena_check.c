@@ -0,0 +1,306 @@
+/** ***************************************************************************
+ * @file
+ * @brief Check of the SDRAM arenas on a region from malloc()
+ *
+ * Usage
+ * =====
+ * @code
+ * arena_check          built-in checks, exit status 1 if one fails
+ * @endcode
+ * arena.c is compiled unchanged. The region starts at an odd address,
+ * ARENA_init() has to align the arenas itself.
+ *
+ * Checks
+ * ======
+ * - init: a region too small fails, every allocation fails then
+ * - layout: arenas aligned, in table order, not overlapping
+ * - bump: allocations aligned and contiguous, exhaustion fails,
+ *   ARENA_reset() releases all and keeps the peak
+ * - pool: all blocks distinct and aligned, the next one fails,
+ *   a returned block is reused, ARENA_reset() returns all blocks
+ * - kinds: ARENA_alloc() on a pool and ARENA_pool_get() on a bump arena fail
+ * - time: the cost of an allocation does not depend on the fill level
+ *   (first and last eighth of a bump arena, empty and full pool)
+ *
+ * One CSV line per check, the times per allocation are printed on stderr.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "arena.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define REGION_SIZE     (2*1024*1024)   ///< Region of the arenas, larger than the table needs
+#define SMALL_SIZE      (64*1024)       ///< Region too small for the table
+#define TIME_RUNS       20              ///< Repetitions of a time measurement, the minimum is used
+#define TIME_RATIO      4.0             ///< Max ratio of two times per allocation
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static int failed = 0;                  ///< Failed checks
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** Print the result of a check */
+static void check(const char *name, bool ok, const char *detail)
+{
+    printf("%s,%s,%s\n", name, detail, ok ? "pass" : "FAIL");
+    failed += !ok;
+}
+
+
+/** Address is a multiple of ARENA_ALIGN */
+static bool aligned(const void *p)
+{
+    return ((uintptr_t)p % ARENA_ALIGN) == 0;
+}
+
+
+/** Monotonic time [ns] */
+static double now_ns(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+
+/** ***************************************************************************
+ * @brief Init with a region too small for the table
+ *****************************************************************************/
+static void check_init(uint8_t *region)
+{
+    bool init = ARENA_init(region + 1, SMALL_SIZE);
+    bool none = ARENA_alloc(ARENA_CAPTURE, 1) == NULL && ARENA_pool_get(ARENA_CHUNKS) == NULL;
+    bool counted = ARENA_get_stats(ARENA_CAPTURE).failures == 1
+            && ARENA_get_stats(ARENA_CAPTURE).size == 0;
+    check("init small region", !init && none && counted, "returns false; no allocation");
+    check("init region", ARENA_init(region + 1, REGION_SIZE), "returns true");
+}
+
+
+/** ***************************************************************************
+ * @brief Arenas are aligned, in order, inside the region and do not overlap
+ *****************************************************************************/
+static void check_layout(uint8_t *region)
+{
+    bool ok = true;
+    uint8_t *end = region + 1;
+    for (int i = 0; i < ARENA_COUNT; i++) {
+        ARENA_stats_t s = ARENA_get_stats(i);
+        ARENA_reset(i);
+        uint8_t *base = (s.block_size > 0) ? ARENA_pool_get(i) : ARENA_alloc(i, 1);
+        ok = ok && base != NULL && aligned(base) && base >= end && s.size % ARENA_ALIGN == 0;
+        end = base + s.size;
+        ARENA_reset(i);
+    }
+    ok = ok && end <= region + 1 + REGION_SIZE;
+    check("layout", ok, "aligned; ordered; inside the region");
+}
+
+
+/** ***************************************************************************
+ * @brief Bump allocation of ARENA_HISTORY
+ *****************************************************************************/
+static void check_bump(void)
+{
+    const ARENA_id_t id = ARENA_HISTORY;
+    ARENA_reset(id);
+    ARENA_stats_t before = ARENA_get_stats(id);
+
+    uint8_t *a = ARENA_alloc(id, 1);
+    uint8_t *b = ARENA_alloc(id, ARENA_ALIGN + 1);
+    uint8_t *c = ARENA_alloc(id, 100);
+    bool ok = a && b && c && aligned(a) && aligned(b) && aligned(c)
+            && b == a + ARENA_ALIGN && c == b + 2*ARENA_ALIGN;
+    ARENA_stats_t s = ARENA_get_stats(id);
+    ok = ok && s.used == 7*ARENA_ALIGN && s.peak == 7*ARENA_ALIGN && s.allocs == before.allocs + 3;
+    check("bump aligned", ok, "1 / 33 / 100 bytes take 1 / 2 / 4 units");
+
+    uint32_t rest = s.size - s.used;
+    bool full = ARENA_alloc(id, rest + 1) == NULL;
+    bool last = ARENA_alloc(id, rest) == c + 4*ARENA_ALIGN;
+    bool empty = ARENA_alloc(id, 1) == NULL;
+    bool wrap = ARENA_alloc(id, UINT32_MAX) == NULL;
+    s = ARENA_get_stats(id);
+    ok = full && last && empty && wrap && s.used == s.size && s.failures == before.failures + 3;
+    check("bump exhaustion", ok, "rest + 1 / 1 / UINT32_MAX fail; rest fits");
+
+    ARENA_reset(id);
+    s = ARENA_get_stats(id);
+    ok = s.used == 0 && s.peak == s.size && ARENA_alloc(id, 1) == a;
+    check("bump reset", ok, "used 0; peak kept; same address again");
+    ARENA_reset(id);
+}
+
+
+/** ***************************************************************************
+ * @brief Pool allocation of ARENA_CHUNKS
+ *****************************************************************************/
+static void check_pool(void)
+{
+    const ARENA_id_t id = ARENA_CHUNKS;
+    ARENA_reset(id);
+    ARENA_stats_t s = ARENA_get_stats(id);
+    uint32_t blocks = s.size / s.block_size;
+    uint8_t *block[ARENA_CHUNK_BLOCKS];
+
+    bool ok = blocks == ARENA_CHUNK_BLOCKS && s.block_size == ARENA_CHUNK_SIZE;
+    for (uint32_t i = 0; i < blocks && ok; i++) {
+        block[i] = ARENA_pool_get(id);
+        ok = block[i] != NULL && aligned(block[i]);
+        for (uint32_t j = 0; j < i && ok; j++) {
+            uint8_t *lo = (block[i] < block[j]) ? block[i] : block[j];
+            uint8_t *hi = (block[i] < block[j]) ? block[j] : block[i];
+            ok = lo + s.block_size <= hi;
+        }
+    }
+    check("pool blocks", ok, "ARENA_CHUNK_BLOCKS distinct aligned blocks");
+
+    uint32_t failures = ARENA_get_stats(id).failures;
+    s = ARENA_get_stats(id);
+    ok = ARENA_pool_get(id) == NULL && ARENA_get_stats(id).failures == failures + 1
+            && s.used == s.size && s.peak == s.size;
+    check("pool exhaustion", ok, "next block fails; used = peak = size");
+
+    ARENA_pool_put(id, block[3]);
+    ARENA_pool_put(id, NULL);
+    s = ARENA_get_stats(id);
+    ok = s.used == s.size - s.block_size && ARENA_pool_get(id) == block[3]
+            && ARENA_pool_get(id) == NULL;
+    check("pool reuse", ok, "returned block is the next one; NULL ignored");
+
+    ARENA_reset(id);
+    uint32_t count = 0;
+    while (ARENA_pool_get(id) != NULL) {
+        count++;
+    }
+    s = ARENA_get_stats(id);
+    check("pool reset", count == blocks && s.peak == s.size, "all blocks back; peak kept");
+    ARENA_reset(id);
+}
+
+
+/** ***************************************************************************
+ * @brief The kind of an arena is respected
+ *****************************************************************************/
+static void check_kinds(void)
+{
+    bool ok = ARENA_alloc(ARENA_CHUNKS, 1) == NULL && ARENA_pool_get(ARENA_HISTORY) == NULL
+            && ARENA_get_stats(ARENA_HISTORY).used == 0 && ARENA_get_stats(ARENA_CHUNKS).used == 0;
+    check("kinds", ok, "ARENA_alloc() on a pool and ARENA_pool_get() on a bump arena fail");
+    ARENA_pool_put(ARENA_HISTORY, NULL);
+}
+
+
+/** ***************************************************************************
+ * @brief Time per bump allocation in an eighth of the arena
+ * @param [in] first true = first eighth, false = last eighth
+ * @return ns per allocation, minimum of TIME_RUNS
+ *****************************************************************************/
+static double bump_ns(bool first)
+{
+    const ARENA_id_t id = ARENA_HISTORY;
+    uint32_t n = ARENA_get_stats(id).size / ARENA_ALIGN / 8;
+    double best = 1e9;
+    for (int r = 0; r < TIME_RUNS; r++) {
+        ARENA_reset(id);
+        if (!first) {
+            ARENA_alloc(id, 7*n*ARENA_ALIGN);
+        }
+        double t0 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            if (ARENA_alloc(id, ARENA_ALIGN) == NULL) {
+                return 1e9;
+            }
+        }
+        double t = (now_ns() - t0) / n;
+        best = (t < best) ? t : best;
+    }
+    ARENA_reset(id);
+    return best;
+}
+
+
+/** ***************************************************************************
+ * @brief Time per pool get and put
+ * @param [in] full false = all blocks free, true = one block free
+ * @return ns per pair, minimum of TIME_RUNS
+ *****************************************************************************/
+static double pool_ns(bool full)
+{
+    const ARENA_id_t id = ARENA_CHUNKS;
+    const uint32_t n = 10000;
+    double best = 1e9;
+    for (int r = 0; r < TIME_RUNS; r++) {
+        ARENA_reset(id);
+        for (int i = 0; full && i < ARENA_CHUNK_BLOCKS - 1; i++) {
+            ARENA_pool_get(id);
+        }
+        double t0 = now_ns();
+        for (uint32_t i = 0; i < n; i++) {
+            void *b = ARENA_pool_get(id);
+            if (b == NULL) {
+                return 1e9;
+            }
+            ARENA_pool_put(id, b);
+        }
+        double t = (now_ns() - t0) / n;
+        best = (t < best) ? t : best;
+    }
+    ARENA_reset(id);
+    return best;
+}
+
+
+/** ***************************************************************************
+ * @brief Cost of an allocation independent of the fill level
+ *****************************************************************************/
+static void check_time(void)
+{
+    double bump[2] = {bump_ns(true), bump_ns(false)};
+    double pool[2] = {pool_ns(false), pool_ns(true)};
+    bool ok = bump[1] < TIME_RATIO*bump[0] + 1 && bump[0] < TIME_RATIO*bump[1] + 1
+            && pool[1] < TIME_RATIO*pool[0] + 1 && pool[0] < TIME_RATIO*pool[1] + 1;
+    check("time", ok, "same cost at low and high fill level");
+    fprintf(stderr, "bump: %.1f / %.1f ns, pool get+put: %.1f / %.1f ns (empty / full)\n",
+            bump[0], bump[1], pool[0], pool[1]);
+}
+
+
+int main(void)
+{
+    uint8_t *region = malloc(REGION_SIZE + 1);
+    if (region == NULL) {
+        fprintf(stderr, "arena_check: no memory\n");
+        return 2;
+    }
+    printf("check,detail,result\n");
+    check_init(region);
+    check_layout(region);
+    check_bump();
+    check_pool();
+    check_kinds();
+    check_time();
+    free(region);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,431 @@
+/** ***************************************************************************
+ * @file
+ * @brief Check of the acquisition backends on a mock of measuring.c
+ *
+ * Usage
+ * =====
+ * @code
+ * backends [-v]        all backends, exit status 1 if one fails
+ * @endcode
+ * acquisition.c is compiled unchanged. The init and start functions
+ * of measuring.c are replaced by a mock of the ADC configurations:
+ * each one converts its inputs in the order of its sequence registers
+ * and leaves the buffer as its interrupt handler does
+ * (dual mode packed into 32 bit words and unpacked, the Hall sensors
+ * of the channel groups in their own buffer and copied next to the pads).
+ * The value of sample n of an input is 1000 * ACQ_channel_t + n,
+ * so each column of a frame shows where it came from.
+ *
+ * Checks
+ * ======
+ * For each backend:
+ * - ACQ_select() aborts with MEAS_stop() and sets the trigger rate,
+ *   ACQ_start() inits and starts the configuration of the backend once
+ *   and not again while the frame is sampled or processed.
+ * - The map of ACQ_get_frame() names the input of every column,
+ *   the Hall group of ACQ_GROUPS as well, at MEAS_HALL_RATIO times the rate.
+ * - start_us and end_us fit length and fs, the frame number counts.
+ * - ACQ_is_complete() only for the first ACQ_DSP_BACKENDS at the rate of the pipeline,
+ *   not after an overrun.
+ * - ACQ_set_rate() doubles the rate within the steps of the prescaler
+ *   (not for ACQ_SINGLE), the processed frame keeps it after ACQ_select().
+ * - A backend selected while a frame is sampled starts at once,
+ *   one selected while a frame is processed keeps its layout.
+ * One CSV line per backend is printed.
+ *
+ * -v prints the first samples of each frame.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "acquisition.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define TIMER_HZ        8400000UL       ///< TIM2 counter clock / (TIM_TOP+1)
+#define CHECK(cond)     do { if (!(cond) && failed == NULL) { failed = #cond; } } while (0)
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Configurations of measuring.c, set by their init function */
+typedef enum {
+    MODE_NONE = 0,          ///< Not configured or stopped
+    MODE_GROUPS,            ///< ADC3_groups_init()
+    MODE_TIMER,             ///< ADC3_IN4_timer_init()
+    MODE_DMA,               ///< ADC3_IN4_DMA_init()
+    MODE_DUAL,              ///< ADC1_IN13_ADC2_IN5_dual_init()
+    MODE_SCAN2,             ///< ADC2_IN13_IN5_scan_init()
+    MODE_SCAN3,             ///< ADC3_IN13_IN4_scan_init()
+    MODE_SINGLE             ///< ADC3_IN4_single_init()
+} config_t;
+
+/** Conversions of a configuration at each trigger */
+typedef struct {
+    uint8_t inputs[ACQ_CHANNELS];       ///< ACQ_channel_t in the order of the buffer
+    uint8_t count;                      ///< Inputs
+    uint8_t ratio;                      ///< Triggers per sample, 0 = software
+    uint16_t length;                    ///< Samples per input
+} sequence_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+/** Sequences as configured by measuring.c */
+static const sequence_t sequences[] = {
+        [MODE_GROUPS] = {{ACQ_PAD_LEFT, ACQ_PAD_RIGHT, ACQ_HALL_LEFT, ACQ_HALL_RIGHT}, 4,
+                         MEAS_HALL_RATIO, ADC_NUMS},
+        [MODE_TIMER]  = {{ACQ_PAD_LEFT, ACQ_PAD_RIGHT, ACQ_HALL_LEFT, ACQ_HALL_RIGHT}, 4, 1, ADC_NUMS},
+        [MODE_DMA]    = {{ACQ_PAD_LEFT}, 1, 1, ADC_NUMS},
+        [MODE_DUAL]   = {{ACQ_PAD_RIGHT, ACQ_AUX}, 2, 1, ADC_NUMS},     // ADC1, ADC2
+        [MODE_SCAN2]  = {{ACQ_PAD_RIGHT, ACQ_AUX}, 2, 1, ADC_NUMS},     // SQ1 IN13, SQ2 IN5
+        [MODE_SCAN3]  = {{ACQ_PAD_RIGHT, ACQ_PAD_LEFT}, 2, 1, ADC_NUMS},// SQ1 IN13, SQ2 IN4
+        [MODE_SINGLE] = {{ACQ_PAD_LEFT}, 1, 0, 1},
+};
+
+/** Configuration expected for each backend */
+static const config_t expected[ACQ_BACKENDS] = {
+        [ACQ_GROUPS] = MODE_GROUPS, [ACQ_TIMER] = MODE_TIMER, [ACQ_DMA] = MODE_DMA,
+        [ACQ_DUAL] = MODE_DUAL, [ACQ_SCAN2] = MODE_SCAN2, [ACQ_SCAN3] = MODE_SCAN3,
+        [ACQ_SINGLE] = MODE_SINGLE,
+};
+
+static const char *names[] = {"-", "pad_left", "pad_right", "hall_left", "hall_right", "aux"};
+
+volatile bool MEAS_data_ready = false;
+
+static uint32_t samples[4*ADC_NUMS];    ///< ADC buffer
+static uint32_t hall_samples[2*MEAS_HALL_NUMS]; ///< Hall buffer of the channel groups
+static config_t configured = MODE_NONE; ///< Last init
+static config_t running = MODE_NONE;    ///< Frame sampled
+static uint32_t starts = 0;             ///< Calls of a start function
+static uint32_t stops = 0;              ///< Calls of MEAS_stop()
+static uint32_t trigger_fs = MEAS_HALL_FS;  ///< Rate of MEAS_set_rate()
+static uint32_t frame_fs = MEAS_HALL_FS;    ///< trigger_fs at the start of the frame
+static uint32_t now_us = 1000;          ///< Time of the mock
+static MEAS_timing_t timing;            ///< Last frame
+static bool overrun = false;            ///< Next frame has an overrun
+static int verbose = 0;                 ///< Print samples
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** Value of sample n of an input */
+static uint32_t value(uint8_t input, uint32_t n)
+{
+    return 1000 * input + n;
+}
+
+
+/** ***************************************************************************
+ * @brief Complete the running frame like the interrupt handler
+ * @return false if no frame is running
+ *****************************************************************************/
+static bool complete(void)
+{
+    if (running == MODE_NONE) {
+        return false;
+    }
+    const sequence_t *seq = &sequences[running];
+    if (running == MODE_GROUPS) {
+        for (uint32_t i = 0; i < MEAS_HALL_NUMS; i++) {     // Regular group by DMA
+            hall_samples[2*i] = value(ACQ_HALL_LEFT, i);
+            hall_samples[2*i+1] = value(ACQ_HALL_RIGHT, i);
+        }
+        for (uint32_t i = 0; i < ADC_NUMS; i++) {           // Injected group
+            samples[4*i] = value(ACQ_PAD_LEFT, i);
+            samples[4*i+1] = value(ACQ_PAD_RIGHT, i);
+            samples[4*i+2] = hall_samples[2*MEAS_HALL_RATIO*i];
+            samples[4*i+3] = hall_samples[2*MEAS_HALL_RATIO*i+1];
+        }
+    } else if (running == MODE_DUAL) {
+        for (uint32_t i = 0; i < ADC_NUMS; i++) {           // ADC_CDR = ADC2_DR | ADC1_DR
+            samples[i] = (value(seq->inputs[1], i) << 16) | value(seq->inputs[0], i);
+        }
+        for (int32_t i = ADC_NUMS-1; i >= 0; i--) {
+            samples[2*i+1] = (samples[i] >> 16);
+            samples[2*i]   = (samples[i] & 0xffff);
+        }
+    } else {
+        for (uint32_t i = 0; i < seq->length; i++) {
+            for (uint32_t c = 0; c < seq->count; c++) {
+                samples[seq->count*i + c] = value(seq->inputs[c], i);
+            }
+        }
+    }
+    timing.end_us = timing.start_us;
+    if (seq->ratio > 0) {               // Complete at the last trigger
+        uint32_t triggers = seq->length * seq->ratio;
+        timing.end_us += (uint32_t)((uint64_t)(triggers - 1) * 1000000 / trigger_fs);
+    }
+    now_us = timing.end_us + 100;
+    timing.number++;
+    timing.overrun = overrun;
+    running = MODE_NONE;
+    MEAS_data_ready = true;
+    return true;
+}
+
+
+/** Start of a configuration */
+static void start(config_t mode)
+{
+    if (configured != mode) {
+        return;                         // Not initialized, nothing happens
+    }
+    running = mode;
+    starts++;
+    timing.start_us = now_us + ((sequences[mode].ratio > 0) ? 1000000 / trigger_fs : 0);
+    frame_fs = trigger_fs;
+    if (mode == MODE_SINGLE) {
+        complete();                     // Polled
+    }
+}
+
+
+/******************************************************************************
+ * Mock of measuring.c
+ *****************************************************************************/
+
+void ADC3_groups_init(void)             { configured = MODE_GROUPS; }
+void ADC3_groups_start(void)            { start(MODE_GROUPS); }
+void ADC3_IN4_timer_init(void)          { configured = MODE_TIMER; }
+void ADC3_IN4_timer_start(void)         { start(MODE_TIMER); }
+void ADC3_IN4_DMA_init(void)            { configured = MODE_DMA; }
+void ADC3_IN4_DMA_start(void)           { start(MODE_DMA); }
+void ADC1_IN13_ADC2_IN5_dual_init(void) { configured = MODE_DUAL; }
+void ADC1_IN13_ADC2_IN5_dual_start(void){ start(MODE_DUAL); }
+void ADC2_IN13_IN5_scan_init(void)      { configured = MODE_SCAN2; }
+void ADC2_IN13_IN5_scan_start(void)     { start(MODE_SCAN2); }
+void ADC3_IN13_IN4_scan_init(void)      { configured = MODE_SCAN3; }
+void ADC3_IN13_IN4_scan_start(void)     { start(MODE_SCAN3); }
+void ADC3_IN4_single_init(void)         { configured = MODE_SINGLE; }
+void ADC3_IN4_single_read(void)         { start(MODE_SINGLE); }
+
+void MEAS_stop(void)
+{
+    running = MODE_NONE;
+    stops++;
+}
+
+uint32_t MEAS_set_rate(uint32_t fs)
+{
+    uint32_t prescale = (TIMER_HZ + fs/2) / fs;
+    trigger_fs = TIMER_HZ / (prescale ? prescale : 1);
+    return trigger_fs;
+}
+
+MEAS_timing_t MEAS_get_timing(void)
+{
+    return timing;
+}
+
+const uint32_t *MEAS_get_samples(void)
+{
+    return samples;
+}
+
+MEAS_frame_t MEAS_get_group(MEAS_group_t group)
+{
+    MEAS_frame_t frame = {samples, 4, ADC_NUMS, frame_fs / MEAS_HALL_RATIO, timing.start_us};
+    if (group == MEAS_GROUP_HALLS) {
+        frame.samples = hall_samples;
+        frame.stride = 2;
+        frame.length = MEAS_HALL_NUMS;
+        frame.fs = frame_fs;
+    }
+    return frame;
+}
+
+void reset_sample_counter(void)
+{
+    MEAS_data_ready = false;
+}
+
+
+/******************************************************************************
+ * Checks
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Check the layout and the timing of a frame
+ * @param [in] frame
+ * @param [in] number expected frame number
+ * @return NULL or the failed condition
+ *****************************************************************************/
+static const char *check_frame(const ACQ_frame_t *frame, uint16_t number)
+{
+    const char *failed = NULL;
+    CHECK(frame->samples != NULL && frame->channels >= 1 && frame->channels <= ACQ_CHANNELS);
+    CHECK(frame->number == number);
+    for (int c = 0; c < frame->channels && failed == NULL; c++) {
+        CHECK(frame->map[c] != ACQ_NONE && ACQ_find(frame, frame->map[c]) == c);
+        uint32_t step = 1;              // Hall sensors of the groups at the pad triggers
+        if (frame->halls.samples != NULL && frame->fs > 0
+                && (frame->map[c] == ACQ_HALL_LEFT || frame->map[c] == ACQ_HALL_RIGHT)) {
+            step = frame->halls.fs / frame->fs;
+        }
+        for (uint32_t n = 0; n < frame->length; n++) {
+            CHECK(frame->samples[n*frame->channels + c] == value(frame->map[c], n * step));
+        }
+    }
+    for (int c = frame->channels; c < ACQ_CHANNELS; c++) {
+        CHECK(frame->map[c] == ACQ_NONE);
+    }
+    if (frame->fs > 0) {
+        uint32_t span = frame->end_us - frame->start_us;
+        uint32_t period_us = 1000000 / frame->fs;
+        CHECK(span + 1 >= (frame->length - 1) * period_us && span <= frame->length * period_us);
+    }
+    if (frame->halls.samples != NULL) {
+        CHECK(frame->halls.stride == 2 && frame->halls.length == MEAS_HALL_NUMS);
+        CHECK(frame->halls.fs / MEAS_HALL_RATIO == frame->fs);
+        for (uint32_t n = 0; n < frame->halls.length; n++) {
+            CHECK(frame->halls.samples[2*n] == value(ACQ_HALL_LEFT, n));
+            CHECK(frame->halls.samples[2*n+1] == value(ACQ_HALL_RIGHT, n));
+        }
+    }
+    if (verbose) {
+        printf("  frame %d:", frame->number);
+        for (int i = 0; i < 2 * frame->channels && i < frame->length * frame->channels; i++) {
+            printf(" %d", (int)frame->samples[i]);
+        }
+        printf("\n");
+    }
+    return failed;
+}
+
+
+/** ***************************************************************************
+ * @brief Sample a frame with the selected backend
+ * @return NULL or the failed condition
+ *****************************************************************************/
+static const char *sample(ACQ_frame_t *frame)
+{
+    const char *failed = NULL;
+    uint32_t before = starts;
+    uint16_t number = timing.number;
+    ACQ_start();
+    ACQ_start();                        // Running or processed: nothing
+    CHECK(starts == before + 1);
+    CHECK(configured == expected[ACQ_get_backend()]);
+    if (!MEAS_data_ready) {
+        CHECK(complete());
+    }
+    ACQ_start();                        // Processed: nothing
+    CHECK(starts == before + 1);
+    *frame = ACQ_get_frame();
+    const char *layout = check_frame(frame, number + 1);
+    return failed ? failed : layout;
+}
+
+
+/** ***************************************************************************
+ * @brief Run the checks of a backend
+ * @return true if passed
+ *****************************************************************************/
+static bool run_backend(ACQ_backend_t backend)
+{
+    const char *failed = NULL;
+    ACQ_frame_t frame;
+    uint32_t before = stops;
+
+    CHECK(ACQ_select(backend) && stops == before + 1);
+    uint32_t fs = ACQ_get_rate();
+    CHECK(fs == ((backend == ACQ_SINGLE) ? 0 : ADC_FS));
+    CHECK(fs == 0 || trigger_fs == fs * sequences[expected[backend]].ratio);
+    const char *f = sample(&frame);
+    failed = failed ? failed : f;
+    ACQ_frame_t first = frame;
+    CHECK(frame.backend == backend && frame.fs == fs);
+    CHECK(frame.channels == sequences[expected[backend]].count);
+    CHECK(ACQ_is_complete(&frame, ADC_FS) == (backend < ACQ_DSP_BACKENDS));
+    CHECK((frame.halls.samples != NULL) == (backend == ACQ_GROUPS));
+    reset_sample_counter();
+
+    /* The next frame starts after the reset */
+    f = sample(&frame);
+    failed = failed ? failed : f;
+    reset_sample_counter();
+
+    /* Overrun */
+    overrun = true;
+    f = sample(&frame);
+    failed = failed ? failed : f;
+    CHECK(frame.overrun && !ACQ_is_complete(&frame, ADC_FS));
+    overrun = false;
+    reset_sample_counter();
+
+    /* Double rate */
+    if (fs > 0) {
+        CHECK(ACQ_set_rate(2 * fs));
+        uint32_t rate = ACQ_get_rate();     // Rounded to the prescaler
+        CHECK(rate > 2 * fs - 2 * fs / 100 && rate < 2 * fs + 2 * fs / 100);
+        f = sample(&frame);
+        failed = failed ? failed : f;
+        CHECK(frame.fs == rate && !ACQ_is_complete(&frame, ADC_FS)
+                && ACQ_is_complete(&frame, rate) == (backend < ACQ_DSP_BACKENDS));
+        CHECK(ACQ_select(backend) && ACQ_get_rate() == fs);
+        ACQ_frame_t kept = ACQ_get_frame();     // Processed frame keeps its rates
+        CHECK(kept.fs == rate && kept.halls.fs == frame.halls.fs);
+        reset_sample_counter();
+    } else {
+        CHECK(!ACQ_set_rate(1000) && ACQ_get_rate() == 0);
+    }
+
+    /* Another backend selected while a frame is sampled starts at once */
+    ACQ_backend_t other = (backend + 1) % ACQ_BACKENDS;
+    ACQ_start();
+    if (MEAS_data_ready) {
+        reset_sample_counter();         // ACQ_SINGLE is complete at once
+    }
+    CHECK(ACQ_select(other) && running == MODE_NONE);
+    f = sample(&frame);
+    failed = failed ? failed : f;
+    CHECK(frame.backend == other);
+
+    /* The processed frame keeps its layout when the backend changes */
+    CHECK(ACQ_select(backend));
+    ACQ_frame_t kept = ACQ_get_frame();
+    CHECK(kept.backend == other && kept.channels == frame.channels);
+    reset_sample_counter();
+
+    printf("%s,%d,", ACQ_get_name(backend), first.channels);
+    for (int c = 0; c < first.channels; c++) {
+        printf("%s%s", c ? " " : "", names[first.map[c]]);
+    }
+    printf(",%d,%d,%d,%s%s\n", (int)first.length, (int)first.fs,
+           ACQ_is_complete(&first, ADC_FS), failed ? "FAIL: " : "pass", failed ? failed : "");
+    return failed == NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-v") != 0)) {
+        fprintf(stderr, "usage: backends [-v]\n");
+        return 2;
+    }
+    verbose = (argc == 2);
+    int failed = 0;
+    printf("backend,channels,map,length,fs,dsp,result\n");
+    for (int b = 0; b < ACQ_BACKENDS; b++) {
+        failed += !run_backend(b);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+/** ***************************************************************************
+ * @file
+ * @brief Memory-mapped reader of the capture files (see Core/Src/capture.c)
+ *
+ * The file is mapped read-only, the chunks are used in place.
+ * CR_decode() expands one compressed frame into interleaved samples,
+ * the same layout as the ADC buffer of the firmware.
+ * The index is read from the trailer, or rebuilt from the chunk headers
+ * if the capture was interrupted.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "capture_reader.h"
+
+
+/** ***************************************************************************
+ * @brief Read the index from the trailer or from the chunk headers
+ * @return 0 or -1
+ *****************************************************************************/
+static int read_index(CR_file_t *file)
+{
+    const CAP_header_t *h = &file->header;
+    CAP_trailer_t trailer;
+    uint32_t chunks = 0;
+    const uint8_t *entries = NULL;
+
+    if (file->size >= h->header_size + sizeof(trailer)) {
+        memcpy(&trailer, file->base + file->size - sizeof(trailer), sizeof(trailer));
+        if (memcmp(trailer.magic, "CIDX", 4) == 0
+                && trailer.index_offset + (size_t)trailer.chunks * sizeof(CAP_chunk_t) <= file->size) {
+            chunks = trailer.chunks;
+            entries = file->base + trailer.index_offset;
+        }
+    }
+    if (entries == NULL) {              // No trailer, scan the chunk headers
+        size_t offset = h->header_size;
+        uint32_t next = 0;              // Frame number after the last chunk
+        while (offset + h->chunk_size <= file->size) {
+            CAP_chunk_t c;
+            memcpy(&c, file->base + offset, sizeof(c));
+            if (c.frames == 0 || c.first_frame < next
+                    || c.bytes > h->chunk_size - sizeof(CAP_chunk_t)) {
+                break;                  // Unwritten chunk or start of the index
+            }
+            next = c.first_frame + c.frames;
+            chunks++;
+            offset += h->chunk_size;
+        }
+    }
+
+    file->index = malloc((chunks + 1) * sizeof(CAP_chunk_t));
+    file->first_ordinal = malloc((chunks + 1) * sizeof(uint32_t));
+    if (file->index == NULL || file->first_ordinal == NULL) {
+        return -1;
+    }
+    file->chunks = chunks;
+    file->frames = 0;
+    for (uint32_t i = 0; i < chunks; i++) {
+        const uint8_t *src = entries ? entries + i * sizeof(CAP_chunk_t)
+                                     : file->base + h->header_size + (size_t)i * h->chunk_size;
+        memcpy(&file->index[i], src, sizeof(CAP_chunk_t));
+        file->first_ordinal[i] = file->frames;
+        file->frames += file->index[i].frames;
+    }
+    file->first_ordinal[chunks] = file->frames;
+    return 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Map a capture file
+ * @param [out] file
+ * @param [in] path
+ * @return 0 or -1 with a message on stderr
+ *****************************************************************************/
+int CR_open(CR_file_t *file, const char *path)
+{
+    memset(file, 0, sizeof(*file));
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CAP_header_t)) {
+        fprintf(stderr, "%s: can not open\n", path);
+        if (fd >= 0) { close(fd); }
+        return -1;
+    }
+    file->size = st.st_size;
+    file->base = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->base == MAP_FAILED) {
+        fprintf(stderr, "%s: can not map\n", path);
+        file->base = NULL;
+        return -1;
+    }
+    memcpy(&file->header, file->base, sizeof(file->header));
+    const CAP_header_t *h = &file->header;
+    if (memcmp(h->magic, "CMCP", 4) != 0 || h->version != CAP_VERSION
+            || h->channels != 4 || h->chunk_size < sizeof(CAP_chunk_t)) {
+        fprintf(stderr, "%s: not a capture file of version %d\n", path, CAP_VERSION);
+        CR_close(file);
+        return -1;
+    }
+    if (read_index(file) < 0) {
+        CR_close(file);
+        return -1;
+    }
+    return 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Unmap a capture file
+ *****************************************************************************/
+void CR_close(CR_file_t *file)
+{
+    if (file->base != NULL) {
+        munmap((void *)file->base, file->size);
+    }
+    free(file->index);
+    free(file->first_ordinal);
+    memset(file, 0, sizeof(*file));
+}
+
+
+/** ***************************************************************************
+ * @brief Compressed frames of a chunk
+ * @return Pointer into the mapping, file->index[chunk].bytes are valid
+ *****************************************************************************/
+const uint8_t *CR_chunk(const CR_file_t *file, uint32_t chunk)
+{
+    return file->base + file->header.header_size
+            + (size_t)chunk * file->header.chunk_size + sizeof(CAP_chunk_t);
+}
+
+
+/** ***************************************************************************
+ * @brief Decode a frame
+ * @param [in] raw compressed frame
+ * @param [out] samples channels * frame_length interleaved samples
+ * @return Bytes of the compressed frame
+ *****************************************************************************/
+uint32_t CR_decode(const CR_file_t *file, const uint8_t *raw, uint32_t *samples)
+{
+    const uint32_t channels = file->header.channels;
+    const uint32_t length = file->header.frame_length;
+    const uint8_t *p = raw;
+    for (uint32_t ch = 0; ch < channels; ch++) {
+        int32_t value = p[0] | (p[1] << 8);
+        uint32_t bits = p[2];
+        uint32_t mask = (bits >= 32) ? 0xFFFFFFFF : (1u << bits) - 1;
+        p += 3;
+        samples[ch] = value;
+        uint64_t accu = 0;              // Not yet used bits
+        uint32_t count = 0;
+        for (uint32_t j = 1; j < length; j++) {
+            while (count < bits) {
+                accu |= (uint64_t)*p++ << count;
+                count += 8;
+            }
+            uint32_t zigzag = accu & mask;
+            accu >>= bits;
+            count -= bits;
+            value += (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+            samples[channels*j + ch] = value;
+        }
+    }
+    return p - raw;
+}
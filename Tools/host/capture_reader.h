@@ -0,0 +1,31 @@
+/** ***************************************************************************
+ * @file
+ * @brief See capture_reader.c
+ *
+ * Prefix CR
+ *
+ *****************************************************************************/
+
+#ifndef CAPTURE_READER_H_
+#define CAPTURE_READER_H_
+
+#include <stddef.h>
+#include "capture.h"
+
+/** Memory-mapped capture file */
+typedef struct {
+    const uint8_t *base;            ///< Mapping of the file
+    size_t size;                    ///< Bytes of the file
+    CAP_header_t header;            ///< Header of the file
+    CAP_chunk_t *index;             ///< Chunk headers
+    uint32_t chunks;                ///< Entries in index
+    uint32_t *first_ordinal;        ///< Number of stored frames before each chunk
+    uint32_t frames;                ///< Stored frames
+} CR_file_t;
+
+int CR_open(CR_file_t *file, const char *path);
+void CR_close(CR_file_t *file);
+const uint8_t *CR_chunk(const CR_file_t *file, uint32_t chunk);
+uint32_t CR_decode(const CR_file_t *file, const uint8_t *raw, uint32_t *samples);
+
+#endif
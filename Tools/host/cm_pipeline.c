@@ -0,0 +1,302 @@
+/** ***************************************************************************
+ * @file
+ * @brief Host pipeline library: the firmware algorithms of calculations.c
+ * over batches of frames
+ *
+ * Batches
+ * =======
+ * All functions take whole batches in contiguous arrays of the caller.
+ * The input is read in place and the results are written in place,
+ * there is no copy and no call per frame (see Tools/host/cm_pipeline.py).
+ * | Function         | Firmware                                  | Arrays                        |
+ * | :--------------- | :---------------------------------------- | :---------------------------- |
+ * | CMP_process()    | calculate_pos(): the whole pipeline       | samples[frames][256]          |
+ * | CMP_amplitudes() | split_Array(), calculate_amplitude()      | amplitudes[frames][4], phasors[frames][4][2] |
+ * | CMP_distances()  | distance_LUT()                            | amplitudes[n][2] (LPAD, RPAD) |
+ * | CMP_positions()  | calculate_triangulation(), calculate_current() | distances[n][2], hall_voltages[n][2] |
+ * The samples are interleaved scans as in the ADC buffer of the firmware
+ * (LPAD, RPAD, LHALL, RHALL), one uint32_t per sample.
+ *
+ * State
+ * =====
+ * CMP_process() keeps the averaging window and the last distances between
+ * calls like the firmware, consecutive batches are one stream.
+ * The other functions have no state. CMP_positions() starts each result with
+ * the error codes, the firmware would keep the current of an earlier frame.
+ * @n Different pipelines can be used in different threads at the same time.
+ *
+ * Build
+ * =====
+ * make -C Tools/host libcm_pipeline.so
+ * @n Only the CMP_ functions are exported, calculations.c is linked in.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cm_pipeline.h"
+#include "calculations.h"
+#include "measuring.h"
+#include "error_code.h"
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Pipeline behind the opaque handle */
+struct CMP_pipeline {
+    CALC_context_t ctx;                 ///< State of the firmware pipeline
+    int32_t averaged_frames;            ///< fft_avg_num
+};
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;   ///< FFT_Init() once per process
+
+_Static_assert(sizeof(CMP_result_t) == 32, "CMP_result_t is part of the ABI");
+_Static_assert(CMP_FRAME_LENGTH == ADC_NUMS, "frame length of the firmware");
+_Static_assert(CMP_CHANNELS == CALC_CHANNELS, "channels of the firmware");
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Version of the ABI the library was built with
+ *****************************************************************************/
+uint32_t CMP_abi_version(void)
+{
+    return CMP_ABI_VERSION;
+}
+
+
+/** ***************************************************************************
+ * @brief Parameters of the firmware
+ *****************************************************************************/
+void CMP_default_config(CMP_config_t *config)
+{
+    if (config == NULL) {
+        return;
+    }
+    config->averaged_frames = 1;
+    config->lpad_min = CALC_config_default.lpad_min;
+    config->lpad_max = CALC_config_default.lpad_max;
+    config->rpad_min = CALC_config_default.rpad_min;
+    config->rpad_max = CALC_config_default.rpad_max;
+    config->max_x = CALC_config_default.max_x;
+    config->max_y = CALC_config_default.max_y;
+    config->smoothing = CALC_config_default.smoothing;
+}
+
+
+/** ***************************************************************************
+ * @brief Check a configuration and set up a context with it
+ * @param [in] config NULL = CMP_default_config()
+ * @return CMP_OK or CMP_ERR_ARGUMENT
+ *****************************************************************************/
+static int setup(CALC_context_t *ctx, const CMP_config_t *config)
+{
+    CMP_config_t c;
+    if (config == NULL) {
+        CMP_default_config(&c);
+        config = &c;
+    }
+    const int32_t lut_end = CALC_LUT_BASE + CALC_LUT_ENTRIES;
+    if (config->averaged_frames < 1
+            || config->lpad_min < CALC_LUT_BASE || config->lpad_max > lut_end
+            || config->rpad_min < CALC_LUT_BASE || config->rpad_max > lut_end
+            || !(config->smoothing > 0 && config->smoothing <= 1)) {
+        return CMP_ERR_ARGUMENT;
+    }
+    pthread_once(&init_once, FFT_Init);
+    ctx->clock = NULL;
+    calculate_init(ctx);
+    ctx->config.lpad_min = config->lpad_min;
+    ctx->config.lpad_max = config->lpad_max;
+    ctx->config.rpad_min = config->rpad_min;
+    ctx->config.rpad_max = config->rpad_max;
+    ctx->config.max_x = config->max_x;
+    ctx->config.max_y = config->max_y;
+    ctx->config.smoothing = config->smoothing;
+    return CMP_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief Copy the outputs of a context into a result
+ *****************************************************************************/
+static void store_result(const CALC_context_t *ctx, CMP_result_t *r)
+{
+    r->x = ctx->X_Pos;
+    r->y = ctx->Y_Pos;
+    r->angle = (float)ctx->Gamma;
+    r->current = ctx->current;
+    r->lpad_distance = ctx->LPAD_FFT_distance;
+    r->rpad_distance = ctx->RPAD_FFT_distance;
+    r->clip_flags = ctx->clip_flags;
+    r->valid = 0;
+    if (ctx->X_Pos != CALC_OUTOF_X_RANGE && ctx->Y_Pos != CALC_OUTOF_Y_RANGE) {
+        r->valid |= CMP_VALID_POSITION;
+        /* The error codes of the current are >= 1000 A */
+        if (ctx->current >= 0 && ctx->current < CURR_OUTOF_Y_RANGE) {
+            r->valid |= CMP_VALID_CURRENT;
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Create a pipeline
+ * @param [in] config NULL = CMP_default_config()
+ * @return Pipeline or NULL if the configuration is invalid
+ *****************************************************************************/
+CMP_pipeline_t *CMP_create(const CMP_config_t *config)
+{
+    CMP_pipeline_t *p = malloc(sizeof(*p));
+    if (p == NULL || setup(&p->ctx, config) != CMP_OK) {
+        free(p);
+        return NULL;
+    }
+    p->averaged_frames = config ? config->averaged_frames : 1;
+    return p;
+}
+
+
+void CMP_destroy(CMP_pipeline_t *pipeline)
+{
+    free(pipeline);
+}
+
+
+/** ***************************************************************************
+ * @brief Start a new stream, the configuration is kept
+ *****************************************************************************/
+void CMP_reset(CMP_pipeline_t *pipeline)
+{
+    if (pipeline != NULL) {
+        CALC_config_t config = pipeline->ctx.config;
+        calculate_init(&pipeline->ctx);
+        pipeline->ctx.config = config;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Run the whole pipeline over a batch of frames
+ * @param [in] samples frames * CMP_FRAME_SAMPLES interleaved samples
+ * @param [out] results one per frame
+ * @return CMP_OK or CMP_ERR_ARGUMENT
+ *****************************************************************************/
+int CMP_process(CMP_pipeline_t *pipeline, const uint32_t *samples, size_t frames,
+                CMP_result_t *results)
+{
+    if (pipeline == NULL || (frames > 0 && (samples == NULL || results == NULL))) {
+        return CMP_ERR_ARGUMENT;
+    }
+    CALC_context_t *ctx = &pipeline->ctx;
+    for (size_t k = 0; k < frames; k++) {
+        calculate_frame(ctx, &samples[k * CMP_FRAME_SAMPLES], pipeline->averaged_frames);
+        store_result(ctx, &results[k]);
+    }
+    return CMP_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief 50 Hz amplitudes and phasors of a batch of frames
+ * @param [in] samples frames * CMP_FRAME_SAMPLES interleaved samples
+ * @param [out] amplitudes frames * CMP_CHANNELS RMS amplitudes in ADC steps
+ * @param [out] phasors frames * CMP_CHANNELS * (re, im) or NULL
+ * @return CMP_OK or CMP_ERR_ARGUMENT
+ *****************************************************************************/
+int CMP_amplitudes(const uint32_t *samples, size_t frames, int32_t *amplitudes, float *phasors)
+{
+    CALC_context_t ctx;
+    if (frames > 0 && (samples == NULL || amplitudes == NULL)) {
+        return CMP_ERR_ARGUMENT;
+    }
+    setup(&ctx, NULL);
+    for (size_t k = 0; k < frames; k++) {
+        ctx.samples = &samples[k * CMP_FRAME_SAMPLES];
+        split_Array(&ctx);
+        for (int i = 0; i < CALC_CHANNELS; i++) {
+            amplitudes[k*CALC_CHANNELS + i] = calculate_amplitude(ctx.phasor[i]);
+        }
+        if (phasors != NULL) {
+            memcpy(&phasors[k * 2*CALC_CHANNELS], ctx.phasor, sizeof(ctx.phasor));
+        }
+    }
+    return CMP_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief Distances to the pads from the LUTs
+ * @param [in] amplitudes count * (LPAD, RPAD) averaged amplitudes
+ * @param [out] distances count * (LPAD, RPAD) in mm, 0 or FFT_NO_SIGNAL
+ * @return CMP_OK or CMP_ERR_ARGUMENT
+ *****************************************************************************/
+int CMP_distances(const CMP_config_t *config, const int32_t *amplitudes, size_t count,
+                  int32_t *distances)
+{
+    CALC_context_t ctx;
+    if ((count > 0 && (amplitudes == NULL || distances == NULL)) || setup(&ctx, config) != CMP_OK) {
+        return CMP_ERR_ARGUMENT;
+    }
+    for (size_t k = 0; k < count; k++) {
+        ctx.LPAD_FFT_distance = amplitudes[2*k];
+        ctx.RPAD_FFT_distance = amplitudes[2*k + 1];
+        distance_LUT(&ctx);
+        distances[2*k] = ctx.LPAD_FFT_distance;
+        distances[2*k + 1] = ctx.RPAD_FFT_distance;
+    }
+    return CMP_OK;
+}
+
+
+/** ***************************************************************************
+ * @brief Position, angle and current from the distances
+ * @param [in] distances count * (LPAD, RPAD) in mm
+ * @param [in] hall_voltages count * (LHALL, RHALL) averaged amplitudes
+ * @param [in] clip_flags count clipped channels or NULL (none)
+ * @param [out] results one per entry
+ * @return CMP_OK or CMP_ERR_ARGUMENT
+ *****************************************************************************/
+int CMP_positions(const CMP_config_t *config, const int32_t *distances,
+                  const int32_t *hall_voltages, const uint32_t *clip_flags,
+                  size_t count, CMP_result_t *results)
+{
+    CALC_context_t ctx;
+    if ((count > 0 && (distances == NULL || hall_voltages == NULL || results == NULL))
+            || setup(&ctx, config) != CMP_OK) {
+        return CMP_ERR_ARGUMENT;
+    }
+    for (size_t k = 0; k < count; k++) {
+        ctx.X_Pos = CALC_OUTOF_X_RANGE;
+        ctx.Y_Pos = CALC_OUTOF_Y_RANGE;
+        ctx.Gamma = CALC_OUTOF_ANGLE_RANGE;
+        ctx.current = CURR_OUTOF_Y_RANGE;
+        ctx.LPAD_FFT_distance = distances[2*k];
+        ctx.RPAD_FFT_distance = distances[2*k + 1];
+        ctx.LHALL_FFT_voltage = hall_voltages[2*k];
+        ctx.RHALL_FFT_voltage = hall_voltages[2*k + 1];
+        ctx.clip_flags = (clip_flags != NULL) ? clip_flags[k] : 0;
+        /* Same condition as in calculate_from_phasors() */
+        if (ctx.LPAD_FFT_distance != FFT_NO_SIGNAL || ctx.RPAD_FFT_distance != FFT_NO_SIGNAL) {
+            calculate_triangulation(&ctx, ctx.LPAD_FFT_distance, ctx.RPAD_FFT_distance);
+        }
+        store_result(&ctx, &results[k]);
+    }
+    return CMP_OK;
+}
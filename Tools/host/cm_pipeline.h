@@ -0,0 +1,100 @@
+/** ***************************************************************************
+ * @file
+ * @brief Public C ABI of the host pipeline library (libcm_pipeline.so)
+ *
+ * Prefix CMP
+ *
+ * The types only use fixed width integers and float, the pipeline is opaque.
+ * A change of a type or function increments CMP_ABI_VERSION.
+ *****************************************************************************/
+
+#ifndef CM_PIPELINE_H_
+#define CM_PIPELINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define CMP_ABI_VERSION     1       ///< Version of the types and functions below
+#define CMP_CHANNELS        4       ///< Samples of a scan: LPAD, RPAD, LHALL, RHALL
+#define CMP_FRAME_LENGTH    64      ///< Scans of a frame
+#define CMP_FRAME_SAMPLES   (CMP_CHANNELS * CMP_FRAME_LENGTH)   ///< Samples of a frame
+
+#define CMP_VALID_POSITION  0x1     ///< x, y and angle are valid
+#define CMP_VALID_CURRENT   0x2     ///< current is valid
+
+#define CMP_OK              0       ///< Success
+#define CMP_ERR_ARGUMENT    (-1)    ///< NULL pointer or parameter out of range
+
+#if defined(_WIN32)
+#define CMP_API __declspec(dllexport)
+#else
+#define CMP_API __attribute__((visibility("default")))
+#endif
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Parameters, see CMP_default_config() */
+typedef struct {
+    int32_t averaged_frames;        ///< Frames averaged before the LUT (fft_avg_num)
+    int32_t lpad_min;               ///< LPAD amplitudes above are looked up in the LUT
+    int32_t lpad_max;               ///< LPAD amplitudes above are at distance 0
+    int32_t rpad_min;               ///< Same for RPAD
+    int32_t rpad_max;               ///< Same for RPAD
+    int32_t max_x;                  ///< Largest |x| in mm
+    int32_t max_y;                  ///< Largest y in mm
+    float smoothing;                ///< Smoothing of the window amplitudes, 1 = off
+} CMP_config_t;
+
+/** Result of one frame, 32 bytes */
+typedef struct {
+    int32_t x;                      ///< X position in mm or error code
+    int32_t y;                      ///< Y position in mm or error code
+    float angle;                    ///< Angle in degree or error code
+    float current;                  ///< Current in A or error code
+    int32_t lpad_distance;          ///< Distance to the left pad in mm or FFT_NO_SIGNAL
+    int32_t rpad_distance;          ///< Distance to the right pad in mm or FFT_NO_SIGNAL
+    uint32_t clip_flags;            ///< Clipped channels of the last averaging window
+    uint32_t valid;                 ///< CMP_VALID_POSITION | CMP_VALID_CURRENT
+} CMP_result_t;
+
+typedef struct CMP_pipeline CMP_pipeline_t;     ///< Opaque pipeline with its state
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+CMP_API uint32_t CMP_abi_version(void);
+CMP_API void CMP_default_config(CMP_config_t *config);
+
+CMP_API CMP_pipeline_t *CMP_create(const CMP_config_t *config);
+CMP_API void CMP_destroy(CMP_pipeline_t *pipeline);
+CMP_API void CMP_reset(CMP_pipeline_t *pipeline);
+CMP_API int CMP_process(CMP_pipeline_t *pipeline, const uint32_t *samples, size_t frames,
+                        CMP_result_t *results);
+
+CMP_API int CMP_amplitudes(const uint32_t *samples, size_t frames, int32_t *amplitudes,
+                           float *phasors);
+CMP_API int CMP_distances(const CMP_config_t *config, const int32_t *amplitudes, size_t count,
+                          int32_t *distances);
+CMP_API int CMP_positions(const CMP_config_t *config, const int32_t *distances,
+                          const int32_t *hall_voltages, const uint32_t *clip_flags,
+                          size_t count, CMP_result_t *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
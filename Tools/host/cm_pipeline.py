@@ -0,0 +1,285 @@
+"""ctypes wrapper of libcm_pipeline.so (see cm_pipeline.c).
+
+The arrays of the caller are passed in place: NumPy arrays (C contiguous,
+matching dtype) or any writable buffer, e.g. array.array("I"). Outputs
+are allocated as NumPy arrays if NumPy is installed, else as ctypes arrays.
+
+    import numpy as np
+    from cm_pipeline import Pipeline
+    samples = np.asarray(frames, dtype=np.uint32)   # (n, 64, 4) or (n, 256)
+    results = Pipeline(averaged_frames=3).process(samples)
+    x = results["x"][results["valid"] & 1 == 1]
+
+usage: cm_pipeline.py bench [frames] [threads]
+
+ctypes releases the GIL during the calls, so pipelines in several threads
+run on several cores (bench with threads > 1).
+"""
+
+import ctypes
+import math
+import os
+import sys
+import threading
+import time
+from array import array
+
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
+ABI_VERSION = 1
+CHANNELS = 4
+FRAME_LENGTH = 64
+FRAME_SAMPLES = CHANNELS * FRAME_LENGTH
+VALID_POSITION = 0x1
+VALID_CURRENT = 0x2
+
+
+class Config(ctypes.Structure):
+    _fields_ = [("averaged_frames", ctypes.c_int32),
+                ("lpad_min", ctypes.c_int32), ("lpad_max", ctypes.c_int32),
+                ("rpad_min", ctypes.c_int32), ("rpad_max", ctypes.c_int32),
+                ("max_x", ctypes.c_int32), ("max_y", ctypes.c_int32),
+                ("smoothing", ctypes.c_float)]
+
+
+class Result(ctypes.Structure):
+    _fields_ = [("x", ctypes.c_int32), ("y", ctypes.c_int32),
+                ("angle", ctypes.c_float), ("current", ctypes.c_float),
+                ("lpad_distance", ctypes.c_int32), ("rpad_distance", ctypes.c_int32),
+                ("clip_flags", ctypes.c_uint32), ("valid", ctypes.c_uint32)]
+
+
+if np is not None:
+    RESULT_DTYPE = np.dtype([(name, np.dtype(ctype)) for name, ctype in Result._fields_])
+
+
+def _load():
+    path = os.environ.get("CM_PIPELINE_LIB",
+                          os.path.join(os.path.dirname(os.path.abspath(__file__)), "libcm_pipeline.so"))
+    lib = ctypes.CDLL(path)
+    p = ctypes.c_void_p
+    size = ctypes.c_size_t
+    cfg = ctypes.POINTER(Config)
+    lib.CMP_abi_version.restype = ctypes.c_uint32
+    lib.CMP_default_config.argtypes = [cfg]
+    lib.CMP_create.argtypes = [cfg]
+    lib.CMP_create.restype = p
+    lib.CMP_destroy.argtypes = [p]
+    lib.CMP_reset.argtypes = [p]
+    lib.CMP_process.argtypes = [p, p, size, p]
+    lib.CMP_amplitudes.argtypes = [p, size, p, p]
+    lib.CMP_distances.argtypes = [cfg, p, size, p]
+    lib.CMP_positions.argtypes = [cfg, p, p, p, size, p]
+    if lib.CMP_abi_version() != ABI_VERSION:
+        raise ImportError("%s has ABI %d, the wrapper %d" % (path, lib.CMP_abi_version(), ABI_VERSION))
+    return lib
+
+
+_lib = _load()
+
+_NUMPY_TYPES = {ctypes.c_uint32: "uint32", ctypes.c_int32: "int32", ctypes.c_float: "float32"}
+
+
+def _pointer(obj, ctype, items, writable=False):
+    """Address of obj, which must hold at least items elements of ctype.
+
+    Returns (address, keep), keep must live until the call returned.
+    A read-only buffer without NumPy is copied."""
+    if obj is None:
+        return None, None
+    if np is not None and isinstance(obj, np.ndarray):
+        expected = RESULT_DTYPE if ctype is Result else np.dtype(_NUMPY_TYPES[ctype])
+        if obj.dtype != expected or not obj.flags.c_contiguous:
+            raise TypeError("need a C contiguous array of %s" % expected)
+        if obj.size < items:
+            raise ValueError("array too small")
+        if writable and not obj.flags.writeable:
+            raise ValueError("array is read-only")
+        return obj.ctypes.data, obj
+    if isinstance(obj, ctypes.Array):
+        if ctypes.sizeof(obj) < items * ctypes.sizeof(ctype):
+            raise ValueError("array too small")
+        return ctypes.addressof(obj), obj
+    view = memoryview(obj).cast("B")
+    if view.nbytes < items * ctypes.sizeof(ctype):
+        raise ValueError("buffer too small")
+    if view.readonly:
+        if writable:
+            raise ValueError("buffer is read-only")
+        keep = (ctype * items).from_buffer_copy(view)
+    else:
+        keep = (ctype * items).from_buffer(view)
+    return ctypes.addressof(keep), keep
+
+
+def _frames(samples):
+    if np is not None and isinstance(samples, np.ndarray):
+        count = samples.size
+    else:
+        count = memoryview(samples).nbytes // 4
+    if count % FRAME_SAMPLES:
+        raise ValueError("samples are not whole frames of %d" % FRAME_SAMPLES)
+    return count // FRAME_SAMPLES
+
+
+def _output(ctype, count, columns=1):
+    if np is not None:
+        if ctype is Result:
+            return np.empty(count, RESULT_DTYPE)
+        shape = (count, columns) if columns > 1 else count
+        return np.empty(shape, _NUMPY_TYPES[ctype])
+    return (ctype * (count * columns))()
+
+
+def _check(status):
+    if status != 0:
+        raise ValueError("invalid argument or configuration")
+
+
+def default_config(**params):
+    """Config of the firmware, changed by params (fields of Config)."""
+    config = Config()
+    _lib.CMP_default_config(ctypes.byref(config))
+    for name, value in params.items():
+        setattr(config, name, value)
+    return config
+
+
+class Pipeline:
+    """The whole pipeline with its state, consecutive batches are one stream."""
+
+    def __init__(self, **params):
+        self.config = default_config(**params)
+        self._handle = _lib.CMP_create(ctypes.byref(self.config))
+        if not self._handle:
+            raise ValueError("invalid configuration")
+
+    def __del__(self):
+        if getattr(self, "_handle", None):
+            _lib.CMP_destroy(self._handle)
+            self._handle = None
+
+    def reset(self):
+        _lib.CMP_reset(self._handle)
+
+    def process(self, samples, out=None):
+        """Results of each frame of samples (n * 256 uint32)."""
+        frames = _frames(samples)
+        if out is None:
+            out = _output(Result, frames)
+        src, keep_src = _pointer(samples, ctypes.c_uint32, frames * FRAME_SAMPLES)
+        dst, keep_dst = _pointer(out, Result, frames, writable=True)
+        _check(_lib.CMP_process(self._handle, src, frames, dst))
+        return out
+
+
+def amplitudes(samples, phasors=False):
+    """50 Hz RMS amplitudes (n, 4) and optionally phasors (n, 4, re/im)."""
+    frames = _frames(samples)
+    amp = _output(ctypes.c_int32, frames, CHANNELS)
+    pha = _output(ctypes.c_float, frames, 2 * CHANNELS) if phasors else None
+    src, keep_src = _pointer(samples, ctypes.c_uint32, frames * FRAME_SAMPLES)
+    dst, keep_dst = _pointer(amp, ctypes.c_int32, frames * CHANNELS, writable=True)
+    ph, keep_ph = _pointer(pha, ctypes.c_float, frames * 2 * CHANNELS, writable=True)
+    _check(_lib.CMP_amplitudes(src, frames, dst, ph))
+    if phasors:
+        if np is not None:
+            pha = pha.reshape(frames, CHANNELS, 2)
+        return amp, pha
+    return amp
+
+
+def distances(pad_amplitudes, config=None):
+    """Distances (n, 2) in mm of the (n, 2) LPAD, RPAD amplitudes."""
+    count = _items(pad_amplitudes) // 2
+    out = _output(ctypes.c_int32, count, 2)
+    src, keep_src = _pointer(pad_amplitudes, ctypes.c_int32, count * 2)
+    dst, keep_dst = _pointer(out, ctypes.c_int32, count * 2, writable=True)
+    _check(_lib.CMP_distances(ctypes.byref(config or default_config()), src, count, dst))
+    return out
+
+
+def positions(pad_distances, hall_voltages, clip_flags=None, config=None):
+    """Results of (n, 2) distances and (n, 2) Hall amplitudes."""
+    count = _items(pad_distances) // 2
+    out = _output(Result, count)
+    dist, keep_dist = _pointer(pad_distances, ctypes.c_int32, count * 2)
+    hall, keep_hall = _pointer(hall_voltages, ctypes.c_int32, count * 2)
+    clip, keep_clip = _pointer(clip_flags, ctypes.c_uint32, count)
+    dst, keep_dst = _pointer(out, Result, count, writable=True)
+    _check(_lib.CMP_positions(ctypes.byref(config or default_config()), dist, hall, clip,
+                              count, dst))
+    return out
+
+
+def _items(obj):
+    if np is not None and isinstance(obj, np.ndarray):
+        return obj.size
+    return memoryview(obj).nbytes // 4
+
+
+def _synthetic(frames):
+    """Frames of 50 Hz sines within the LUT range, all frames equal."""
+    amplitude = (900, 800, 300, 250)
+    frame = array("I", [int(2048 + amplitude[c] * math.sin(2 * math.pi * 5 * j / FRAME_LENGTH))
+                        for j in range(FRAME_LENGTH) for c in range(CHANNELS)])
+    return frame * frames
+
+
+def bench(frames, threads=1):
+    samples = _synthetic(frames)
+    if np is not None:
+        samples = np.frombuffer(samples, dtype=np.uint32).copy()
+    print("%d frames, %s" % (frames, "NumPy" if np is not None else "array/ctypes"))
+
+    def run(name, function, count):
+        function()                      # Warm up, allocate the output once
+        start = time.perf_counter()
+        function()
+        seconds = time.perf_counter() - start
+        print("%-10s %12.0f per s" % (name, count / seconds))
+
+    pipeline = Pipeline(averaged_frames=3)
+    out = _output(Result, frames)
+    run("process", lambda: pipeline.process(samples, out), frames)
+    amp = amplitudes(samples)
+    run("amplitudes", lambda: amplitudes(samples), frames)
+    pads = array("i", [v for k in range(frames) for v in (amp[4 * k], amp[4 * k + 1])]) \
+        if np is None else np.ascontiguousarray(amp[:, :2])
+    halls = array("i", [v for k in range(frames) for v in (amp[4 * k + 2], amp[4 * k + 3])]) \
+        if np is None else np.ascontiguousarray(amp[:, 2:])
+    dist = distances(pads)
+    run("distances", lambda: distances(pads), frames)
+    run("positions", lambda: positions(dist, halls), frames)
+
+    if threads > 1:
+        per_thread = frames // threads
+        pipelines = [Pipeline(averaged_frames=3) for _ in range(threads)]
+        parts = [memoryview(samples).cast("B")[t * per_thread * FRAME_SAMPLES * 4:
+                                               (t + 1) * per_thread * FRAME_SAMPLES * 4]
+                 for t in range(threads)]
+        outs = [_output(Result, per_thread) for _ in range(threads)]
+
+        def parallel():
+            workers = [threading.Thread(target=pipelines[t].process, args=(parts[t], outs[t]))
+                       for t in range(threads)]
+            for w in workers:
+                w.start()
+            for w in workers:
+                w.join()
+        run("process/%d" % threads, parallel, per_thread * threads)
+
+
+def main():
+    if len(sys.argv) >= 2 and sys.argv[1] == "bench":
+        bench(int(sys.argv[2]) if len(sys.argv) > 2 else 1000000,
+              int(sys.argv[3]) if len(sys.argv) > 3 else os.cpu_count() or 1)
+        return 0
+    sys.exit(__doc__)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
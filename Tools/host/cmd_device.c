@@ -0,0 +1,512 @@
+/** ***************************************************************************
+ * @file
+ * @brief Stand-in of the device for the command interface on a pseudo-terminal
+ *
+ * Usage
+ * =====
+ * @code
+ * cmd_device [-l link] [-t seconds]
+ * command.py <pty or link> ping
+ * @endcode
+ * Core/Src/command.c, settings.c, snapshot.c, session.c, detector.c and arena.c
+ * are compiled unchanged, this file replaces serial.c, capture.c, the buzzer,
+ * the LCD and the pipeline.
+ * The bytes of the pseudo-terminal go to CMD_update() as from the receive ring
+ * of USART1, the frames are written back as from the transmit queue.
+ * Clients (Tools/command.py) can be tested without a board.
+ * The path of the terminal is printed on stdout, -l also links it to a fixed path.
+ * -t ends the stand-in after the given time (default: never).
+ *
+ * Simulated device
+ * ================
+ * - The loop runs every LOOP_MS like the main loop of the firmware,
+ *   a frame is processed every FRAME_MS while the mode is not CFG_MODE_NOTHING.
+ * - The readings follow a cable moving slowly from side to side.
+ *   A load of LOAD_STEP is switched on and off every LOAD_PERIOD_S / 2,
+ *   detector.c sees it on the current and the Hall amplitudes.
+ * - A change of the mode, table or averaging restarts the capture session
+ *   and the session statistics like main().
+ *   The capture sessions are only counted, no file is sent.
+ * - A SER_FRAME_TEXT is sent every second, so clients must skip frames
+ *   of other types like on the real line.
+ * - The LCD is a frame buffer behind a simulated LTDC layer with a screen
+ *   like the graphic page: menu, text, grid and the cable as a dot,
+ *   which moves while a snapshot is taken (CMD_SNAPSHOT).
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "settings.h"
+#include "serial.h"
+#include "capture.h"
+#include "snapshot.h"
+#include "session.h"
+#include "detector.h"
+#include "arena.h"
+#include "error_code.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define LOOP_MS         10      ///< Pass of the main loop
+#define FRAME_MS        100     ///< One frame: ADC_NUMS / ADC_FS
+#define LOAD_PERIOD_S   40      ///< Period of the simulated load switching
+#define LOAD_STEP       6.0     ///< Current of the switched load [A]
+#define HALL_PER_AMPERE 12.0    ///< Simulated Hall amplitude [ADC steps / A]
+#define LCD_WIDTH       240     ///< Pixels of a line
+#define LCD_HEIGHT      320     ///< Lines
+#define WHITE           0xFFFFFFFF  ///< LCD_COLOR_WHITE
+#define BLACK           0xFF000000  ///< LCD_COLOR_BLACK
+#define GRAY            0xFFD3D3D3  ///< LCD_COLOR_LIGHTGRAY
+#define RED             0xFFFF0000  ///< LCD_COLOR_RED
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static int master = -1;                 ///< Device side of the pseudo-terminal
+static struct timespec boot;            ///< Start of the stand-in
+static uint32_t tx_dropped = 0;         ///< Bytes not written, terminal full
+static bool capture_active = false;     ///< Simulated capture session
+static uint32_t capture_sessions = 0;   ///< Sessions started
+static volatile sig_atomic_t stop = 0;  ///< Set by SIGINT and SIGTERM
+static uint32_t screen[LCD_WIDTH * LCD_HEIGHT]; ///< Frame buffer, ARGB8888
+static uint32_t background[LCD_WIDTH * LCD_HEIGHT]; ///< Screen without the dot
+LTDC_Layer_TypeDef shim_ltdc_layer2;    ///< Foreground layer showing screen[]
+
+
+/******************************************************************************
+ * Functions replacing the firmware
+ *****************************************************************************/
+
+uint32_t HAL_GetTick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - boot.tv_sec) * 1000 + (now.tv_nsec - boot.tv_nsec) / 1000000;
+}
+
+uint32_t SER_read(void *data, uint32_t length)
+{
+    ssize_t n = read(master, data, length);
+    return (n > 0) ? n : 0;
+}
+
+uint32_t SER_get_rx_lost(void)
+{
+    return 0;                           // The terminal buffers, nothing is lost
+}
+
+uint32_t SER_get_free(void)
+{
+    return SER_TX_SIZE;
+}
+
+uint32_t SER_get_dropped(void)
+{
+    return tx_dropped;
+}
+
+bool SER_send_frame(SER_frame_type_t type, const void *payload, uint16_t length)
+{
+    uint8_t frame[SER_TX_SIZE];
+    if ((uint32_t)length + SER_FRAME_OVERHEAD > sizeof(frame)) {
+        tx_dropped += length + SER_FRAME_OVERHEAD;
+        return false;
+    }
+    uint8_t sum = type + (length & 0xFF) + (length >> 8);
+    frame[0] = SER_FRAME_START;
+    frame[1] = type;
+    frame[2] = length & 0xFF;
+    frame[3] = length >> 8;
+    memcpy(&frame[4], payload, length);
+    for (uint32_t i = 0; i < length; i++) {
+        sum += frame[4 + i];
+    }
+    frame[4 + length] = -sum;
+    ssize_t n = write(master, frame, length + SER_FRAME_OVERHEAD);
+    if (n != length + SER_FRAME_OVERHEAD) {
+        tx_dropped += length + SER_FRAME_OVERHEAD - (n > 0 ? n : 0);
+        return false;
+    }
+    return true;
+}
+
+void CAP_start(void)
+{
+    if (!capture_active) {
+        capture_active = true;
+        capture_sessions++;
+        fprintf(stderr, "capture session %u started\n", capture_sessions);
+    }
+}
+
+void CAP_stop(void)
+{
+    if (capture_active) {
+        capture_active = false;
+        fprintf(stderr, "capture session %u stopped\n", capture_sessions);
+    }
+}
+
+bool CAP_active(void)
+{
+    return capture_active;
+}
+
+uint32_t CAP_get_dropped(void)
+{
+    return 0;
+}
+
+void BUZZER_play_alert(bool rising)
+{
+    fprintf(stderr, "alert: load %s\n", rising ? "on" : "off");
+}
+
+static int null_frames = 0;         ///< Frames of the background capture
+static bool background_set = false; ///< Background captured
+
+void null_background_start(void)
+{
+    null_frames = CALC_NULL_FRAMES;
+}
+
+void null_background_clear(void)
+{
+    null_frames = 0;
+    background_set = false;
+}
+
+int get_null_frames(void)
+{
+    if (null_frames > 0 && --null_frames == 0) {    // One frame per query
+        background_set = true;
+    }
+    return null_frames;
+}
+
+bool get_background(CALC_phasor_t *phasor)
+{
+    memset(phasor, 0, CALC_CHANNELS*sizeof(CALC_phasor_t));
+    return background_set;
+}
+
+static int xtalk_frames = 0;        ///< Frames of the column capture
+static uint8_t xtalk_columns = 0;   ///< Captured columns
+static bool decoupled = false;      ///< Decoupling applied
+
+bool crosstalk_start(int channel)
+{
+    if (channel < 0 || channel >= CALC_CHANNELS) {
+        return false;
+    }
+    xtalk_frames = CALC_XTALK_FRAMES;
+    xtalk_columns |= 1 << channel;
+    return true;
+}
+
+bool crosstalk_apply(void)
+{
+    decoupled = true;
+    return true;
+}
+
+void crosstalk_clear(void)
+{
+    xtalk_frames = 0;
+    xtalk_columns = 0;
+    decoupled = false;
+}
+
+int get_crosstalk_frames(uint8_t *columns)
+{
+    if (xtalk_frames > 0) {
+        xtalk_frames--;                 // One frame per query
+    }
+    *columns = xtalk_frames ? 0 : xtalk_columns;
+    return xtalk_frames;
+}
+
+bool get_decoupling(CALC_phasor_t *decoupling)
+{
+    memset(decoupling, 0, CALC_CHANNELS*CALC_CHANNELS*sizeof(CALC_phasor_t));
+    return decoupled;
+}
+
+uint8_t get_clip_flags(void)
+{
+    return 0;
+}
+
+CALC_stats_t get_channel_stats(int channel)
+{
+    CALC_stats_t stats = {
+            .min = 2048 - 400 + 50*channel,
+            .max = 2048 + 400 - 50*channel,
+            .mean = 2048,
+            .clip_count = 0,
+    };
+    return stats;
+}
+
+
+/******************************************************************************
+ * Functions of the stand-in
+ *****************************************************************************/
+
+static void on_signal(int signal)
+{
+    (void)signal;
+    stop = 1;
+}
+
+
+/** ***************************************************************************
+ * @brief Open the pseudo-terminal, the slave side is kept open and raw
+ * @return slave file descriptor or -1
+ *****************************************************************************/
+static int open_terminal(const char *link)
+{
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0) {
+        perror("posix_openpt");
+        return -1;
+    }
+    const char *name = ptsname(master);
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios tio;
+    if (slave < 0 || tcgetattr(slave, &tio) < 0) {
+        perror(name);
+        return -1;
+    }
+    cfmakeraw(&tio);                    // No echo, the frames are binary
+    tcsetattr(slave, TCSANOW, &tio);
+    fcntl(master, F_SETFL, O_NONBLOCK);
+    if (link != NULL) {
+        unlink(link);
+        if (symlink(name, link) < 0) {
+            perror(link);
+            return -1;
+        }
+    }
+    printf("%s\n", name);
+    fflush(stdout);
+    return slave;
+}
+
+
+/** ***************************************************************************
+ * @brief Fill a rectangle of the screen
+ *****************************************************************************/
+static void fill(int x0, int y0, int w, int h, uint32_t color)
+{
+    for (int y = y0; y < y0 + h; y++) {
+        for (int x = x0; x < x0 + w; x++) {
+            if (x >= 0 && x < LCD_WIDTH && y >= 0 && y < LCD_HEIGHT) {
+                screen[y * LCD_WIDTH + x] = color;
+            }
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Text-like pattern of characters 8 x 12 pixels
+ *****************************************************************************/
+static void text(int x0, int y0, const char *s, uint32_t color)
+{
+    for (; *s != '\0'; s++, x0 += 8) {
+        for (int y = 2; y < 11; y++) {
+            for (int x = 1; x < 7; x++) {
+                if (*s != ' ' && ((*s * 7 + x * 13 + y * 5) % 11) < 4) {
+                    fill(x0 + x, y0 + y, 1, 1, color);
+                }
+            }
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Screen of the graphic page and the simulated layer registers
+ *****************************************************************************/
+static void screen_init(void)
+{
+    static const uint32_t buttons[] = {0xFF0000FF, 0xFF00FF00, 0xFFFF0000, 0xFFFFA500};
+    fill(0, 0, LCD_WIDTH, LCD_HEIGHT, WHITE);
+    text(8, 4, "AVERAGE: ONE PHASE", BLACK);
+    for (int y = 40; y <= 240; y += 20) {
+        fill(20, y, 200, 1, GRAY);
+    }
+    for (int x = 20; x <= 220; x += 20) {
+        fill(x, 40, 1, 200, GRAY);
+    }
+    for (int i = 0; i < 4; i++) {
+        fill(i * 60, 260, 60, 60, buttons[i]);
+        text(i * 60 + 6, 284, "MENU", WHITE);
+    }
+    memcpy(background, screen, sizeof(screen));
+    shim_ltdc_layer2.CFBAR = (uintptr_t)screen;
+    shim_ltdc_layer2.CFBLR = ((LCD_WIDTH * 4) << LTDC_LxCFBLR_CFBP_Pos) | (LCD_WIDTH * 4 + 3);
+    shim_ltdc_layer2.CFBLNR = LCD_HEIGHT;
+    shim_ltdc_layer2.PFCR = 0;          // ARGB8888
+}
+
+
+/** ***************************************************************************
+ * @brief Draw the cable at a position, the last dot is restored from background[]
+ *****************************************************************************/
+static void screen_dot(int x, int y)
+{
+    static int last_x = -1, last_y = -1;
+    if (last_x >= 0) {
+        for (int row = last_y - 3; row <= last_y + 3; row++) {
+            memcpy(&screen[row * LCD_WIDTH + last_x - 3], &background[row * LCD_WIDTH + last_x - 3],
+                   7 * sizeof(uint32_t));
+        }
+    }
+    last_x = 120 + x * 2;
+    last_y = 240 - y;
+    fill(last_x - 3, last_y - 3, 7, 7, RED);
+}
+
+
+/** ***************************************************************************
+ * @brief Reading of a simulated frame, the cable moves from side to side
+ *****************************************************************************/
+static void add_reading(uint32_t ms)
+{
+    double t = ms / 1000.0;
+    int x = (int)lround(60 * sin(2 * M_PI * t / 20));
+    int y = 80 + (int)lround(20 * sin(2 * M_PI * t / 7));
+    int angle = (int)lround(5 * sin(2 * M_PI * t / 11));
+    double load = 12.0 + 0.05 * sin(2 * M_PI * t / 3);
+    if (fmod(t, LOAD_PERIOD_S) >= LOAD_PERIOD_S / 2) {
+        load += LOAD_STEP;
+    }
+    float current = (float)load;
+    float hall = (float)(load * HALL_PER_AMPERE);
+    if (abs(x) > 50) {
+        CMD_add_reading(CALC_OUTOF_X_RANGE, CALC_OUTOF_Y_RANGE, CALC_OUTOF_ANGLE_RANGE,
+                        CURR_OUTOF_Y_RANGE, 0);
+        SES_add_reading(CALC_OUTOF_X_RANGE, CALC_OUTOF_Y_RANGE, CALC_OUTOF_ANGLE_RANGE,
+                        CURR_OUTOF_Y_RANGE);
+        DET_add_frame(ms, CURR_OUTOF_Y_RANGE, hall, hall * 0.9f, 0);
+    } else {
+        CMD_add_reading(x, y, angle, current, 0);
+        SES_add_reading(x, y, angle, current);
+        DET_add_frame(ms, current, hall, hall * 0.9f, 0);
+        screen_dot(x, y);
+    }
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: cmd_device [-l link] [-t seconds]\n");
+    exit(2);
+}
+
+
+int main(int argc, char *argv[])
+{
+    const char *link = NULL;
+    double seconds = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || argv[i][2] != '\0' || i + 1 == argc) {
+            usage();
+        }
+        switch (argv[i][1]) {
+        case 'l': link = argv[++i]; break;
+        case 't': seconds = atof(argv[++i]); break;
+        default: usage();
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &boot);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    screen_init();
+    ARENA_init(malloc(ARENA_SDRAM_SIZE), ARENA_SDRAM_SIZE);    // SDRAM of the history
+    CMD_init();
+    int slave = open_terminal(link);
+    if (slave < 0) {
+        return 1;
+    }
+
+    int32_t applied[CFG_SETTINGS];
+    for (int id = 0; id < CFG_SETTINGS; id++) {
+        applied[id] = CFG_get(id);
+    }
+    DET_set_sensitivity(applied[CFG_DETECT]);
+    uint32_t next_frame = 0, next_text = 1000;
+    while (!stop && (seconds <= 0 || HAL_GetTick() < seconds * 1000)) {
+        struct pollfd pfd = {.fd = master, .events = POLLIN};
+        poll(&pfd, 1, LOOP_MS);         // Rest of the pass, HAL_Delay() in the firmware
+
+        CMD_update();
+        SNAP_update();
+        DET_update();
+
+        /* Same reaction to a change as main() */
+        bool changed = false, restart = false;
+        for (int id = 0; id < CFG_SETTINGS; id++) {
+            if (applied[id] != CFG_get(id)) {
+                changed = true;
+                restart |= (id == CFG_MODE || id == CFG_TABLE || id == CFG_AVERAGING);
+                applied[id] = CFG_get(id);
+            }
+        }
+        if (changed) {
+            fprintf(stderr, "settings: mode %d, page %d, table %d, averaging %d, buzzer %d, detect %d\n",
+                    (int)applied[CFG_MODE], (int)applied[CFG_PAGE], (int)applied[CFG_TABLE],
+                    (int)applied[CFG_AVERAGING], (int)applied[CFG_BUZZER], (int)applied[CFG_DETECT]);
+            DET_set_sensitivity(applied[CFG_DETECT]);
+        }
+        if (restart) {
+            CAP_stop();
+            if (applied[CFG_MODE] != CFG_MODE_NOTHING) {
+                CAP_start();
+            }
+            SES_reset();
+            DET_reset();
+        }
+
+        uint32_t ms = HAL_GetTick();
+        if (applied[CFG_MODE] != CFG_MODE_NOTHING && ms >= next_frame) {
+            add_reading(ms);
+            next_frame = ms + FRAME_MS;
+        }
+        if (ms >= next_text) {
+            char text[48];
+            int n = snprintf(text, sizeof(text), "cmd_device: %u s\r\n", ms / 1000);
+            SER_send_frame(SER_FRAME_TEXT, text, n);
+            next_text += 1000;
+        }
+    }
+    if (link != NULL) {
+        unlink(link);
+    }
+    close(slave);
+    close(master);
+    return 0;
+}
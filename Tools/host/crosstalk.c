@@ -0,0 +1,220 @@
+/** ***************************************************************************
+ * @file
+ * @brief Check of the crosstalk capture and decoupling with known couplings
+ *
+ * Usage
+ * =====
+ * @code
+ * crosstalk [-v]       built-in cases, exit status 1 if one fails
+ * @endcode
+ * calculations.c is compiled unchanged. The phasors of each frame are
+ * set in the context and passed to calculate_FFT() like after split_Array().
+ *
+ * Cases
+ * =====
+ * A case has a coupling C (unit diagonal). Each column is captured
+ * with crosstalk_start() semantics: the stimulus is on one channel only,
+ * at a random mains phase in each frame, with noise on all channels.
+ * The case passes if
+ * - the captured C is within the tolerance of the case,
+ * - calculate_decoupling() succeeds (fails for a singular C) and
+ * - the amplitudes of calculate_FFT() for random true phasors x,
+ *   measured as C * x, are those of x within the tolerance.
+ * "identity" has no coupling, the decoupling must not change the amplitudes
+ * (rounding of the last ADC step aside).
+ * One CSV line per case is printed.
+ *
+ * -v prints the captured and the true C.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "calculations.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define N               CALC_CHANNELS   ///< Size of the matrix
+#define VECTORS         200             ///< Random true phasors per case
+#define AMPLITUDE       40000.0f        ///< Scale of the phasors (about 880 ADC steps RMS)
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Known coupling with the expected results */
+typedef struct {
+    const char *name;                   ///< Name in the output
+    float c[N][N][2];                   ///< Off-diagonal coupling (re, im), diagonal is 1
+    float noise;                        ///< Noise of the capture [part of AMPLITUDE]
+    float tolerance;                    ///< Max error of an element of C
+    int max_error;                      ///< Max error of an amplitude [ADC steps]
+    int singular;                       ///< calculate_decoupling() must fail
+} case_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const case_t cases[] = {
+        {"identity", {{{0}}}, 0, 1e-5f, 1, 0},
+        /* Hall sensors leak into the pads, small pad to pad coupling */
+        {"hall leak", {{{0, 0}, {0.02f, 0.01f}, {0.05f, -0.02f}, {0.01f, 0}},
+                       {{0.02f, -0.01f}, {0, 0}, {0.01f, 0}, {0.05f, 0.03f}},
+                       {{0.002f, 0}, {0, 0}, {0, 0}, {0.01f, 0}},
+                       {{0, 0}, {0.002f, 0}, {0.01f, 0}, {0, 0}}}, 0.001f, 0.002f, 2, 0},
+        /* Strong coupling through a shared ground, all channels */
+        {"ground", {{{0, 0}, {0.2f, 0.1f}, {0.3f, -0.2f}, {0.15f, 0.05f}},
+                    {{0.2f, -0.1f}, {0, 0}, {0.1f, 0.1f}, {0.3f, 0.2f}},
+                    {{-0.1f, 0.05f}, {0.1f, 0}, {0, 0}, {0.25f, -0.1f}},
+                    {{0.05f, 0}, {-0.2f, 0.1f}, {0.2f, 0.2f}, {0, 0}}}, 0.001f, 0.003f, 3, 0},
+        /* Channels 0 and 1 see the same: no inverse */
+        {"singular", {{{0, 0}, {1, 0}, {0, 0}, {0, 0}},
+                      {{1, 0}, {0, 0}, {0, 0}, {0, 0}},
+                      {{0, 0}, {0, 0}, {0, 0}, {0, 0}},
+                      {{0, 0}, {0, 0}, {0, 0}, {0, 0}}}, 0, 0.001f, 0, 1},
+};
+
+static int verbose = 0;                 ///< Print the matrices
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** Uniform random number in [-1, 1) */
+static float uniform(void)
+{
+    return 2.0f * rand() / ((float)RAND_MAX + 1) - 1;
+}
+
+
+/** Element of the coupling of a case */
+static CALC_phasor_t element(const case_t *cs, int r, int c)
+{
+    CALC_phasor_t v = {cs->c[r][c][0], cs->c[r][c][1]};
+    if (r == c) {
+        v.re = 1;
+        v.im = 0;
+    }
+    return v;
+}
+
+
+/** ***************************************************************************
+ * @brief Run one frame through calculate_FFT()
+ * @param [in] ctx context, the window is never closed
+ * @param [in] x true phasors
+ * @param [in] cs coupling, measured = C * x
+ * @param [in] noise added to each measured phasor [part of AMPLITUDE]
+ * @param [out] amplitude of each channel after the decoupling, may be NULL
+ *****************************************************************************/
+static void run_frame(CALC_context_t *ctx, const CALC_phasor_t x[N], const case_t *cs,
+                      float noise, uint32_t amplitude[N])
+{
+    for (int r = 0; r < N; r++) {
+        CALC_phasor_t y = {noise * AMPLITUDE * uniform(), noise * AMPLITUDE * uniform()};
+        for (int c = 0; c < N; c++) {
+            CALC_phasor_t e = element(cs, r, c);
+            y.re += e.re * x[c].re - e.im * x[c].im;
+            y.im += e.re * x[c].im + e.im * x[c].re;
+        }
+        ctx->phasor[r] = y;
+    }
+    ctx->num_of_samples = 1 << 30;
+    ctx->avg_counter = 0;
+    memset(ctx->amplitude_sum, 0, sizeof(ctx->amplitude_sum));
+    calculate_FFT(ctx);
+    if (amplitude != NULL) {
+        memcpy(amplitude, ctx->amplitude_sum, sizeof(ctx->amplitude_sum));
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Run a case
+ * @return true if passed
+ *****************************************************************************/
+static bool run_case(const case_t *cs)
+{
+    static CALC_context_t ctx;
+    calculate_init(&ctx);
+
+    /* Capture the columns, the stimulus has a random phase in each frame */
+    for (int c = 0; c < N; c++) {
+        ctx.xtalk_channel = c;
+        ctx.xtalk_frames = CALC_XTALK_FRAMES;
+        while (ctx.xtalk_frames > 0) {
+            CALC_phasor_t x[N] = {{0}};
+            float phase = (float)M_PI * uniform();
+            x[c].re = AMPLITUDE * cosf(phase);
+            x[c].im = AMPLITUDE * sinf(phase);
+            run_frame(&ctx, x, cs, cs->noise, NULL);
+        }
+    }
+    float error = 0;
+    for (int r = 0; r < N; r++) {
+        for (int c = 0; c < N; c++) {
+            CALC_phasor_t e = element(cs, r, c);
+            CALC_phasor_t m = ctx.coupling[r * N + c];
+            float d = hypotf(m.re - e.re, m.im - e.im);
+            error = (d > error) ? d : error;
+            if (verbose) {
+                printf("  C[%d][%d] %+.4f%+.4fj  true %+.4f%+.4fj\n", r, c, m.re, m.im, e.re, e.im);
+            }
+        }
+    }
+    bool ok = (ctx.xtalk_columns == (1 << N) - 1) && (error <= cs->tolerance);
+    bool inverted = calculate_decoupling(&ctx);
+    ok &= (inverted != cs->singular);
+
+    /* Decouple random true phasors */
+    int max_error = 0;
+    for (int k = 0; k < VECTORS && inverted; k++) {
+        CALC_phasor_t x[N];
+        uint32_t amplitude[N];
+        for (int c = 0; c < N; c++) {
+            x[c].re = AMPLITUDE * uniform();
+            x[c].im = AMPLITUDE * uniform();
+        }
+        run_frame(&ctx, x, cs, 0, amplitude);
+        for (int c = 0; c < N; c++) {
+            int d = abs((int)amplitude[c] - (int)calculate_amplitude(x[c]));
+            max_error = (d > max_error) ? d : max_error;
+        }
+    }
+    ok &= (max_error <= cs->max_error);
+    printf("%s,%.5f,%.5f,%d,%d,%d,%s\n", cs->name, error, cs->tolerance, inverted,
+           max_error, cs->max_error, ok ? "pass" : "FAIL");
+    return ok;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-v") != 0)) {
+        fprintf(stderr, "usage: crosstalk [-v]\n");
+        return 2;
+    }
+    verbose = (argc == 2);
+    FFT_Init();
+    srand(1);
+    int failed = 0;
+    printf("case,error,tolerance,inverted,amplitude_error,max_amplitude_error,result\n");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        failed += !run_case(&cases[i]);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,276 @@
+/** ***************************************************************************
+ * @file
+ * @brief Replay of capture files through the load change detection
+ *
+ * Usage
+ * =====
+ * @code
+ * detect [-s sensitivity] [-a averaged_frames] [-w window_frames] [-v] file.cmcap [labels.csv]
+ * synth_capture.py steps.cmcap steps.csv && detect steps.cmcap steps.csv
+ * @endcode
+ * The frames are run through calculate_frame() and DET_add_frame()
+ * like on the device (Core/Src/calculations.c and detector.c, compiled unchanged).
+ * The time of a frame is its number times the frame duration of the file.
+ * -s is the setting CFG_DETECT (default 2), -a the averaging (default 1),
+ * -v prints the log lines of DET_update().
+ *
+ * Evaluation
+ * ==========
+ * The labels are lines "frame,direction[,...]" (see Tools/synth_capture.py),
+ * a header line is skipped. For each signal, an event detects a label if it has
+ * the same direction and comes at most -w frames (default 20) after it.
+ * Other events are false alarms. The alerts (events grouped like
+ * the buzzer alerts of DET_update()) are evaluated the same way.
+ * One CSV line per signal is printed: labels, detected, missed,
+ * false alarms, mean and max delay [frames].
+ * Without labels, the events are listed.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "capture_reader.h"
+#include "calculations.h"
+#include "detector.h"
+#include "measuring.h"
+#include "serial.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define MAX_LABELS      4096            ///< Labels of a file
+#define MAX_EVENTS      65536           ///< Events of a file
+#define ALERTS          DET_SIGNALS     ///< Row of the alerts in the results
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Labelled step */
+typedef struct {
+    uint32_t frame;                     ///< Frame number of the step
+    int direction;                      ///< +1 = rise, -1 = fall
+} label_t;
+
+/** Results of one signal */
+typedef struct {
+    uint32_t detected;                  ///< Labels with an event
+    uint32_t false_alarms;              ///< Events without a label
+    uint64_t delay_sum;                 ///< Sum of the delays [frames]
+    uint32_t delay_max;                 ///< Max delay [frames]
+} result_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static int verbose = 0;                 ///< Print the log lines
+static label_t labels[MAX_LABELS];      ///< Labels of the file
+static uint32_t label_count = 0;        ///< Entries in labels
+static DET_event_t events[MAX_EVENTS];  ///< All events of the file
+static uint32_t event_count = 0;        ///< Entries in events
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** Log of DET_update() */
+bool SER_send_frame(SER_frame_type_t type, const void *payload, uint16_t length)
+{
+    if (verbose && type == SER_FRAME_TEXT) {
+        fwrite(payload, 1, length, stdout);
+    }
+    return true;
+}
+
+
+/** Alert of DET_update() */
+void BUZZER_play_alert(bool rising)
+{
+    (void)rising;
+}
+
+
+/** ***************************************************************************
+ * @brief Read the labels
+ * @return -1 on error
+ *****************************************************************************/
+static int read_labels(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL && label_count < MAX_LABELS) {
+        unsigned frame;
+        int direction;
+        if (sscanf(line, "%u,%d", &frame, &direction) == 2 && direction != 0) {
+            labels[label_count].frame = frame;
+            labels[label_count].direction = (direction > 0) ? 1 : -1;
+            label_count++;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Run the pipeline and the detector over all frames of a file
+ * @return frame duration [ms]
+ *****************************************************************************/
+static uint32_t run(const CR_file_t *file, int avg_frames)
+{
+    uint32_t frame_ms = 1000 * file->header.frame_length / file->header.sample_rate;
+    uint32_t *samples = malloc(CALC_CHANNELS * ADC_NUMS * sizeof(uint32_t));
+    CALC_context_t ctx;
+    calculate_init(&ctx);
+
+    for (uint32_t c = 0; c < file->chunks; c++) {
+        const uint8_t *raw = CR_chunk(file, c);
+        for (uint32_t k = 0; k < file->index[c].frames; k++) {
+            raw += CR_decode(file, raw, samples);
+            calculate_frame(&ctx, samples, avg_frames);
+            uint32_t time_ms = (file->index[c].first_frame + k) * frame_ms;
+            DET_add_frame(time_ms, ctx.current,
+                    calculate_amplitude(ctx.phasor[CALC_LHALL]),
+                    calculate_amplitude(ctx.phasor[CALC_RHALL]), ctx.clip_flags);
+            DET_update();
+            while (event_count < DET_get_count() && event_count < MAX_EVENTS) {
+                DET_get_event(event_count, &events[event_count]);
+                event_count++;
+            }
+        }
+    }
+    free(samples);
+    return frame_ms;
+}
+
+
+/** ***************************************************************************
+ * @brief Match the events of one signal (or the alerts) with the labels
+ * @param [in] signal DET_signal_t or ALERTS
+ *****************************************************************************/
+static result_t evaluate(int signal, uint32_t frame_ms, uint32_t window)
+{
+    result_t r = {0};
+    static uint8_t used[MAX_EVENTS];
+    memset(used, 0, sizeof(used));
+    uint32_t last_alert = 0;
+    int alerted = 0;
+
+    /* The alerts are the events outside of the holdoff of the previous alert */
+    for (uint32_t e = 0; e < event_count; e++) {
+        int mine = (events[e].signal == signal);
+        if (signal == ALERTS) {
+            mine = !alerted || events[e].time_ms - last_alert >= DET_ALERT_HOLDOFF_MS;
+            if (mine) {
+                last_alert = events[e].time_ms;
+                alerted = 1;
+            }
+        }
+        used[e] = mine ? 1 : 2;         // 1 = candidate, 2 = other signal
+    }
+    for (uint32_t l = 0; l < label_count; l++) {
+        for (uint32_t e = 0; e < event_count; e++) {
+            uint32_t frame = events[e].time_ms / frame_ms;
+            if (used[e] != 1 || events[e].direction != labels[l].direction
+                    || frame < labels[l].frame || frame > labels[l].frame + window) {
+                continue;
+            }
+            uint32_t delay = frame - labels[l].frame;
+            used[e] = 0;
+            r.detected++;
+            r.delay_sum += delay;
+            if (delay > r.delay_max) {
+                r.delay_max = delay;
+            }
+            break;
+        }
+    }
+    for (uint32_t e = 0; e < event_count; e++) {
+        r.false_alarms += (used[e] == 1);
+    }
+    return r;
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: detect [-s sensitivity] [-a averaged_frames] [-w window_frames] [-v] "
+            "file.cmcap [labels.csv]\n");
+    exit(2);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int sensitivity = 2, avg_frames = 1;
+    uint32_t window = 20;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            sensitivity = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            avg_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else {
+            usage();
+        }
+    }
+    if (argc - i < 1 || argc - i > 2 || avg_frames < 1
+            || sensitivity < 1 || sensitivity > DET_SENSITIVITIES) {
+        usage();
+    }
+    CR_file_t file;
+    if (CR_open(&file, argv[i]) < 0) {
+        return 1;
+    }
+    if (file.header.frame_length != ADC_NUMS) {
+        fprintf(stderr, "%s: %d samples per frame, the pipeline is built for %d\n",
+                argv[i], file.header.frame_length, ADC_NUMS);
+        return 1;
+    }
+    if (argc - i == 2 && read_labels(argv[i + 1]) < 0) {
+        return 1;
+    }
+
+    FFT_Init();
+    DET_set_sensitivity(sensitivity);
+    uint32_t frame_ms = run(&file, avg_frames);
+
+    if (argc - i == 1) {
+        for (uint32_t e = 0; e < event_count; e++) {
+            char text[80];
+            DET_format_event(&events[e], text, sizeof(text));
+            fputs(text, stdout);
+        }
+        return 0;
+    }
+    static const char *const names[] = {"current", "LHALL", "RHALL", "alerts"};
+    printf("signal,labels,detected,missed,false_alarms,mean_delay,max_delay\n");
+    for (int s = 0; s <= ALERTS; s++) {
+        result_t r = evaluate(s, frame_ms, window);
+        printf("%s,%u,%u,%u,%u,%.1f,%u\n", names[s], label_count, r.detected,
+               label_count - r.detected, r.false_alarms,
+               r.detected ? (double)r.delay_sum / r.detected : 0.0, r.delay_max);
+    }
+    CR_close(&file);
+    return 0;
+}
@@ -0,0 +1,254 @@
+/** ***************************************************************************
+ * @file
+ * @brief Simulation of the load governor with injected stage costs
+ *
+ * Usage
+ * =====
+ * @code
+ * governor_sim [-v]              built-in scenarios, exit status 1 if one fails
+ * governor_sim [-v] costs.csv    costs of each frame from a file
+ * @endcode
+ * governor.c is compiled unchanged, the costs are charged with
+ * GOV_add_cost() and each frame is closed with GOV_frame().
+ *
+ * Scenarios
+ * =========
+ * Each scenario is a sequence of phases. A phase gives the costs of
+ * the stages per frame [ms] for each level, so shedding lowers the costs
+ * like on the device. A frame is late by the time the stages take
+ * beyond the frame period, which follows the rate of the scenario
+ * (GOV_set_rate(), e.g. 214 Hz for 16.7 Hz mains).
+ * A scenario passes if it ends at the expected level with at most
+ * the expected number of level changes. In every frame the shed features
+ * must be a prefix of GOV_feature_t (the order of shedding) and the
+ * display must be drawn at the rate of the level (GOV_draw_due()).
+ * One CSV line per scenario is printed.
+ *
+ * File
+ * ====
+ * One line per frame "dsp,lcd,telemetry,input[,age]" [us], a header line
+ * is skipped. The costs do not depend on the level.
+ * One CSV line per frame is printed: frame, level, total [us], drawn.
+ *
+ * -v prints each level change.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "governor.h"
+#include "profiling.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define MAX_PHASES      4               ///< Phases of a scenario
+
+/** The same costs [ms] at all levels */
+#define SAME(dsp, lcd, tlm, in) \
+        {{dsp, lcd, tlm, in}, {dsp, lcd, tlm, in}, {dsp, lcd, tlm, in}, {dsp, lcd, tlm, in}}
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Frames with the same costs */
+typedef struct {
+    uint32_t frames;                            ///< Length of the phase
+    uint16_t cost_ms[GOV_LEVELS+1][GOV_STAGES]; ///< Costs per frame at each level
+} phase_t;
+
+/** Scenario with the expected decisions */
+typedef struct {
+    const char *name;                   ///< Name in the output
+    uint32_t fs;                        ///< Sampling frequency [Hz], 0 = ADC_FS
+    phase_t phase[MAX_PHASES];          ///< Phases, frames = 0 ends the list
+    uint8_t level;                      ///< Expected level at the end
+    uint32_t max_changes;               ///< Max level changes
+} scenario_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const scenario_t scenarios[] = {
+        {"idle", 0, {{600, SAME(3, 20, 3, 1)}}, 0, 0},
+        /* A single slow frame (e.g. a page init) is no pressure */
+        {"spike", 0, {{100, SAME(3, 20, 3, 1)}, {1, SAME(3, 150, 3, 1)},
+                   {100, SAME(3, 20, 3, 1)}}, 0, 0},
+        /* Busy, but all stages within their budgets */
+        {"busy", 0, {{600, SAME(10, 35, 10, 5)}}, 0, 0},
+        /* Graphic page redrawn in every pass, half the rate is enough */
+        {"display", 0, {{600, {{3, 55, 3, 1}, {3, 28, 3, 1}, {3, 28, 3, 1}, {3, 28, 3, 1}}}}, 1, 1},
+        /* Diagnostics page: the load at level 2 is low, but restoring
+         * the text pages would bring back the pressure */
+        {"text page", 0, {{3000, {{3, 90, 3, 1}, {3, 45, 3, 1}, {3, 9, 3, 1}, {3, 9, 3, 1}}}}, 2, 2},
+        /* Snapshot and trace dump on top of a busy display */
+        {"telemetry", 0, {{600, {{3, 55, 25, 1}, {3, 28, 25, 1}, {3, 28, 25, 1}, {3, 28, 6, 1}}}}, 3, 3},
+        /* Heavy averaging: everything else is shed, the acquisition goes on */
+        {"dsp", 0, {{600, SAME(70, 20, 3, 1)}}, 3, 3},
+        /* Display load ends, the feature is restored after the relief */
+        {"recovery", 0, {{100, {{3, 55, 3, 1}, {3, 28, 3, 1}, {3, 28, 3, 1}, {3, 28, 3, 1}}},
+                      {100, SAME(3, 20, 3, 1)}}, 0, 2},
+        /* Display gets cheaper at level 1 only: the feature is restored once,
+         * shed again and the new factor keeps it shed */
+        {"relearn", 0, {{100, {{3, 55, 3, 1}, {3, 28, 3, 1}, {3, 28, 3, 1}, {3, 28, 3, 1}}},
+                     {900, {{3, 50, 3, 1}, {3, 15, 3, 1}, {3, 15, 3, 1}, {3, 15, 3, 1}}}}, 1, 3},
+        /* Blocking transfers make the frames late, shedding cannot help */
+        {"input", 0, {{100, SAME(3, 20, 3, 120)}}, 3, 3},
+        /* 16.7 Hz mains, 299 ms frames: three times the passes of 50 Hz per frame
+         * fit in the longer period, nothing is shed */
+        {"16.7 Hz busy", 214, {{300, SAME(30, 105, 30, 15)}}, 0, 0},
+        /* 16.7 Hz mains, the display is over its budget of the longer period */
+        {"16.7 Hz display", 214, {{300, {{9, 165, 9, 3}, {9, 83, 9, 3}, {9, 83, 9, 3}, {9, 83, 9, 3}}}}, 1, 1},
+};
+
+static int verbose = 0;                 ///< Print the level changes
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** Not used, the costs are injected */
+uint32_t PROF_get_cycles(void)
+{
+    return 0;
+}
+
+
+/** Not used, the costs are injected */
+uint32_t PROF_cycles_to_us(uint32_t cycles)
+{
+    return cycles;
+}
+
+
+/** ***************************************************************************
+ * @brief Charge the costs of one frame and close it
+ * @param [in] cost_us costs of the stages
+ * @param [in] age_us age of the frame
+ * @param [in] frame number for the output
+ * @return false if the shed features are not in the order of GOV_feature_t
+ *****************************************************************************/
+static bool run_frame(const uint32_t cost_us[GOV_STAGES], uint32_t age_us, uint32_t frame)
+{
+    uint8_t before = GOV_get_level();
+    for (int s = 0; s < GOV_STAGES; s++) {
+        GOV_add_cost(s, cost_us[s]);
+    }
+    GOV_frame(age_us);
+    uint8_t level = GOV_get_level();
+    if (verbose && level != before) {
+        printf("  frame %u: level %d -> %d\n", frame, before, level);
+    }
+    for (int f = 1; f < GOV_LEVELS; f++) {
+        if (GOV_shed(f) && !GOV_shed(f - 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/** ***************************************************************************
+ * @brief Run a scenario
+ * @return true if passed
+ *****************************************************************************/
+static bool run_scenario(const scenario_t *sc)
+{
+    GOV_set_rate(sc->fs ? sc->fs : ADC_FS);
+    GOV_init();
+    bool ok = true;
+    uint32_t frame = 0, drawn = 0, expected_drawn = 0;
+    for (int p = 0; p < MAX_PHASES && sc->phase[p].frames > 0; p++) {
+        for (uint32_t k = 0; k < sc->phase[p].frames; k++, frame++) {
+            const uint16_t *ms = sc->phase[p].cost_ms[GOV_get_level()];
+            uint32_t cost_us[GOV_STAGES], total = 0;
+            for (int s = 0; s < GOV_STAGES; s++) {
+                cost_us[s] = ms[s] * 1000;
+                total += cost_us[s];
+            }
+            uint32_t age_us = (total > GOV_get_frame_us()) ? total - GOV_get_frame_us() : 0;
+            ok &= run_frame(cost_us, age_us, frame);
+
+            /* Drawn in the pass of the frame, graphic page */
+            drawn += GOV_draw_due(true, false);
+            expected_drawn += !GOV_shed(GOV_SHED_UI) || (GOV_get_status().frames % GOV_UI_DIVIDER == 0);
+        }
+    }
+    GOV_status_t status = GOV_get_status();
+    ok &= (drawn == expected_drawn);
+    ok &= (status.level == sc->level && status.changes <= sc->max_changes);
+    printf("%s,%u,%u,%d,%d,%u,%u,%u,%s\n", sc->name, sc->fs ? sc->fs : ADC_FS, frame, status.level, sc->level,
+           status.changes, sc->max_changes, status.late, ok ? "pass" : "FAIL");
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @brief Run the frames of a file
+ * @return -1 on error
+ *****************************************************************************/
+static int run_file(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    GOV_init();
+    printf("frame,level,total_us,drawn\n");
+    char line[256];
+    uint32_t frame = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        uint32_t cost_us[GOV_STAGES] = {0};
+        unsigned c[GOV_STAGES], age = 0;
+        if (sscanf(line, "%u,%u,%u,%u,%u", &c[0], &c[1], &c[2], &c[3], &age) < GOV_STAGES) {
+            continue;
+        }
+        uint32_t total = 0;
+        for (int s = 0; s < GOV_STAGES; s++) {
+            cost_us[s] = c[s];
+            total += c[s];
+        }
+        run_frame(cost_us, age, frame);
+        printf("%u,%d,%u,%d\n", frame, GOV_get_level(), total, GOV_draw_due(true, false));
+        frame++;
+    }
+    fclose(f);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int i = 1;
+    if (i < argc && strcmp(argv[i], "-v") == 0) {
+        verbose = 1;
+        i++;
+    }
+    if (argc - i > 1 || (i < argc && argv[i][0] == '-')) {
+        fprintf(stderr, "usage: governor_sim [-v] [costs.csv]\n");
+        return 2;
+    }
+    if (i < argc) {
+        return (run_file(argv[i]) < 0) ? 1 : 0;
+    }
+    int failed = 0;
+    printf("scenario,fs,frames,level,expected,changes,max_changes,late,result\n");
+    for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++) {
+        failed += !run_scenario(&scenarios[s]);
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,283 @@
+/** ***************************************************************************
+ * @file
+ * @brief Check of the mains detection and of the retargeted pipeline
+ *
+ * Usage
+ * =====
+ * @code
+ * mains_check [-v]     built-in cases, exit status 1 if one fails
+ * @endcode
+ * mains.c and calculations.c are compiled unchanged,
+ * the frames are synthesized like the ADC buffer of ACQ_GROUPS.
+ *
+ * Detection
+ * =========
+ * Each case is a mix of sines on a DC level with noise, a third harmonic
+ * and random phases. It is sampled at the rate of every profile, because
+ * the detection runs on the frames of the current profile.
+ * MAINS_detect() must find the expected profile in one frame, or nothing
+ * for the quiet and the tied cases. The mains frequencies are off their
+ * nominal value by up to 0.2 Hz. One CSV line per case and rate.
+ *
+ * Pipeline
+ * ========
+ * For each profile, frames at its mains frequency are sampled at the rate
+ * TIM2 makes and run through calculate_frame() with MAINS_get_config().
+ * The pad amplitudes must be those of the pad gain, the Hall amplitudes
+ * the true ones, within 0.5 %. The error with CALC_config_default
+ * (all frames analysed at 50 Hz) is printed for comparison.
+ * The time of MAINS_detect() per frame is printed on stderr.
+ *
+ * -v prints the amplitudes of every frame.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mains.h"
+#include "measuring.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define FRAMES          20              ///< Frames per case and rate
+#define PAD_RMS         600.0           ///< Pad amplitude [ADC steps RMS]
+#define HALL_RMS        400.0           ///< Hall amplitude [ADC steps RMS]
+#define NOISE           3.0             ///< Noise of the samples [ADC steps, uniform]
+#define HARMONIC        0.1             ///< Third harmonic relative to the fundamental
+#define MAX_ERROR       0.005           ///< Max relative amplitude error of the pipeline
+#define TIMER_HZ        (84000000 / 10) ///< Counter rate of TIM2, see MEAS_set_rate()
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Synthetic signal, up to two mains frequencies */
+typedef struct {
+    const char *name;                   ///< Name in the output
+    double hz[2];                       ///< Frequencies, 0 = none
+    double level[2];                    ///< Amplitude relative to PAD_RMS / HALL_RMS
+    int expected;                       ///< MAINS_t, MAINS_PROFILES = no detection
+} case_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static const case_t cases[] = {
+        {"50 Hz",           {50.0},         {1},        MAINS_50HZ},
+        {"50 Hz low",       {49.8},         {1},        MAINS_50HZ},
+        {"60 Hz",           {60.0},         {1},        MAINS_60HZ},
+        {"60 Hz high",      {60.2},         {1},        MAINS_60HZ},
+        {"16.7 Hz",         {16.7},         {1},        MAINS_16HZ7},
+        {"16.7 Hz low",     {16.5},         {1},        MAINS_16HZ7},
+        {"railway + grid",  {16.7, 50.0},   {1, 0.3},   MAINS_16HZ7},
+        {"grid + railway",  {50.0, 16.7},   {1, 0.3},   MAINS_50HZ},
+        {"60 Hz + 50 Hz",   {60.0, 50.0},   {1, 0.3},   MAINS_60HZ},
+        {"weak 50 Hz",      {50.0},         {0.05},     MAINS_50HZ},
+        {"tied",            {50.0, 60.0},   {1, 1},     MAINS_PROFILES},
+        {"quiet",           {0},            {0},        MAINS_PROFILES},
+};
+
+static int verbose = 0;                 ///< Print every frame
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** Uniform random number in [-1, 1) */
+static double uniform(void)
+{
+    return 2.0 * rand() / ((double)RAND_MAX + 1) - 1;
+}
+
+
+/** Rate of the pads TIM2 makes for a profile, like ACQ_set_rate() of ACQ_GROUPS */
+static uint32_t timer_rate(uint32_t fs)
+{
+    uint32_t trigger = fs * MEAS_HALL_RATIO;
+    uint32_t prescale = (TIMER_HZ + trigger / 2) / trigger;
+    return TIMER_HZ / prescale / MEAS_HALL_RATIO;
+}
+
+
+/** ***************************************************************************
+ * @brief Synthesize one frame of the four channels
+ * @param [out] frame CALC_CHANNELS*ADC_NUMS interleaved samples
+ * @param [in] hz frequencies, 0 = none
+ * @param [in] level amplitudes relative to PAD_RMS and HALL_RMS
+ * @param [in] fs sampling frequency [Hz]
+ *****************************************************************************/
+static void synthesize(uint32_t *frame, const double hz[2], const double level[2], double fs)
+{
+    for (int c = 0; c < CALC_CHANNELS; c++) {
+        double rms = (c == CALC_LPAD || c == CALC_RPAD) ? PAD_RMS : HALL_RMS;
+        double phase[2] = {M_PI * uniform(), M_PI * uniform()};
+        for (int n = 0; n < ADC_NUMS; n++) {
+            double x = 2048 + NOISE * uniform();
+            for (int k = 0; k < 2; k++) {
+                if (hz[k] > 0) {
+                    double w = 2 * M_PI * hz[k] * n / fs + phase[k];
+                    x += M_SQRT2 * rms * level[k] * (sin(w) + HARMONIC * sin(3 * w));
+                }
+            }
+            frame[n * CALC_CHANNELS + c] = (uint32_t)lround(x);
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Detect a case on FRAMES frames at the rate of a profile
+ * @return true if every frame gave the expected result
+ *****************************************************************************/
+static bool run_detection(const case_t *cs, MAINS_t rate)
+{
+    uint32_t fs = timer_rate(MAINS_get_profile(rate)->fs);
+    uint32_t frame[CALC_CHANNELS * ADC_NUMS];
+    int correct = 0;
+    float rms[MAINS_PROFILES] = {0};
+
+    for (int f = 0; f < FRAMES; f++) {
+        MAINS_result_t result;
+        synthesize(frame, cs->hz, cs->level, fs);
+        bool found = MAINS_detect(frame, CALC_CHANNELS, ADC_NUMS, fs, &result);
+        int detected = found ? (int)result.dominant : MAINS_PROFILES;
+        correct += (detected == cs->expected);
+        for (int i = 0; i < MAINS_PROFILES; i++) {
+            rms[i] += result.rms[i] / FRAMES;
+        }
+        if (verbose) {
+            printf("  %.1f %.1f %.1f -> %s\n", result.rms[MAINS_50HZ], result.rms[MAINS_60HZ],
+                   result.rms[MAINS_16HZ7], found ? MAINS_get_profile(result.dominant)->name : "-");
+        }
+    }
+    bool ok = (correct == FRAMES);
+    printf("%s,%u,%s,%d/%d,%.1f,%.1f,%.1f,%s\n", cs->name, fs,
+           (cs->expected < MAINS_PROFILES) ? MAINS_get_profile(cs->expected)->name : "-",
+           correct, FRAMES, rms[MAINS_50HZ], rms[MAINS_60HZ], rms[MAINS_16HZ7], ok ? "pass" : "FAIL");
+    return ok;
+}
+
+
+/** ***************************************************************************
+ * @brief Largest relative amplitude error of a channel group over FRAMES frames
+ * @param [in] config parameters of the pipeline
+ * @param [in] hz mains frequency
+ * @param [in] fs sampling frequency
+ * @param [out] error of the pads and the Hall sensors
+ *****************************************************************************/
+static void run_pipeline(const CALC_config_t *config, double hz, uint32_t fs, double error[2])
+{
+    static CALC_context_t ctx;
+    uint32_t frame[CALC_CHANNELS * ADC_NUMS];
+    const double level[2] = {1, 0};
+    const double mains[2] = {hz, 0};
+
+    error[0] = error[1] = 0;
+    calculate_init(&ctx);
+    ctx.config = *config;
+    for (int f = 0; f < FRAMES; f++) {
+        synthesize(frame, mains, level, fs);
+        ctx.avg_counter = 0;
+        memset(ctx.amplitude_sum, 0, sizeof(ctx.amplitude_sum));
+        calculate_frame(&ctx, frame, 1 << 30);      // The window is never closed
+        for (int c = 0; c < CALC_CHANNELS; c++) {
+            bool pad = (c == CALC_LPAD || c == CALC_RPAD);
+            double expected = pad ? PAD_RMS * config->pad_gain : HALL_RMS;
+            double e = fabs(ctx.amplitude_sum[c] - expected) / expected;
+            error[!pad] = (e > error[!pad]) ? e : error[!pad];
+            if (verbose) {
+                printf("  channel %d: %u, expected %.1f\n", c, ctx.amplitude_sum[c], expected);
+            }
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Check the pipeline of a profile against the one of 50 Hz
+ * @return true if passed
+ *****************************************************************************/
+static bool run_profile(MAINS_t mains)
+{
+    const MAINS_profile_t *p = MAINS_get_profile(mains);
+    CALC_config_t config;
+    MAINS_get_config(mains, &config);
+    config.fs = timer_rate(config.fs);
+    double hz = p->mains_mhz / 1000.0;
+    double error[2];
+    double untargeted[2];
+
+    run_pipeline(&config, hz, config.fs, error);
+    CALC_config_t fixed = CALC_config_default;
+    fixed.pad_gain = config.pad_gain;   // Only the rate and the bin differ
+    run_pipeline(&fixed, hz, ADC_FS, untargeted);
+    bool ok = error[0] <= MAX_ERROR && error[1] <= MAX_ERROR;
+    printf("%s,%u,%u,%.3f,%.2f,%.2f,%.2f,%.2f,%s\n", p->name, config.fs, config.bin, config.pad_gain,
+           100 * error[0], 100 * error[1], 100 * untargeted[0], 100 * untargeted[1], ok ? "pass" : "FAIL");
+    return ok;
+}
+
+
+/** Time of MAINS_detect() per frame [ns] */
+static double detect_ns(void)
+{
+    static const double mains[2] = {50.0, 0};
+    static const double level[2] = {1, 0};
+    uint32_t frame[CALC_CHANNELS * ADC_NUMS];
+    MAINS_result_t result;
+    struct timespec t0, t1;
+    int found = 0;
+
+    synthesize(frame, mains, level, ADC_FS);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < 100000; i++) {
+        frame[0] ^= 1;                  // Not optimized away
+        found += MAINS_detect(frame, CALC_CHANNELS, ADC_NUMS, ADC_FS, &result);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / 100000 + 0 * found;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-v") != 0)) {
+        fprintf(stderr, "usage: mains_check [-v]\n");
+        return 2;
+    }
+    verbose = (argc == 2);
+    FFT_Init();
+    srand(1);
+    int failed = 0;
+    printf("case,fs,expected,detected,rms_50hz,rms_60hz,rms_16.7hz,result\n");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        for (int rate = 0; rate < MAINS_PROFILES; rate++) {
+            if (rate == MAINS_60HZ) {
+                continue;               // Same rate as 50 Hz
+            }
+            failed += !run_detection(&cases[i], (MAINS_t)rate);
+        }
+    }
+    printf("\nprofile,fs,bin,pad_gain,pad_error_%%,hall_error_%%,"
+           "pad_error_50hz_%%,hall_error_50hz_%%,result\n");
+    for (int m = 0; m < MAINS_PROFILES; m++) {
+        failed += !run_profile((MAINS_t)m);
+    }
+    fprintf(stderr, "MAINS_detect(): %.0f ns per frame\n", detect_ns());
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,544 @@
+/** ***************************************************************************
+ * @file
+ * @brief Parallel reprocessing of capture files with the firmware pipeline
+ *
+ * Usage
+ * =====
+ * @code
+ * reprocess [-j threads] [-a averaged_frames] file.cmcap...
+ * reprocess --bench [-j max_threads] [-a averaged_frames] file.cmcap...
+ * @endcode
+ * The frames of the capture files (see Core/Src/capture.c) are run through
+ * calculate_frame() of Core/Src/calculations.c, compiled unchanged for the host.
+ * -a is the fft_avg_num of calculate_pos() in the firmware (default 1).
+ * The pipeline is set to the mains frequency of the file (see mains.c).
+ *
+ * Work stealing
+ * =============
+ * Each file is cut into segments of SEGMENT_CHUNKS chunks, a segment is one task.
+ * The tasks are dealt out to one deque per worker. A worker takes its tasks
+ * from the bottom of its own deque, an idle worker steals from the top of the
+ * others, so large and small files are balanced without a central queue.
+ * Every worker has its own CALC_context_t, only the twiddle table and the
+ * LUTs of calculations.c are shared (read-only).
+ *
+ * A segment starts in the middle of the frames of a file. The pipeline carries
+ * the distances of the last averaging window into the next window, so the
+ * worker first replays the previous window without recording statistics.
+ * The results are then identical to a single pass over the file.
+ *
+ * Output
+ * ======
+ * One CSV line per file on stdout:
+ * - frames, rate of frames with a valid position (X and Y without error code)
+ * - 5 %, 50 % and 95 % of X [mm], Y [mm] and current [A] of the valid frames
+ * - time per frame of each stage [ns]
+ *
+ * The throughput is printed on stderr. --bench runs the whole workload with
+ * 1 to max_threads workers (without stage timing) and prints frames per second
+ * and frames per second per core.
+ *
+ * @note Frames dropped on the device while capturing are not in the file,
+ * the averaging windows of the host are counted over the stored frames.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture_reader.h"
+#include "calculations.h"
+#include "mains.h"
+#include "measuring.h"
+#include "error_code.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define SEGMENT_CHUNKS  64              ///< Chunks of a task
+#define MAX_THREADS     256             ///< Max number of workers
+#define X_RANGE         100             ///< X histogram from -X_RANGE to X_RANGE mm
+#define Y_RANGE         200             ///< Y histogram from 0 to Y_RANGE mm
+#define CURRENT_BINS    2000            ///< Current histogram in 0.1 A, last bin = overflow
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Statistics of a file or of a task */
+typedef struct {
+    uint64_t frames;                    ///< Processed frames
+    uint64_t valid;                     ///< Frames with valid X and Y
+    uint64_t current_valid;             ///< Valid frames with a current
+    uint64_t stage_ns[CALC_STAGES];     ///< Time of each stage
+    uint32_t hist_x[2*X_RANGE + 1];     ///< X of the valid frames, 1 mm bins
+    uint32_t hist_y[Y_RANGE + 1];       ///< Y of the valid frames, 1 mm bins
+    uint32_t hist_current[CURRENT_BINS];///< Current of the valid frames, 0.1 A bins
+} stats_t;
+
+/** Capture file and its statistics */
+typedef struct {
+    const char *path;                   ///< Name on the command line
+    CR_file_t file;                     ///< Mapping
+    CALC_config_t config;               ///< Parameters of the mains frequency of the file
+    pthread_mutex_t lock;               ///< Protects stats
+    stats_t stats;                      ///< Merged statistics of all tasks
+} job_t;
+
+/** Segment of a file */
+typedef struct {
+    job_t *job;                         ///< File of the segment
+    uint32_t first_chunk;               ///< First chunk of the segment
+    uint32_t chunks;                    ///< Chunks of the segment
+} task_t;
+
+/** Deque of tasks of a worker */
+typedef struct {
+    pthread_mutex_t lock;               ///< Protects top and bottom
+    uint32_t *tasks;                    ///< Indices into the task array
+    uint32_t top;                       ///< Next task to be stolen
+    uint32_t bottom;                    ///< One after the next task of the owner
+} deque_t;
+
+/** Worker thread */
+typedef struct {
+    pthread_t thread;                   ///< Thread handle
+    uint32_t id;                        ///< Index of the worker and its deque
+    CALC_context_t ctx;                 ///< Pipeline of the worker
+    stats_t stats;                      ///< Statistics of the current task
+    uint32_t *samples;                  ///< Decoded frame
+    uint64_t frames;                    ///< Frames processed by the worker
+    uint32_t steals;                    ///< Tasks taken from other workers
+} worker_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+static job_t *jobs;                     ///< Capture files
+static uint32_t job_count;              ///< Number of capture files
+static task_t *tasks;                   ///< Segments of all files
+static uint32_t task_count;             ///< Number of segments
+static deque_t deques[MAX_THREADS];     ///< One deque per worker
+static worker_t workers[MAX_THREADS];   ///< Workers
+static uint32_t worker_count;           ///< Number of workers of the current run
+static int avg_frames = 1;              ///< fft_avg_num of the pipeline
+static int timing = 1;                  ///< Stage timing enabled
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Time source of the pipelines
+ * @return Monotonic time in ns (wraps, only differences are used)
+ *****************************************************************************/
+static uint32_t clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+
+/** ***************************************************************************
+ * @brief Wall time in s
+ *****************************************************************************/
+static double wall_time(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** ***************************************************************************
+ * @brief Add the result of the last frame of a pipeline to the statistics
+ *****************************************************************************/
+static void record_frame(stats_t *stats, const CALC_context_t *ctx)
+{
+    stats->frames++;
+    if (ctx->X_Pos == CALC_OUTOF_X_RANGE || ctx->Y_Pos == CALC_OUTOF_Y_RANGE) {
+        return;
+    }
+    stats->valid++;
+    int x = ctx->X_Pos + X_RANGE;
+    int y = ctx->Y_Pos;
+    stats->hist_x[x < 0 ? 0 : (x > 2*X_RANGE ? 2*X_RANGE : x)]++;
+    stats->hist_y[y < 0 ? 0 : (y > Y_RANGE ? Y_RANGE : y)]++;
+    /* The current is calculated with the position, error codes are >= 1000 A */
+    if (ctx->current >= 0 && ctx->current < CURR_OUTOF_Y_RANGE) {
+        int bin = (int)(ctx->current * 10);
+        stats->current_valid++;
+        stats->hist_current[bin < CURRENT_BINS ? bin : CURRENT_BINS - 1]++;
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Add the statistics of a task to those of its file
+ *****************************************************************************/
+static void merge_stats(stats_t *dst, const stats_t *src)
+{
+    dst->frames += src->frames;
+    dst->valid += src->valid;
+    dst->current_valid += src->current_valid;
+    for (int i = 0; i < CALC_STAGES; i++) {
+        dst->stage_ns[i] += src->stage_ns[i];
+    }
+    for (int i = 0; i <= 2*X_RANGE; i++) {
+        dst->hist_x[i] += src->hist_x[i];
+    }
+    for (int i = 0; i <= Y_RANGE; i++) {
+        dst->hist_y[i] += src->hist_y[i];
+    }
+    for (int i = 0; i < CURRENT_BINS; i++) {
+        dst->hist_current[i] += src->hist_current[i];
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Run the pipeline over the stored frames first..last-1 of a file
+ * @param [in] stats NULL = replay only
+ *****************************************************************************/
+static void run_frames(worker_t *w, const CR_file_t *file, uint32_t first, uint32_t last,
+                       stats_t *stats)
+{
+    /* Chunk of frame first */
+    uint32_t lo = 0, hi = file->chunks;
+    while (hi - lo > 1) {
+        uint32_t mid = (lo + hi) / 2;
+        if (file->first_ordinal[mid] <= first) { lo = mid; } else { hi = mid; }
+    }
+    for (uint32_t c = lo; c < file->chunks && file->first_ordinal[c] < last; c++) {
+        const uint8_t *raw = CR_chunk(file, c);
+        for (uint32_t n = file->first_ordinal[c]; n < file->first_ordinal[c + 1] && n < last; n++) {
+            raw += CR_decode(file, raw, w->samples);
+            if (n < first) {
+                continue;
+            }
+            calculate_frame(&w->ctx, w->samples, avg_frames);
+            if (stats != NULL) {
+                record_frame(stats, &w->ctx);
+            }
+        }
+    }
+    w->frames += (last > first) ? last - first : 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Process one segment
+ *****************************************************************************/
+static void run_task(worker_t *w, const task_t *t)
+{
+    const CR_file_t *file = &t->job->file;
+    uint32_t first = file->first_ordinal[t->first_chunk];
+    uint32_t last = file->first_ordinal[t->first_chunk + t->chunks];
+
+    /* Replay the averaging window before the one of the first frame */
+    uint32_t window = first - first % avg_frames;
+    uint32_t replay = (window >= (uint32_t)avg_frames) ? window - avg_frames : 0;
+    w->ctx.clock = NULL;
+    calculate_init(&w->ctx);
+    w->ctx.config = t->job->config;
+    run_frames(w, file, replay, first, NULL);
+
+    memset(&w->stats, 0, sizeof(w->stats));
+    memset(w->ctx.stage_time, 0, sizeof(w->ctx.stage_time));
+    w->ctx.clock = timing ? clock_ns : NULL;
+    run_frames(w, file, first, last, &w->stats);
+    for (int i = 0; i < CALC_STAGES; i++) {
+        w->stats.stage_ns[i] = w->ctx.stage_time[i];
+    }
+
+    pthread_mutex_lock(&t->job->lock);
+    merge_stats(&t->job->stats, &w->stats);
+    pthread_mutex_unlock(&t->job->lock);
+}
+
+
+/** ***************************************************************************
+ * @brief Take a task from the bottom of the own deque
+ * @return Task index or -1
+ *****************************************************************************/
+static int pop_task(deque_t *d)
+{
+    int task = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+        task = d->tasks[--d->bottom];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return task;
+}
+
+
+/** ***************************************************************************
+ * @brief Take a task from the top of another deque
+ * @return Task index or -1
+ *****************************************************************************/
+static int steal_task(deque_t *d)
+{
+    int task = -1;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom > d->top) {
+        task = d->tasks[d->top++];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return task;
+}
+
+
+/** ***************************************************************************
+ * @brief Worker thread
+ *
+ * Tasks are only dealt out before the start, a worker is done
+ * when all deques are empty.
+ *****************************************************************************/
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+    while (1) {
+        int task = pop_task(&deques[w->id]);
+        for (uint32_t k = 1; task < 0 && k < worker_count; k++) {
+            task = steal_task(&deques[(w->id + k) % worker_count]);
+            if (task >= 0) {
+                w->steals++;
+            }
+        }
+        if (task < 0) {
+            return NULL;
+        }
+        run_task(w, &tasks[task]);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Process all tasks with a number of workers
+ * @return Wall time in s
+ *****************************************************************************/
+static double run_all(uint32_t threads)
+{
+    worker_count = threads;
+    for (uint32_t j = 0; j < job_count; j++) {
+        memset(&jobs[j].stats, 0, sizeof(jobs[j].stats));
+    }
+    /* Deal out contiguous blocks, neighbouring segments share the mapping pages */
+    for (uint32_t i = 0; i < threads; i++) {
+        deque_t *d = &deques[i];
+        d->top = 0;
+        d->bottom = 0;
+        for (uint32_t t = task_count * i / threads; t < task_count * (i + 1) / threads; t++) {
+            d->tasks[d->bottom++] = t;
+        }
+        workers[i].id = i;
+        workers[i].frames = 0;
+        workers[i].steals = 0;
+    }
+
+    double start = wall_time();
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    for (uint32_t i = 0; i < threads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    return wall_time() - start;
+}
+
+
+/** ***************************************************************************
+ * @brief Value below which a fraction of a histogram lies
+ *****************************************************************************/
+static double percentile(const uint32_t *hist, int bins, uint64_t count, double fraction,
+                         double offset, double scale)
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(fraction * (count - 1)), sum = 0;
+    for (int i = 0; i < bins; i++) {
+        sum += hist[i];
+        if (sum > target) {
+            return (i + offset) * scale;
+        }
+    }
+    return (bins - 1 + offset) * scale;
+}
+
+
+/** ***************************************************************************
+ * @brief Print the statistics of each file as CSV
+ *****************************************************************************/
+static void report(void)
+{
+    static const double p[] = {0.05, 0.5, 0.95};
+    printf("file,frames,valid_pct,x_p5,x_p50,x_p95,y_p5,y_p50,y_p95,"
+           "current_frames,current_p5,current_p50,current_p95,dft_ns,lut_ns,triang_ns\n");
+    for (uint32_t j = 0; j < job_count; j++) {
+        const stats_t *s = &jobs[j].stats;
+        uint64_t frames = s->frames ? s->frames : 1;
+        printf("%s,%llu,%.1f", jobs[j].path, (unsigned long long)s->frames, 100.0 * s->valid / frames);
+        for (int i = 0; i < 3; i++) {
+            printf(",%.0f", percentile(s->hist_x, 2*X_RANGE + 1, s->valid, p[i], -X_RANGE, 1));
+        }
+        for (int i = 0; i < 3; i++) {
+            printf(",%.0f", percentile(s->hist_y, Y_RANGE + 1, s->valid, p[i], 0, 1));
+        }
+        printf(",%llu", (unsigned long long)s->current_valid);
+        for (int i = 0; i < 3; i++) {
+            printf(",%.1f", percentile(s->hist_current, CURRENT_BINS, s->current_valid, p[i], 0, 0.1));
+        }
+        for (int i = 0; i < CALC_STAGES; i++) {
+            printf(",%.0f", (double)s->stage_ns[i] / frames);
+        }
+        printf("\n");
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Cut the files into tasks
+ *****************************************************************************/
+static int make_tasks(void)
+{
+    uint32_t count = 0;
+    for (uint32_t j = 0; j < job_count; j++) {
+        count += (jobs[j].file.chunks + SEGMENT_CHUNKS - 1) / SEGMENT_CHUNKS;
+    }
+    tasks = calloc(count ? count : 1, sizeof(task_t));
+    if (tasks == NULL) {
+        return -1;
+    }
+    for (uint32_t j = 0; j < job_count; j++) {
+        for (uint32_t c = 0; c < jobs[j].file.chunks; c += SEGMENT_CHUNKS) {
+            task_t *t = &tasks[task_count++];
+            t->job = &jobs[j];
+            t->first_chunk = c;
+            t->chunks = (jobs[j].file.chunks - c < SEGMENT_CHUNKS) ? jobs[j].file.chunks - c : SEGMENT_CHUNKS;
+        }
+    }
+    return 0;
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: reprocess [--bench] [-j threads] [-a averaged_frames] file.cmcap...\n");
+    exit(2);
+}
+
+
+int main(int argc, char *argv[])
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = (cores > 0) ? cores : 1;
+    int bench = 0;
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            avg_frames = atoi(argv[++i]);
+        } else {
+            usage();
+        }
+    }
+    if (i == argc || threads < 1 || threads > MAX_THREADS || avg_frames < 1) {
+        usage();
+    }
+
+    job_count = argc - i;
+    jobs = calloc(job_count, sizeof(job_t));
+    for (uint32_t j = 0; j < job_count; j++) {
+        jobs[j].path = argv[i + j];
+        pthread_mutex_init(&jobs[j].lock, NULL);
+        if (CR_open(&jobs[j].file, jobs[j].path) < 0) {
+            return 1;
+        }
+        if (jobs[j].file.header.frame_length != ADC_NUMS) {
+            fprintf(stderr, "%s: %d samples per frame, the pipeline is built for %d\n",
+                    jobs[j].path, jobs[j].file.header.frame_length, ADC_NUMS);
+            return 1;
+        }
+        MAINS_t mains = MAINS_find(jobs[j].file.header.mains_mhz);
+        if (mains == MAINS_PROFILES) {
+            fprintf(stderr, "%s: no profile for mains %d mHz\n",
+                    jobs[j].path, (int)jobs[j].file.header.mains_mhz);
+            return 1;
+        }
+        MAINS_get_config(mains, &jobs[j].config);
+        if (jobs[j].file.header.calibration != CALC_CAL_VERSION) {
+            fprintf(stderr, "%s: recorded with calibration %d, processed with %d\n",
+                    jobs[j].path, (int)jobs[j].file.header.calibration, CALC_CAL_VERSION);
+        }
+    }
+    if (make_tasks() < 0) {
+        return 1;
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+        deques[t].tasks = malloc((task_count + 1) * sizeof(uint32_t));
+        workers[t].samples = malloc(CALC_CHANNELS * ADC_NUMS * sizeof(uint32_t));
+        pthread_mutex_init(&deques[t].lock, NULL);
+    }
+    FFT_Init();
+
+    if (bench) {
+        timing = 0;
+        printf("threads,frames,seconds,frames_per_s,frames_per_s_per_core,efficiency_pct\n");
+        double single = 0;
+        for (uint32_t n = 1; n <= threads; n++) {
+            double seconds = run_all(n);
+            uint64_t frames = 0;
+            for (uint32_t j = 0; j < job_count; j++) {
+                frames += jobs[j].stats.frames;
+            }
+            double rate = frames / seconds;
+            if (n == 1) {
+                single = rate;
+            }
+            printf("%u,%llu,%.3f,%.0f,%.0f,%.1f\n", n, (unsigned long long)frames, seconds,
+                   rate, rate / n, 100.0 * rate / (n * single));
+            fflush(stdout);
+        }
+    } else {
+        double seconds = run_all(threads);
+        report();
+        uint64_t frames = 0, replayed = 0;
+        uint32_t steals = 0;
+        for (uint32_t t = 0; t < threads; t++) {
+            replayed += workers[t].frames;
+            steals += workers[t].steals;
+        }
+        for (uint32_t j = 0; j < job_count; j++) {
+            frames += jobs[j].stats.frames;
+        }
+        fprintf(stderr, "%llu frames (%llu with replay) in %.3f s, %.0f frames/s, "
+                "%u threads, %u tasks, %u stolen\n",
+                (unsigned long long)frames, (unsigned long long)replayed, seconds,
+                frames / seconds, threads, task_count, steals);
+    }
+
+    for (uint32_t j = 0; j < job_count; j++) {
+        CR_close(&jobs[j].file);
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+/** ***************************************************************************
+ * @file
+ * @brief Host replacement of the acquisition.c, governor.c and CMSIS-DSP functions used by calculations.c and mains.c
+ *
+ * The host tools call calculate_frame() directly, calculate_pos() is not used.
+ * The matrix functions behave like those of CMSIS-DSP: the source of
+ * arm_mat_inverse_f32() is overwritten, a singular matrix returns ARM_MATH_SINGULAR.
+ *****************************************************************************/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "acquisition.h"
+#include "arm_math.h"
+
+volatile bool MEAS_data_ready = false;
+
+void ACQ_start(void)
+{
+}
+
+ACQ_frame_t ACQ_get_frame(void)
+{
+    ACQ_frame_t frame = {0};
+    return frame;
+}
+
+bool ACQ_is_complete(const ACQ_frame_t *frame, uint32_t fs)
+{
+    (void)frame;
+    (void)fs;
+    return false;
+}
+
+bool ACQ_set_rate(uint32_t fs)
+{
+    (void)fs;
+    return false;
+}
+
+uint32_t ACQ_get_rate(void)
+{
+    return 0;
+}
+
+void GOV_set_rate(uint32_t fs)
+{
+    (void)fs;
+}
+
+void arm_mat_init_f32(arm_matrix_instance_f32 *S, uint16_t nRows, uint16_t nColumns, float32_t *pData)
+{
+    S->numRows = nRows;
+    S->numCols = nColumns;
+    S->pData = pData;
+}
+
+arm_status arm_mat_cmplx_mult_f32(const arm_matrix_instance_f32 *pSrcA,
+                                  const arm_matrix_instance_f32 *pSrcB, arm_matrix_instance_f32 *pDst)
+{
+    if (pSrcA->numCols != pSrcB->numRows || pDst->numRows != pSrcA->numRows
+            || pDst->numCols != pSrcB->numCols) {
+        return ARM_MATH_SIZE_MISMATCH;
+    }
+    for (int r = 0; r < pSrcA->numRows; r++) {
+        for (int c = 0; c < pSrcB->numCols; c++) {
+            float32_t re = 0, im = 0;
+            for (int k = 0; k < pSrcA->numCols; k++) {
+                const float32_t *a = &pSrcA->pData[2 * (r * pSrcA->numCols + k)];
+                const float32_t *b = &pSrcB->pData[2 * (k * pSrcB->numCols + c)];
+                re += a[0] * b[0] - a[1] * b[1];
+                im += a[0] * b[1] + a[1] * b[0];
+            }
+            pDst->pData[2 * (r * pDst->numCols + c)] = re;
+            pDst->pData[2 * (r * pDst->numCols + c) + 1] = im;
+        }
+    }
+    return ARM_MATH_SUCCESS;
+}
+
+arm_status arm_mat_inverse_f32(const arm_matrix_instance_f32 *pSrc, arm_matrix_instance_f32 *pDst)
+{
+    int n = pSrc->numRows;
+    float32_t *a = pSrc->pData, *b = pDst->pData;
+    if (n != pSrc->numCols || n != pDst->numRows || n != pDst->numCols) {
+        return ARM_MATH_SIZE_MISMATCH;
+    }
+    for (int i = 0; i < n * n; i++) {
+        b[i] = (i % (n + 1) == 0) ? 1 : 0;
+    }
+    for (int c = 0; c < n; c++) {       /* Gauss-Jordan with partial pivoting */
+        int p = c;
+        for (int r = c + 1; r < n; r++) {
+            if (fabsf(a[r * n + c]) > fabsf(a[p * n + c])) {
+                p = r;
+            }
+        }
+        if (a[p * n + c] == 0) {
+            return ARM_MATH_SINGULAR;
+        }
+        for (int k = 0; k < n; k++) {
+            float32_t t = a[c * n + k]; a[c * n + k] = a[p * n + k]; a[p * n + k] = t;
+            t = b[c * n + k]; b[c * n + k] = b[p * n + k]; b[p * n + k] = t;
+        }
+        float32_t pivot = a[c * n + c];
+        for (int k = 0; k < n; k++) {
+            a[c * n + k] /= pivot;
+            b[c * n + k] /= pivot;
+        }
+        for (int r = 0; r < n; r++) {
+            float32_t f = a[r * n + c];
+            if (r != c && f != 0) {
+                for (int k = 0; k < n; k++) {
+                    a[r * n + k] -= f * a[c * n + k];
+                    b[r * n + k] -= f * b[c * n + k];
+                }
+            }
+        }
+    }
+    return ARM_MATH_SUCCESS;
+}
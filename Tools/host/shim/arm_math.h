@@ -0,0 +1,57 @@
+/** ***************************************************************************
+ * @file
+ * @brief Host replacement of the CMSIS-DSP header for calculations.c
+ *
+ * Only the types and constants used by calculations.c,
+ * the matrix functions are implemented in shim.c.
+ *****************************************************************************/
+
+#ifndef SHIM_ARM_MATH_H_
+#define SHIM_ARM_MATH_H_
+
+#include "stm32f4xx.h"
+#include <math.h>
+
+#define PI  3.14159265358979f
+
+typedef float float32_t;
+
+/** Same layout as in CMSIS-DSP, only used with sizeof() */
+typedef struct {
+    uint16_t fftLen;
+    const float32_t *pTwiddle;
+    const uint16_t *pBitRevTable;
+    uint16_t bitRevLength;
+} arm_cfft_instance_f32;
+
+/** Same layout as in CMSIS-DSP, only used with sizeof() */
+typedef struct {
+    arm_cfft_instance_f32 Sint;
+    uint16_t fftLenRFFT;
+    const float32_t *pTwiddleRFFT;
+} arm_rfft_fast_instance_f32;
+
+/** Same values as in CMSIS-DSP */
+typedef enum {
+    ARM_MATH_SUCCESS = 0,
+    ARM_MATH_ARGUMENT_ERROR = -1,
+    ARM_MATH_LENGTH_ERROR = -2,
+    ARM_MATH_SIZE_MISMATCH = -3,
+    ARM_MATH_NANINF = -4,
+    ARM_MATH_SINGULAR = -5,
+    ARM_MATH_TEST_FAILURE = -6
+} arm_status;
+
+/** Same layout as in CMSIS-DSP */
+typedef struct {
+    uint16_t numRows;
+    uint16_t numCols;
+    float32_t *pData;
+} arm_matrix_instance_f32;
+
+void arm_mat_init_f32(arm_matrix_instance_f32 *S, uint16_t nRows, uint16_t nColumns, float32_t *pData);
+arm_status arm_mat_cmplx_mult_f32(const arm_matrix_instance_f32 *pSrcA,
+                                  const arm_matrix_instance_f32 *pSrcB, arm_matrix_instance_f32 *pDst);
+arm_status arm_mat_inverse_f32(const arm_matrix_instance_f32 *pSrc, arm_matrix_instance_f32 *pDst);
+
+#endif
@@ -0,0 +1,9 @@
+/** ***************************************************************************
+ * @file
+ * @brief Empty host replacement, calculations.c does not use the BSP
+ *****************************************************************************/
+
+#ifndef SHIM_STM32F429I_DISCOVERY_LCD_H_
+#define SHIM_STM32F429I_DISCOVERY_LCD_H_
+
+#endif
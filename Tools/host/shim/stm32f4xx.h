@@ -0,0 +1,76 @@
+/** ***************************************************************************
+ * @file
+ * @brief Host replacement of the device header for calculations.c, command.c
+ * and snapshot.c
+ *
+ * Provides the Cortex-M4 SIMD intrinsics used by split_Array() in plain C.
+ * The GE flags of the core are emulated per thread.
+ * HAL_GetTick() and the LTDC layer registers are provided by the host tool.
+ *****************************************************************************/
+
+#ifndef SHIM_STM32F4XX_H_
+#define SHIM_STM32F4XX_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+uint32_t HAL_GetTick(void);
+
+/** Registers of an LTDC layer read by snapshot.c, CFBAR holds a host pointer */
+typedef struct {
+    uintptr_t CFBAR;
+    uint32_t CFBLR;
+    uint32_t CFBLNR;
+    uint32_t PFCR;
+} LTDC_Layer_TypeDef;
+
+extern LTDC_Layer_TypeDef shim_ltdc_layer2;
+#define LTDC_Layer2                 (&shim_ltdc_layer2)
+#define LTDC_LxCFBLR_CFBLL_Msk      0x00001FFFUL
+#define LTDC_LxCFBLR_CFBP_Pos       16U
+#define LTDC_LxCFBLR_CFBP_Msk       0x1FFF0000UL
+#define LTDC_LxCFBLNR_CFBLNBR_Msk   0x000007FFUL
+#define LTDC_LxPFCR_PF_Msk          0x00000007UL
+
+static _Thread_local uint32_t shim_ge;  ///< GE flags as select mask, 0x0000FFFF = lower, 0xFFFF0000 = upper halfword
+
+/** Pack the lower halfword of a and the shifted upper halfword of b */
+static inline uint32_t __PKHBT(uint32_t a, uint32_t b, uint32_t shift)
+{
+    return (a & 0xFFFF) | ((b << shift) & 0xFFFF0000);
+}
+
+/** Halfword subtraction, GE set where a >= b */
+static inline uint32_t __USUB16(uint32_t a, uint32_t b)
+{
+    uint32_t lo = (a & 0xFFFF) - (b & 0xFFFF);
+    uint32_t hi = (a >> 16) - (b >> 16);
+    /* No borrow: bit 16 of the 32 bit difference of two halfwords is clear */
+    shim_ge = (((lo >> 16) & 1) - 1) & 0x0000FFFF;
+    shim_ge |= (((hi >> 16) & 1) - 1) & 0xFFFF0000;
+    return (lo & 0xFFFF) | (hi << 16);
+}
+
+/** Halfword addition, GE set where the sum overflows */
+static inline uint32_t __UADD16(uint32_t a, uint32_t b)
+{
+    uint32_t lo = (a & 0xFFFF) + (b & 0xFFFF);
+    uint32_t hi = (a >> 16) + (b >> 16);
+    shim_ge = (0 - ((lo >> 16) & 1)) & 0x0000FFFF;
+    shim_ge |= (0 - ((hi >> 16) & 1)) & 0xFFFF0000;
+    return (lo & 0xFFFF) | (hi << 16);
+}
+
+/** Select the halfwords of a where GE is set, else of b */
+static inline uint32_t __SEL(uint32_t a, uint32_t b)
+{
+    return (a & shim_ge) | (b & ~shim_ge);
+}
+
+static inline uint32_t __CLZ(uint32_t value)
+{
+    return value ? (uint32_t)__builtin_clz(value) : 32;
+}
+
+#endif
@@ -0,0 +1,612 @@
+/** ***************************************************************************
+ * @file
+ * @brief Parameter sweep of the pipeline: accuracy versus time to a stable reading
+ *
+ * Usage
+ * =====
+ * @code
+ * sweep [-j threads] [-p] [grid options] [-r repeats]
+ * sweep [-j threads] [-p] [grid options] -t x,y,current file.cmcap...
+ * @endcode
+ * | Option | Parameter                                   | Default          |
+ * | :----- | :------------------------------------------ | :--------------- |
+ * | -a     | averaged frames (fft_avg_num)               | 1,2,3,5,8        |
+ * | -l     | frame length in samples                     | 32,64,128        |
+ * | -w     | window of the DFT (rect, hann)              | rect,hann        |
+ * | -s     | smoothing of the amplitudes (1 = off)       | 1,0.5,0.25       |
+ * | -m     | lower LUT limit of both pads                | 200,250,300      |
+ * | -y     | max Y distance                              | 150,200          |
+ * | -e     | tolerance of a stable reading in mm         | 5                |
+ * | -v     | min rate of valid readings in %             | 90               |
+ * Every combination is one configuration. -p prints only the Pareto frontier.
+ *
+ * Frames
+ * ======
+ * Without files, a scenario of cable positions and currents is simulated
+ * (r repeats with different noise). The pad amplitudes follow the calibration
+ * LUTs, the Hall amplitudes calculate_current() backwards, plus noise and
+ * a 150 Hz harmonic. With files, the capture is taken as one static position
+ * given with -t.
+ *
+ * Evaluation
+ * ==========
+ * The upstream stage (phasors and clip flags of each frame) depends only on
+ * frame length and window. It is computed once per combination and cached,
+ * all configurations sharing it run only calculate_from_phasors() of
+ * calculations.c with their CALC_config_t. 64 samples with the rectangular
+ * window are the phasors of split_Array(), the other variants are computed
+ * here in double precision (DC removed, scaled to the gain of the firmware DFT).
+ *
+ * Per configuration:
+ * - valid_pct: readings with valid X and Y in the second half of each hold
+ * - pos_rmse_mm: RMS position error of these readings
+ * - current_rmse_a: RMS current error of the readings with a current ("-" = none)
+ * - settle_s: mean time from a step until all further readings of the hold
+ *   are valid and within the tolerance (the hold time if never)
+ *
+ * A configuration is on the Pareto frontier if no other one with at least
+ * the minimum validity is as good in position error, current error and
+ * settle time, and better in one of them.
+ *****************************************************************************/
+
+
+/******************************************************************************
+ * Includes
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include "capture_reader.h"
+#include "calculations.h"
+#include "measuring.h"
+#include "error_code.h"
+
+
+/******************************************************************************
+ * Defines
+ *****************************************************************************/
+
+#define MAX_LIST        16              ///< Max values of a grid option
+#define MAX_THREADS     256             ///< Max number of workers
+#define CLIP_MARGIN     8               ///< ADC_CLIP_MARGIN of calculations.c
+#define PAD_OFFSET      25              ///< X of the right pad in mm, the left pad is at -PAD_OFFSET
+#define CURRENT_FACTOR  0.357           ///< CURRENT_FACTOR of calculations.c
+#define NOISE           8.0             ///< RMS noise in ADC steps
+#define HARMONIC        0.05            ///< 150 Hz amplitude relative to 50 Hz
+
+#define WINDOW_RECT     0               ///< Rectangular window
+#define WINDOW_HANN     1               ///< Hann window
+
+
+/******************************************************************************
+ * Types
+ *****************************************************************************/
+
+/** Cable position and current of a part of the recording */
+typedef struct {
+    int x;                              ///< X in mm, left of the device is positive
+    int y;                              ///< Y in mm
+    float current;                      ///< Current in A, 0 = none
+    float seconds;                      ///< Duration
+} hold_t;
+
+/** Upstream result of one frame */
+typedef struct {
+    CALC_phasor_t phasor[CALC_CHANNELS];///< 50 Hz phasors
+    uint8_t clip;                       ///< Clipped channels
+} phasors_t;
+
+/** Cached upstream stage of a frame length and window */
+typedef struct {
+    int length;                         ///< Frame length in samples
+    int window;                         ///< WINDOW_RECT or WINDOW_HANN
+    phasors_t *frames;                  ///< Phasors of each frame
+    uint32_t count;                     ///< Number of frames
+} upstream_t;
+
+/** Configuration and its result */
+typedef struct {
+    upstream_t *upstream;               ///< Cached phasors
+    int avg;                            ///< Averaged frames
+    CALC_config_t config;               ///< Parameters of the pipeline
+    double valid_pct;                   ///< Valid readings in the steady part
+    double pos_rmse;                    ///< Position error in mm
+    double current_rmse;                ///< Current error in A, NAN = no current
+    double settle;                      ///< Time to a stable reading in s
+    int pareto;                         ///< On the frontier
+} config_t;
+
+/** Comma separated values of an option */
+typedef struct {
+    double value[MAX_LIST];             ///< Values
+    int count;                          ///< Number of values
+} list_t;
+
+
+/******************************************************************************
+ * Variables
+ *****************************************************************************/
+
+extern const int32_t LPAD_LUT[CALC_LUT_ENTRIES];
+extern const int32_t RPAD_LUT[CALC_LUT_ENTRIES];
+
+static const hold_t scenario[] = {      ///< Simulated recording, repeated
+        {  0,  20,  6, 4},
+        {-30,  60,  0, 4},
+        { 40, 100,  0, 4},
+        {  5,  22,  8, 4},
+        { 30, 190,  0, 4},
+        {-60,  40,  0, 4},
+        { -4,  18,  4, 4},
+        {  0, 150,  0, 4},
+};
+
+static hold_t *holds;                   ///< Holds of the recording
+static uint32_t hold_count;             ///< Number of holds
+static uint16_t *scans;                 ///< Interleaved samples of the recording
+static uint32_t scan_count;             ///< Number of scans (CALC_CHANNELS samples)
+static upstream_t upstreams[MAX_LIST * 2];  ///< Cached upstream stages
+static uint32_t upstream_count;         ///< Number of cached upstream stages
+static config_t *configs;               ///< The grid
+static uint32_t config_count;           ///< Number of configurations
+static atomic_uint next_item;           ///< Next upstream stage or configuration to evaluate
+static double tolerance = 5;            ///< Tolerance of a stable reading in mm
+static double min_valid = 90;           ///< Min valid readings for the frontier in %
+
+
+/******************************************************************************
+ * Functions
+ *****************************************************************************/
+
+/** ***************************************************************************
+ * @brief Parse comma separated values
+ *****************************************************************************/
+static void parse_list(list_t *list, const char *text)
+{
+    list->count = 0;
+    while (*text && list->count < MAX_LIST) {
+        char *end;
+        if (strncmp(text, "rect", 4) == 0) {
+            list->value[list->count++] = WINDOW_RECT;
+            end = (char *)text + 4;
+        } else if (strncmp(text, "hann", 4) == 0) {
+            list->value[list->count++] = WINDOW_HANN;
+            end = (char *)text + 4;
+        } else {
+            list->value[list->count++] = strtod(text, &end);
+        }
+        text = (*end == ',') ? end + 1 : end + strlen(end);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Pad amplitude (RMS in ADC steps) at which a LUT gives a distance
+ *
+ * Searches the falling part of the LUT and interpolates between the entries.
+ *****************************************************************************/
+static double lut_amplitude(const int32_t *lut, double distance)
+{
+    int top = 0;
+    for (int i = 1; i < CALC_LUT_ENTRIES; i++) {
+        if (lut[i] > lut[top]) { top = i; }
+    }
+    for (int i = top + 1; i < CALC_LUT_ENTRIES; i++) {
+        if (lut[i] <= distance) {
+            double fraction = (lut[i-1] - distance) / (double)(lut[i-1] - lut[i]);
+            return CALC_LUT_BASE + i - 1 + fraction;
+        }
+    }
+    return CALC_LUT_BASE + CALC_LUT_ENTRIES;
+}
+
+
+/** ***************************************************************************
+ * @brief Gaussian noise (Box-Muller)
+ *****************************************************************************/
+static double gauss(unsigned int *seed)
+{
+    double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(u)) * cos(2 * M_PI * v);
+}
+
+
+/** ***************************************************************************
+ * @brief Simulate the scenario
+ *****************************************************************************/
+static void simulate(int repeats)
+{
+    const uint32_t per_repeat = sizeof(scenario) / sizeof(scenario[0]);
+    unsigned int seed = 1;
+    hold_count = per_repeat * repeats;
+    holds = malloc(hold_count * sizeof(hold_t));
+    scan_count = 0;
+    for (uint32_t h = 0; h < hold_count; h++) {
+        holds[h] = scenario[h % per_repeat];
+        scan_count += (uint32_t)(holds[h].seconds * ADC_FS);
+    }
+    scans = malloc((size_t)scan_count * CALC_CHANNELS * sizeof(uint16_t));
+
+    uint32_t n = 0;
+    for (uint32_t h = 0; h < hold_count; h++) {
+        const hold_t *p = &holds[h];
+        double rms[CALC_CHANNELS];
+        rms[CALC_LPAD] = lut_amplitude(LPAD_LUT, hypot(p->x + PAD_OFFSET, p->y));
+        rms[CALC_RPAD] = lut_amplitude(RPAD_LUT, hypot(p->x - PAD_OFFSET, p->y));
+        rms[CALC_LHALL] = p->current * 1000 / (CURRENT_FACTOR * p->y);
+        rms[CALC_RHALL] = 0.8 * rms[CALC_LHALL];
+        for (uint32_t end = n + (uint32_t)(p->seconds * ADC_FS); n < end; n++) {
+            double phase = 2 * M_PI * 50 * n / ADC_FS;
+            for (int c = 0; c < CALC_CHANNELS; c++) {
+                double a = rms[c] * M_SQRT2;
+                double v = 2048 + a * sin(phase + 0.4 * c) + HARMONIC * a * sin(3 * phase)
+                         + NOISE * gauss(&seed);
+                scans[CALC_CHANNELS*n + c] = (v < 0) ? 0 : (v > 4095 ? 4095 : (uint16_t)v);
+            }
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Load capture files as one static hold
+ * @return 0 or -1
+ *****************************************************************************/
+static int load_files(char **paths, int count, const hold_t *truth)
+{
+    CR_file_t files[count];
+    uint32_t samples[CALC_CHANNELS * ADC_NUMS];
+    scan_count = 0;
+    for (int f = 0; f < count; f++) {
+        if (CR_open(&files[f], paths[f]) < 0) {
+            return -1;
+        }
+        if (files[f].header.frame_length != ADC_NUMS) {
+            fprintf(stderr, "%s: %d samples per frame, the pipeline is built for %d\n",
+                    paths[f], files[f].header.frame_length, ADC_NUMS);
+            return -1;
+        }
+        scan_count += files[f].frames * ADC_NUMS;
+    }
+    scans = malloc((size_t)scan_count * CALC_CHANNELS * sizeof(uint16_t));
+    uint32_t n = 0;
+    for (int f = 0; f < count; f++) {
+        for (uint32_t c = 0; c < files[f].chunks; c++) {
+            const uint8_t *raw = CR_chunk(&files[f], c);
+            for (uint32_t k = 0; k < files[f].index[c].frames; k++) {
+                raw += CR_decode(&files[f], raw, samples);
+                for (uint32_t i = 0; i < CALC_CHANNELS * ADC_NUMS; i++) {
+                    scans[CALC_CHANNELS*n + i] = samples[i];
+                }
+                n += ADC_NUMS;
+            }
+        }
+        CR_close(&files[f]);
+    }
+    hold_count = 1;
+    holds = malloc(sizeof(hold_t));
+    holds[0] = *truth;
+    holds[0].seconds = (float)scan_count / ADC_FS;
+    return 0;
+}
+
+
+/** ***************************************************************************
+ * @brief Compute the phasors of all frames of an upstream stage
+ *****************************************************************************/
+static void run_upstream(upstream_t *u)
+{
+    const int length = u->length;
+    u->count = scan_count / length;
+    u->frames = malloc((u->count ? u->count : 1) * sizeof(phasors_t));
+
+    if (length == ADC_NUMS && u->window == WINDOW_RECT) {
+        /* The firmware DFT */
+        CALC_context_t ctx = {0};
+        uint32_t frame[CALC_CHANNELS * ADC_NUMS];
+        calculate_init(&ctx);
+        for (uint32_t k = 0; k < u->count; k++) {
+            for (uint32_t i = 0; i < CALC_CHANNELS * ADC_NUMS; i++) {
+                frame[i] = scans[(size_t)k * CALC_CHANNELS * ADC_NUMS + i];
+            }
+            ctx.samples = frame;
+            ctx.clip_flags_window = 0;
+            split_Array(&ctx);
+            memcpy(u->frames[k].phasor, ctx.phasor, sizeof(ctx.phasor));
+            u->frames[k].clip = ctx.clip_flags_window;
+        }
+        return;
+    }
+
+    double w[length], gain = 0;
+    for (int j = 0; j < length; j++) {
+        w[j] = (u->window == WINDOW_HANN) ? 0.5 - 0.5 * cos(2 * M_PI * j / length) : 1;
+        gain += w[j];
+    }
+    for (uint32_t k = 0; k < u->count; k++) {
+        const uint16_t *s = &scans[(size_t)k * length * CALC_CHANNELS];
+        phasors_t *out = &u->frames[k];
+        out->clip = 0;
+        for (int c = 0; c < CALC_CHANNELS; c++) {
+            double mean = 0, re = 0, im = 0;
+            for (int j = 0; j < length; j++) {
+                uint16_t v = s[CALC_CHANNELS*j + c];
+                mean += v;
+                if (v < CLIP_MARGIN || v > 4095 - CLIP_MARGIN) {
+                    out->clip |= 1u << c;
+                }
+            }
+            mean /= length;
+            for (int j = 0; j < length; j++) {
+                /* Phase of the frame start, the magnitude does not depend on it */
+                double phase = 2 * M_PI * 50 * j / ADC_FS;
+                double v = w[j] * (s[CALC_CHANNELS*j + c] - mean);
+                re += v * cos(phase);
+                im -= v * sin(phase);
+            }
+            out->phasor[c].re = re * ADC_NUMS / gain;
+            out->phasor[c].im = im * ADC_NUMS / gain;
+        }
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Run the pipeline of a configuration over the cached phasors
+ *****************************************************************************/
+static void run_config(config_t *cfg)
+{
+    const upstream_t *u = cfg->upstream;
+    const double frame_s = (double)u->length / ADC_FS;
+    CALC_context_t ctx = {0};
+    calculate_init(&ctx);
+    ctx.config = cfg->config;
+
+    uint64_t steady = 0, valid = 0, currents = 0;
+    double pos_sq = 0, current_sq = 0, settle_sum = 0;
+    uint32_t k = 0;
+    double hold_start = 0;
+    for (uint32_t h = 0; h < hold_count; h++) {
+        const hold_t *p = &holds[h];
+        double hold_end = hold_start + p->seconds;
+        double stable_since = -1;       // Time of the first reading of the current stable run
+        for (; k < u->count && (k + 1) * frame_s <= hold_end + 1e-9; k++) {
+            memcpy(ctx.phasor, u->frames[k].phasor, sizeof(ctx.phasor));
+            ctx.clip_flags_window |= u->frames[k].clip;
+            calculate_from_phasors(&ctx, cfg->avg);
+
+            double t = (k + 1) * frame_s;
+            int ok = (ctx.X_Pos != CALC_OUTOF_X_RANGE && ctx.Y_Pos != CALC_OUTOF_Y_RANGE);
+            double error = ok ? hypot(ctx.X_Pos - p->x, ctx.Y_Pos - p->y) : INFINITY;
+            if (error <= tolerance) {
+                if (stable_since < 0) { stable_since = t; }
+            } else {
+                stable_since = -1;
+            }
+            if (t > hold_start + p->seconds / 2) {
+                steady++;
+                if (ok) {
+                    valid++;
+                    pos_sq += error * error;
+                    if (p->current > 0 && ctx.current >= 0 && ctx.current < CURR_OUTOF_Y_RANGE) {
+                        currents++;
+                        current_sq += (ctx.current - p->current) * (ctx.current - p->current);
+                    }
+                }
+            }
+        }
+        settle_sum += (stable_since < 0) ? p->seconds : stable_since - hold_start;
+        hold_start = hold_end;
+    }
+    cfg->valid_pct = steady ? 100.0 * valid / steady : 0;
+    cfg->pos_rmse = valid ? sqrt(pos_sq / valid) : INFINITY;
+    cfg->current_rmse = currents ? sqrt(current_sq / currents) : NAN;
+    cfg->settle = settle_sum / hold_count;
+}
+
+
+/** ***************************************************************************
+ * @brief Worker: first the upstream stages, then the configurations
+ *
+ * The shared counter hands out the items, they are all similar in cost.
+ *****************************************************************************/
+static void *worker_main(void *arg)
+{
+    uint32_t limit = *(uint32_t *)arg;
+    for (uint32_t i; (i = atomic_fetch_add(&next_item, 1)) < limit; ) {
+        if (limit == upstream_count) {
+            run_upstream(&upstreams[i]);
+        } else {
+            run_config(&configs[i]);
+        }
+    }
+    return NULL;
+}
+
+
+/** ***************************************************************************
+ * @brief Run items 0..limit-1 on the workers
+ *****************************************************************************/
+static void run_parallel(uint32_t threads, uint32_t limit)
+{
+    pthread_t thread[MAX_THREADS];
+    atomic_store(&next_item, 0);
+    for (uint32_t t = 0; t < threads; t++) {
+        pthread_create(&thread[t], NULL, worker_main, &limit);
+    }
+    for (uint32_t t = 0; t < threads; t++) {
+        pthread_join(thread[t], NULL);
+    }
+}
+
+
+/** ***************************************************************************
+ * @brief Mark the configurations on the Pareto frontier
+ *****************************************************************************/
+static void mark_pareto(void)
+{
+    for (uint32_t i = 0; i < config_count; i++) {
+        config_t *a = &configs[i];
+        double a_cur = isnan(a->current_rmse) ? INFINITY : a->current_rmse;
+        a->pareto = (a->valid_pct >= min_valid);
+        for (uint32_t j = 0; j < config_count && a->pareto; j++) {
+            const config_t *b = &configs[j];
+            double b_cur = isnan(b->current_rmse) ? INFINITY : b->current_rmse;
+            if (j == i || b->valid_pct < min_valid) {
+                continue;
+            }
+            if (b->pos_rmse <= a->pos_rmse && b_cur <= a_cur && b->settle <= a->settle
+                    && (b->pos_rmse < a->pos_rmse || b_cur < a_cur || b->settle < a->settle)) {
+                a->pareto = 0;
+            }
+        }
+    }
+}
+
+
+static int compare_settle(const void *a, const void *b)
+{
+    const config_t *x = a, *y = b;
+    return (x->settle > y->settle) - (x->settle < y->settle);
+}
+
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: sweep [-j threads] [-p] [-a list] [-l list] [-w list] [-s list] [-m list]\n"
+                    "             [-y list] [-e mm] [-v pct] [-r repeats | -t x,y,current file.cmcap...]\n");
+    exit(2);
+}
+
+
+int main(int argc, char *argv[])
+{
+    list_t avg, length, window, smoothing, lut_min, max_y;
+    parse_list(&avg, "1,2,3,5,8");
+    parse_list(&length, "32,64,128");
+    parse_list(&window, "rect,hann");
+    parse_list(&smoothing, "1,0.5,0.25");
+    parse_list(&lut_min, "200,250,300");
+    parse_list(&max_y, "150,200");
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threads = (cores > 0) ? cores : 1;
+    int frontier_only = 0, repeats = 8, have_truth = 0;
+    hold_t truth = {0};
+
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
+        char option = argv[i][1];
+        if (option == 'p') {
+            frontier_only = 1;
+            continue;
+        }
+        if (i + 1 == argc || argv[i][2] != '\0') {
+            usage();
+        }
+        const char *value = argv[++i];
+        switch (option) {
+        case 'j': threads = atoi(value); break;
+        case 'a': parse_list(&avg, value); break;
+        case 'l': parse_list(&length, value); break;
+        case 'w': parse_list(&window, value); break;
+        case 's': parse_list(&smoothing, value); break;
+        case 'm': parse_list(&lut_min, value); break;
+        case 'y': parse_list(&max_y, value); break;
+        case 'e': tolerance = atof(value); break;
+        case 'v': min_valid = atof(value); break;
+        case 'r': repeats = atoi(value); break;
+        case 't':
+            have_truth = (sscanf(value, "%d,%d,%f", &truth.x, &truth.y, &truth.current) == 3);
+            break;
+        default: usage();
+        }
+    }
+    if (threads < 1 || threads > MAX_THREADS || repeats < 1 || (i < argc) != have_truth) {
+        usage();
+    }
+    for (int k = 0; k < avg.count; k++) {
+        if (avg.value[k] < 1) { usage(); }
+    }
+    for (int k = 0; k < length.count; k++) {
+        if (length.value[k] < 8) { usage(); }
+    }
+    for (int k = 0; k < lut_min.count; k++) {
+        if (lut_min.value[k] < CALC_LUT_BASE || lut_min.value[k] >= CALC_config_default.lpad_max) {
+            fprintf(stderr, "LUT limit %g outside %d..%d\n", lut_min.value[k],
+                    CALC_LUT_BASE, (int)CALC_config_default.lpad_max - 1);
+            return 2;
+        }
+    }
+
+    FFT_Init();
+    if (have_truth) {
+        if (load_files(&argv[i], argc - i, &truth) < 0) {
+            return 1;
+        }
+    } else {
+        simulate(repeats);
+    }
+
+    /* Upstream stages, each is shared by all downstream parameters */
+    for (int l = 0; l < length.count; l++) {
+        for (int w = 0; w < window.count; w++) {
+            upstreams[upstream_count].length = (int)length.value[l];
+            upstreams[upstream_count].window = (int)window.value[w];
+            upstream_count++;
+        }
+    }
+    config_count = upstream_count * avg.count * smoothing.count * lut_min.count * max_y.count;
+    configs = calloc(config_count, sizeof(config_t));
+    config_t *cfg = configs;
+    for (uint32_t u = 0; u < upstream_count; u++) {
+        for (int a = 0; a < avg.count; a++) {
+            for (int s = 0; s < smoothing.count; s++) {
+                for (int m = 0; m < lut_min.count; m++) {
+                    for (int y = 0; y < max_y.count; y++, cfg++) {
+                        cfg->upstream = &upstreams[u];
+                        cfg->avg = (int)avg.value[a];
+                        cfg->config = CALC_config_default;
+                        cfg->config.lpad_min = (int32_t)lut_min.value[m];
+                        cfg->config.rpad_min = (int32_t)lut_min.value[m];
+                        cfg->config.max_y = (int32_t)max_y.value[y];
+                        cfg->config.smoothing = smoothing.value[s];
+                    }
+                }
+            }
+        }
+    }
+
+    run_parallel(threads, upstream_count);
+    run_parallel(threads, config_count);
+    mark_pareto();
+    fprintf(stderr, "%u configurations on %u cached phasor sets, %.0f s of frames\n",
+            config_count, upstream_count, (double)scan_count / ADC_FS);
+
+    if (frontier_only) {
+        qsort(configs, config_count, sizeof(config_t), compare_settle);
+    }
+    printf("avg,frame_length,window,smoothing,lut_min,max_y,valid_pct,pos_rmse_mm,current_rmse_a,settle_s,pareto\n");
+    for (uint32_t k = 0; k < config_count; k++) {
+        const config_t *c = &configs[k];
+        if (frontier_only && !c->pareto) {
+            continue;
+        }
+        printf("%d,%d,%s,%g,%d,%d,%.1f,%.2f,", c->avg, c->upstream->length,
+               c->upstream->window == WINDOW_HANN ? "hann" : "rect", c->config.smoothing,
+               (int)c->config.lpad_min, (int)c->config.max_y, c->valid_pct, c->pos_rmse);
+        if (isnan(c->current_rmse)) {
+            printf("-");
+        } else {
+            printf("%.2f", c->current_rmse);
+        }
+        printf(",%.2f,%d\n", c->settle, c->pareto);
+    }
+    return 0;
+}
@@ -0,0 +1,36 @@
+"""Log the power reports (PWR_report_t, see power.c) as CSV.
+
+usage: power_log.py <port|file> [output.csv]
+"""
+
+import csv
+import struct
+import sys
+
+from serial_frames import FRAME_POWER, open_port, read_frames
+
+SUBSYSTEMS = ["main", "acq", "dsp", "lcd", "touch", "buzzer"]
+
+# window_ms, measurements, sleep_us, active_us[], busy_us[], energy_uj, energy_per_meas_uj
+REPORT = struct.Struct("<3I%dI%dI2I" % (len(SUBSYSTEMS), len(SUBSYSTEMS)))
+
+HEADER = (["window_ms", "measurements", "sleep_us"]
+          + ["active_us_" + s for s in SUBSYSTEMS]
+          + ["busy_us_" + s for s in SUBSYSTEMS]
+          + ["energy_uj", "energy_per_meas_uj"])
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    output = open(sys.argv[2], "w", newline="") if len(sys.argv) > 2 else sys.stdout
+    writer = csv.writer(output)
+    writer.writerow(HEADER)
+    for frame_type, payload in read_frames(open_port(sys.argv[1])):
+        if frame_type == FRAME_POWER and len(payload) == REPORT.size:
+            writer.writerow(REPORT.unpack(payload))
+            output.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,100 @@
+"""RAM budget of the firmware.
+
+usage: ram_budget.py <firmware.map> [build directory] [--serial <port>]
+
+Prints the sections of RAM and CCMRAM from the linker map file
+(the same table as memory.c shows on the device)
+and the largest stack frames from the -fstack-usage (.su) files.
+With --serial the MEM_report_t frames of the device are printed.
+"""
+
+import glob
+import os
+import re
+import struct
+import sys
+
+from serial_frames import FRAME_MEMORY, open_port, read_frames
+
+RAM = (0x20000000, 192 * 1024)
+CCMRAM = (0x10000000, 64 * 1024)
+
+SECTIONS = ["data", "bss", "irq_stack", "ccmram", "main_stack"]
+STACKS = ["main", "irq"]
+REPORT = struct.Struct("<%dI%dI" % (len(SECTIONS), len(STACKS)))
+
+TOP_FRAMES = 15
+
+
+def read_symbols(map_file):
+    """Addresses of the linker script symbols in the map file."""
+    symbols = {}
+    pattern = re.compile(r"^\s+0x([0-9a-f]+)\s+(?:PROVIDE \(\s*)?(\w+) = ")
+    with open(map_file) as f:
+        for line in f:
+            match = pattern.match(line)
+            if match:
+                symbols.setdefault(match.group(2), int(match.group(1), 16))
+    return symbols
+
+
+def print_sections(symbols):
+    rows = [
+        ("RAM", ".data", "_sdata", "_edata"),
+        ("RAM", ".bss", "_sbss", "_ebss"),
+        ("RAM", "IRQ stack", "_end", "_estack"),
+        ("CCMRAM", ".ccmram", "_sccmram", "_eccmram"),
+        ("CCMRAM", "main stack", "_eccmram", "_estack_main"),
+    ]
+    print("%-7s %-11s %-10s %8s" % ("Memory", "Section", "Start", "Size"))
+    for memory, name, start, end in rows:
+        if start in symbols and end in symbols:
+            print("%-7s %-11s 0x%08X %8d" % (memory, name, symbols[start],
+                                             symbols[end] - symbols[start]))
+    if "_ebss" in symbols:
+        used = symbols["_ebss"] - symbols["_sdata"]
+        print("RAM static    %6d of %6d bytes" % (used, RAM[1]))
+    if "_eccmram" in symbols:
+        used = symbols["_eccmram"] - symbols["_sccmram"]
+        print("CCMRAM static %6d of %6d bytes" % (used, CCMRAM[1]))
+
+
+def print_stack_frames(build_dir):
+    frames = []
+    for su in glob.glob(os.path.join(build_dir, "**", "*.su"), recursive=True):
+        with open(su) as f:
+            for line in f:
+                parts = line.rstrip().split("\t")
+                if len(parts) == 3:
+                    frames.append((int(parts[1]), parts[2], parts[0]))
+    frames.sort(reverse=True)
+    print("\nLargest stack frames")
+    for size, kind, function in frames[:TOP_FRAMES]:
+        print("%6d %-8s %s" % (size, kind, function))
+
+
+def print_reports(port):
+    for frame_type, payload in read_frames(open_port(port)):
+        if frame_type == FRAME_MEMORY and len(payload) == REPORT.size:
+            values = REPORT.unpack(payload)
+            sections = dict(zip(SECTIONS, values[:len(SECTIONS)]))
+            used = dict(zip(STACKS, values[len(SECTIONS):]))
+            print("stack main %d of %d, IRQ %d of %d bytes" % (
+                used["main"], sections["main_stack"],
+                used["irq"], sections["irq_stack"]))
+
+
+def main():
+    args = sys.argv[1:]
+    if "--serial" in args:
+        i = args.index("--serial")
+        print_reports(args[i + 1])
+        return
+    if not args:
+        sys.exit(__doc__)
+    print_sections(read_symbols(args[0]))
+    print_stack_frames(args[1] if len(args) > 1 else os.path.dirname(args[0]) or ".")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,77 @@
+"""Decoder for the telemetry frames sent by serial.c on USART1.
+
+Frame: 0xA5, type, length (little endian, 2 bytes), payload, checksum.
+The checksum is chosen so that the 8-bit sum of type, length,
+payload and checksum is zero.
+"""
+
+import sys
+
+FRAME_START = 0xA5
+
+FRAME_TEXT = 0x00
+FRAME_POWER = 0x01
+FRAME_MEMORY = 0x02
+FRAME_TRACE = 0x03
+FRAME_CAPTURE = 0x04
+
+
+def open_port(name, baudrate=115200):
+    """Open a serial port (pyserial) or a file with recorded data."""
+    try:
+        import serial
+        return serial.Serial(name, baudrate, timeout=1)
+    except (ImportError, ValueError, OSError):
+        return open(name, "rb")
+
+
+class FrameDecoder:
+    """Incremental decoder, feed bytes and get (type, payload) tuples."""
+
+    def __init__(self):
+        self.buffer = bytearray()
+        self.errors = 0
+
+    def feed(self, data):
+        self.buffer += data
+        frames = []
+        while True:
+            start = self.buffer.find(FRAME_START)
+            if start < 0:
+                self.buffer.clear()
+                break
+            del self.buffer[:start]
+            if len(self.buffer) < 5:
+                break
+            length = self.buffer[2] | (self.buffer[3] << 8)
+            if len(self.buffer) < length + 5:
+                break
+            frame = self.buffer[1:length + 5]
+            if sum(frame) & 0xFF:
+                self.errors += 1
+                del self.buffer[:1]         # Resynchronize on next start byte
+                continue
+            frames.append((frame[0], bytes(frame[3:3 + length])))
+            del self.buffer[:length + 5]
+        return frames
+
+
+def read_frames(stream):
+    """Generator of (type, payload) tuples from a stream."""
+    decoder = FrameDecoder()
+    while True:
+        data = stream.read(256)
+        if not data:
+            return
+        for frame in decoder.feed(data):
+            yield frame
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        sys.exit("usage: serial_frames.py <port|file>")
+    for frame_type, payload in read_frames(open_port(sys.argv[1])):
+        if frame_type == FRAME_TEXT:
+            print(payload.decode("ascii", "replace"), end="")
+        else:
+            print("frame 0x%02X, %d bytes" % (frame_type, len(payload)))
@@ -0,0 +1,193 @@
+"""Screen snapshots of the device (SER_FRAME_SNAPSHOT, see snapshot.c).
+
+usage: snapshot.py <port> [file.png]
+       snapshot.py --listen <port|file> [prefix]
+
+The first form starts a snapshot with CMD_SNAPSHOT (see command.py) and
+saves it (default snapshot.png). --listen decodes all snapshots of a
+stream or recording into <prefix>_<number>.png (default prefix "snapshot").
+The compression ratio (raw ARGB8888 against the bytes on the line)
+and the transfer time are printed.
+"""
+
+import struct
+import sys
+import time
+import zlib
+
+from serial_frames import open_port, read_frames
+
+FRAME_SNAPSHOT = 0x07
+FRAME_OVERHEAD = 5
+
+CHUNK = struct.Struct("<2B7HI")         # SNAP_chunk_t
+FIRST = 0x01
+LAST = 0x02
+LOSSY = 0x04
+OP_LITERAL = 0x00
+OP_RUN = 0x40
+OP_COPY = 0x80
+OP_MASK = 0xC0
+LENGTH_EXT = 0x3F
+
+
+class SnapshotError(Exception):
+    pass
+
+
+class Snapshot:
+    """A decoded snapshot: width, height, palette (ARGB) and indices per pixel."""
+
+    def __init__(self, number, width, height):
+        self.number = number
+        self.width = width
+        self.height = height
+        self.palette = []
+        self.indices = bytearray(width * height)
+        self.lines = 0
+        self.lossy = False
+        self.wire_bytes = 0
+        self.device_ms = 0
+
+    def rgb_rows(self):
+        rgb = [bytes(((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF)) for c in self.palette]
+        for y in range(self.height):
+            row = self.indices[y * self.width:(y + 1) * self.width]
+            yield b"".join(rgb[i] for i in row)
+
+    def save_png(self, name):
+        def chunk(kind, data):
+            return (struct.pack(">I", len(data)) + kind + data
+                    + struct.pack(">I", zlib.crc32(kind + data) & 0xFFFFFFFF))
+        raw = b"".join(b"\0" + row for row in self.rgb_rows())
+        with open(name, "wb") as f:
+            f.write(b"\x89PNG\r\n\x1a\n")
+            f.write(chunk(b"IHDR", struct.pack(">2I5B", self.width, self.height, 8, 2, 0, 0, 0)))
+            f.write(chunk(b"IDAT", zlib.compress(raw, 9)))
+            f.write(chunk(b"IEND", b""))
+
+    def report(self):
+        raw = self.width * self.height * 4
+        return ("snapshot %d: %dx%d, %d colors%s, %d bytes (raw %d), ratio %.1f:1, device %.2f s"
+                % (self.number, self.width, self.height, len(self.palette),
+                   " (lossy)" if self.lossy else "", self.wire_bytes, raw,
+                   raw / max(1, self.wire_bytes), self.device_ms / 1000.0))
+
+
+class Decoder:
+    """Feed the SER_FRAME_SNAPSHOT payloads, get the completed snapshots."""
+
+    def __init__(self):
+        self.current = None
+
+    def feed(self, payload):
+        """Snapshot if payload was its last chunk, else None."""
+        (number, flags, width, height, first_line, lines,
+         palette_first, palette_new, _, elapsed_ms) = CHUNK.unpack_from(payload)
+        if flags & FIRST:
+            self.current = Snapshot(number, width, height)
+        s = self.current
+        if s is None or s.number != number:
+            return None                 # Started before we listened
+        if palette_first != len(s.palette) or first_line != s.lines:
+            self.current = None
+            raise SnapshotError("snapshot %d: chunk missing before line %d" % (number, first_line))
+        offset = CHUNK.size
+        s.palette += struct.unpack_from("<%dI" % palette_new, payload, offset)
+        offset += 4 * palette_new
+        offset = self._lines(s, payload, offset, first_line, lines)
+        if offset != len(payload):
+            raise SnapshotError("snapshot %d: %d bytes left in chunk" % (number, len(payload) - offset))
+        s.lines += lines
+        s.lossy |= bool(flags & LOSSY)
+        s.wire_bytes += len(payload) + FRAME_OVERHEAD
+        s.device_ms = elapsed_ms
+        if not flags & LAST:
+            return None
+        self.current = None
+        if s.lines != s.height:
+            raise SnapshotError("snapshot %d: %d of %d lines" % (number, s.lines, s.height))
+        return s
+
+    @staticmethod
+    def _lines(s, data, offset, first_line, lines):
+        w = s.width
+        for y in range(first_line, first_line + lines):
+            x = 0
+            base = y * w
+            while x < w:
+                token = data[offset]
+                offset += 1
+                n = (token & LENGTH_EXT) + 1
+                if n == LENGTH_EXT + 1:
+                    n = 64 + data[offset]
+                    offset += 1
+                if x + n > w:
+                    raise SnapshotError("line %d: token beyond the line" % y)
+                op = token & OP_MASK
+                if op == OP_LITERAL:
+                    s.indices[base + x:base + x + n] = data[offset:offset + n]
+                    offset += n
+                elif op == OP_RUN:
+                    s.indices[base + x:base + x + n] = bytes([data[offset]]) * n
+                    offset += 1
+                elif op == OP_COPY and y > 0:
+                    s.indices[base + x:base + x + n] = s.indices[base - w + x:base - w + x + n]
+                else:
+                    raise SnapshotError("line %d: bad token 0x%02X" % (y, token))
+                x += n
+        return offset
+
+
+def take(port, name, timeout=60):
+    from command import Client
+    decoder = Decoder()
+    done = []
+
+    def listener(frame_type, payload):
+        if frame_type == FRAME_SNAPSHOT:
+            snapshot = decoder.feed(payload)
+            if snapshot is not None:
+                done.append(snapshot)
+
+    client = Client(port, listener=listener)
+    start = time.monotonic()
+    number = client.snapshot()
+    while not any(s.number == number for s in done):
+        if time.monotonic() - start > timeout:
+            sys.exit("snapshot %d: timeout" % number)
+        client.poll(0.1)
+    seconds = time.monotonic() - start
+    snapshot = [s for s in done if s.number == number][0]
+    snapshot.save_png(name)
+    print("%s, transfer %.2f s -> %s" % (snapshot.report(), seconds, name))
+
+
+def listen(port, prefix):
+    decoder = Decoder()
+    for frame_type, payload in read_frames(open_port(port)):
+        if frame_type != FRAME_SNAPSHOT:
+            continue
+        try:
+            snapshot = decoder.feed(payload)
+        except SnapshotError as e:
+            print(e)
+            continue
+        if snapshot is not None:
+            name = "%s_%d.png" % (prefix, snapshot.number)
+            snapshot.save_png(name)
+            print("%s -> %s" % (snapshot.report(), name))
+
+
+def main():
+    if len(sys.argv) >= 3 and sys.argv[1] == "--listen":
+        listen(sys.argv[2], sys.argv[3] if len(sys.argv) > 3 else "snapshot")
+    elif len(sys.argv) in (2, 3) and not sys.argv[1].startswith("-"):
+        take(sys.argv[1], sys.argv[2] if len(sys.argv) > 2 else "snapshot.png")
+    else:
+        sys.exit(__doc__)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,131 @@
+"""Synthetic capture file with labelled load steps (see capture.c, detect.c).
+
+usage: synth_capture.py <file.cmcap> <labels.csv> [options]
+
+    --frames N      frames of the file (default 6000, 10 min)
+    --steps N       load steps (default 20)
+    --seed N        random seed (default 1)
+    --noise ADC     noise of the samples [ADC steps] (default 3)
+    --pad ADC       50 Hz amplitude of the pads [ADC steps RMS] (default 1340, y = 22 mm)
+    --hall ADC      50 Hz amplitude of the Hall sensors at 10 A (default 150)
+    --drift PCT     slow drift of the load [%] (default 2)
+
+The cable stays at a fixed position (constant pad amplitudes), the load
+current switches between random levels at random frames. The Hall
+amplitudes follow the current, with a slow drift and noise on top.
+The labels are one line per step: frame, direction (+1 / -1), current
+before and after [A]. Tools/host/detect replays the file against them.
+"""
+
+import math
+import random
+import struct
+import sys
+
+from capture_file import HEADER, CHUNK, TRAILER
+
+SAMPLE_RATE = 640
+FRAME_LENGTH = 64
+MAINS_BIN = 5
+CHUNK_SIZE = 1024
+CALIBRATION = 1                         # CALC_CAL_VERSION
+MAINS_MHZ = 50000
+MIN_GAP = 150                           # Frames between two steps (15 s)
+
+
+def encode_channel(samples):
+    """First sample, bits, zigzag deltas packed LSB first."""
+    deltas = [b - a for a, b in zip(samples, samples[1:])]
+    zigzag = [d << 1 if d >= 0 else ((-d) << 1) - 1 for d in deltas]
+    bits = max(zigzag).bit_length()
+    packed = 0
+    for i, z in enumerate(zigzag):
+        packed |= z << (i * bits)
+    return (struct.pack("<HB", samples[0], bits)
+            + packed.to_bytes((len(zigzag) * bits + 7) // 8, "little"))
+
+
+def frame_samples(amplitudes, noise, rng):
+    channels = []
+    for c, rms in enumerate(amplitudes):
+        peak = rms * math.sqrt(2)
+        channels.append([min(4095, max(0, int(round(
+            2048 + peak * math.sin(2 * math.pi * MAINS_BIN * j / FRAME_LENGTH + 0.3 * c)
+            + rng.gauss(0, noise))))) for j in range(FRAME_LENGTH)])
+    return channels
+
+
+def load_profile(frames, steps, rng):
+    """Step frames and the current of each frame."""
+    candidates = list(range(MIN_GAP, frames - MIN_GAP // 2, MIN_GAP))
+    step_frames = sorted(rng.sample(candidates, min(steps, len(candidates))))
+    step_frames = [f + rng.randrange(MIN_GAP // 3) for f in step_frames]
+    current, level = [], 10.0
+    labels = []
+    for n in range(frames):
+        if step_frames and n == step_frames[0]:
+            step_frames.pop(0)
+            factors = [0.5, 0.6, 0.7, 1.4, 1.6, 2.0]
+            new = level * rng.choice([f for f in factors if 2.0 <= level * f <= 30.0])
+            labels.append((n, 1 if new > level else -1, level, new))
+            level = new
+        current.append(level)
+    return current, labels
+
+
+def write(path, frame_bytes):
+    index = []
+    with open(path, "wb") as f:
+        f.write(HEADER.pack(b"CMCP", 1, HEADER.size, SAMPLE_RATE, FRAME_LENGTH, 4, 12,
+                            bytes([1, 2, 3, 4, 0, 0, 0, 0]), CALIBRATION, CHUNK_SIZE, 1, 0,
+                            MAINS_MHZ, bytes(20)))
+        data, first, count = bytearray(), 0, 0
+        for n, frame in enumerate(frame_bytes + [None]):
+            if frame is None or len(data) + len(frame) > CHUNK_SIZE - CHUNK.size:
+                index.append((first, count, len(data)))
+                f.write(CHUNK.pack(first, count, len(data)) + data
+                        + bytes(CHUNK_SIZE - CHUNK.size - len(data)))
+                data, first, count = bytearray(), n, 0
+            if frame is not None:
+                data += frame
+                count += 1
+        offset = f.tell()
+        for entry in index:
+            f.write(CHUNK.pack(*entry))
+        f.write(TRAILER.pack(b"CIDX", len(index), len(frame_bytes), offset))
+
+
+def main():
+    args = sys.argv[1:]
+    if len(args) < 2 or args[0].startswith("-"):
+        sys.exit(__doc__)
+    path, labels_path = args[0], args[1]
+    options = {"frames": 6000, "steps": 20, "seed": 1, "noise": 3.0, "pad": 1340.0,
+               "hall": 150.0, "drift": 2.0}
+    rest = args[2:]
+    if len(rest) % 2 or any(not r.startswith("--") or r[2:] not in options for r in rest[::2]):
+        sys.exit(__doc__)
+    for name, value in zip(rest[::2], rest[1::2]):
+        options[name[2:]] = type(options[name[2:]])(value)
+
+    rng = random.Random(options["seed"])
+    current, labels = load_profile(options["frames"], options["steps"], rng)
+    frames = []
+    for n, amps in enumerate(current):
+        drift = 1 + options["drift"] / 100 * math.sin(2 * math.pi * n / 3000)
+        hall = options["hall"] * amps / 10 * drift
+        channels = frame_samples([options["pad"], options["pad"], hall, hall * 0.9],
+                                 options["noise"], rng)
+        frames.append(b"".join(encode_channel(c) for c in channels))
+    write(path, frames)
+
+    with open(labels_path, "w") as f:
+        f.write("frame,direction,before,after\n")
+        for n, direction, before, after in labels:
+            f.write("%d,%d,%.2f,%.2f\n" % (n, direction, before, after))
+    print("%s: %d frames, %d steps -> %s" % (path, len(frames), len(labels), labels_path))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
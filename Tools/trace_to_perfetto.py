@@ -0,0 +1,114 @@
+"""Convert the trace dumps (SER_FRAME_TRACE, see trace.c) into the
+Chrome trace format (JSON) for ui.perfetto.dev or chrome://tracing.
+
+usage: trace_to_perfetto.py <port|file> [output.json]
+
+Each complete dump is written to its own file: output.json, output_1.json, ...
+Tracks:
+- "main": DSP, LCD and touch work of the main loop (PWR_begin() / PWR_end())
+- one track per interrupt source (IRQ_enter() / IRQ_exit())
+- instant events for captured frames and for the trigger
+- counter "core clock [MHz]"
+"""
+
+import json
+import struct
+import sys
+
+from serial_frames import FRAME_TRACE, open_port, read_frames
+
+# See TRACE_id_t in trace.h
+ISR_ENTER, ISR_EXIT, FRAME, BEGIN, END, CLOCK, TRIGGER = range(1, 8)
+
+# See IRQ_source_t in interrupts.h and PWR_subsystem_t in power.h
+SOURCES = ["ADC", "DMA", "TIM2", "Tick", "UART", "TIM5", "Btn", "TS", "PSV"]
+SUBSYSTEMS = ["main", "acq", "dsp", "lcd", "touch", "buzzer"]
+
+HEADER = struct.Struct("<2I")           # index, total
+EVENT = struct.Struct("<2I2H")          # ms, val, id, arg
+
+TID_MAIN = 1
+TID_MARKERS = 2
+TID_ISR = 10                            # + source
+
+
+def timestamp_us(ms, val):
+    """Time from the HAL tick and the SysTick counter (counts down)."""
+    mhz = val >> 24
+    val &= 0xFFFFFF
+    if mhz == 0:
+        return ms * 1000.0
+    return ms * 1000.0 + (mhz * 1000 - 1 - val) / float(mhz)
+
+
+def convert(events):
+    """Chrome trace events from the recorded events, oldest first."""
+    out = [{"ph": "M", "pid": 1, "name": "process_name", "args": {"name": "firmware"}},
+           {"ph": "M", "pid": 1, "tid": TID_MAIN, "name": "thread_name", "args": {"name": "main"}},
+           {"ph": "M", "pid": 1, "tid": TID_MARKERS, "name": "thread_name", "args": {"name": "frames"}}]
+    for source, name in enumerate(SOURCES):
+        out.append({"ph": "M", "pid": 1, "tid": TID_ISR + source, "name": "thread_name",
+                    "args": {"name": "IRQ " + name}})
+    origin = None
+    open_slices = {}                    # tid -> number of open slices
+    for ms, val, event_id, arg in events:
+        ts = timestamp_us(ms, val)
+        if origin is None:
+            origin = ts
+        ts -= origin
+        if event_id in (ISR_ENTER, ISR_EXIT, BEGIN, END):
+            isr = event_id in (ISR_ENTER, ISR_EXIT)
+            tid = TID_ISR + arg if isr else TID_MAIN
+            name = (SOURCES[arg] if arg < len(SOURCES) else str(arg)) if isr else \
+                (SUBSYSTEMS[arg] if arg < len(SUBSYSTEMS) else str(arg))
+            if event_id in (ISR_ENTER, BEGIN):
+                open_slices[tid] = open_slices.get(tid, 0) + 1
+                out.append({"ph": "B", "pid": 1, "tid": tid, "ts": ts, "name": name})
+            elif open_slices.get(tid, 0) > 0:   # Skip the end of a slice started before the dump
+                open_slices[tid] -= 1
+                out.append({"ph": "E", "pid": 1, "tid": tid, "ts": ts, "name": name})
+        elif event_id == FRAME:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MARKERS, "ts": ts, "s": "g",
+                        "name": "frame %d" % arg})
+        elif event_id == TRIGGER:
+            out.append({"ph": "i", "pid": 1, "tid": TID_MARKERS, "ts": ts, "s": "g",
+                        "name": "late frame (%d ms)" % arg})
+        elif event_id == CLOCK:
+            out.append({"ph": "C", "pid": 1, "ts": ts, "name": "core clock [MHz]",
+                        "args": {"MHz": arg}})
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def dumps(frames):
+    """Generator of complete dumps (lists of events) from the frames."""
+    events = []
+    for frame_type, payload in frames:
+        if frame_type != FRAME_TRACE or len(payload) < HEADER.size:
+            continue
+        index, total = HEADER.unpack_from(payload)
+        if index == 0:
+            events = []
+        elif index != len(events):
+            events = []                 # Chunk lost, wait for the next dump
+            continue
+        for offset in range(HEADER.size, len(payload) - EVENT.size + 1, EVENT.size):
+            events.append(EVENT.unpack_from(payload, offset))
+        if len(events) >= total:
+            yield events[:total]
+            events = []
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+    output = sys.argv[2] if len(sys.argv) > 2 else "trace.json"
+    base = output[:-5] if output.endswith(".json") else output
+    for number, events in enumerate(dumps(read_frames(open_port(sys.argv[1])))):
+        name = output if number == 0 else "%s_%d.json" % (base, number)
+        with open(name, "w") as f:
+            json.dump(convert(events), f)
+        print("%s: %d events" % (name, len(events)))
+
+
+if __name__ == "__main__":
+    main()